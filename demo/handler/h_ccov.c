@@ -149,6 +149,7 @@ void handler_ccov_notification(
 #endif
         goto CCOV_ABORT;
     } else {
+        handler_cov_notification_callback(src, &cov_data);
         len =
             encode_simple_ack(&Handler_Transmit_Buffer[pdu_len],
             service_data->invoke_id, SERVICE_CONFIRMED_COV_NOTIFICATION);
@@ -25,6 +25,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include "config.h"
@@ -49,9 +50,15 @@
 
 /** @file h_cov.c  Handles Change of Value (COV) services. */
 
+/* The subscriptions and their addresses live in pools that grow on
+   demand.  All links between slots hold index + 1, so that 0 (the
+   static default) ends a chain and the tables work without an init. */
+
 typedef struct BACnet_COV_Address {
     bool valid:1;
     BACNET_ADDRESS dest;
+    unsigned refcount;  /* subscriptions sending to this address */
+    unsigned next;      /* hash chain, or free list when not valid */
 } BACNET_COV_ADDRESS;
 
 /* note: This COV service only monitors the properties
@@ -60,40 +67,355 @@ typedef struct BACnet_COV_Subscription_Flags {
     bool valid:1;
     bool issueConfirmedNotifications:1; /* optional */
     bool send_requested:1;
+    bool queued:1;      /* waiting in the COV send queue */
+    bool timed:1;       /* waiting in the COV timer wheel */
 } BACNET_COV_SUBSCRIPTION_FLAGS;
 
 typedef struct BACnet_COV_Subscription {
     BACNET_COV_SUBSCRIPTION_FLAGS flag;
-    uint8_t dest_index;
+    int dest_index;
     uint8_t invokeID;   /* for confirmed COV */
     uint32_t subscriberProcessIdentifier;
     uint32_t lifetime;  /* optional */
+    uint32_t expires;   /* COV_Seconds when a definite lifetime is over */
     BACNET_OBJECT_ID monitoredObjectIdentifier;
+    unsigned key_next;  /* subscription hash chain, or free list */
+    unsigned object_next;       /* next subscription on the same object */
+    unsigned send_next; /* send queue */
+    unsigned timer_next;        /* timer wheel slot */
+    unsigned timer_prev;
 } BACNET_COV_SUBSCRIPTION;
 
 #ifndef MAX_COV_SUBCRIPTIONS
-#define MAX_COV_SUBCRIPTIONS 128
+#define MAX_COV_SUBCRIPTIONS 4096
+#endif
+#ifndef COV_SUBSCRIPTIONS_INITIAL
+#define COV_SUBSCRIPTIONS_INITIAL 32
 #endif
-static BACNET_COV_SUBSCRIPTION COV_Subscriptions[MAX_COV_SUBCRIPTIONS];
+static BACNET_COV_SUBSCRIPTION *COV_Subscriptions = NULL;
+static unsigned COV_Subscriptions_Size = 0;
+static unsigned COV_Subscriptions_Free = 0;
+/* subscriptions hashed by address, process and monitored object, and
+   chained by monitored object, so that a change only visits the
+   subscriptions of the object that changed.  Sized with the pool. */
+static unsigned *COV_Subscription_Index = NULL;
+static unsigned *COV_Object_Index = NULL;
+static unsigned COV_Index_Size = 0;
 #ifndef MAX_COV_ADDRESSES
-#define MAX_COV_ADDRESSES 16
+#define MAX_COV_ADDRESSES 256
+#endif
+#ifndef COV_ADDRESSES_INITIAL
+#define COV_ADDRESSES_INITIAL 8
+#endif
+#ifndef COV_ADDRESS_BUCKETS
+#define COV_ADDRESS_BUCKETS 32
+#endif
+static BACNET_COV_ADDRESS *COV_Addresses = NULL;
+static unsigned COV_Addresses_Size = 0;
+static unsigned COV_Addresses_Free = 0;
+static unsigned COV_Address_Index[COV_ADDRESS_BUCKETS];
+/* objects reported by handler_cov_object_changed() since the last task */
+#ifndef MAX_COV_CHANGED_OBJECTS
+#define MAX_COV_CHANGED_OBJECTS 64
+#endif
+static BACNET_OBJECT_ID COV_Changed_Objects[MAX_COV_CHANGED_OBJECTS];
+static unsigned COV_Changed_Head = 0;
+static unsigned COV_Changed_Count = 0;
+static bool COV_Changed_Overflow = false;
+/* subscriptions with a notification to send or a confirmation to await */
+static unsigned COV_Send_Head = 0;
+static unsigned COV_Send_Tail = 0;
+static unsigned COV_Send_Count = 0;
+/* subscriptions with a definite lifetime, in the slot of their expiry */
+#ifndef COV_TIMER_WHEEL_SLOTS
+#define COV_TIMER_WHEEL_SLOTS 256
 #endif
-static BACNET_COV_ADDRESS COV_Addresses[MAX_COV_ADDRESSES];
+static unsigned COV_Timer_Wheel[COV_TIMER_WHEEL_SLOTS];
+static uint32_t COV_Seconds = 0;
+/* also told about each change, e.g. for COV trend logging */
+static cov_object_changed_function COV_Object_Changed_Callback = NULL;
+
+static uint32_t cov_hash_mix(
+    uint32_t hash,
+    uint32_t value)
+{
+    hash ^= value;
+    hash *= 16777619UL;
+
+    return hash;
+}
+
+static unsigned cov_object_bucket(
+    uint16_t object_type,
+    uint32_t object_instance)
+{
+    uint32_t key = 0;
+
+    key = BACNET_ID_VALUE(object_instance, (uint32_t) object_type);
+    key *= 2654435761UL;
+
+    return (unsigned) ((key >> 16) & (COV_Index_Size - 1));
+}
+
+static unsigned cov_key_bucket(
+    int dest_index,
+    uint32_t process_id,
+    uint16_t object_type,
+    uint32_t object_instance)
+{
+    uint32_t hash = 2166136261UL;
+
+    hash = cov_hash_mix(hash, (uint32_t) dest_index);
+    hash = cov_hash_mix(hash, process_id);
+    hash = cov_hash_mix(hash, BACNET_ID_VALUE(object_instance,
+            (uint32_t) object_type));
+
+    return (unsigned) (hash & (COV_Index_Size - 1));
+}
+
+/* hashes the fields bacnet_address_same() compares: the router MAC of a
+   remote address may differ between renewals of the same subscriber */
+static unsigned cov_address_bucket(
+    BACNET_ADDRESS * dest)
+{
+    uint32_t hash = 2166136261UL;
+    unsigned i = 0;
+
+    hash = cov_hash_mix(hash, dest->net);
+    for (i = 0; (i < dest->len) && (i < MAX_MAC_LEN); i++) {
+        hash = cov_hash_mix(hash, dest->adr[i]);
+    }
+    if (dest->net == 0) {
+        for (i = 0; (i < dest->mac_len) && (i < MAX_MAC_LEN); i++) {
+            hash = cov_hash_mix(hash, dest->mac[i]);
+        }
+    }
+
+    return (unsigned) (hash % COV_ADDRESS_BUCKETS);
+}
+
+static bool cov_object_match(
+    int index,
+    uint16_t object_type,
+    uint32_t object_instance)
+{
+    return ((COV_Subscriptions[index].monitoredObjectIdentifier.type ==
+            object_type) &&
+        (COV_Subscriptions[index].monitoredObjectIdentifier.instance ==
+            object_instance));
+}
 
 /**
-* Gets the address from the list of COV addresses
-*
-* @param  index - offset into COV address list where address is stored
-* @param  dest - address to be filled when found
-*
-* @return true if valid address, false if not valid or not found
-*/
+ * Finds the first subscription chain of the bucket of an object.
+ *
+ * @return the link (index + 1) to the chain, or 0 if empty
+ */
+static unsigned cov_object_first(
+    uint16_t object_type,
+    uint32_t object_instance)
+{
+    if (!COV_Index_Size) {
+        return 0;
+    }
+
+    return COV_Object_Index[cov_object_bucket(object_type, object_instance)];
+}
+
+/**
+ * Adds a valid subscription to the hash and to its monitored object chain
+ */
+static void cov_index_link(
+    int index)
+{
+    BACNET_COV_SUBSCRIPTION *cov_subscription = &COV_Subscriptions[index];
+    unsigned bucket = 0;
+
+    bucket =
+        cov_object_bucket(cov_subscription->monitoredObjectIdentifier.type,
+        cov_subscription->monitoredObjectIdentifier.instance);
+    cov_subscription->object_next = COV_Object_Index[bucket];
+    COV_Object_Index[bucket] = index + 1;
+    bucket =
+        cov_key_bucket(cov_subscription->dest_index,
+        cov_subscription->subscriberProcessIdentifier,
+        cov_subscription->monitoredObjectIdentifier.type,
+        cov_subscription->monitoredObjectIdentifier.instance);
+    cov_subscription->key_next = COV_Subscription_Index[bucket];
+    COV_Subscription_Index[bucket] = index + 1;
+}
+
+/**
+ * Removes a subscription from the hash and from its monitored object chain.
+ * Must be called before the subscription is invalidated or reused.
+ */
+static void cov_index_unlink(
+    int index)
+{
+    BACNET_COV_SUBSCRIPTION *cov_subscription = &COV_Subscriptions[index];
+    unsigned bucket = 0;
+    unsigned *link = NULL;
+
+    bucket =
+        cov_object_bucket(cov_subscription->monitoredObjectIdentifier.type,
+        cov_subscription->monitoredObjectIdentifier.instance);
+    link = &COV_Object_Index[bucket];
+    while (*link) {
+        if (*link == (unsigned) (index + 1)) {
+            *link = cov_subscription->object_next;
+            break;
+        }
+        link = &COV_Subscriptions[*link - 1].object_next;
+    }
+    cov_subscription->object_next = 0;
+    bucket =
+        cov_key_bucket(cov_subscription->dest_index,
+        cov_subscription->subscriberProcessIdentifier,
+        cov_subscription->monitoredObjectIdentifier.type,
+        cov_subscription->monitoredObjectIdentifier.instance);
+    link = &COV_Subscription_Index[bucket];
+    while (*link) {
+        if (*link == (unsigned) (index + 1)) {
+            *link = cov_subscription->key_next;
+            break;
+        }
+        link = &COV_Subscriptions[*link - 1].key_next;
+    }
+    cov_subscription->key_next = 0;
+}
+
+/**
+ * Resizes both subscription indexes to the pool size and links
+ * the valid subscriptions again.
+ *
+ * @return true if the indexes have the new size
+ */
+static bool cov_index_rebuild(
+    unsigned size)
+{
+    unsigned *subscription_index = NULL;
+    unsigned *object_index = NULL;
+    unsigned index = 0;
+
+    subscription_index = calloc(size, sizeof(unsigned));
+    object_index = calloc(size, sizeof(unsigned));
+    if (!subscription_index || !object_index) {
+        free(subscription_index);
+        free(object_index);
+        return false;
+    }
+    free(COV_Subscription_Index);
+    free(COV_Object_Index);
+    COV_Subscription_Index = subscription_index;
+    COV_Object_Index = object_index;
+    COV_Index_Size = size;
+    for (index = 0; index < COV_Subscriptions_Size; index++) {
+        if (COV_Subscriptions[index].flag.valid) {
+            cov_index_link(index);
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Finds a subscription by its address, process and monitored object
+ *
+ * @return index of the subscription, or -1 if not found
+ */
+static int cov_subscription_find(
+    int dest_index,
+    uint32_t process_id,
+    uint16_t object_type,
+    uint32_t object_instance)
+{
+    unsigned link = 0;
+    BACNET_COV_SUBSCRIPTION *cov_subscription = NULL;
+
+    if (!COV_Index_Size) {
+        return -1;
+    }
+    link =
+        COV_Subscription_Index[cov_key_bucket(dest_index, process_id,
+            object_type, object_instance)];
+    while (link) {
+        cov_subscription = &COV_Subscriptions[link - 1];
+        if ((cov_subscription->dest_index == dest_index) &&
+            (cov_subscription->subscriberProcessIdentifier == process_id) &&
+            cov_object_match(link - 1, object_type, object_instance)) {
+            return (int) (link - 1);
+        }
+        link = cov_subscription->key_next;
+    }
+
+    return -1;
+}
+
+/**
+ * Takes a slot from the subscription pool, growing the pool when it is
+ * empty, up to MAX_COV_SUBCRIPTIONS.
+ *
+ * @return index of the (not yet valid) slot, or -1 if out of resources
+ */
+static int cov_subscription_alloc(
+    void)
+{
+    BACNET_COV_SUBSCRIPTION *pool = NULL;
+    unsigned size = 0;
+    unsigned index = 0;
+
+    if (!COV_Subscriptions_Free) {
+        if (COV_Subscriptions_Size >= MAX_COV_SUBCRIPTIONS) {
+            return -1;
+        }
+        size = COV_Subscriptions_Size * 2;
+        if (size < COV_SUBSCRIPTIONS_INITIAL) {
+            size = COV_SUBSCRIPTIONS_INITIAL;
+        }
+        if (size > MAX_COV_SUBCRIPTIONS) {
+            size = MAX_COV_SUBCRIPTIONS;
+        }
+        pool = realloc(COV_Subscriptions, size * sizeof(*pool));
+        if (!pool) {
+            return -1;
+        }
+        memset(&pool[COV_Subscriptions_Size], 0,
+            (size - COV_Subscriptions_Size) * sizeof(*pool));
+        COV_Subscriptions = pool;
+        for (index = size; index > COV_Subscriptions_Size; index--) {
+            COV_Subscriptions[index - 1].key_next = COV_Subscriptions_Free;
+            COV_Subscriptions_Free = index;
+        }
+        COV_Subscriptions_Size = size;
+        /* the hash keeps a load factor of one or less, if memory allows */
+        size = 1;
+        while (size < COV_Subscriptions_Size) {
+            size <<= 1;
+        }
+        if ((size != COV_Index_Size) && !cov_index_rebuild(size) &&
+            !COV_Index_Size) {
+            return -1;
+        }
+    }
+    index = COV_Subscriptions_Free - 1;
+    COV_Subscriptions_Free = COV_Subscriptions[index].key_next;
+    COV_Subscriptions[index].key_next = 0;
+
+    return (int) index;
+}
+
+/**
+ * Gets the address from the list of COV addresses
+ *
+ * @param  index - offset into COV address list where address is stored
+ *
+ * @return the address if valid, NULL if not valid or not found
+ */
 static BACNET_ADDRESS *cov_address_get(
     int index)
 {
     BACNET_ADDRESS *cov_dest = NULL;
 
-    if (index < MAX_COV_ADDRESSES) {
+    if ((index >= 0) && ((unsigned) index < COV_Addresses_Size)) {
         if (COV_Addresses[index].valid) {
             cov_dest = &COV_Addresses[index].dest;
         }
@@ -103,79 +425,254 @@ static BACNET_ADDRESS *cov_address_get(
 }
 
 /**
- * Removes the address from the list of COV addresses, if it is not
- * used by other COV subscriptions
+ * Finds the address in the list of COV addresses
+ *
+ * @param  dest - address to be found
+ *
+ * @return index number 0..N, or -1 if not found
  */
-static void cov_address_remove_unused(
-    void)
+static int cov_address_find(
+    BACNET_ADDRESS * dest)
 {
-    unsigned index = 0;
-    unsigned cov_index = 0;
-    bool found = false;
-
-    for (cov_index = 0; cov_index < MAX_COV_ADDRESSES; cov_index++) {
-        if (COV_Addresses[cov_index].valid) {
-            found = false;
-            for (index = 0; index < MAX_COV_SUBCRIPTIONS; index++) {
-                if ((COV_Subscriptions[index].flag.valid) &&
-                    (COV_Subscriptions[index].dest_index == cov_index)) {
-                    found = true;
-                    break;
-                }
-            }
-            if (!found) {
-                COV_Addresses[cov_index].valid = false;
-            }
+    unsigned link = 0;
+
+    link = COV_Address_Index[cov_address_bucket(dest)];
+    while (link) {
+        if (bacnet_address_same(dest, &COV_Addresses[link - 1].dest)) {
+            return (int) (link - 1);
         }
+        link = COV_Addresses[link - 1].next;
     }
+
+    return -1;
 }
 
 /**
-* Adds the address to the list of COV addresses
-*
-* @param  dest - address to be added if there is room in the list
-*
-* @return index number 0..N, or -1 if unable to add
-*/
+ * Adds a reference to the address in the list of COV addresses,
+ * adding the address if it is not there yet.
+ *
+ * @param  dest - address to be added if there is room in the list
+ *
+ * @return index number 0..N, or -1 if unable to add
+ */
 static int cov_address_add(
     BACNET_ADDRESS * dest)
 {
+    BACNET_COV_ADDRESS *pool = NULL;
+    unsigned size = 0;
+    unsigned bucket = 0;
     int index = -1;
-    unsigned i = 0;
-    bool found = false;
-    bool valid = false;
-    BACNET_ADDRESS *cov_dest = NULL;
 
-    if (dest) {
-        for (i = 0; i < MAX_COV_ADDRESSES; i++) {
-            valid = COV_Addresses[i].valid;
-            if (valid) {
-                cov_dest = &COV_Addresses[i].dest;
-                found = bacnet_address_same(dest, cov_dest);
-                if (found) {
-                    index = i;
-                    break;
-                }
+    index = cov_address_find(dest);
+    if (index < 0) {
+        if (!COV_Addresses_Free) {
+            if (COV_Addresses_Size >= MAX_COV_ADDRESSES) {
+                return -1;
             }
-        }
-        if (!found) {
-            /* find a free place to add a new address */
-            for (i = 0; i < MAX_COV_ADDRESSES; i++) {
-                valid = COV_Addresses[i].valid;
-                if (!valid) {
-                    index = i;
-                    cov_dest = &COV_Addresses[i].dest;
-                    bacnet_address_copy(cov_dest, dest);
-                    COV_Addresses[i].valid = true;
-                    break;
-                }
+            size = COV_Addresses_Size * 2;
+            if (size < COV_ADDRESSES_INITIAL) {
+                size = COV_ADDRESSES_INITIAL;
+            }
+            if (size > MAX_COV_ADDRESSES) {
+                size = MAX_COV_ADDRESSES;
+            }
+            pool = realloc(COV_Addresses, size * sizeof(*pool));
+            if (!pool) {
+                return -1;
             }
+            memset(&pool[COV_Addresses_Size], 0,
+                (size - COV_Addresses_Size) * sizeof(*pool));
+            COV_Addresses = pool;
+            for (bucket = size; bucket > COV_Addresses_Size; bucket--) {
+                COV_Addresses[bucket - 1].next = COV_Addresses_Free;
+                COV_Addresses_Free = bucket;
+            }
+            COV_Addresses_Size = size;
+        }
+        index = (int) COV_Addresses_Free - 1;
+        COV_Addresses_Free = COV_Addresses[index].next;
+        bacnet_address_copy(&COV_Addresses[index].dest, dest);
+        COV_Addresses[index].valid = true;
+        COV_Addresses[index].refcount = 0;
+        bucket = cov_address_bucket(dest);
+        COV_Addresses[index].next = COV_Address_Index[bucket];
+        COV_Address_Index[bucket] = index + 1;
+    } else if (dest->net) {
+        /* a renewal may come through another router: answer through it */
+        memcpy(COV_Addresses[index].dest.mac, dest->mac, MAX_MAC_LEN);
+        COV_Addresses[index].dest.mac_len = dest->mac_len;
+    }
+    COV_Addresses[index].refcount++;
+
+    return index;
+}
+
+/**
+ * Drops a reference to the address, and removes the address from the
+ * list of COV addresses when no other COV subscription uses it.
+ */
+static void cov_address_remove(
+    int index)
+{
+    unsigned *link = NULL;
+
+    if (!cov_address_get(index)) {
+        return;
+    }
+    if (COV_Addresses[index].refcount > 1) {
+        COV_Addresses[index].refcount--;
+        return;
+    }
+    link = &COV_Address_Index[cov_address_bucket(&COV_Addresses[index].dest)];
+    while (*link) {
+        if (*link == (unsigned) (index + 1)) {
+            *link = COV_Addresses[index].next;
+            break;
+        }
+        link = &COV_Addresses[*link - 1].next;
+    }
+    COV_Addresses[index].valid = false;
+    COV_Addresses[index].refcount = 0;
+    COV_Addresses[index].next = COV_Addresses_Free;
+    COV_Addresses_Free = index + 1;
+}
+
+/**
+ * Puts a subscription on the send queue, unless it is already waiting there
+ */
+static void cov_send_queue_add(
+    int index)
+{
+    if (!COV_Subscriptions[index].flag.queued) {
+        COV_Subscriptions[index].send_next = 0;
+        if (COV_Send_Tail) {
+            COV_Subscriptions[COV_Send_Tail - 1].send_next = index + 1;
+        } else {
+            COV_Send_Head = index + 1;
         }
+        COV_Send_Tail = index + 1;
+        COV_Send_Count++;
+        COV_Subscriptions[index].flag.queued = true;
+    }
+}
+
+/**
+ * Takes the first subscription from the send queue
+ *
+ * @return index of the subscription, or -1 if the queue is empty
+ */
+static int cov_send_queue_remove(
+    void)
+{
+    int index = -1;
+
+    if (COV_Send_Head) {
+        index = (int) COV_Send_Head - 1;
+        COV_Send_Head = COV_Subscriptions[index].send_next;
+        if (!COV_Send_Head) {
+            COV_Send_Tail = 0;
+        }
+        COV_Send_Count--;
+        COV_Subscriptions[index].send_next = 0;
+        COV_Subscriptions[index].flag.queued = false;
     }
 
     return index;
 }
 
+static void cov_timer_unlink(
+    int index)
+{
+    BACNET_COV_SUBSCRIPTION *cov_subscription = &COV_Subscriptions[index];
+
+    if (!cov_subscription->flag.timed) {
+        return;
+    }
+    if (cov_subscription->timer_prev) {
+        COV_Subscriptions[cov_subscription->timer_prev - 1].timer_next =
+            cov_subscription->timer_next;
+    } else {
+        COV_Timer_Wheel[cov_subscription->expires % COV_TIMER_WHEEL_SLOTS] =
+            cov_subscription->timer_next;
+    }
+    if (cov_subscription->timer_next) {
+        COV_Subscriptions[cov_subscription->timer_next - 1].timer_prev =
+            cov_subscription->timer_prev;
+    }
+    cov_subscription->timer_next = 0;
+    cov_subscription->timer_prev = 0;
+    cov_subscription->flag.timed = false;
+}
+
+/**
+ * (Re)starts the lifetime of a subscription.  A definite lifetime puts
+ * the subscription in the timer wheel slot of the second it expires.
+ */
+static void cov_timer_start(
+    int index)
+{
+    BACNET_COV_SUBSCRIPTION *cov_subscription = &COV_Subscriptions[index];
+    unsigned slot = 0;
+
+    cov_timer_unlink(index);
+    if (cov_subscription->lifetime) {
+        cov_subscription->expires = COV_Seconds + cov_subscription->lifetime;
+        slot = cov_subscription->expires % COV_TIMER_WHEEL_SLOTS;
+        cov_subscription->timer_prev = 0;
+        cov_subscription->timer_next = COV_Timer_Wheel[slot];
+        if (COV_Timer_Wheel[slot]) {
+            COV_Subscriptions[COV_Timer_Wheel[slot] - 1].timer_prev =
+                index + 1;
+        }
+        COV_Timer_Wheel[slot] = index + 1;
+        cov_subscription->flag.timed = true;
+    }
+}
+
+/**
+ * Gets the time remaining of a subscription
+ *
+ * @return seconds until the subscription expires, 0 for indefinite
+ *  or already expired
+ */
+static uint32_t cov_time_remaining(
+    BACNET_COV_SUBSCRIPTION * cov_subscription)
+{
+    if (!cov_subscription->flag.timed) {
+        return 0;
+    }
+    if ((int32_t) (cov_subscription->expires - COV_Seconds) <= 0) {
+        /* over, but not purged from the wheel yet */
+        return 0;
+    }
+
+    return cov_subscription->expires - COV_Seconds;
+}
+
+/**
+ * Invalidates a subscription and returns its slot to the pool
+ */
+static void cov_subscription_free(
+    int index)
+{
+    BACNET_COV_SUBSCRIPTION *cov_subscription = &COV_Subscriptions[index];
+
+    cov_index_unlink(index);
+    cov_timer_unlink(index);
+    if (cov_subscription->invokeID) {
+        tsm_free_invoke_id_peer(cov_address_get(cov_subscription->dest_index),
+            cov_subscription->invokeID);
+        cov_subscription->invokeID = 0;
+    }
+    cov_address_remove(cov_subscription->dest_index);
+    cov_subscription->flag.valid = false;
+    cov_subscription->flag.send_requested = false;
+    cov_subscription->dest_index = -1;
+    /* a queued slot stays queued; the send task skips invalid slots */
+    cov_subscription->key_next = COV_Subscriptions_Free;
+    COV_Subscriptions_Free = index + 1;
+}
+
 /*
 BACnetCOVSubscription ::= SEQUENCE {
 Recipient [0] BACnetRecipientProcess,
@@ -283,7 +780,7 @@ static int cov_encode_subscription(
     /* TimeRemaining [3] Unsigned, */
     len =
         encode_context_unsigned(&apdu[apdu_len], 3,
-        cov_subscription->lifetime);
+        cov_time_remaining(cov_subscription));
     apdu_len += len;
 
     return apdu_len;
@@ -309,7 +806,7 @@ int handler_cov_encode_subscriptions(
     unsigned index = 0;
 
     if (apdu) {
-        for (index = 0; index < MAX_COV_SUBCRIPTIONS; index++) {
+        for (index = 0; index < COV_Subscriptions_Size; index++) {
             if (COV_Subscriptions[index].flag.valid) {
                 len =
                     cov_encode_subscription(&apdu[apdu_len],
@@ -334,20 +831,36 @@ void handler_cov_init(
 {
     unsigned index = 0;
 
-    for (index = 0; index < MAX_COV_SUBCRIPTIONS; index++) {
-        COV_Subscriptions[index].flag.valid = false;
-        COV_Subscriptions[index].dest_index = -1;
-        COV_Subscriptions[index].subscriberProcessIdentifier = 0;
-        COV_Subscriptions[index].monitoredObjectIdentifier.type =
-            OBJECT_ANALOG_INPUT;
-        COV_Subscriptions[index].monitoredObjectIdentifier.instance = 0;
-        COV_Subscriptions[index].flag.issueConfirmedNotifications = false;
-        COV_Subscriptions[index].invokeID = 0;
-        COV_Subscriptions[index].lifetime = 0;
-        COV_Subscriptions[index].flag.send_requested = false;
+    for (index = 0; index < COV_Subscriptions_Size; index++) {
+        if (COV_Subscriptions[index].invokeID) {
+            tsm_free_invoke_id_peer(cov_address_get(COV_Subscriptions[index].
+                    dest_index), COV_Subscriptions[index].invokeID);
+        }
+    }
+    free(COV_Subscriptions);
+    COV_Subscriptions = NULL;
+    COV_Subscriptions_Size = 0;
+    COV_Subscriptions_Free = 0;
+    free(COV_Subscription_Index);
+    COV_Subscription_Index = NULL;
+    free(COV_Object_Index);
+    COV_Object_Index = NULL;
+    COV_Index_Size = 0;
+    free(COV_Addresses);
+    COV_Addresses = NULL;
+    COV_Addresses_Size = 0;
+    COV_Addresses_Free = 0;
+    for (index = 0; index < COV_ADDRESS_BUCKETS; index++) {
+        COV_Address_Index[index] = 0;
     }
-    for (index = 0; index < MAX_COV_ADDRESSES; index++) {
-        COV_Addresses[index].valid = false;
+    COV_Changed_Head = 0;
+    COV_Changed_Count = 0;
+    COV_Changed_Overflow = false;
+    COV_Send_Head = 0;
+    COV_Send_Tail = 0;
+    COV_Send_Count = 0;
+    for (index = 0; index < COV_TIMER_WHEEL_SLOTS; index++) {
+        COV_Timer_Wheel[index] = 0;
     }
 }
 
@@ -357,90 +870,80 @@ static bool cov_list_subscribe(
     BACNET_ERROR_CLASS * error_class,
     BACNET_ERROR_CODE * error_code)
 {
-    bool existing_entry = false;
-    int index;
-    int first_invalid_index = -1;
-    bool found = true;
-    bool address_match = false;
-    BACNET_ADDRESS *dest = NULL;
-
-    /* unable to subscribe - resources? */
-    /* unable to cancel subscription - other? */
+    BACNET_COV_SUBSCRIPTION *cov_subscription = NULL;
+    int index = -1;
+    int dest_index = -1;
 
     /* existing? - match Object ID and Process ID and address */
-    for (index = 0; index < MAX_COV_SUBCRIPTIONS; index++) {
-        if (COV_Subscriptions[index].flag.valid) {
-            dest = cov_address_get(COV_Subscriptions[index].dest_index);
-            if (dest) {
-                address_match = bacnet_address_same(src, dest);
-            } else {
-                /* skip address matching - we don't have an address */
-                address_match = true;
-            }
-            if ((COV_Subscriptions[index].monitoredObjectIdentifier.type ==
-                    cov_data->monitoredObjectIdentifier.type) &&
-                (COV_Subscriptions[index].monitoredObjectIdentifier.instance ==
-                    cov_data->monitoredObjectIdentifier.instance) &&
-                (COV_Subscriptions[index].subscriberProcessIdentifier ==
-                    cov_data->subscriberProcessIdentifier) && address_match) {
-                existing_entry = true;
-                if (cov_data->cancellationRequest) {
-                    COV_Subscriptions[index].flag.valid = false;
-                    COV_Subscriptions[index].dest_index = -1;
-                    cov_address_remove_unused();
-                } else {
-                    COV_Subscriptions[index].dest_index = cov_address_add(src);
-                    COV_Subscriptions[index].flag.issueConfirmedNotifications =
-                        cov_data->issueConfirmedNotifications;
-                    COV_Subscriptions[index].lifetime = cov_data->lifetime;
-                    COV_Subscriptions[index].flag.send_requested = true;
-                }
-                if (COV_Subscriptions[index].invokeID) {
-                    tsm_free_invoke_id(COV_Subscriptions[index].invokeID);
-                    COV_Subscriptions[index].invokeID = 0;
-                }
-                break;
-            }
+    dest_index = cov_address_find(src);
+    if (dest_index >= 0) {
+        index =
+            cov_subscription_find(dest_index,
+            cov_data->subscriberProcessIdentifier,
+            cov_data->monitoredObjectIdentifier.type,
+            cov_data->monitoredObjectIdentifier.instance);
+    }
+    if (index >= 0) {
+        cov_subscription = &COV_Subscriptions[index];
+        if (cov_data->cancellationRequest) {
+            cov_subscription_free(index);
         } else {
-            if (first_invalid_index < 0) {
-                first_invalid_index = index;
+            cov_subscription->flag.issueConfirmedNotifications =
+                cov_data->issueConfirmedNotifications;
+            cov_subscription->lifetime = cov_data->lifetime;
+            cov_subscription->flag.send_requested = true;
+            if (cov_subscription->invokeID) {
+                tsm_free_invoke_id_peer(cov_address_get(cov_subscription->
+                        dest_index), cov_subscription->invokeID);
+                cov_subscription->invokeID = 0;
             }
+            cov_timer_start(index);
+            cov_send_queue_add(index);
         }
+        return true;
     }
-    if (!existing_entry && (first_invalid_index >= 0) &&
-        (!cov_data->cancellationRequest)) {
-        index = first_invalid_index;
-        found = true;
-        COV_Subscriptions[index].flag.valid = true;
-        COV_Subscriptions[index].dest_index = cov_address_add(src);
-        COV_Subscriptions[index].monitoredObjectIdentifier.type =
-            cov_data->monitoredObjectIdentifier.type;
-        COV_Subscriptions[index].monitoredObjectIdentifier.instance =
-            cov_data->monitoredObjectIdentifier.instance;
-        COV_Subscriptions[index].subscriberProcessIdentifier =
-            cov_data->subscriberProcessIdentifier;
-        COV_Subscriptions[index].flag.issueConfirmedNotifications =
-            cov_data->issueConfirmedNotifications;
-        COV_Subscriptions[index].invokeID = 0;
-        COV_Subscriptions[index].lifetime = cov_data->lifetime;
-        COV_Subscriptions[index].flag.send_requested = true;
-    } else if (!existing_entry) {
-        if (first_invalid_index < 0) {
-            /* Out of resources */
-            *error_class = ERROR_CLASS_RESOURCES;
-            *error_code = ERROR_CODE_NO_SPACE_TO_ADD_LIST_ELEMENT;
-            found = false;
-        } else {
-            /* cancellationRequest - valid object not subscribed */
-            /* From BACnet Standard 135-2010-13.14.2
-               ...Cancellations that are issued for which no matching COV
-               context can be found shall succeed as if a context had
-               existed, returning 'Result(+)'. */
-            found = true;
+    if (cov_data->cancellationRequest) {
+        /* cancellationRequest - valid object not subscribed */
+        /* From BACnet Standard 135-2010-13.14.2
+           ...Cancellations that are issued for which no matching COV
+           context can be found shall succeed as if a context had
+           existed, returning 'Result(+)'. */
+        return true;
+    }
+    index = cov_subscription_alloc();
+    if (index >= 0) {
+        dest_index = cov_address_add(src);
+        if (dest_index < 0) {
+            COV_Subscriptions[index].key_next = COV_Subscriptions_Free;
+            COV_Subscriptions_Free = index + 1;
+            index = -1;
         }
     }
+    if (index < 0) {
+        /* Out of resources */
+        *error_class = ERROR_CLASS_RESOURCES;
+        *error_code = ERROR_CODE_NO_SPACE_TO_ADD_LIST_ELEMENT;
+        return false;
+    }
+    cov_subscription = &COV_Subscriptions[index];
+    cov_subscription->flag.valid = true;
+    cov_subscription->dest_index = dest_index;
+    cov_subscription->monitoredObjectIdentifier.type =
+        cov_data->monitoredObjectIdentifier.type;
+    cov_subscription->monitoredObjectIdentifier.instance =
+        cov_data->monitoredObjectIdentifier.instance;
+    cov_subscription->subscriberProcessIdentifier =
+        cov_data->subscriberProcessIdentifier;
+    cov_subscription->flag.issueConfirmedNotifications =
+        cov_data->issueConfirmedNotifications;
+    cov_subscription->invokeID = 0;
+    cov_subscription->lifetime = cov_data->lifetime;
+    cov_subscription->flag.send_requested = true;
+    cov_index_link(index);
+    cov_timer_start(index);
+    cov_send_queue_add(index);
 
-    return found;
+    return true;
 }
 
 static bool cov_send_request(
@@ -486,11 +989,12 @@ static bool cov_send_request(
         cov_subscription->monitoredObjectIdentifier.type;
     cov_data.monitoredObjectIdentifier.instance =
         cov_subscription->monitoredObjectIdentifier.instance;
-    cov_data.timeRemaining = cov_subscription->lifetime;
+    cov_data.timeRemaining = cov_time_remaining(cov_subscription);
     cov_data.listOfValues = value_list;
     if (cov_subscription->flag.issueConfirmedNotifications) {
         npdu_data.data_expecting_reply = true;
-        invoke_id = tsm_next_free_invokeID();
+        /* each subscriber has its own invoke IDs */
+        invoke_id = tsm_next_free_invokeID_peer(dest);
         if (invoke_id) {
             cov_subscription->invokeID = invoke_id;
             len =
@@ -525,223 +1029,268 @@ static bool cov_send_request(
 }
 
 static void cov_lifetime_expiration_handler(
-    unsigned index,
-    uint32_t elapsed_seconds,
-    uint32_t lifetime_seconds)
-{
-    if (index < MAX_COV_SUBCRIPTIONS) {
-        /* handle lifetime expiration */
-        if (lifetime_seconds >= elapsed_seconds) {
-            COV_Subscriptions[index].lifetime -= elapsed_seconds;
-#if 0
-            fprintf(stderr, "COVtimer: subscription[%d].lifetime=%lu\n", index,
-                (unsigned long) COV_Subscriptions[index].lifetime);
-#endif
-        } else {
-            COV_Subscriptions[index].lifetime = 0;
-        }
-        if (COV_Subscriptions[index].lifetime == 0) {
-            /* expire the subscription */
+    unsigned index)
+{
+    if (index < COV_Subscriptions_Size) {
+        /* expire the subscription */
 #if PRINT_ENABLED
-            fprintf(stderr, "COVtimer: PID=%u ",
-                COV_Subscriptions[index].subscriberProcessIdentifier);
-            fprintf(stderr, "%s %u ",
-                bactext_object_type_name(COV_Subscriptions[index].
-                    monitoredObjectIdentifier.type),
-                COV_Subscriptions[index].monitoredObjectIdentifier.instance);
-            fprintf(stderr, "time remaining=%u seconds ",
-                COV_Subscriptions[index].lifetime);
-            fprintf(stderr, "\n");
+        fprintf(stderr, "COVtimer: PID=%u ",
+            COV_Subscriptions[index].subscriberProcessIdentifier);
+        fprintf(stderr, "%s %u ",
+            bactext_object_type_name(COV_Subscriptions[index].
+                monitoredObjectIdentifier.type),
+            COV_Subscriptions[index].monitoredObjectIdentifier.instance);
+        fprintf(stderr, "\n");
 #endif
-            COV_Subscriptions[index].flag.valid = false;
-            COV_Subscriptions[index].dest_index = -1;
-            cov_address_remove_unused();
-            if (COV_Subscriptions[index].flag.issueConfirmedNotifications) {
-                if (COV_Subscriptions[index].invokeID) {
-                    tsm_free_invoke_id(COV_Subscriptions[index].invokeID);
-                    COV_Subscriptions[index].invokeID = 0;
-                }
-            }
-        }
+        cov_subscription_free(index);
     }
 }
 
-/** Handler to check the list of subscribed objects for any that have changed
- *  and so need to have notifications sent.
+/** Handler to expire the COV subscriptions whose lifetime is over.
  * @ingroup DSCOV
  * This handler will be invoked by the main program every second or so.
- * This example only handles Binary Inputs, but can be easily extended to
- * support other types.
- * For each subscribed object,
- *  - See if the subscription has timed out
- *    - Remove it if it has timed out.
- *  - See if the subscribed object instance has changed
- *    (eg, check with Binary_Input_Change_Of_Value() )
- *  - If changed,
- *    - Clear the COV (eg, Binary_Input_Change_Of_Value_Clear() )
- *    - Send the notice with cov_send_request()
- *      - Will be confirmed or unconfirmed, as per the subscription.
- *
- * @note worst case tasking: MS/TP with the ability to send only
- *        one notification per task cycle.
+ * The subscriptions with a definite lifetime wait in the timer wheel slot
+ * of the second they expire, so only the slots of the elapsed seconds
+ * are visited.  Subscriptions with lifetimes longer than a turn of the
+ * wheel stay in their slot until their turn comes.
  *
  * @param elapsed_seconds [in] How many seconds have elapsed since last called.
  */
 void handler_cov_timer_seconds(
     uint32_t elapsed_seconds)
 {
+    uint32_t seconds = 0;
+    uint32_t steps = 0;
+    unsigned link = 0;
     unsigned index = 0;
-    uint32_t lifetime_seconds = 0;
 
     if (elapsed_seconds) {
-        /* handle the subscription timeouts */
-        for (index = 0; index < MAX_COV_SUBCRIPTIONS; index++) {
-            if (COV_Subscriptions[index].flag.valid) {
-                lifetime_seconds = COV_Subscriptions[index].lifetime;
-                if (lifetime_seconds) {
-                    /* only expire COV with definite lifetimes */
-                    cov_lifetime_expiration_handler(index, elapsed_seconds,
-                        lifetime_seconds);
+        seconds = COV_Seconds;
+        COV_Seconds += elapsed_seconds;
+        steps = elapsed_seconds;
+        if (steps > COV_TIMER_WHEEL_SLOTS) {
+            steps = COV_TIMER_WHEEL_SLOTS;
+        }
+        while (steps) {
+            seconds++;
+            link = COV_Timer_Wheel[seconds % COV_TIMER_WHEEL_SLOTS];
+            while (link) {
+                index = link - 1;
+                link = COV_Subscriptions[index].timer_next;
+                if ((int32_t) (COV_Subscriptions[index].expires -
+                        COV_Seconds) <= 0) {
+                    cov_lifetime_expiration_handler(index);
                 }
             }
+            steps--;
         }
     }
 }
 
-bool handler_cov_fsm(
-    void)
+/** Reports that an object may have a new value for its COV subscribers.
+ * @ingroup DSCOV
+ * Called by the objects whenever they raise their COV flag (value
+ * changed by more than the COV increment, status flags changed).
+ * Objects that nobody subscribed to are ignored; the others are queued
+ * for the next handler_cov_task().  If the queue is full, the next task
+ * sweeps all subscriptions instead, so no change is lost.
+ *
+ * @param object_type [in] The type of the object that changed.
+ * @param object_instance [in] The instance of the object that changed.
+ */
+void handler_cov_object_changed(
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance)
 {
-    static int index = 0;
-    BACNET_OBJECT_TYPE object_type = MAX_BACNET_OBJECT_TYPE;
-    uint32_t object_instance = 0;
-    bool status = false;
-    bool send = false;
-    BACNET_PROPERTY_VALUE value_list[2];
-    /* states for transmitting */
-    static enum {
-        COV_STATE_IDLE = 0,
-        COV_STATE_MARK,
-        COV_STATE_CLEAR,
-        COV_STATE_FREE,
-        COV_STATE_SEND
-    } cov_task_state = COV_STATE_IDLE;
-
-    switch (cov_task_state) {
-        case COV_STATE_IDLE:
-            index = 0;
-            cov_task_state = COV_STATE_MARK;
+    unsigned link = 0;
+    unsigned tail = 0;
+
+    if (COV_Object_Changed_Callback) {
+        COV_Object_Changed_Callback(object_type, object_instance);
+    }
+    link = cov_object_first((uint16_t) object_type, object_instance);
+    while (link) {
+        if (cov_object_match(link - 1, (uint16_t) object_type,
+                object_instance)) {
             break;
-        case COV_STATE_MARK:
-            /* mark any subscriptions where the value has changed */
-            if (COV_Subscriptions[index].flag.valid) {
-                object_type = (BACNET_OBJECT_TYPE)
-                    COV_Subscriptions[index].monitoredObjectIdentifier.type;
-                object_instance =
-                    COV_Subscriptions[index].
-                    monitoredObjectIdentifier.instance;
-                status = Device_COV(object_type, object_instance);
-                if (status) {
-                    COV_Subscriptions[index].flag.send_requested = true;
+        }
+        link = COV_Subscriptions[link - 1].object_next;
+    }
+    if (!link) {
+        /* nobody is subscribed to this object */
+        return;
+    }
+    if (COV_Changed_Count < MAX_COV_CHANGED_OBJECTS) {
+        tail = (COV_Changed_Head + COV_Changed_Count) %
+            MAX_COV_CHANGED_OBJECTS;
+        COV_Changed_Objects[tail].type = (uint16_t) object_type;
+        COV_Changed_Objects[tail].instance = object_instance;
+        COV_Changed_Count++;
+    } else {
+        COV_Changed_Overflow = true;
+    }
+}
+
+/** Sets the function that is also told about each object reported
+ * with handler_cov_object_changed(), subscribed to or not.
+ * @ingroup DSCOV
+ *
+ * @param callback [in] The function, or NULL for none.
+ */
+void handler_cov_object_changed_set_callback(
+    cov_object_changed_function callback)
+{
+    COV_Object_Changed_Callback = callback;
+}
+
+/**
+ * Marks the subscriptions of an object whose COV flag is set,
+ * queues them for sending, and clears the COV flag.
+ */
+static void cov_object_mark(
+    uint16_t object_type,
+    uint32_t object_instance)
+{
+    unsigned link = 0;
+    int index = 0;
+
+    if (!Device_COV((BACNET_OBJECT_TYPE) object_type, object_instance)) {
+        return;
+    }
+    link = cov_object_first(object_type, object_instance);
+    while (link) {
+        index = link - 1;
+        if (cov_object_match(index, object_type, object_instance)) {
+            COV_Subscriptions[index].flag.send_requested = true;
+            cov_send_queue_add(index);
 #if PRINT_ENABLED
-                    fprintf(stderr, "COVtask: Marking...\n");
+            fprintf(stderr, "COVtask: Marking...\n");
 #endif
-                }
-            }
-            index++;
-            if (index >= MAX_COV_SUBCRIPTIONS) {
-                index = 0;
-                cov_task_state = COV_STATE_CLEAR;
-            }
-            break;
-        case COV_STATE_CLEAR:
-            /* clear the COV flag after checking all subscriptions */
-            if ((COV_Subscriptions[index].flag.valid) &&
-                (COV_Subscriptions[index].flag.send_requested)) {
-                object_type = (BACNET_OBJECT_TYPE)
-                    COV_Subscriptions[index].monitoredObjectIdentifier.type;
-                object_instance =
-                    COV_Subscriptions[index].
-                    monitoredObjectIdentifier.instance;
-                Device_COV_Clear(object_type, object_instance);
-            }
-            index++;
-            if (index >= MAX_COV_SUBCRIPTIONS) {
-                index = 0;
-                cov_task_state = COV_STATE_FREE;
-            }
-            break;
-        case COV_STATE_FREE:
-            /* confirmed notification house keeping */
-            if ((COV_Subscriptions[index].flag.valid) &&
-                (COV_Subscriptions[index].flag.issueConfirmedNotifications) &&
-                (COV_Subscriptions[index].invokeID)) {
-                if (tsm_invoke_id_free(COV_Subscriptions[index].invokeID)) {
-                    COV_Subscriptions[index].invokeID = 0;
-                } else
-                    if (tsm_invoke_id_failed(COV_Subscriptions
-                        [index].invokeID)) {
-                    tsm_free_invoke_id(COV_Subscriptions[index].invokeID);
-                    COV_Subscriptions[index].invokeID = 0;
-                }
+        }
+        link = COV_Subscriptions[index].object_next;
+    }
+    Device_COV_Clear((BACNET_OBJECT_TYPE) object_type, object_instance);
+}
+
+/**
+ * Does the confirmed notification house keeping of one queued subscription
+ * and sends its notification, if one is requested.
+ *
+ * @return true if the subscription has to stay on the send queue
+ */
+static bool cov_subscription_send(
+    int index)
+{
+    bool status = false;
+    bool send = false;
+    BACNET_PROPERTY_VALUE value_list[2];
+    BACNET_ADDRESS *dest = NULL;
+
+    if (!COV_Subscriptions[index].flag.valid) {
+        return false;
+    }
+    /* confirmed notification house keeping */
+    if ((COV_Subscriptions[index].flag.issueConfirmedNotifications) &&
+        (COV_Subscriptions[index].invokeID)) {
+        dest = cov_address_get(COV_Subscriptions[index].dest_index);
+        if (tsm_invoke_id_free_peer(dest, COV_Subscriptions[index].invokeID)) {
+            COV_Subscriptions[index].invokeID = 0;
+        } else if (tsm_invoke_id_failed_peer(dest,
+                COV_Subscriptions[index].invokeID)) {
+            tsm_free_invoke_id_peer(dest, COV_Subscriptions[index].invokeID);
+            COV_Subscriptions[index].invokeID = 0;
+        }
+    }
+    /* send the COV, if requested */
+    if (COV_Subscriptions[index].flag.send_requested) {
+        send = true;
+        if (COV_Subscriptions[index].flag.issueConfirmedNotifications) {
+            if (COV_Subscriptions[index].invokeID != 0) {
+                /* already sending */
+                send = false;
             }
-            index++;
-            if (index >= MAX_COV_SUBCRIPTIONS) {
-                index = 0;
-                cov_task_state = COV_STATE_SEND;
+            if (!tsm_transaction_available()) {
+                /* no transactions available - can't send now */
+                send = false;
             }
-            break;
-        case COV_STATE_SEND:
-            /* send any COVs that are requested */
-            if ((COV_Subscriptions[index].flag.valid) &&
-                (COV_Subscriptions[index].flag.send_requested)) {
-                send = true;
-                if (COV_Subscriptions[index].flag.issueConfirmedNotifications) {
-                    if (COV_Subscriptions[index].invokeID != 0) {
-                        /* already sending */
-                        send = false;
-                    }
-                    if (!tsm_transaction_available()) {
-                        /* no transactions available - can't send now */
-                        send = false;
-                    }
-                }
-                if (send) {
-                    object_type = (BACNET_OBJECT_TYPE)
-                        COV_Subscriptions[index].
-                        monitoredObjectIdentifier.type;
-                    object_instance =
-                        COV_Subscriptions[index].
-                        monitoredObjectIdentifier.instance;
+        }
+        if (send) {
 #if PRINT_ENABLED
-                    fprintf(stderr, "COVtask: Sending...\n");
+            fprintf(stderr, "COVtask: Sending...\n");
 #endif
-                    /* configure the linked list for the two properties */
-                    value_list[0].next = &value_list[1];
-                    value_list[1].next = NULL;
-                    status = Device_Encode_Value_List(object_type,
-                        object_instance, &value_list[0]);
-                    if (status) {
-                        status =
-                            cov_send_request(&COV_Subscriptions[index],
-                            &value_list[0]);
-                    }
-                    if (status) {
-                        COV_Subscriptions[index].flag.send_requested = false;
-                    }
-                }
+            /* configure the linked list for the two properties */
+            value_list[0].next = &value_list[1];
+            value_list[1].next = NULL;
+            status =
+                Device_Encode_Value_List((BACNET_OBJECT_TYPE)
+                COV_Subscriptions[index].monitoredObjectIdentifier.type,
+                COV_Subscriptions[index].monitoredObjectIdentifier.instance,
+                &value_list[0]);
+            if (status) {
+                status =
+                    cov_send_request(&COV_Subscriptions[index],
+                    &value_list[0]);
             }
-            index++;
-            if (index >= MAX_COV_SUBCRIPTIONS) {
-                index = 0;
-                cov_task_state = COV_STATE_IDLE;
+            if (status) {
+                COV_Subscriptions[index].flag.send_requested = false;
             }
-            break;
-        default:
-            index = 0;
-            cov_task_state = COV_STATE_IDLE;
-            break;
+        }
     }
-    return (cov_task_state == COV_STATE_IDLE);
+
+    return (COV_Subscriptions[index].flag.send_requested ||
+        (COV_Subscriptions[index].invokeID != 0));
+}
+
+/** Handler to send the notifications of the objects that have changed.
+ * @ingroup DSCOV
+ * The objects report their changes with handler_cov_object_changed(),
+ * and only the subscriptions of those objects are visited:
+ *  - Mark the subscriptions of each changed object, clear the object COV flag
+ *  - For each subscription on the send queue,
+ *    - release the invoke ID of a finished confirmed notification
+ *    - send the notice with cov_send_request(), if requested
+ *    - keep it queued while a notice or confirmation is outstanding
+ *
+ * @return true if there is nothing left to send
+ */
+bool handler_cov_fsm(
+    void)
+{
+    unsigned count = 0;
+    unsigned index = 0;
+    int cov_index = 0;
+    BACNET_OBJECT_ID *object_id = NULL;
+
+    if (COV_Changed_Overflow) {
+        /* lost track of the changes - check every subscribed object */
+        COV_Changed_Overflow = false;
+        COV_Changed_Count = 0;
+        for (index = 0; index < COV_Subscriptions_Size; index++) {
+            if (COV_Subscriptions[index].flag.valid) {
+                cov_object_mark(COV_Subscriptions[index].
+                    monitoredObjectIdentifier.type,
+                    COV_Subscriptions[index].
+                    monitoredObjectIdentifier.instance);
+            }
+        }
+    }
+    while (COV_Changed_Count) {
+        object_id = &COV_Changed_Objects[COV_Changed_Head];
+        COV_Changed_Head = (COV_Changed_Head + 1) % MAX_COV_CHANGED_OBJECTS;
+        COV_Changed_Count--;
+        cov_object_mark(object_id->type, object_id->instance);
+    }
+    /* one round through the subscriptions that were queued */
+    count = COV_Send_Count;
+    while (count) {
+        cov_index = cov_send_queue_remove();
+        if (cov_subscription_send(cov_index)) {
+            cov_send_queue_add(cov_index);
+        }
+        count--;
+    }
+
+    return (COV_Send_Count == 0);
 }
 
 void handler_cov_task(
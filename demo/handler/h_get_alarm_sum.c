@@ -63,6 +63,9 @@ void handler_get_alarm_summary(
     int alarm_value = 0;
     unsigned i = 0;
     unsigned j = 0;
+    unsigned n = 0;
+    const unsigned *active = NULL;
+    int active_count = 0;
     bool error = false;
     BACNET_ADDRESS my_address;
     BACNET_NPDU_DATA npdu_data;
@@ -97,7 +100,18 @@ void handler_get_alarm_summary(
 
     for (i = 0; i < MAX_BACNET_OBJECT_TYPE; i++) {
         if (Get_Alarm_Summary[i]) {
-            for (j = 0; j < 0xffff; j++) {
+            /* alarms are among the objects with events */
+            active_count =
+                handler_event_summary_list((BACNET_OBJECT_TYPE) i, &active);
+            for (n = 0; n < 0xffff; n++) {
+                if (active_count >= 0) {
+                    if (n >= (unsigned) active_count) {
+                        break;
+                    }
+                    j = active[n];
+                } else {
+                    j = n;
+                }
                 alarm_value = Get_Alarm_Summary[i] (j, &getalarm_data);
                 if (alarm_value > 0) {
                     len =
@@ -25,6 +25,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include "config.h"
@@ -43,6 +44,18 @@
 
 static get_event_info_function Get_Event_Info[MAX_BACNET_OBJECT_TYPE];
 
+/* The objects of each type with an active event or unacknowledged
+   transitions, as sorted object indexes.  The objects keep it up to
+   date when their event state or acknowledgements change, so the
+   services visit only these.  Types that don't are scanned. */
+struct event_summary_list {
+    bool indexed;
+    unsigned count;
+    unsigned size;
+    unsigned *index;
+};
+static struct event_summary_list Event_Summary[MAX_BACNET_OBJECT_TYPE];
+
 
 /** print eventState
  */
@@ -77,6 +90,137 @@ void handler_get_event_information_set(
     }
 }
 
+/* returns the position of the object index, or where it would be added */
+static unsigned event_summary_search(
+    struct event_summary_list *list,
+    unsigned index,
+    bool * found)
+{
+    unsigned low = 0;
+    unsigned high = list->count;
+    unsigned mid;
+
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        if (list->index[mid] < index) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    *found = (low < list->count) && (list->index[low] == index);
+
+    return low;
+}
+
+static void event_summary_set(
+    struct event_summary_list *list,
+    unsigned index,
+    bool active)
+{
+    unsigned position;
+    unsigned size;
+    unsigned *grown;
+    bool found = false;
+
+    position = event_summary_search(list, index, &found);
+    if (found && !active) {
+        list->count--;
+        memmove(&list->index[position], &list->index[position + 1],
+            (list->count - position) * sizeof(list->index[0]));
+    } else if (!found && active) {
+        if (list->count >= list->size) {
+            size = list->size ? (list->size * 2) : 16;
+            grown = realloc(list->index, size * sizeof(list->index[0]));
+            if (!grown) {
+                /* out of memory: back to scanning the objects */
+                list->indexed = false;
+                return;
+            }
+            list->index = grown;
+            list->size = size;
+        }
+        memmove(&list->index[position + 1], &list->index[position],
+            (list->count - position) * sizeof(list->index[0]));
+        list->index[position] = index;
+        list->count++;
+    }
+}
+
+/** Rebuilds the event summary of an object type, and keeps it from now
+ * on, from handler_event_summary_update() calls.  Call it after the
+ * objects are created and their GetEventInformation function is set.
+ * @param object_type [in] The object type.
+ */
+void handler_event_summary_reset(
+    BACNET_OBJECT_TYPE object_type)
+{
+    BACNET_GET_EVENT_INFORMATION_DATA getevent_data;
+    struct event_summary_list *list;
+    unsigned j = 0;
+    int valid_event = 0;
+
+    if ((object_type >= MAX_BACNET_OBJECT_TYPE) ||
+        !Get_Event_Info[object_type]) {
+        return;
+    }
+    list = &Event_Summary[object_type];
+    list->count = 0;
+    list->indexed = true;
+    for (j = 0; j < 0xffff; j++) {
+        valid_event = Get_Event_Info[object_type] (j, &getevent_data);
+        if (valid_event < 0) {
+            break;
+        }
+        if (valid_event > 0) {
+            event_summary_set(list, j, true);
+        }
+    }
+}
+
+/** Adds an object to the event summary of its type, or removes it,
+ * after its event state or its acknowledged transitions changed.
+ * @param object_type [in] The object type.
+ * @param index [in] The index of the object, as for GetEventInformation.
+ */
+void handler_event_summary_update(
+    BACNET_OBJECT_TYPE object_type,
+    unsigned index)
+{
+    BACNET_GET_EVENT_INFORMATION_DATA getevent_data;
+    struct event_summary_list *list;
+
+    if ((object_type >= MAX_BACNET_OBJECT_TYPE) ||
+        !Get_Event_Info[object_type]) {
+        return;
+    }
+    list = &Event_Summary[object_type];
+    if (list->indexed) {
+        event_summary_set(list, index,
+            Get_Event_Info[object_type] (index, &getevent_data) > 0);
+    }
+}
+
+/** The objects of a type with an active event or unacknowledged
+ * transitions.  Alarms are a subset of them.
+ * @param object_type [in] The object type.
+ * @param index [out] The sorted object indexes.
+ * @return The number of objects, or -1 if the type is not indexed
+ *  and all of its objects have to be checked.
+ */
+int handler_event_summary_list(
+    BACNET_OBJECT_TYPE object_type,
+    const unsigned **index)
+{
+    if ((object_type >= MAX_BACNET_OBJECT_TYPE) ||
+        !Event_Summary[object_type].indexed) {
+        return -1;
+    }
+    *index = Event_Summary[object_type].index;
+
+    return (int) Event_Summary[object_type].count;
+}
+
 void handler_get_event_information(
     uint8_t * service_request,
     uint16_t service_len,
@@ -94,9 +238,11 @@ void handler_get_event_information(
     BACNET_ERROR_CODE error_code = ERROR_CODE_UNKNOWN_OBJECT;
     BACNET_ADDRESS my_address;
     BACNET_OBJECT_ID object_id;
-    unsigned i = 0, j = 0;      /* counter */
+    unsigned i = 0, j = 0, n = 0;       /* counter */
     BACNET_GET_EVENT_INFORMATION_DATA getevent_data;
     int valid_event = 0;
+    const unsigned *active = NULL;
+    int active_count = 0;
 
     /* initialize type of 'Last Received Object Identifier' using max value */
     object_id.type = MAX_BACNET_OBJECT_TYPE;
@@ -145,7 +291,18 @@ void handler_get_event_information(
     apdu_len = len;
     for (i = 0; i < MAX_BACNET_OBJECT_TYPE; i++) {
         if (Get_Event_Info[i]) {
-            for (j = 0; j < 0xffff; j++) {
+            active_count =
+                handler_event_summary_list((BACNET_OBJECT_TYPE) i, &active);
+            for (n = 0; n < 0xffff; n++) {
+                if (active_count >= 0) {
+                    /* only the objects with events */
+                    if (n >= (unsigned) active_count) {
+                        break;
+                    }
+                    j = active[n];
+                } else {
+                    j = n;
+                }
                 valid_event = Get_Event_Info[i] (j, &getevent_data);
                 if (valid_event > 0) {
                     /* encode GetEvent_data only when type of object_id has max value */
@@ -41,6 +41,7 @@
 /* device object has custom handler for all objects */
 #include "device.h"
 #include "handlers.h"
+#include "tsm.h"
 
 /** @file h_rp.c  Handles Read Property requests. */
 
@@ -51,10 +52,11 @@
  * by a call to apdu_set_confirmed_handler().
  * This handler builds a response packet, which is
  * - an Abort if
- *   - the message is segmented
+ *   - the message is segmented (when segmentation is not configured)
  *   - if decoding fails
  *   - if the response would be too large
- * - the result from Device_Read_Property(), if it succeeds
+ * - the result from Device_Read_Property(), if it succeeds, sent in
+ *   segments by the TSM when it doesn't fit in one APDU of the requester
  * - an Error if Device_Read_Property() fails
  *   or there isn't enough room in the APDU to fit the data.
  *
@@ -79,6 +81,8 @@ void handler_read_property(
     bool error = true;  /* assume that there is an error */
     int bytes_sent = 0;
     BACNET_ADDRESS my_address;
+    uint8_t *apdu = NULL;
+    int apdu_max = 0;
 
     /* configure default error code as an abort since it is common */
     rpdata.error_code = ERROR_CODE_ABORT_SEGMENTATION_NOT_SUPPORTED;
@@ -116,20 +120,47 @@ void handler_read_property(
         rpdata.object_instance = Device_Object_Instance_Number();
     }
 
+#if MAX_SEGMENTS_ACCEPTED
+    /* the ack may be sent in segments, so it is built apart from the NPDU */
+    apdu = &Handler_Segmented_Buffer[0];
+    /* leave room for the closing tag */
+    apdu_max = (int) tsm_segmented_complex_ack_max(service_data) - 1;
+#else
+    apdu = &Handler_Transmit_Buffer[npdu_len];
+    apdu_max = (int) sizeof(Handler_Transmit_Buffer) - npdu_len;
+#endif
     apdu_len =
-        rp_ack_encode_apdu_init(&Handler_Transmit_Buffer[npdu_len],
-        service_data->invoke_id, &rpdata);
+        rp_ack_encode_apdu_init(&apdu[0], service_data->invoke_id, &rpdata);
     /* configure our storage */
-    rpdata.application_data = &Handler_Transmit_Buffer[npdu_len + apdu_len];
-    rpdata.application_data_len =
-        sizeof(Handler_Transmit_Buffer) - (npdu_len + apdu_len);
+    rpdata.application_data = &apdu[apdu_len];
+    rpdata.application_data_len = apdu_max - apdu_len;
     len = Device_Read_Property(&rpdata);
     if (len >= 0) {
         apdu_len += len;
-        len =
-            rp_ack_encode_apdu_object_property_end(&Handler_Transmit_Buffer
-            [npdu_len + apdu_len]);
+        len = rp_ack_encode_apdu_object_property_end(&apdu[apdu_len]);
         apdu_len += len;
+#if MAX_SEGMENTS_ACCEPTED
+        if ((apdu_len > MAX_APDU) || (apdu_len > service_data->max_resp)) {
+            /* too big for one APDU of the sender - send it in segments */
+            if (tsm_segmented_complex_ack_send(src, &npdu_data, service_data,
+                    apdu, apdu_len, &rpdata.error_code)) {
+#if PRINT_ENABLED
+                fprintf(stderr, "RP: Sending Segmented Ack!\n");
+#endif
+                return;
+            }
+            len = BACNET_STATUS_ABORT;
+#if PRINT_ENABLED
+            fprintf(stderr, "RP: Message too large.\n");
+#endif
+        } else {
+            memcpy(&Handler_Transmit_Buffer[npdu_len], apdu, apdu_len);
+#if PRINT_ENABLED
+            fprintf(stderr, "RP: Sending Ack!\n");
+#endif
+            error = false;
+        }
+#else
         if (apdu_len > service_data->max_resp) {
             /* too big for the sender - send an abort
              * Setting of error code needed here as read property processing may
@@ -145,6 +176,7 @@ void handler_read_property(
 #endif
             error = false;
         }
+#endif
     } else {
 #if PRINT_ENABLED
         fprintf(stderr, "RP: Device_Read_Property: ");
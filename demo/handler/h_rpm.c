@@ -41,6 +41,7 @@
 #include "bacerror.h"
 #include "rpm.h"
 #include "handlers.h"
+#include "tsm.h"
 /* device object has custom handler for all objects */
 #include "device.h"
 
@@ -171,10 +172,11 @@ static int RPM_Encode_Property(
  * by a call to apdu_set_confirmed_handler().
  * This handler builds a response packet, which is
  * - an Abort if
- *   - the message is segmented
+ *   - the message is segmented (when segmentation is not configured)
  *   - if decoding fails
  *   - if the response would be too large
- * - the result from each included read request, if it succeeds
+ * - the result from each included read request, if it succeeds, sent in
+ *   segments by the TSM when it doesn't fit in one APDU of the requester
  * - an Error if processing fails for all, or individual errors if only some fail,
  *   or there isn't enough room in the APDU to fit the data.
  *
@@ -201,6 +203,8 @@ void handler_read_property_multiple(
     int apdu_len = 0;
     int npdu_len = 0;
     int error = 0;
+    uint8_t *apdu = NULL;
+    unsigned apdu_max = 0;
 
     /* jps_debug - see if we are utilizing all the buffer */
     /* memset(&Handler_Transmit_Buffer[0], 0xff, sizeof(Handler_Transmit_Buffer)); */
@@ -218,11 +222,18 @@ void handler_read_property_multiple(
 #endif
         goto RPM_FAILURE;
     }
+#if MAX_SEGMENTS_ACCEPTED
+    /* the ack may be sent in segments, so it is built apart from the NPDU */
+    apdu = &Handler_Segmented_Buffer[0];
+    apdu_max = tsm_segmented_complex_ack_max(service_data);
+#else
+    apdu = &Handler_Transmit_Buffer[npdu_len];
+    apdu_max = MAX_APDU;
+#endif
     /* decode apdu request & encode apdu reply
        encode complex ack, invoke id, service choice */
     apdu_len =
-        rpm_ack_encode_apdu_init(&Handler_Transmit_Buffer[npdu_len],
-        service_data->invoke_id);
+        rpm_ack_encode_apdu_init(&apdu[0], service_data->invoke_id);
     for (;;) {
         /* Start by looking for an object ID */
         len =
@@ -249,8 +260,7 @@ void handler_read_property_multiple(
         /* Stick this object id into the reply - if it will fit */
         len = rpm_ack_encode_apdu_object_begin(&Temp_Buf[0], &rpmdata);
         copy_len =
-            memcopy(&Handler_Transmit_Buffer[npdu_len], &Temp_Buf[0], apdu_len,
-            len, MAX_APDU);
+            memcopy(&apdu[0], &Temp_Buf[0], apdu_len, len, apdu_max);
         if (copy_len == 0) {
 #if PRINT_ENABLED
             fprintf(stderr, "RPM: Response too big!\r\n");
@@ -292,8 +302,8 @@ void handler_read_property_multiple(
                         rpm_ack_encode_apdu_object_property(&Temp_Buf[0],
                         rpmdata.object_property, rpmdata.array_index);
                     copy_len =
-                        memcopy(&Handler_Transmit_Buffer[npdu_len],
-                        &Temp_Buf[0], apdu_len, len, MAX_APDU);
+                        memcopy(&apdu[0], &Temp_Buf[0], apdu_len, len,
+                        apdu_max);
                     if (copy_len == 0) {
 #if PRINT_ENABLED
                         fprintf(stderr,
@@ -310,8 +320,8 @@ void handler_read_property_multiple(
                         ERROR_CLASS_PROPERTY,
                         ERROR_CODE_PROPERTY_IS_NOT_AN_ARRAY);
                     copy_len =
-                        memcopy(&Handler_Transmit_Buffer[npdu_len],
-                        &Temp_Buf[0], apdu_len, len, MAX_APDU);
+                        memcopy(&apdu[0], &Temp_Buf[0], apdu_len, len,
+                        apdu_max);
                     if (copy_len == 0) {
 #if PRINT_ENABLED
                         fprintf(stderr, "RPM: Too full to encode error!\r\n");
@@ -342,8 +352,8 @@ void handler_read_property_multiple(
                                 RPM_Object_Property(&property_list,
                                 special_object_property, index);
                             len =
-                                RPM_Encode_Property(&Handler_Transmit_Buffer
-                                [npdu_len], (uint16_t) apdu_len, MAX_APDU,
+                                RPM_Encode_Property(&apdu[0],
+                                (uint16_t) apdu_len, (uint16_t) apdu_max,
                                 &rpmdata);
                             if (len > 0) {
                                 apdu_len += len;
@@ -361,8 +371,8 @@ void handler_read_property_multiple(
             } else {
                 /* handle an individual property */
                 len =
-                    RPM_Encode_Property(&Handler_Transmit_Buffer[npdu_len],
-                    (uint16_t) apdu_len, MAX_APDU, &rpmdata);
+                    RPM_Encode_Property(&apdu[0],
+                    (uint16_t) apdu_len, (uint16_t) apdu_max, &rpmdata);
                 if (len > 0) {
                     apdu_len += len;
                 } else {
@@ -379,8 +389,8 @@ void handler_read_property_multiple(
                 decode_len++;
                 len = rpm_ack_encode_apdu_object_end(&Temp_Buf[0]);
                 copy_len =
-                    memcopy(&Handler_Transmit_Buffer[npdu_len], &Temp_Buf[0],
-                    apdu_len, len, MAX_APDU);
+                    memcopy(&apdu[0], &Temp_Buf[0], apdu_len, len,
+                    apdu_max);
                 if (copy_len == 0) {
 #if PRINT_ENABLED
                     fprintf(stderr, "RPM: Too full to encode object end!\r\n");
@@ -401,6 +411,24 @@ void handler_read_property_multiple(
         }
     }
 
+#if MAX_SEGMENTS_ACCEPTED
+    if ((apdu_len > MAX_APDU) || (apdu_len > service_data->max_resp)) {
+        /* too big for one APDU of the sender - send it in segments */
+        if (tsm_segmented_complex_ack_send(src, &npdu_data, service_data,
+                apdu, apdu_len, &rpmdata.error_code)) {
+#if PRINT_ENABLED
+            fprintf(stderr, "RPM: Sending Segmented Ack!\n");
+#endif
+            return;
+        }
+        error = BACNET_STATUS_ABORT;
+#if PRINT_ENABLED
+        fprintf(stderr, "RPM: Message too large.  Sending Abort!\n");
+#endif
+        goto RPM_FAILURE;
+    }
+    memcpy(&Handler_Transmit_Buffer[npdu_len], apdu, apdu_len);
+#else
     if (apdu_len > service_data->max_resp) {
         /* too big for the sender - send an abort */
         rpmdata.error_code = ERROR_CODE_ABORT_SEGMENTATION_NOT_SUPPORTED;
@@ -410,6 +438,7 @@ void handler_read_property_multiple(
 #endif
         goto RPM_FAILURE;
     }
+#endif
 
   RPM_FAILURE:
     if (error) {
@@ -38,6 +38,7 @@
 #include "readrange.h"
 #include "device.h"
 #include "handlers.h"
+#include "tsm.h"
 
 /** @file h_rr.c  Handles Read Range requests. */
 
@@ -145,9 +146,36 @@ void handler_read_range(
         data.application_data = &Temp_Buf[0];
         data.application_data_len = len;
         /* FIXME: probably need a length limitation sent with encode */
+#if MAX_SEGMENTS_ACCEPTED
+        /* the ack may be sent in segments, so it is built apart */
+        len =
+            rr_ack_encode_apdu(&Handler_Segmented_Buffer[0],
+            service_data->invoke_id, &data);
+        if ((len > MAX_APDU) || (len > service_data->max_resp)) {
+            /* too big for one APDU of the sender - send it in segments */
+            if (tsm_segmented_complex_ack_send(src, &npdu_data, service_data,
+                    &Handler_Segmented_Buffer[0], len, &data.error_code)) {
+#if PRINT_ENABLED
+                fprintf(stderr, "RR: Sending Segmented Ack!\n");
+#endif
+                return;
+            }
+            len =
+                abort_encode_apdu(&Handler_Transmit_Buffer[pdu_len],
+                service_data->invoke_id,
+                abort_convert_error_code(data.error_code), true);
+#if PRINT_ENABLED
+            fprintf(stderr, "RR: Reply too big.  Sending Abort!\n");
+#endif
+            goto RR_ABORT;
+        }
+        memcpy(&Handler_Transmit_Buffer[pdu_len],
+            &Handler_Segmented_Buffer[0], len);
+#else
         len =
             rr_ack_encode_apdu(&Handler_Transmit_Buffer[pdu_len],
             service_data->invoke_id, &data);
+#endif
 #if PRINT_ENABLED
         fprintf(stderr, "RR: Sending Ack!\n");
 #endif
@@ -45,6 +45,36 @@
 
 /** @file h_ucov.c  Handles Unconfirmed COV Notifications. */
 
+static cov_notification_function COV_Notification_Callback = NULL;
+
+/** Sets the function that is given the decoded COV notifications,
+ * both unconfirmed and confirmed, e.g. for COV trend logging.
+ * @ingroup DSCOV
+ *
+ * @param callback [in] The function, or NULL for none.
+ */
+void handler_cov_notification_set_callback(
+    cov_notification_function callback)
+{
+    COV_Notification_Callback = callback;
+}
+
+/** Passes a decoded COV notification to the function that was set
+ * with handler_cov_notification_set_callback(), if any.
+ * @ingroup DSCOV
+ *
+ * @param src [in] BACNET_ADDRESS of the device that sent it.
+ * @param cov_data [in] The decoded notification.
+ */
+void handler_cov_notification_callback(
+    BACNET_ADDRESS * src,
+    BACNET_COV_DATA * cov_data)
+{
+    if (COV_Notification_Callback) {
+        COV_Notification_Callback(src, cov_data);
+    }
+}
+
 /*  */
 /** Handler for an Unconfirmed COV Notification.
  * @ingroup DSCOV
@@ -55,7 +85,7 @@
  *
  * @param service_request [in] The contents of the service request.
  * @param service_len [in] The length of the service_request.
- * @param src [in] BACNET_ADDRESS of the source of the message (unused)
+ * @param src [in] BACNET_ADDRESS of the source of the message
  */
 void handler_ucov_notification(
     uint8_t * service_request,
@@ -68,8 +98,6 @@ void handler_ucov_notification(
     int len = 0;
     unsigned index = 0;
 
-    /* src not needed for this application */
-    unused_var(src);
     /* create linked list to store data if more
        than one property value is expected */
     pProperty_value = &property_value[0];
@@ -90,6 +118,9 @@ void handler_ucov_notification(
     len =
         cov_notify_decode_service_request(service_request, service_len,
         &cov_data);
+    if (len > 0) {
+        handler_cov_notification_callback(src, &cov_data);
+    }
 #if PRINT_ENABLED
     if (len > 0) {
         fprintf(stderr, "UCOV: PID=%u ", cov_data.subscriberProcessIdentifier);
@@ -109,17 +109,11 @@ int Send_UCOV_Notify(
     return bytes_sent;
 }
 
-/** Sends a COV Subscription request.
- * @ingroup DSCOV
- *
- * @param device_id [in] ID of the destination device
- * @param cov_data [in]  The COV subscription information to be encoded.
- * @return invoke id of outgoing message, or 0 if communication is disabled or
- *         no slot is available from the tsm for sending.
- */
-uint8_t Send_COV_Subscribe(
+/* sends a SubscribeCOV, or a SubscribeCOVProperty if property is set */
+static uint8_t cov_subscribe_send(
     uint32_t device_id,
-    BACNET_SUBSCRIBE_COV_DATA * cov_data)
+    BACNET_SUBSCRIBE_COV_DATA * cov_data,
+    bool property)
 {
     BACNET_ADDRESS dest;
     BACNET_ADDRESS my_address;
@@ -147,9 +141,16 @@ uint8_t Send_COV_Subscribe(
             npdu_encode_pdu(&Handler_Transmit_Buffer[0], &dest, &my_address,
             &npdu_data);
         /* encode the APDU portion of the packet */
-        len =
-            cov_subscribe_encode_apdu(&Handler_Transmit_Buffer[pdu_len],
-            sizeof(Handler_Transmit_Buffer)-pdu_len, invoke_id, cov_data);
+        if (property) {
+            len =
+                cov_subscribe_property_encode_apdu(&Handler_Transmit_Buffer
+                [pdu_len], sizeof(Handler_Transmit_Buffer) - pdu_len,
+                invoke_id, cov_data);
+        } else {
+            len =
+                cov_subscribe_encode_apdu(&Handler_Transmit_Buffer[pdu_len],
+                sizeof(Handler_Transmit_Buffer)-pdu_len, invoke_id, cov_data);
+        }
         pdu_len += len;
         /* will it fit in the sender?
            note: if there is a bottleneck router in between
@@ -181,3 +182,34 @@ uint8_t Send_COV_Subscribe(
 
     return invoke_id;
 }
+
+/** Sends a COV Subscription request.
+ * @ingroup DSCOV
+ *
+ * @param device_id [in] ID of the destination device
+ * @param cov_data [in]  The COV subscription information to be encoded.
+ * @return invoke id of outgoing message, or 0 if communication is disabled or
+ *         no slot is available from the tsm for sending.
+ */
+uint8_t Send_COV_Subscribe(
+    uint32_t device_id,
+    BACNET_SUBSCRIBE_COV_DATA * cov_data)
+{
+    return cov_subscribe_send(device_id, cov_data, false);
+}
+
+/** Sends a COV Property Subscription request, for the monitoredProperty
+ * and with the covIncrement of cov_data when covIncrementPresent is set.
+ * @ingroup DSCOV
+ *
+ * @param device_id [in] ID of the destination device
+ * @param cov_data [in]  The COV subscription information to be encoded.
+ * @return invoke id of outgoing message, or 0 if communication is disabled or
+ *         no slot is available from the tsm for sending.
+ */
+uint8_t Send_COV_Subscribe_Property(
+    uint32_t device_id,
+    BACNET_SUBSCRIBE_COV_DATA * cov_data)
+{
+    return cov_subscribe_send(device_id, cov_data, true);
+}
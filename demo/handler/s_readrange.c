@@ -46,43 +46,47 @@
 
 /** @file s_readrange.c  Send a ReadRange request. */
 
-/* returns invoke id of 0 if device is not bound or no tsm available */
-uint8_t Send_ReadRange_Request(
-    uint32_t device_id, /* destination device */
-    BACNET_READ_RANGE_DATA * read_access_data)
+/* sends the request with an invoke ID of the peer's own space,
+   or with one that is unique among all peers */
+static uint8_t read_range_request_send(
+    BACNET_ADDRESS * dest,
+    unsigned max_apdu,
+    BACNET_READ_RANGE_DATA * read_access_data,
+    bool peer)
 {
-    BACNET_ADDRESS dest;
     BACNET_ADDRESS my_address;
-    unsigned max_apdu = 0;
     uint8_t invoke_id = 0;
-    bool status = false;
     int len = 0;
     int pdu_len = 0;
     int bytes_sent = 0;
+    uint8_t *pdu = NULL;
     BACNET_NPDU_DATA npdu_data;
 
     if (!dcc_communication_enabled())
         return 0;
 
-    /* is the device bound? */
-    status = address_get_by_device(device_id, &max_apdu, &dest);
     /* is there a tsm available? */
-    if (status)
+    if (peer)
+        invoke_id = tsm_next_free_invokeID_peer(dest);
+    else
         invoke_id = tsm_next_free_invokeID();
 
     if (invoke_id) {
+        /* encode in the buffer that the TSM keeps for retries */
+        pdu = tsm_transaction_buffer(dest, invoke_id);
         /* encode the NPDU portion of the packet */
         datalink_get_my_address(&my_address);
         npdu_encode_npdu_data(&npdu_data, true, MESSAGE_PRIORITY_NORMAL);
         pdu_len =
-            npdu_encode_pdu(&Handler_Transmit_Buffer[0], &dest, &my_address,
+            npdu_encode_pdu(&pdu[0], dest, &my_address,
             &npdu_data);
 
         /* encode the APDU portion of the packet */
         len =
-            rr_encode_apdu(&Handler_Transmit_Buffer[pdu_len], invoke_id,
+            rr_encode_apdu(&pdu[pdu_len], invoke_id,
             read_access_data);
         if (len <= 0) {
+            tsm_free_invoke_id_peer(dest, invoke_id);
             return 0;
         }
 
@@ -93,18 +97,18 @@ uint8_t Send_ReadRange_Request(
            we have a way to check for that and update the
            max_apdu in the address binding table. */
         if ((unsigned) pdu_len < max_apdu) {
-            tsm_set_confirmed_unsegmented_transaction(invoke_id, &dest,
-                &npdu_data, &Handler_Transmit_Buffer[0], (uint16_t) pdu_len);
+            tsm_set_confirmed_unsegmented_transaction(invoke_id, dest,
+                &npdu_data, &pdu[0], (uint16_t) pdu_len);
             bytes_sent =
-                datalink_send_pdu(&dest, &npdu_data,
-                &Handler_Transmit_Buffer[0], pdu_len);
+                datalink_send_pdu(dest, &npdu_data,
+                &pdu[0], pdu_len);
 #if PRINT_ENABLED
             if (bytes_sent <= 0)
                 fprintf(stderr, "Failed to Send ReadRange Request (%s)!\n",
                     strerror(errno));
 #endif
         } else {
-            tsm_free_invoke_id(invoke_id);
+            tsm_free_invoke_id_peer(dest, invoke_id);
             invoke_id = 0;
 #if PRINT_ENABLED
             fprintf(stderr,
@@ -115,3 +119,34 @@ uint8_t Send_ReadRange_Request(
 
     return invoke_id;
 }
+
+/* returns invoke id of 0 if device is not bound or no tsm available */
+uint8_t Send_ReadRange_Request(
+    uint32_t device_id, /* destination device */
+    BACNET_READ_RANGE_DATA * read_access_data)
+{
+    BACNET_ADDRESS dest;
+    unsigned max_apdu = 0;
+    bool status = false;
+
+    /* is the device bound? */
+    status = address_get_by_device(device_id, &max_apdu, &dest);
+    if (!status)
+        return 0;
+
+    return read_range_request_send(&dest, max_apdu, read_access_data, false);
+}
+
+/* sends with an invoke ID of the peer's space, which is checked and freed
+   with the _peer functions of the TSM; returns invoke id of 0 if no tsm
+   is available or the window of the peer is full */
+uint8_t Send_ReadRange_Request_Peer(
+    BACNET_ADDRESS * dest,
+    uint16_t max_apdu,
+    BACNET_READ_RANGE_DATA * read_access_data)
+{
+    if (!dest)
+        return 0;
+
+    return read_range_request_send(dest, max_apdu, read_access_data, true);
+}
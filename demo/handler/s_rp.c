@@ -45,33 +45,23 @@
 
 /** @file s_rp.c  Send Read Property request. */
 
-/** Sends a Read Property request
- * @ingroup DSRP
- *
- * @param dest [in] BACNET_ADDRESS of the destination device
- * @param max_apdu [in]
- * @param object_type [in]  Type of the object whose property is to be read.
- * @param object_instance [in] Instance # of the object to be read.
- * @param object_property [in] Property to be read, but not ALL, REQUIRED, or OPTIONAL.
- * @param array_index [in] Optional: if the Property is an array,
- *   - 0 for the array size
- *   - 1 to n for individual array members
- *   - BACNET_ARRAY_ALL (~0) for the full array to be read.
- * @return invoke id of outgoing message, or 0 if device is not bound or no tsm available
- */
-uint8_t Send_Read_Property_Request_Address(
+/* sends the request with an invoke ID of the peer's own space,
+   or with one that is unique among all peers */
+static uint8_t read_property_request_send(
     BACNET_ADDRESS * dest,
     uint16_t max_apdu,
     BACNET_OBJECT_TYPE object_type,
     uint32_t object_instance,
     BACNET_PROPERTY_ID object_property,
-    uint32_t array_index)
+    uint32_t array_index,
+    bool peer)
 {
     BACNET_ADDRESS my_address;
     uint8_t invoke_id = 0;
     int len = 0;
     int pdu_len = 0;
     int bytes_sent = 0;
+    uint8_t *pdu = NULL;
     BACNET_READ_PROPERTY_DATA data;
     BACNET_NPDU_DATA npdu_data;
 
@@ -82,13 +72,19 @@ uint8_t Send_Read_Property_Request_Address(
         return 0;
     }
     /* is there a tsm available? */
-    invoke_id = tsm_next_free_invokeID();
+    if (peer) {
+        invoke_id = tsm_next_free_invokeID_peer(dest);
+    } else {
+        invoke_id = tsm_next_free_invokeID();
+    }
     if (invoke_id) {
+        /* encode in the buffer that the TSM keeps for retries */
+        pdu = tsm_transaction_buffer(dest, invoke_id);
         /* encode the NPDU portion of the packet */
         datalink_get_my_address(&my_address);
         npdu_encode_npdu_data(&npdu_data, true, MESSAGE_PRIORITY_NORMAL);
         pdu_len =
-            npdu_encode_pdu(&Handler_Transmit_Buffer[0], dest, &my_address,
+            npdu_encode_pdu(&pdu[0], dest, &my_address,
             &npdu_data);
         /* encode the APDU portion of the packet */
         data.object_type = object_type;
@@ -96,7 +92,7 @@ uint8_t Send_Read_Property_Request_Address(
         data.object_property = object_property;
         data.array_index = array_index;
         len =
-            rp_encode_apdu(&Handler_Transmit_Buffer[pdu_len], invoke_id,
+            rp_encode_apdu(&pdu[pdu_len], invoke_id,
             &data);
         pdu_len += len;
         /* will it fit in the sender?
@@ -106,10 +102,10 @@ uint8_t Send_Read_Property_Request_Address(
            max_apdu in the address binding table. */
         if ((uint16_t) pdu_len < max_apdu) {
             tsm_set_confirmed_unsegmented_transaction(invoke_id, dest,
-                &npdu_data, &Handler_Transmit_Buffer[0], (uint16_t) pdu_len);
+                &npdu_data, &pdu[0], (uint16_t) pdu_len);
             bytes_sent =
                 datalink_send_pdu(dest, &npdu_data,
-                &Handler_Transmit_Buffer[0], pdu_len);
+                &pdu[0], pdu_len);
             if (bytes_sent <= 0) {
 #if PRINT_ENABLED
                 fprintf(stderr, "Failed to Send ReadProperty Request (%s)!\n",
@@ -117,7 +113,7 @@ uint8_t Send_Read_Property_Request_Address(
 #endif
             }
         } else {
-            tsm_free_invoke_id(invoke_id);
+            tsm_free_invoke_id_peer(dest, invoke_id);
             invoke_id = 0;
 #if PRINT_ENABLED
             fprintf(stderr,
@@ -130,6 +126,62 @@ uint8_t Send_Read_Property_Request_Address(
     return invoke_id;
 }
 
+/** Sends a Read Property request
+ * @ingroup DSRP
+ *
+ * @param dest [in] BACNET_ADDRESS of the destination device
+ * @param max_apdu [in]
+ * @param object_type [in]  Type of the object whose property is to be read.
+ * @param object_instance [in] Instance # of the object to be read.
+ * @param object_property [in] Property to be read, but not ALL, REQUIRED, or OPTIONAL.
+ * @param array_index [in] Optional: if the Property is an array,
+ *   - 0 for the array size
+ *   - 1 to n for individual array members
+ *   - BACNET_ARRAY_ALL (~0) for the full array to be read.
+ * @return invoke id of outgoing message, or 0 if device is not bound or no tsm available
+ */
+uint8_t Send_Read_Property_Request_Address(
+    BACNET_ADDRESS * dest,
+    uint16_t max_apdu,
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance,
+    BACNET_PROPERTY_ID object_property,
+    uint32_t array_index)
+{
+    return read_property_request_send(dest, max_apdu, object_type,
+        object_instance, object_property, array_index, false);
+}
+
+/** Sends a Read Property request with an invoke ID of the peer's own
+ * space, from tsm_next_free_invokeID_peer(), so that many requests
+ * to many devices can be outstanding.  Check and free it with the
+ * _peer functions of the TSM, e.g. tsm_invoke_id_free_peer().
+ * @ingroup DSRP
+ *
+ * @param dest [in] BACNET_ADDRESS of the destination device
+ * @param max_apdu [in]
+ * @param object_type [in]  Type of the object whose property is to be read.
+ * @param object_instance [in] Instance # of the object to be read.
+ * @param object_property [in] Property to be read, but not ALL, REQUIRED, or OPTIONAL.
+ * @param array_index [in] Optional: if the Property is an array,
+ *   - 0 for the array size
+ *   - 1 to n for individual array members
+ *   - BACNET_ARRAY_ALL (~0) for the full array to be read.
+ * @return invoke id of outgoing message, or 0 if no tsm is available
+ *  or the window of the peer is full
+ */
+uint8_t Send_Read_Property_Request_Peer(
+    BACNET_ADDRESS * dest,
+    uint16_t max_apdu,
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance,
+    BACNET_PROPERTY_ID object_property,
+    uint32_t array_index)
+{
+    return read_property_request_send(dest, max_apdu, object_type,
+        object_instance, object_property, array_index, true);
+}
+
 /** Sends a Read Property request.
  * @ingroup DSRP
  *
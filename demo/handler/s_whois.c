@@ -195,3 +195,223 @@ void Send_WhoIs(
 {
     Send_WhoIs_Global(low_limit, high_limit);
 }
+
+/* Who-Is discovery scheduler.
+   Instead of one Who-Is per unknown device, the device ids are queued
+   and sent as merged ranges, at a limited rate, from the timer. */
+
+/* pending and recently sent device ids */
+#ifndef WHOIS_DISCOVER_MAX
+#define WHOIS_DISCOVER_MAX 256
+#endif
+/* unrequested device ids that may be included to merge two ranges */
+#ifndef WHOIS_DISCOVER_GAP
+#define WHOIS_DISCOVER_GAP 4
+#endif
+/* widest range, which bounds the burst of I-Am replies */
+#ifndef WHOIS_DISCOVER_SPAN
+#define WHOIS_DISCOVER_SPAN 64
+#endif
+/* time before a sent device id may be requested again */
+#ifndef WHOIS_DISCOVER_HOLDOFF_MS
+#define WHOIS_DISCOVER_HOLDOFF_MS 30000UL
+#endif
+/* time between Who-Is broadcasts, and the burst after a quiet period */
+#ifndef WHOIS_DISCOVER_INTERVAL_MS
+#if defined(BACDL_BIP) || defined(BACDL_BIP6) || defined(BACDL_ETHERNET)
+#define WHOIS_DISCOVER_INTERVAL_MS 100UL
+#else
+/* MS/TP and ARCNET trunks are slow, and broadcasts hold the token */
+#define WHOIS_DISCOVER_INTERVAL_MS 1000UL
+#endif
+#endif
+#ifndef WHOIS_DISCOVER_BURST
+#define WHOIS_DISCOVER_BURST 2
+#endif
+
+struct WhoIs_Discover_Entry {
+    uint32_t device_id;
+    /* zero while pending, else the time left before a new request */
+    uint32_t holdoff;
+};
+
+/* sorted by device id */
+static struct WhoIs_Discover_Entry WhoIs_Discover_List[WHOIS_DISCOVER_MAX];
+static unsigned WhoIs_Discover_Count;
+static uint32_t WhoIs_Discover_Credit =
+    WHOIS_DISCOVER_BURST * WHOIS_DISCOVER_INTERVAL_MS;
+static WHOIS_DISCOVER_STATS WhoIs_Discover_Stats;
+
+/* returns the index of the device id, or where it would be inserted */
+static unsigned whois_discover_search(
+    uint32_t device_id,
+    bool * found)
+{
+    unsigned low = 0;
+    unsigned high = WhoIs_Discover_Count;
+    unsigned mid;
+
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        if (WhoIs_Discover_List[mid].device_id < device_id) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    *found = (low < WhoIs_Discover_Count) &&
+        (WhoIs_Discover_List[low].device_id == device_id);
+
+    return low;
+}
+
+static bool whois_discover_bound(
+    uint32_t device_id)
+{
+    BACNET_ADDRESS src;
+    unsigned max_apdu = 0;
+
+    return address_get_by_device(device_id, &max_apdu, &src);
+}
+
+/** Queue a Who-Is for a device whose address is unknown.
+ * Requests for a device that is bound, pending, or that was asked for
+ * within the hold-off time are merged with the earlier one.
+ * @ingroup DMDDB
+ * @param device_id [in] Device Instance, 0 - 4,194,303
+ * @return true if the device is bound or a Who-Is is, or will be, sent
+ */
+bool Send_WhoIs_Discover(
+    uint32_t device_id)
+{
+    unsigned index;
+    bool found = false;
+
+    if (device_id >= BACNET_MAX_INSTANCE) {
+        return false;
+    }
+    WhoIs_Discover_Stats.requested++;
+    index = whois_discover_search(device_id, &found);
+    if (found || whois_discover_bound(device_id)) {
+        WhoIs_Discover_Stats.deduplicated++;
+        return true;
+    }
+    if (WhoIs_Discover_Count >= WHOIS_DISCOVER_MAX) {
+        WhoIs_Discover_Stats.dropped++;
+        return false;
+    }
+    memmove(&WhoIs_Discover_List[index + 1], &WhoIs_Discover_List[index],
+        (WhoIs_Discover_Count - index) * sizeof(WhoIs_Discover_List[0]));
+    WhoIs_Discover_List[index].device_id = device_id;
+    WhoIs_Discover_List[index].holdoff = 0;
+    WhoIs_Discover_Count++;
+
+    return true;
+}
+
+/* sends one Who-Is for the first pending device id and its neighbours */
+static bool whois_discover_send(
+    void)
+{
+    struct WhoIs_Discover_Entry *entry;
+    unsigned first, last, i;
+    uint32_t low, high;
+
+    for (first = 0; first < WhoIs_Discover_Count; first++) {
+        if (WhoIs_Discover_List[first].holdoff == 0) {
+            break;
+        }
+    }
+    if (first >= WhoIs_Discover_Count) {
+        return false;
+    }
+    low = high = WhoIs_Discover_List[first].device_id;
+    last = first;
+    for (i = first + 1; i < WhoIs_Discover_Count; i++) {
+        entry = &WhoIs_Discover_List[i];
+        if ((entry->device_id - low) >= WHOIS_DISCOVER_SPAN) {
+            break;
+        }
+        if (entry->holdoff == 0) {
+            if ((entry->device_id - high) > (WHOIS_DISCOVER_GAP + 1)) {
+                break;
+            }
+            high = entry->device_id;
+            last = i;
+        }
+    }
+    for (i = first; i <= last; i++) {
+        entry = &WhoIs_Discover_List[i];
+        if (entry->holdoff == 0) {
+            if (i != first) {
+                WhoIs_Discover_Stats.ranges_merged++;
+            }
+            entry->holdoff = WHOIS_DISCOVER_HOLDOFF_MS;
+        }
+    }
+    Send_WhoIs_Global((int32_t) low, (int32_t) high);
+    WhoIs_Discover_Stats.broadcasts++;
+
+    return true;
+}
+
+/** Sends the queued Who-Is requests, no more often than one every
+ * WHOIS_DISCOVER_INTERVAL_MS on average, and forgets the devices that
+ * were bound.  Call it periodically, e.g. every second, with the elapsed
+ * time; a call every WHOIS_DISCOVER_INTERVAL_MS spreads them evenly.
+ * @ingroup DMDDB
+ * @param milliseconds [in] time since the last call
+ */
+void Send_WhoIs_Discover_Timer(
+    uint32_t milliseconds)
+{
+    struct WhoIs_Discover_Entry *entry;
+    unsigned i, count = 0;
+    uint32_t limit = WHOIS_DISCOVER_BURST * WHOIS_DISCOVER_INTERVAL_MS;
+
+    /* drop the bound devices and the expired hold-offs */
+    for (i = 0; i < WhoIs_Discover_Count; i++) {
+        entry = &WhoIs_Discover_List[i];
+        if (entry->holdoff) {
+            if (entry->holdoff <= milliseconds) {
+                continue;
+            }
+            entry->holdoff -= milliseconds;
+        }
+        if (whois_discover_bound(entry->device_id)) {
+            continue;
+        }
+        WhoIs_Discover_List[count++] = *entry;
+    }
+    WhoIs_Discover_Count = count;
+    /* a caller with a longer period gets the credit of its period,
+       else it would send only a burst per call */
+    if (milliseconds > limit) {
+        limit = milliseconds;
+    }
+    WhoIs_Discover_Credit += milliseconds;
+    if (WhoIs_Discover_Credit > limit) {
+        WhoIs_Discover_Credit = limit;
+    }
+    if (!dcc_communication_enabled()) {
+        return;
+    }
+    while (WhoIs_Discover_Credit >= WHOIS_DISCOVER_INTERVAL_MS) {
+        if (!whois_discover_send()) {
+            break;
+        }
+        WhoIs_Discover_Credit -= WHOIS_DISCOVER_INTERVAL_MS;
+    }
+}
+
+/** Copies the Who-Is discovery counters.
+ * @param stats [out] the counters since start-up
+ */
+void Send_WhoIs_Discover_Stats(
+    WHOIS_DISCOVER_STATS * stats)
+{
+    if (stats) {
+        *stats = WhoIs_Discover_Stats;
+        stats->outstanding = WhoIs_Discover_Count;
+    }
+}
@@ -45,42 +45,45 @@
 
 /** @file s_wp.c  Send a Write Property request. */
 
-/** returns the invoke ID for confirmed request, or zero on failure */
-uint8_t Send_Write_Property_Request_Data(
-    uint32_t device_id,
+/* sends the request with an invoke ID of the peer's own space,
+   or with one that is unique among all peers */
+static uint8_t write_property_request_send(
+    BACNET_ADDRESS * dest,
+    unsigned max_apdu,
     BACNET_OBJECT_TYPE object_type,
     uint32_t object_instance,
     BACNET_PROPERTY_ID object_property,
     uint8_t * application_data,
     int application_data_len,
     uint8_t priority,
-    uint32_t array_index)
+    uint32_t array_index,
+    bool peer)
 {
-    BACNET_ADDRESS dest;
     BACNET_ADDRESS my_address;
-    unsigned max_apdu = 0;
     uint8_t invoke_id = 0;
-    bool status = false;
     int len = 0;
     int pdu_len = 0;
     int bytes_sent = 0;
+    uint8_t *pdu = NULL;
     BACNET_WRITE_PROPERTY_DATA data;
     BACNET_NPDU_DATA npdu_data;
 
     if (!dcc_communication_enabled())
         return 0;
 
-    /* is the device bound? */
-    status = address_get_by_device(device_id, &max_apdu, &dest);
     /* is there a tsm available? */
-    if (status)
+    if (peer)
+        invoke_id = tsm_next_free_invokeID_peer(dest);
+    else
         invoke_id = tsm_next_free_invokeID();
     if (invoke_id) {
+        /* encode in the buffer that the TSM keeps for retries */
+        pdu = tsm_transaction_buffer(dest, invoke_id);
         /* encode the NPDU portion of the packet */
         datalink_get_my_address(&my_address);
         npdu_encode_npdu_data(&npdu_data, true, MESSAGE_PRIORITY_NORMAL);
         pdu_len =
-            npdu_encode_pdu(&Handler_Transmit_Buffer[0], &dest, &my_address,
+            npdu_encode_pdu(&pdu[0], dest, &my_address,
             &npdu_data);
         /* encode the APDU portion of the packet */
         data.object_type = object_type;
@@ -92,7 +95,7 @@ uint8_t Send_Write_Property_Request_Data(
             application_data_len);
         data.priority = priority;
         len =
-            wp_encode_apdu(&Handler_Transmit_Buffer[pdu_len], invoke_id,
+            wp_encode_apdu(&pdu[pdu_len], invoke_id,
             &data);
         pdu_len += len;
         /* will it fit in the sender?
@@ -101,18 +104,18 @@ uint8_t Send_Write_Property_Request_Data(
            we have a way to check for that and update the
            max_apdu in the address binding table. */
         if ((unsigned) pdu_len < max_apdu) {
-            tsm_set_confirmed_unsegmented_transaction(invoke_id, &dest,
-                &npdu_data, &Handler_Transmit_Buffer[0], (uint16_t) pdu_len);
+            tsm_set_confirmed_unsegmented_transaction(invoke_id, dest,
+                &npdu_data, &pdu[0], (uint16_t) pdu_len);
             bytes_sent =
-                datalink_send_pdu(&dest, &npdu_data,
-                &Handler_Transmit_Buffer[0], pdu_len);
+                datalink_send_pdu(dest, &npdu_data,
+                &pdu[0], pdu_len);
 #if PRINT_ENABLED
             if (bytes_sent <= 0)
                 fprintf(stderr, "Failed to Send WriteProperty Request (%s)!\n",
                     strerror(errno));
 #endif
         } else {
-            tsm_free_invoke_id(invoke_id);
+            tsm_free_invoke_id_peer(dest, invoke_id);
             invoke_id = 0;
 #if PRINT_ENABLED
             fprintf(stderr,
@@ -125,6 +128,58 @@ uint8_t Send_Write_Property_Request_Data(
     return invoke_id;
 }
 
+/* encodes the values to write, returns their length or -1 if too long */
+static int write_property_values_encode(
+    uint8_t * application_data,
+    BACNET_APPLICATION_DATA_VALUE * object_value)
+{
+    int apdu_len = 0, len = 0;
+
+    while (object_value) {
+#if PRINT_ENABLED_DEBUG
+        fprintf(stderr, "WriteProperty service: " "%s tag=%d\n",
+            (object_value->context_specific ? "context" : "application"),
+            (int) (object_value->
+                context_specific ? object_value->context_tag : object_value->
+                tag));
+#endif
+        len = bacapp_encode_data(&application_data[apdu_len], object_value);
+        if ((len + apdu_len) < MAX_APDU) {
+            apdu_len += len;
+        } else {
+            return -1;
+        }
+        object_value = object_value->next;
+    }
+
+    return apdu_len;
+}
+
+/** returns the invoke ID for confirmed request, or zero on failure */
+uint8_t Send_Write_Property_Request_Data(
+    uint32_t device_id,
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance,
+    BACNET_PROPERTY_ID object_property,
+    uint8_t * application_data,
+    int application_data_len,
+    uint8_t priority,
+    uint32_t array_index)
+{
+    BACNET_ADDRESS dest;
+    unsigned max_apdu = 0;
+    bool status = false;
+
+    /* is the device bound? */
+    status = address_get_by_device(device_id, &max_apdu, &dest);
+    if (!status)
+        return 0;
+
+    return write_property_request_send(&dest, max_apdu, object_type,
+        object_instance, object_property, application_data,
+        application_data_len, priority, array_index, false);
+}
+
 
 /** Sends a Write Property request.
  * @ingroup DSWP
@@ -151,26 +206,60 @@ uint8_t Send_Write_Property_Request(
     uint32_t array_index)
 {
     uint8_t application_data[MAX_APDU] = { 0 };
-    int apdu_len = 0, len = 0;
+    int apdu_len = 0;
 
-    while (object_value) {
-#if PRINT_ENABLED_DEBUG
-        fprintf(stderr, "WriteProperty service: " "%s tag=%d\n",
-            (object_value->context_specific ? "context" : "application"),
-            (int) (object_value->
-                context_specific ? object_value->context_tag : object_value->
-                tag));
-#endif
-        len = bacapp_encode_data(&application_data[apdu_len], object_value);
-        if ((len + apdu_len) < MAX_APDU) {
-            apdu_len += len;
-        } else {
-            return 0;
-        }
-        object_value = object_value->next;
+    apdu_len = write_property_values_encode(&application_data[0],
+        object_value);
+    if (apdu_len < 0) {
+        return 0;
     }
 
     return Send_Write_Property_Request_Data(device_id, object_type,
         object_instance, object_property, &application_data[0], apdu_len,
         priority, array_index);
 }
+
+/** Sends a Write Property request with an invoke ID of the peer's own
+ * space, from tsm_next_free_invokeID_peer().  Check and free it with
+ * the _peer functions of the TSM, e.g. tsm_invoke_id_free_peer().
+ * @ingroup DSWP
+ *
+ * @param dest [in] BACNET_ADDRESS of the destination device
+ * @param max_apdu [in] The largest APDU that the device accepts.
+ * @param object_type [in]  Type of the object whose property is to be written.
+ * @param object_instance [in] Instance # of the object to be written.
+ * @param object_property [in] Property to be written.
+ * @param object_value [in] The value to be written to the property.
+ * @param priority [in] Write priority of 1 (highest) to 16 (lowest)
+ * @param array_index [in] Optional: if the Property is an array,
+ *   - 0 for the array size
+ *   - 1 to n for individual array members
+ *   - BACNET_ARRAY_ALL (~0) for the array value to be ignored (not sent)
+ * @return invoke id of outgoing message, or 0 on failure.
+ */
+uint8_t Send_Write_Property_Request_Peer(
+    BACNET_ADDRESS * dest,
+    uint16_t max_apdu,
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance,
+    BACNET_PROPERTY_ID object_property,
+    BACNET_APPLICATION_DATA_VALUE * object_value,
+    uint8_t priority,
+    uint32_t array_index)
+{
+    uint8_t application_data[MAX_APDU] = { 0 };
+    int apdu_len = 0;
+
+    if (!dest) {
+        return 0;
+    }
+    apdu_len = write_property_values_encode(&application_data[0],
+        object_value);
+    if (apdu_len < 0) {
+        return 0;
+    }
+
+    return write_property_request_send(dest, max_apdu, object_type,
+        object_instance, object_property, &application_data[0], apdu_len,
+        priority, array_index, true);
+}
@@ -30,3 +30,7 @@
 /** @file txbuf.c  Declare the global Transmit Buffer for handler functions. */
 
 uint8_t Handler_Transmit_Buffer[MAX_PDU] = { 0 };
+#if MAX_SEGMENTS_ACCEPTED
+/* a ComplexACK too large for one APDU, before the TSM segments it */
+uint8_t Handler_Segmented_Buffer[MAX_APDU_SEGMENTED] = { 0 };
+#endif
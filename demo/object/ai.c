@@ -45,6 +45,7 @@
 #include "timestamp.h"
 #include "ai.h"
 #include "ucix.h"
+#include "keylist.h"
 
 #ifndef MAX_ANALOG_INPUTS
 #define MAX_ANALOG_INPUTS 1024
@@ -62,6 +63,9 @@ unsigned max_analog_inputs_int = 0;
 
 ANALOG_INPUT_DESCR AI_Descr[MAX_ANALOG_INPUTS];
 
+/* sorted Instance to AI_Descr[] slot lookup, rebuilt by Analog_Input_Init */
+static OS_Keylist AI_Instance_List = NULL;
+
 /* These three arrays are used by the ReadPropertyMultiple handler */
 static const int Analog_Input_Properties_Required[] = {
     PROP_OBJECT_IDENTIFIER,
@@ -139,6 +143,25 @@ void Analog_Input_Load_UCI_List(const char *sec_idx,
 }
 
 
+/* (re)build the Instance lookup from the configured AI_Descr[] slots */
+static void Analog_Input_Instance_List_Init(
+    void)
+{
+    unsigned i;
+
+    if (AI_Instance_List) {
+        Keylist_Delete(AI_Instance_List);
+    }
+    AI_Instance_List = Keylist_Create();
+    for (i = 0; i < max_analog_inputs_int; i++) {
+        /* keep the first slot of a duplicated instance, like a scan would */
+        if (!Keylist_Data(AI_Instance_List, AI_Descr[i].Instance)) {
+            Keylist_Data_Add(AI_Instance_List, AI_Descr[i].Instance,
+                &AI_Descr[i]);
+        }
+    }
+}
+
 void Analog_Input_Init(
     void)
 {
@@ -423,6 +446,10 @@ void Analog_Input_Init(
                 max_analog_inputs_int = i;
             }
         }
+        Analog_Input_Instance_List_Init();
+#if defined(INTRINSIC_REPORTING)
+        handler_event_summary_reset(OBJECT_ANALOG_INPUT);
+#endif
 #if PRINT_ENABLED
         fprintf(stderr, "max_analog_inputs %i\n", max_analog_inputs_int);
 #endif
@@ -432,23 +459,18 @@ void Analog_Input_Init(
     return;
 }
 
-/* we simply have 0-n object instances.  Yours might be */
-/* more complex, and then you need to return the index */
-/* that correlates to the correct instance number */
+/* Instances come from the uci section names and may be sparse, */
+/* so the slot is found with a binary search of the sorted list */
 unsigned Analog_Input_Instance_To_Index(
     uint32_t object_instance)
 {
     ANALOG_INPUT_DESCR *CurrentAI;
-    int index,i;
-    //int instance;
-    index = max_analog_inputs_int;
-    for (i = 0; i < index; i++) {
-    	CurrentAI = &AI_Descr[i];
-    	//instance = CurrentAI->Instance;
-    	if (CurrentAI->Instance == object_instance) {
-    		return i;
-    	}
+
+    CurrentAI = Keylist_Data(AI_Instance_List, object_instance);
+    if (CurrentAI) {
+        return (unsigned) (CurrentAI - &AI_Descr[0]);
     }
+
     return MAX_ANALOG_INPUTS;
 }
 
@@ -516,6 +538,7 @@ static void Analog_Input_COV_Detect(uint32_t object_instance,
         }
         if (cov_delta >= cov_increment) {
             CurrentAI->Changed = true;
+            handler_cov_object_changed(OBJECT_ANALOG_INPUT, object_instance);
             CurrentAI->Prior_Value = value;
         }
     }
@@ -708,6 +731,10 @@ bool Analog_Input_Present_Value_Set(
                 CurrentAI->Priority_Array[15] = value;
             }
             Analog_Input_COV_Detect(object_instance, Analog_Input_Present_Value(object_instance));
+#if defined(INTRINSIC_REPORTING)
+            Device_Intrinsic_Reporting_Request(OBJECT_ANALOG_INPUT,
+                object_instance);
+#endif
             status = true;
         }
     }
@@ -741,7 +768,12 @@ void Analog_Input_Out_Of_Service_Set(
     if (Analog_Input_Valid_Instance(object_instance)) {
         index = Analog_Input_Instance_To_Index(object_instance);
         CurrentAI = &AI_Descr[index];
-        CurrentAI->Out_Of_Service = value;
+        if (CurrentAI->Out_Of_Service != value) {
+            CurrentAI->Out_Of_Service = value;
+            /* Status_Flags changed */
+            CurrentAI->Changed = true;
+            handler_cov_object_changed(OBJECT_ANALOG_INPUT, object_instance);
+        }
     }
 }
 
@@ -852,16 +884,8 @@ static bool Analog_Input_Description_Write(
                 } else {
                     sprintf(idx_cc,"%d",CurrentAI->Instance);
                     idx_c = idx_cc;
-                    if(ctx) {
-                        ucix_add_option(ctx, "bacnet_ai", idx_c,
-                            "description", char_string->value);
-                        ucix_commit(ctx, "bacnet_ai");
-#if PRINT_ENABLED
-                    } else {
-                        fprintf(stderr,
-                            "Failed to open config file bacnet_ai\n");
-#endif
-                    }
+                    ucix_journal_add("bacnet_ai", idx_c,
+                        "description", CurrentAI->Object_Description, true);
                 }
             } else {
                 *error_class = ERROR_CLASS_PROPERTY;
@@ -922,18 +946,12 @@ static bool Analog_Input_Object_Name_Write(
                     *error_class = ERROR_CLASS_PROPERTY;
                     *error_code = ERROR_CODE_VALUE_OUT_OF_RANGE;
                 } else {
+                    Device_Object_Name_Changed(OBJECT_ANALOG_INPUT,
+                        object_instance);
                     sprintf(idx_cc,"%d",CurrentAI->Instance);
                     idx_c = idx_cc;
-                    if(ctx) {
-                        ucix_add_option(ctx, "bacnet_ai", idx_c,
-                            "name", char_string->value);
-                        ucix_commit(ctx, "bacnet_ai");
-#if PRINT_ENABLED
-                    } else {
-                        fprintf(stderr,
-                            "Failed to open config file bacnet_ai\n");
-#endif
-                    }
+                    ucix_journal_add("bacnet_ai", idx_c,
+                        "name", CurrentAI->Object_Name, true);
                 }
             } else {
                 *error_class = ERROR_CLASS_PROPERTY;
@@ -1271,7 +1289,6 @@ bool Analog_Input_Write_Property(
     uint8_t level = ANALOG_LEVEL_NULL;
     int len = 0;
     BACNET_APPLICATION_DATA_VALUE value;
-    ctx = ucix_init("bacnet_ai");
     const char *idx_c;
     char cur_value[16];
     float pvalue;
@@ -1355,14 +1372,13 @@ bool Analog_Input_Write_Property(
                         value.type.Real, wp_data->priority)) {
                     status = true;
                     sprintf(cur_value,"%f",value.type.Real);
-                    ucix_add_option(ctx, "bacnet_ai", idx_c, "value",
-                        cur_value);
+                    ucix_journal_add("bacnet_ai", idx_c, "value",
+                        cur_value, false);
                     cur_value_time = time(NULL);
-                    ucix_add_option_int(ctx, "bacnet_ai", idx_c, "value_time",
-                        cur_value_time);
-                    ucix_add_option_int(ctx, "bacnet_ai", idx_c, "write",
-                        1);
-                    ucix_save_state(ctx, "bacnet_ai");
+                    ucix_journal_add_int("bacnet_ai", idx_c, "value_time",
+                        cur_value_time, false);
+                    ucix_journal_add_int("bacnet_ai", idx_c, "write",
+                        1, false);
                 } else if (wp_data->priority == 6) {
                     /* Command priority 6 is reserved for use by Minimum On/Off
                        algorithm and may not be used for other purposes in any
@@ -1397,14 +1413,13 @@ bool Analog_Input_Write_Property(
                             }
                         }
                         sprintf(cur_value,"%f",pvalue);
-                        ucix_add_option(ctx, "bacnet_ai", idx_c, "value",
-                            cur_value);
+                        ucix_journal_add("bacnet_ai", idx_c, "value",
+                            cur_value, false);
                         cur_value_time = time(NULL);
-                        ucix_add_option_int(ctx, "bacnet_ai", idx_c, "value_time",
-                            cur_value_time);
-                        ucix_add_option_int(ctx, "bacnet_ai", idx_c, "write",
-                            1);
-                        ucix_save_state(ctx, "bacnet_ai");
+                        ucix_journal_add_int("bacnet_ai", idx_c, "value_time",
+                            cur_value_time, false);
+                        ucix_journal_add_int("bacnet_ai", idx_c, "write",
+                            1, false);
                     } else {
                         status = false;
                         wp_data->error_class = ERROR_CLASS_PROPERTY;
@@ -1419,7 +1434,8 @@ bool Analog_Input_Write_Property(
                 WPValidateArgType(&value, BACNET_APPLICATION_TAG_BOOLEAN,
                 &wp_data->error_class, &wp_data->error_code);
             if (status) {
-                CurrentAI->Out_Of_Service = value.type.Boolean;
+                Analog_Input_Out_Of_Service_Set(wp_data->object_instance,
+                    value.type.Boolean);
             }
             break;
 
@@ -1474,9 +1490,8 @@ bool Analog_Input_Write_Property(
 
             if (status) {
                 CurrentAI->Max_Pres_Value = value.type.Real;
-                ucix_add_option_int(ctx, "bacnet_ai", idx_c, "max_value",
-                        value.type.Real);
-                ucix_commit(ctx, "bacnet_ai");
+                ucix_journal_add_int("bacnet_ai", idx_c, "max_value",
+                        value.type.Real, true);
             }
             break;
 
@@ -1487,9 +1502,8 @@ bool Analog_Input_Write_Property(
 
             if (status) {
                 CurrentAI->Min_Pres_Value = value.type.Real;
-                ucix_add_option_int(ctx, "bacnet_ai", idx_c, "min_value",
-                        value.type.Real);
-                ucix_commit(ctx, "bacnet_ai");
+                ucix_journal_add_int("bacnet_ai", idx_c, "min_value",
+                        value.type.Real, true);
             }
             break;
 
@@ -1502,9 +1516,8 @@ bool Analog_Input_Write_Property(
             if (status) {
                 CurrentAI->Time_Delay = value.type.Unsigned_Int;
                 CurrentAI->Remaining_Time_Delay = CurrentAI->Time_Delay;
-                ucix_add_option_int(ctx, "bacnet_ai", idx_c, "time_delay",
-                    value.type.Unsigned_Int);
-                ucix_commit(ctx, "bacnet_ai");
+                ucix_journal_add_int("bacnet_ai", idx_c, "time_delay",
+                    value.type.Unsigned_Int, true);
             }
             break;
 
@@ -1515,9 +1528,8 @@ bool Analog_Input_Write_Property(
 
             if (status) {
                 CurrentAI->Notification_Class = value.type.Unsigned_Int;
-                ucix_add_option_int(ctx, "bacnet_ai", idx_c, "nc",
-                    value.type.Unsigned_Int);
-                ucix_commit(ctx, "bacnet_ai");
+                ucix_journal_add_int("bacnet_ai", idx_c, "nc",
+                    value.type.Unsigned_Int, true);
             }
             break;
 
@@ -1528,9 +1540,8 @@ bool Analog_Input_Write_Property(
 
             if (status) {
                 CurrentAI->High_Limit = value.type.Real;
-                ucix_add_option_int(ctx, "bacnet_ai", idx_c, "high_limit",
-                        value.type.Real);
-                ucix_commit(ctx, "bacnet_ai");
+                ucix_journal_add_int("bacnet_ai", idx_c, "high_limit",
+                        value.type.Real, true);
             }
             break;
 
@@ -1541,9 +1552,8 @@ bool Analog_Input_Write_Property(
 
             if (status) {
                 CurrentAI->Low_Limit = value.type.Real;
-                ucix_add_option_int(ctx, "bacnet_ai", idx_c, "low_limit",
-                        value.type.Real);
-                ucix_commit(ctx, "bacnet_ai");
+                ucix_journal_add_int("bacnet_ai", idx_c, "low_limit",
+                        value.type.Real, true);
             }
             break;
 
@@ -1554,9 +1564,8 @@ bool Analog_Input_Write_Property(
 
             if (status) {
                 CurrentAI->Deadband = value.type.Real;
-                ucix_add_option_int(ctx, "bacnet_ai", idx_c, "dead_limit",
-                        value.type.Real);
-                ucix_commit(ctx, "bacnet_ai");
+                ucix_journal_add_int("bacnet_ai", idx_c, "dead_limit",
+                        value.type.Real, true);
             }
             break;
 
@@ -1568,9 +1577,8 @@ bool Analog_Input_Write_Property(
             if (status) {
                 if (value.type.Bit_String.bits_used == 2) {
                     CurrentAI->Limit_Enable = value.type.Bit_String.value[0];
-                    ucix_add_option_int(ctx, "bacnet_ai", idx_c, "limit",
-                        value.type.Bit_String.value[0]);
-                    ucix_commit(ctx, "bacnet_ai");
+                    ucix_journal_add_int("bacnet_ai", idx_c, "limit",
+                        value.type.Bit_String.value[0], true);
                 } else {
                     wp_data->error_class = ERROR_CLASS_PROPERTY;
                     wp_data->error_code = ERROR_CODE_VALUE_OUT_OF_RANGE;
@@ -1587,9 +1595,8 @@ bool Analog_Input_Write_Property(
             if (status) {
                 if (value.type.Bit_String.bits_used == 3) {
                     CurrentAI->Event_Enable = value.type.Bit_String.value[0];
-                    ucix_add_option_int(ctx, "bacnet_ai", idx_c, "event",
-                        value.type.Bit_String.value[0]);
-                    ucix_commit(ctx, "bacnet_ai");
+                    ucix_journal_add_int("bacnet_ai", idx_c, "event",
+                        value.type.Bit_String.value[0], true);
                 } else {
                     wp_data->error_class = ERROR_CLASS_PROPERTY;
                     wp_data->error_code = ERROR_CODE_VALUE_OUT_OF_RANGE;
@@ -1640,7 +1647,12 @@ bool Analog_Input_Write_Property(
             wp_data->error_code = ERROR_CODE_UNKNOWN_PROPERTY;
             break;
     }
-    ucix_cleanup(ctx);
+#if defined(INTRINSIC_REPORTING)
+    if (status) {
+        Device_Intrinsic_Reporting_Request(OBJECT_ANALOG_INPUT,
+            wp_data->object_instance);
+    }
+#endif
     return status;
 }
 
@@ -1937,6 +1949,15 @@ void Analog_Input_Intrinsic_Reporting(
                     break;
             }
         }
+        /* the object may have joined or left the event summary */
+        handler_event_summary_update(OBJECT_ANALOG_INPUT, index);
+    }
+    /* evaluate again while the time delay is running, and after an
+       AckNotification that skipped the event state checks */
+    if ((CurrentAI->Remaining_Time_Delay != CurrentAI->Time_Delay) ||
+        (SendNotify && (event_data.notifyType == NOTIFY_ACK_NOTIFICATION))) {
+        Device_Intrinsic_Reporting_Request(OBJECT_ANALOG_INPUT,
+            object_instance);
     }
 #endif /* defined(INTRINSIC_REPORTING) */
 }
@@ -2116,6 +2137,10 @@ int Analog_Input_Alarm_Ack(
     CurrentAI->Ack_notify_data.bSendAckNotify = true;
     CurrentAI->Ack_notify_data.EventState = alarmack_data->eventStateAcked;
 
+    Device_Intrinsic_Reporting_Request(OBJECT_ANALOG_INPUT,
+        alarmack_data->eventObjectIdentifier.instance);
+    handler_event_summary_update(OBJECT_ANALOG_INPUT, index);
+
     /* Return OK */
     return 1;
 }
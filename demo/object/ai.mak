@@ -10,6 +10,7 @@ CFLAGS  = -Wall $(INCLUDES) $(DEFINES) -g
 
 SRCS = ai.c \
 	$(SRC_DIR)/bacdcode.c \
+	$(SRC_DIR)/keylist.c \
 	$(SRC_DIR)/bacint.c \
 	$(SRC_DIR)/bacstr.c \
 	$(SRC_DIR)/bacreal.c \
@@ -45,6 +45,7 @@
 #include "timestamp.h"
 #include "ao.h"
 #include "ucix.h"
+#include "keylist.h"
 
 /* number of demo objects */
 #ifndef MAX_ANALOG_OUTPUTS
@@ -63,6 +64,9 @@ unsigned max_analog_outputs_int = 0;
 
 ANALOG_OUTPUT_DESCR AO_Descr[MAX_ANALOG_OUTPUTS];
 
+/* sorted Instance to AO_Descr[] slot lookup, rebuilt by Analog_Output_Init */
+static OS_Keylist AO_Instance_List = NULL;
+
 /* These three arrays are used by the ReadPropertyMultiple handler */
 static const int Analog_Output_Properties_Required[] = {
     PROP_OBJECT_IDENTIFIER,
@@ -140,6 +144,25 @@ void Analog_Output_Load_UCI_List(const char *sec_idx,
 }
 
 
+/* (re)build the Instance lookup from the configured AO_Descr[] slots */
+static void Analog_Output_Instance_List_Init(
+    void)
+{
+    unsigned i;
+
+    if (AO_Instance_List) {
+        Keylist_Delete(AO_Instance_List);
+    }
+    AO_Instance_List = Keylist_Create();
+    for (i = 0; i < max_analog_outputs_int; i++) {
+        /* keep the first slot of a duplicated instance, like a scan would */
+        if (!Keylist_Data(AO_Instance_List, AO_Descr[i].Instance)) {
+            Keylist_Data_Add(AO_Instance_List, AO_Descr[i].Instance,
+                &AO_Descr[i]);
+        }
+    }
+}
+
 void Analog_Output_Init(
     void)
 {
@@ -425,6 +448,10 @@ void Analog_Output_Init(
                 max_analog_outputs_int = i;
             }
         }
+        Analog_Output_Instance_List_Init();
+#if defined(INTRINSIC_REPORTING)
+        handler_event_summary_reset(OBJECT_ANALOG_OUTPUT);
+#endif
 #if PRINT_ENABLED
         fprintf(stderr, "max_analog_outputs %i\n", max_analog_outputs_int);
 #endif
@@ -434,23 +461,18 @@ void Analog_Output_Init(
     return;
 }
 
-/* we simply have 0-n object instances.  Yours might be */
-/* more complex, and then you need to return the index */
-/* that correlates to the correct instance number */
+/* Instances come from the uci section names and may be sparse, */
+/* so the slot is found with a binary search of the sorted list */
 unsigned Analog_Output_Instance_To_Index(
     uint32_t object_instance)
 {
     ANALOG_OUTPUT_DESCR *CurrentAO;
-    int index,i;
-    //int instance;
-    index = max_analog_outputs_int;
-    for (i = 0; i < index; i++) {
-    	CurrentAO = &AO_Descr[i];
-    	//instance = CurrentAO->Instance;
-    	if (CurrentAO->Instance == object_instance) {
-    		return i;
-    	}
+
+    CurrentAO = Keylist_Data(AO_Instance_List, object_instance);
+    if (CurrentAO) {
+        return (unsigned) (CurrentAO - &AO_Descr[0]);
     }
+
     return MAX_ANALOG_OUTPUTS;
 }
 
@@ -518,6 +540,7 @@ static void Analog_Output_COV_Detect(uint32_t object_instance,
         }
         if (cov_delta >= cov_increment) {
             CurrentAO->Changed = true;
+            handler_cov_object_changed(OBJECT_ANALOG_OUTPUT, object_instance);
             CurrentAO->Prior_Value = value;
         }
     }
@@ -710,6 +733,10 @@ bool Analog_Output_Present_Value_Set(
                 CurrentAO->Priority_Array[15] = value;
             }
             Analog_Output_COV_Detect(object_instance, Analog_Output_Present_Value(object_instance));
+#if defined(INTRINSIC_REPORTING)
+            Device_Intrinsic_Reporting_Request(OBJECT_ANALOG_OUTPUT,
+                object_instance);
+#endif
             status = true;
         }
     }
@@ -771,7 +798,12 @@ void Analog_Output_Out_Of_Service_Set(
     if (Analog_Output_Valid_Instance(object_instance)) {
         index = Analog_Output_Instance_To_Index(object_instance);
         CurrentAO = &AO_Descr[index];
-        CurrentAO->Out_Of_Service = value;
+        if (CurrentAO->Out_Of_Service != value) {
+            CurrentAO->Out_Of_Service = value;
+            /* Status_Flags changed */
+            CurrentAO->Changed = true;
+            handler_cov_object_changed(OBJECT_ANALOG_OUTPUT, object_instance);
+        }
     }
 }
 
@@ -882,16 +914,8 @@ static bool Analog_Output_Description_Write(
                 } else {
                     sprintf(idx_cc,"%d",CurrentAO->Instance);
                     idx_c = idx_cc;
-                    if(ctx) {
-                        ucix_add_option(ctx, "bacnet_ao", idx_c,
-                            "description", char_string->value);
-                        ucix_commit(ctx, "bacnet_ao");
-#if PRINT_ENABLED
-                    } else {
-                        fprintf(stderr,
-                            "Failed to open config file bacnet_ao\n");
-#endif
-                    }
+                    ucix_journal_add("bacnet_ao", idx_c,
+                        "description", CurrentAO->Object_Description, true);
                 }
             } else {
                 *error_class = ERROR_CLASS_PROPERTY;
@@ -952,18 +976,12 @@ static bool Analog_Output_Object_Name_Write(
                     *error_class = ERROR_CLASS_PROPERTY;
                     *error_code = ERROR_CODE_VALUE_OUT_OF_RANGE;
                 } else {
+                    Device_Object_Name_Changed(OBJECT_ANALOG_OUTPUT,
+                        object_instance);
                     sprintf(idx_cc,"%d",CurrentAO->Instance);
                     idx_c = idx_cc;
-                    if(ctx) {
-                        ucix_add_option(ctx, "bacnet_ao", idx_c,
-                            "name", char_string->value);
-                        ucix_commit(ctx, "bacnet_ao");
-#if PRINT_ENABLED
-                    } else {
-                        fprintf(stderr,
-                            "Failed to open config file bacnet_ao\n");
-#endif
-                    }
+                    ucix_journal_add("bacnet_ao", idx_c,
+                        "name", CurrentAO->Object_Name, true);
                 }
             } else {
                 *error_class = ERROR_CLASS_PROPERTY;
@@ -1300,7 +1318,6 @@ bool Analog_Output_Write_Property(
     uint8_t level = ANALOG_LEVEL_NULL;
     int len = 0;
     BACNET_APPLICATION_DATA_VALUE value;
-    ctx = ucix_init("bacnet_ao");
     const char *idx_c;
     char cur_value[16];
     float pvalue;
@@ -1384,14 +1401,13 @@ bool Analog_Output_Write_Property(
                         value.type.Real, wp_data->priority)) {
                     status = true;
                     sprintf(cur_value,"%f",value.type.Real);
-                    ucix_add_option(ctx, "bacnet_ao", idx_c, "value",
-                        cur_value);
+                    ucix_journal_add("bacnet_ao", idx_c, "value",
+                        cur_value, false);
                     cur_value_time = time(NULL);
-                    ucix_add_option_int(ctx, "bacnet_ao", idx_c, "value_time",
-                        cur_value_time);
-                    ucix_add_option_int(ctx, "bacnet_ao", idx_c, "write",
-                        1);
-                    ucix_save_state(ctx, "bacnet_ao");
+                    ucix_journal_add_int("bacnet_ao", idx_c, "value_time",
+                        cur_value_time, false);
+                    ucix_journal_add_int("bacnet_ao", idx_c, "write",
+                        1, false);
                 } else if (wp_data->priority == 6) {
                     /* Command priority 6 is reserved for use by Minimum On/Off
                        algorithm and may not be used for other purposes in any
@@ -1426,14 +1442,13 @@ bool Analog_Output_Write_Property(
                             }
                         }
                         sprintf(cur_value,"%f",pvalue);
-                        ucix_add_option(ctx, "bacnet_ao", idx_c, "value",
-                            cur_value);
+                        ucix_journal_add("bacnet_ao", idx_c, "value",
+                            cur_value, false);
                         cur_value_time = time(NULL);
-                        ucix_add_option_int(ctx, "bacnet_ao", idx_c, "value_time",
-                            cur_value_time);
-                        ucix_add_option_int(ctx, "bacnet_ao", idx_c, "write",
-                            1);
-                        ucix_save_state(ctx, "bacnet_ao");
+                        ucix_journal_add_int("bacnet_ao", idx_c, "value_time",
+                            cur_value_time, false);
+                        ucix_journal_add_int("bacnet_ao", idx_c, "write",
+                            1, false);
                     } else {
                         status = false;
                         wp_data->error_class = ERROR_CLASS_PROPERTY;
@@ -1448,7 +1463,8 @@ bool Analog_Output_Write_Property(
                 WPValidateArgType(&value, BACNET_APPLICATION_TAG_BOOLEAN,
                 &wp_data->error_class, &wp_data->error_code);
             if (status) {
-                CurrentAO->Out_Of_Service = value.type.Boolean;
+                Analog_Output_Out_Of_Service_Set(wp_data->object_instance,
+                    value.type.Boolean);
             }
             break;
 
@@ -1503,9 +1519,8 @@ bool Analog_Output_Write_Property(
 
             if (status) {
                 CurrentAO->Max_Pres_Value = value.type.Real;
-                ucix_add_option_int(ctx, "bacnet_ao", idx_c, "max_value",
-                        value.type.Real);
-                ucix_commit(ctx, "bacnet_ao");
+                ucix_journal_add_int("bacnet_ao", idx_c, "max_value",
+                        value.type.Real, true);
             }
             break;
 
@@ -1516,9 +1531,8 @@ bool Analog_Output_Write_Property(
 
             if (status) {
                 CurrentAO->Min_Pres_Value = value.type.Real;
-                ucix_add_option_int(ctx, "bacnet_ao", idx_c, "min_value",
-                        value.type.Real);
-                ucix_commit(ctx, "bacnet_ao");
+                ucix_journal_add_int("bacnet_ao", idx_c, "min_value",
+                        value.type.Real, true);
             }
             break;
 
@@ -1531,9 +1545,8 @@ bool Analog_Output_Write_Property(
             if (status) {
                 CurrentAO->Time_Delay = value.type.Unsigned_Int;
                 CurrentAO->Remaining_Time_Delay = CurrentAO->Time_Delay;
-                ucix_add_option_int(ctx, "bacnet_ao", idx_c, "time_delay",
-                    value.type.Unsigned_Int);
-                ucix_commit(ctx, "bacnet_ao");
+                ucix_journal_add_int("bacnet_ao", idx_c, "time_delay",
+                    value.type.Unsigned_Int, true);
             }
             break;
 
@@ -1544,9 +1557,8 @@ bool Analog_Output_Write_Property(
 
             if (status) {
                 CurrentAO->Notification_Class = value.type.Unsigned_Int;
-                ucix_add_option_int(ctx, "bacnet_ao", idx_c, "nc",
-                    value.type.Unsigned_Int);
-                ucix_commit(ctx, "bacnet_ao");
+                ucix_journal_add_int("bacnet_ao", idx_c, "nc",
+                    value.type.Unsigned_Int, true);
             }
             break;
 
@@ -1557,9 +1569,8 @@ bool Analog_Output_Write_Property(
 
             if (status) {
                 CurrentAO->High_Limit = value.type.Real;
-                ucix_add_option_int(ctx, "bacnet_ao", idx_c, "high_limit",
-                        value.type.Real);
-                ucix_commit(ctx, "bacnet_ao");
+                ucix_journal_add_int("bacnet_ao", idx_c, "high_limit",
+                        value.type.Real, true);
             }
             break;
 
@@ -1570,9 +1581,8 @@ bool Analog_Output_Write_Property(
 
             if (status) {
                 CurrentAO->Low_Limit = value.type.Real;
-                ucix_add_option_int(ctx, "bacnet_ao", idx_c, "low_limit",
-                        value.type.Real);
-                ucix_commit(ctx, "bacnet_ao");
+                ucix_journal_add_int("bacnet_ao", idx_c, "low_limit",
+                        value.type.Real, true);
             }
             break;
 
@@ -1583,9 +1593,8 @@ bool Analog_Output_Write_Property(
 
             if (status) {
                 CurrentAO->Deadband = value.type.Real;
-                ucix_add_option_int(ctx, "bacnet_ao", idx_c, "dead_limit",
-                        value.type.Real);
-                ucix_commit(ctx, "bacnet_ao");
+                ucix_journal_add_int("bacnet_ao", idx_c, "dead_limit",
+                        value.type.Real, true);
             }
             break;
 
@@ -1597,9 +1606,8 @@ bool Analog_Output_Write_Property(
             if (status) {
                 if (value.type.Bit_String.bits_used == 2) {
                     CurrentAO->Limit_Enable = value.type.Bit_String.value[0];
-                    ucix_add_option_int(ctx, "bacnet_ao", idx_c, "limit",
-                        value.type.Bit_String.value[0]);
-                    ucix_commit(ctx, "bacnet_ao");
+                    ucix_journal_add_int("bacnet_ao", idx_c, "limit",
+                        value.type.Bit_String.value[0], true);
                 } else {
                     wp_data->error_class = ERROR_CLASS_PROPERTY;
                     wp_data->error_code = ERROR_CODE_VALUE_OUT_OF_RANGE;
@@ -1616,9 +1624,8 @@ bool Analog_Output_Write_Property(
             if (status) {
                 if (value.type.Bit_String.bits_used == 3) {
                     CurrentAO->Event_Enable = value.type.Bit_String.value[0];
-                    ucix_add_option_int(ctx, "bacnet_ao", idx_c, "event",
-                        value.type.Bit_String.value[0]);
-                    ucix_commit(ctx, "bacnet_ao");
+                    ucix_journal_add_int("bacnet_ao", idx_c, "event",
+                        value.type.Bit_String.value[0], true);
                 } else {
                     wp_data->error_class = ERROR_CLASS_PROPERTY;
                     wp_data->error_code = ERROR_CODE_VALUE_OUT_OF_RANGE;
@@ -1669,7 +1676,12 @@ bool Analog_Output_Write_Property(
             wp_data->error_code = ERROR_CODE_UNKNOWN_PROPERTY;
             break;
     }
-    ucix_cleanup(ctx);
+#if defined(INTRINSIC_REPORTING)
+    if (status) {
+        Device_Intrinsic_Reporting_Request(OBJECT_ANALOG_OUTPUT,
+            wp_data->object_instance);
+    }
+#endif
     return status;
 }
 
@@ -1966,6 +1978,15 @@ void Analog_Output_Intrinsic_Reporting(
                     break;
             }
         }
+        /* the object may have joined or left the event summary */
+        handler_event_summary_update(OBJECT_ANALOG_OUTPUT, index);
+    }
+    /* evaluate again while the time delay is running, and after an
+       AckNotification that skipped the event state checks */
+    if ((CurrentAO->Remaining_Time_Delay != CurrentAO->Time_Delay) ||
+        (SendNotify && (event_data.notifyType == NOTIFY_ACK_NOTIFICATION))) {
+        Device_Intrinsic_Reporting_Request(OBJECT_ANALOG_OUTPUT,
+            object_instance);
     }
 #endif /* defined(INTRINSIC_REPORTING) */
 }
@@ -2144,6 +2165,10 @@ int Analog_Output_Alarm_Ack(
     CurrentAO->Ack_notify_data.bSendAckNotify = true;
     CurrentAO->Ack_notify_data.EventState = alarmack_data->eventStateAcked;
 
+    Device_Intrinsic_Reporting_Request(OBJECT_ANALOG_OUTPUT,
+        alarmack_data->eventObjectIdentifier.instance);
+    handler_event_summary_update(OBJECT_ANALOG_OUTPUT, index);
+
     /* Return OK */
     return 1;
 }
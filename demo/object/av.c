@@ -45,6 +45,7 @@
 #include "timestamp.h"
 #include "av.h"
 #include "ucix.h"
+#include "keylist.h"
 
 /* number of demo objects */
 #ifndef MAX_ANALOG_VALUES
@@ -63,6 +64,9 @@ unsigned max_analog_values_int = 0;
 
 ANALOG_VALUE_DESCR AV_Descr[MAX_ANALOG_VALUES];
 
+/* sorted Instance to AV_Descr[] slot lookup, rebuilt by Analog_Value_Init */
+static OS_Keylist AV_Instance_List = NULL;
+
 /* These three arrays are used by the ReadPropertyMultiple handler */
 static const int Analog_Value_Properties_Required[] = {
     PROP_OBJECT_IDENTIFIER,
@@ -139,6 +143,25 @@ void Analog_Value_Load_UCI_List(const char *sec_idx,
 }
 
 
+/* (re)build the Instance lookup from the configured AV_Descr[] slots */
+static void Analog_Value_Instance_List_Init(
+    void)
+{
+    unsigned i;
+
+    if (AV_Instance_List) {
+        Keylist_Delete(AV_Instance_List);
+    }
+    AV_Instance_List = Keylist_Create();
+    for (i = 0; i < max_analog_values_int; i++) {
+        /* keep the first slot of a duplicated instance, like a scan would */
+        if (!Keylist_Data(AV_Instance_List, AV_Descr[i].Instance)) {
+            Keylist_Data_Add(AV_Instance_List, AV_Descr[i].Instance,
+                &AV_Descr[i]);
+        }
+    }
+}
+
 void Analog_Value_Init(
     void)
 {
@@ -388,6 +411,10 @@ void Analog_Value_Init(
                 max_analog_values_int = i;
             }
         }
+        Analog_Value_Instance_List_Init();
+#if defined(INTRINSIC_REPORTING)
+        handler_event_summary_reset(OBJECT_ANALOG_VALUE);
+#endif
 #if PRINT_ENABLED
         fprintf(stderr, "max_analog_values %i\n", max_analog_values_int);
 #endif
@@ -397,23 +424,18 @@ void Analog_Value_Init(
     return;
 }
 
-/* we simply have 0-n object instances.  Yours might be */
-/* more complex, and then you need to return the index */
-/* that correlates to the correct instance number */
+/* Instances come from the uci section names and may be sparse, */
+/* so the slot is found with a binary search of the sorted list */
 unsigned Analog_Value_Instance_To_Index(
     uint32_t object_instance)
 {
     ANALOG_VALUE_DESCR *CurrentAV;
-    int index,i;
-    //int instance;
-    index = max_analog_values_int;
-    for (i = 0; i < index; i++) {
-    	CurrentAV = &AV_Descr[i];
-    	//instance = CurrentAV->Instance;
-    	if (CurrentAV->Instance == object_instance) {
-    		return i;
-    	}
+
+    CurrentAV = Keylist_Data(AV_Instance_List, object_instance);
+    if (CurrentAV) {
+        return (unsigned) (CurrentAV - &AV_Descr[0]);
     }
+
     return MAX_ANALOG_VALUES;
 }
 
@@ -481,6 +503,7 @@ static void Analog_Value_COV_Detect(uint32_t object_instance,
         }
         if (cov_delta >= cov_increment) {
             CurrentAV->Changed = true;
+            handler_cov_object_changed(OBJECT_ANALOG_VALUE, object_instance);
             CurrentAV->Prior_Value = value;
         }
     }
@@ -672,6 +695,10 @@ bool Analog_Value_Present_Value_Set(
                 CurrentAV->Priority_Array[15] = value;
             }
             Analog_Value_COV_Detect(object_instance, Analog_Value_Present_Value(object_instance));
+#if defined(INTRINSIC_REPORTING)
+            Device_Intrinsic_Reporting_Request(OBJECT_ANALOG_VALUE,
+                object_instance);
+#endif
             status = true;
         }
     }
@@ -732,7 +759,12 @@ void Analog_Value_Out_Of_Service_Set(
     if (Analog_Value_Valid_Instance(object_instance)) {
         index = Analog_Value_Instance_To_Index(object_instance);
         CurrentAV = &AV_Descr[index];
-        CurrentAV->Out_Of_Service = value;
+        if (CurrentAV->Out_Of_Service != value) {
+            CurrentAV->Out_Of_Service = value;
+            /* Status_Flags changed */
+            CurrentAV->Changed = true;
+            handler_cov_object_changed(OBJECT_ANALOG_VALUE, object_instance);
+        }
     }
 }
 
@@ -843,16 +875,8 @@ static bool Analog_Value_Description_Write(
                 } else {
                     sprintf(idx_cc,"%d",CurrentAV->Instance);
                     idx_c = idx_cc;
-                    if(ctx) {
-                        ucix_add_option(ctx, "bacnet_av", idx_c,
-                            "description", char_string->value);
-                        ucix_commit(ctx, "bacnet_av");
-#if PRINT_ENABLED
-                    } else {
-                        fprintf(stderr,
-                            "Failed to open config file bacnet_av\n");
-#endif
-                    }
+                    ucix_journal_add("bacnet_av", idx_c,
+                        "description", CurrentAV->Object_Description, true);
                 }
             } else {
                 *error_class = ERROR_CLASS_PROPERTY;
@@ -913,18 +937,12 @@ static bool Analog_Value_Object_Name_Write(
                     *error_class = ERROR_CLASS_PROPERTY;
                     *error_code = ERROR_CODE_VALUE_OUT_OF_RANGE;
                 } else {
+                    Device_Object_Name_Changed(OBJECT_ANALOG_VALUE,
+                        object_instance);
                     sprintf(idx_cc,"%d",CurrentAV->Instance);
                     idx_c = idx_cc;
-                    if(ctx) {
-                        ucix_add_option(ctx, "bacnet_av", idx_c,
-                            "name", char_string->value);
-                        ucix_commit(ctx, "bacnet_av");
-#if PRINT_ENABLED
-                    } else {
-                        fprintf(stderr,
-                            "Failed to open config file bacnet_av\n");
-#endif
-                    }
+                    ucix_journal_add("bacnet_av", idx_c,
+                        "name", CurrentAV->Object_Name, true);
                 }
             } else {
                 *error_class = ERROR_CLASS_PROPERTY;
@@ -1251,7 +1269,6 @@ bool Analog_Value_Write_Property(
     uint8_t level = ANALOG_LEVEL_NULL;
     int len = 0;
     BACNET_APPLICATION_DATA_VALUE value;
-    ctx = ucix_init("bacnet_av");
     const char *idx_c;
     char cur_value[16];
     float pvalue;
@@ -1335,14 +1352,13 @@ bool Analog_Value_Write_Property(
                         value.type.Real, wp_data->priority)) {
                     status = true;
                     sprintf(cur_value,"%f",value.type.Real);
-                    ucix_add_option(ctx, "bacnet_av", idx_c, "value",
-                        cur_value);
+                    ucix_journal_add("bacnet_av", idx_c, "value",
+                        cur_value, false);
                     cur_value_time = time(NULL);
-                    ucix_add_option_int(ctx, "bacnet_av", idx_c, "value_time",
-                        cur_value_time);
-                    ucix_add_option_int(ctx, "bacnet_av", idx_c, "write",
-                        1);
-                    ucix_save_state(ctx, "bacnet_av");
+                    ucix_journal_add_int("bacnet_av", idx_c, "value_time",
+                        cur_value_time, false);
+                    ucix_journal_add_int("bacnet_av", idx_c, "write",
+                        1, false);
                 } else if (wp_data->priority == 6) {
                     /* Command priority 6 is reserved for use by Minimum On/Off
                        algorithm and may not be used for other purposes in any
@@ -1377,14 +1393,13 @@ bool Analog_Value_Write_Property(
                             }
                         }
                         sprintf(cur_value,"%f",pvalue);
-                        ucix_add_option(ctx, "bacnet_av", idx_c, "value",
-                            cur_value);
+                        ucix_journal_add("bacnet_av", idx_c, "value",
+                            cur_value, false);
                         cur_value_time = time(NULL);
-                        ucix_add_option_int(ctx, "bacnet_av", idx_c, "value_time",
-                            cur_value_time);
-                        ucix_add_option_int(ctx, "bacnet_av", idx_c, "write",
-                            1);
-                        ucix_save_state(ctx, "bacnet_av");
+                        ucix_journal_add_int("bacnet_av", idx_c, "value_time",
+                            cur_value_time, false);
+                        ucix_journal_add_int("bacnet_av", idx_c, "write",
+                            1, false);
                     } else {
                         status = false;
                         wp_data->error_class = ERROR_CLASS_PROPERTY;
@@ -1399,7 +1414,8 @@ bool Analog_Value_Write_Property(
                 WPValidateArgType(&value, BACNET_APPLICATION_TAG_BOOLEAN,
                 &wp_data->error_class, &wp_data->error_code);
             if (status) {
-                CurrentAV->Out_Of_Service = value.type.Boolean;
+                Analog_Value_Out_Of_Service_Set(wp_data->object_instance,
+                    value.type.Boolean);
             }
             break;
 
@@ -1456,9 +1472,8 @@ bool Analog_Value_Write_Property(
             if (status) {
                 CurrentAV->Time_Delay = value.type.Unsigned_Int;
                 CurrentAV->Remaining_Time_Delay = CurrentAV->Time_Delay;
-                ucix_add_option_int(ctx, "bacnet_av", idx_c, "time_delay",
-                    value.type.Unsigned_Int);
-                ucix_commit(ctx, "bacnet_av");
+                ucix_journal_add_int("bacnet_av", idx_c, "time_delay",
+                    value.type.Unsigned_Int, true);
             }
             break;
 
@@ -1469,9 +1484,8 @@ bool Analog_Value_Write_Property(
 
             if (status) {
                 CurrentAV->Notification_Class = value.type.Unsigned_Int;
-                ucix_add_option_int(ctx, "bacnet_av", idx_c, "nc",
-                    value.type.Unsigned_Int);
-                ucix_commit(ctx, "bacnet_av");
+                ucix_journal_add_int("bacnet_av", idx_c, "nc",
+                    value.type.Unsigned_Int, true);
             }
             break;
 
@@ -1482,9 +1496,8 @@ bool Analog_Value_Write_Property(
 
             if (status) {
                 CurrentAV->High_Limit = value.type.Real;
-                ucix_add_option_int(ctx, "bacnet_av", idx_c, "high_limit",
-                        value.type.Real);
-                ucix_commit(ctx, "bacnet_av");
+                ucix_journal_add_int("bacnet_av", idx_c, "high_limit",
+                        value.type.Real, true);
             }
             break;
 
@@ -1495,9 +1508,8 @@ bool Analog_Value_Write_Property(
 
             if (status) {
                 CurrentAV->Low_Limit = value.type.Real;
-                ucix_add_option_int(ctx, "bacnet_av", idx_c, "low_limit",
-                        value.type.Real);
-                ucix_commit(ctx, "bacnet_av");
+                ucix_journal_add_int("bacnet_av", idx_c, "low_limit",
+                        value.type.Real, true);
             }
             break;
 
@@ -1508,9 +1520,8 @@ bool Analog_Value_Write_Property(
 
             if (status) {
                 CurrentAV->Deadband = value.type.Real;
-                ucix_add_option_int(ctx, "bacnet_av", idx_c, "dead_limit",
-                        value.type.Real);
-                ucix_commit(ctx, "bacnet_av");
+                ucix_journal_add_int("bacnet_av", idx_c, "dead_limit",
+                        value.type.Real, true);
             }
             break;
 
@@ -1522,9 +1533,8 @@ bool Analog_Value_Write_Property(
             if (status) {
                 if (value.type.Bit_String.bits_used == 2) {
                     CurrentAV->Limit_Enable = value.type.Bit_String.value[0];
-                    ucix_add_option_int(ctx, "bacnet_av", idx_c, "limit",
-                        value.type.Bit_String.value[0]);
-                    ucix_commit(ctx, "bacnet_av");
+                    ucix_journal_add_int("bacnet_av", idx_c, "limit",
+                        value.type.Bit_String.value[0], true);
                 } else {
                     wp_data->error_class = ERROR_CLASS_PROPERTY;
                     wp_data->error_code = ERROR_CODE_VALUE_OUT_OF_RANGE;
@@ -1541,9 +1551,8 @@ bool Analog_Value_Write_Property(
             if (status) {
                 if (value.type.Bit_String.bits_used == 3) {
                     CurrentAV->Event_Enable = value.type.Bit_String.value[0];
-                    ucix_add_option_int(ctx, "bacnet_av", idx_c, "event",
-                        value.type.Bit_String.value[0]);
-                    ucix_commit(ctx, "bacnet_av");
+                    ucix_journal_add_int("bacnet_av", idx_c, "event",
+                        value.type.Bit_String.value[0], true);
                 } else {
                     wp_data->error_class = ERROR_CLASS_PROPERTY;
                     wp_data->error_code = ERROR_CODE_VALUE_OUT_OF_RANGE;
@@ -1594,7 +1603,12 @@ bool Analog_Value_Write_Property(
             wp_data->error_code = ERROR_CODE_UNKNOWN_PROPERTY;
             break;
     }
-    ucix_cleanup(ctx);
+#if defined(INTRINSIC_REPORTING)
+    if (status) {
+        Device_Intrinsic_Reporting_Request(OBJECT_ANALOG_VALUE,
+            wp_data->object_instance);
+    }
+#endif
     return status;
 }
 
@@ -1891,6 +1905,15 @@ void Analog_Value_Intrinsic_Reporting(
                     break;
             }
         }
+        /* the object may have joined or left the event summary */
+        handler_event_summary_update(OBJECT_ANALOG_VALUE, index);
+    }
+    /* evaluate again while the time delay is running, and after an
+       AckNotification that skipped the event state checks */
+    if ((CurrentAV->Remaining_Time_Delay != CurrentAV->Time_Delay) ||
+        (SendNotify && (event_data.notifyType == NOTIFY_ACK_NOTIFICATION))) {
+        Device_Intrinsic_Reporting_Request(OBJECT_ANALOG_VALUE,
+            object_instance);
     }
 #endif /* defined(INTRINSIC_REPORTING) */
 }
@@ -2069,6 +2092,10 @@ int Analog_Value_Alarm_Ack(
     CurrentAV->Ack_notify_data.bSendAckNotify = true;
     CurrentAV->Ack_notify_data.EventState = alarmack_data->eventStateAcked;
 
+    Device_Intrinsic_Reporting_Request(OBJECT_ANALOG_VALUE,
+        alarmack_data->eventObjectIdentifier.instance);
+    handler_event_summary_update(OBJECT_ANALOG_VALUE, index);
+
     /* Return OK */
     return 1;
 }
@@ -9,6 +9,7 @@ CFLAGS  = -Wall $(INCLUDES) $(DEFINES) -g
 
 SRCS = av.c \
 	$(SRC_DIR)/bacdcode.c \
+	$(SRC_DIR)/keylist.c \
 	$(SRC_DIR)/bacint.c \
 	$(SRC_DIR)/bacstr.c \
 	$(SRC_DIR)/bacreal.c \
@@ -45,6 +45,7 @@
 #include "timestamp.h"
 #include "bi.h"
 #include "ucix.h"
+#include "keylist.h"
 
 #ifndef MAX_BINARY_INPUTS
 #define MAX_BINARY_INPUTS 1024
@@ -62,6 +63,9 @@ unsigned max_binary_inputs_int = 0;
 
 BINARY_INPUT_DESCR BI_Descr[MAX_BINARY_INPUTS];
 
+/* sorted Instance to BI_Descr[] slot lookup, rebuilt by Binary_Input_Init */
+static OS_Keylist BI_Instance_List = NULL;
+
 /* These three arrays are used by the ReadPropertyMultiple handler */
 static const int Binary_Input_Properties_Required[] = {
     PROP_OBJECT_IDENTIFIER,
@@ -134,6 +138,25 @@ void Binary_Input_Load_UCI_List(const char *sec_idx,
     return;
 }
 
+/* (re)build the Instance lookup from the configured BI_Descr[] slots */
+static void Binary_Input_Instance_List_Init(
+    void)
+{
+    unsigned i;
+
+    if (BI_Instance_List) {
+        Keylist_Delete(BI_Instance_List);
+    }
+    BI_Instance_List = Keylist_Create();
+    for (i = 0; i < max_binary_inputs_int; i++) {
+        /* keep the first slot of a duplicated instance, like a scan would */
+        if (!Keylist_Data(BI_Instance_List, BI_Descr[i].Instance)) {
+            Keylist_Data_Add(BI_Instance_List, BI_Descr[i].Instance,
+                &BI_Descr[i]);
+        }
+    }
+}
+
 /*
  * Things to do when starting up the stack for Binary Input.
  * Should be called whenever we reset the device or power it up
@@ -318,6 +341,10 @@ void Binary_Input_Init(
                 max_binary_inputs_int = i;
             }
         }
+        Binary_Input_Instance_List_Init();
+#if defined(INTRINSIC_REPORTING)
+        handler_event_summary_reset(OBJECT_BINARY_INPUT);
+#endif
 #if PRINT_ENABLED
         fprintf(stderr, "max_binary_inputs %i\n", max_binary_inputs_int);
 #endif
@@ -327,21 +354,18 @@ void Binary_Input_Init(
     return;
 }
 
-/* we simply have 0-n object instances.  Yours might be */
-/* more complex, and then you need to return the index */
-/* that correlates to the correct instance number */
+/* Instances come from the uci section names and may be sparse, */
+/* so the slot is found with a binary search of the sorted list */
 unsigned Binary_Input_Instance_To_Index(
     uint32_t object_instance)
 {
     BINARY_INPUT_DESCR *CurrentBI;
-    int index,i;
-    index = max_binary_inputs_int;
-    for (i = 0; i < index; i++) {
-    	CurrentBI = &BI_Descr[i];
-    	if (CurrentBI->Instance == object_instance) {
-    		return i;
-    	}
+
+    CurrentBI = Keylist_Data(BI_Instance_List, object_instance);
+    if (CurrentBI) {
+        return (unsigned) (CurrentBI - &BI_Descr[0]);
     }
+
     return MAX_BINARY_INPUTS;
 }
 
@@ -466,6 +490,7 @@ void Binary_Input_Out_Of_Service_Set(
         CurrentBI = &BI_Descr[index];
         if (CurrentBI->Out_Of_Service != value) {
             CurrentBI->Changed = true;
+            handler_cov_object_changed(OBJECT_BINARY_INPUT, object_instance);
         }
         CurrentBI->Out_Of_Service = value;
     }
@@ -580,16 +605,8 @@ static bool Binary_Input_Description_Write(
                 } else {
                     sprintf(idx_cc,"%d",index);
                     idx_c = idx_cc;
-                    if(ctx) {
-                        ucix_add_option(ctx, "bacnet_bi", idx_c,
-                            "description", char_string->value);
-                        ucix_commit(ctx, "bacnet_bi");
-#if PRINT_ENABLED
-                    } else {
-                        fprintf(stderr,
-                            "Failed to open config file bacnet_bi\n");
-#endif
-                    }
+                    ucix_journal_add("bacnet_bi", idx_c,
+                        "description", CurrentBI->Object_Description, true);
                 }
             } else {
                 *error_class = ERROR_CLASS_PROPERTY;
@@ -683,18 +700,12 @@ static bool Binary_Input_Object_Name_Write(
                     *error_class = ERROR_CLASS_PROPERTY;
                     *error_code = ERROR_CODE_VALUE_OUT_OF_RANGE;
                 } else {
+                    Device_Object_Name_Changed(OBJECT_BINARY_INPUT,
+                        object_instance);
                     sprintf(idx_cc,"%d",index);
                     idx_c = idx_cc;
-                    if(ctx) {
-                        ucix_add_option(ctx, "bacnet_bi", idx_c,
-                            "name", char_string->value);
-                        ucix_commit(ctx, "bacnet_bi");
-#if PRINT_ENABLED
-                    } else {
-                        fprintf(stderr,
-                            "Failed to open config file bacnet_bi\n");
-#endif
-                    }
+                    ucix_journal_add("bacnet_bi", idx_c,
+                        "name", CurrentBI->Object_Name, true);
                 }
             } else {
                 *error_class = ERROR_CLASS_PROPERTY;
@@ -808,6 +819,11 @@ bool Binary_Input_Present_Value_Set(
         CurrentBI->Present_Value = (uint8_t) value;
         CurrentBI->Priority_Array[priority - 1] = (uint8_t) value;
         CurrentBI->Changed = true;
+        handler_cov_object_changed(OBJECT_BINARY_INPUT, object_instance);
+#if defined(INTRINSIC_REPORTING)
+        Device_Intrinsic_Reporting_Request(OBJECT_BINARY_INPUT,
+            object_instance);
+#endif
         status = true;
     }
     return status;
@@ -845,18 +861,11 @@ bool Binary_Input_Polarity_Set(
         CurrentBI = &BI_Descr[index];
         CurrentBI->Polarity=polarity;
         CurrentBI->Changed = true;
+        handler_cov_object_changed(OBJECT_BINARY_INPUT, object_instance);
         sprintf(idx_cc,"%d",index);
         idx_c = idx_cc;
-        if(ctx) {
-            ucix_add_option_int(ctx, "bacnet_bi", idx_c,
-                "polarity", polarity);
-            ucix_commit(ctx, "bacnet_bi");
-#if PRINT_ENABLED
-        } else {
-            fprintf(stderr,
-                "Failed to open config file bacnet_bi\n");
-#endif
-        }
+        ucix_journal_add_int("bacnet_bi", idx_c,
+            "polarity", polarity, true);
     }
 
     return status;
@@ -891,16 +900,8 @@ static bool Binary_Input_Active_Text_Write(
                 } else {
                     sprintf(idx_cc,"%d",index);
                     idx_c = idx_cc;
-                    if(ctx) {
-                        ucix_add_option(ctx, "bacnet_bi", idx_c,
-                            "active", char_string->value);
-                        ucix_commit(ctx, "bacnet_bi");
-#if PRINT_ENABLED
-                    } else {
-                        fprintf(stderr,
-                            "Failed to open config file bacnet_bi\n");
-#endif
-                    }
+                    ucix_journal_add("bacnet_bi", idx_c,
+                        "active", char_string->value, true);
                 }
             } else {
                 *error_class = ERROR_CLASS_PROPERTY;
@@ -944,16 +945,8 @@ static bool Binary_Input_Inactive_Text_Write(
                 } else {
                     sprintf(idx_cc,"%d",index);
                     idx_c = idx_cc;
-                    if(ctx) {
-                        ucix_add_option(ctx, "bacnet_bi", idx_c,
-                            "inactive", char_string->value);
-                        ucix_commit(ctx, "bacnet_bi");
-#if PRINT_ENABLED
-                    } else {
-                        fprintf(stderr,
-                            "Failed to open config file bacnet_bi\n");
-#endif
-                    }
+                    ucix_journal_add("bacnet_bi", idx_c,
+                        "inactive", char_string->value, true);
                 }
             } else {
                 *error_class = ERROR_CLASS_PROPERTY;
@@ -1270,7 +1263,6 @@ bool Binary_Input_Write_Property(
     uint8_t level = BINARY_LEVEL_NULL;
     int len = 0;
     BACNET_APPLICATION_DATA_VALUE value;
-    ctx = ucix_init("bacnet_bi");
 #if defined(INTRINSIC_REPORTING)
     const char index_c[32] = "";
 #endif
@@ -1358,14 +1350,13 @@ bool Binary_Input_Write_Property(
                 if (Binary_Input_Present_Value_Set(wp_data->object_instance,
                         value.type.Unsigned_Int, wp_data->priority)) {
                     status = true;
-                    ucix_add_option_int(ctx, "bacnet_bi", idx_c, "value",
-                        value.type.Unsigned_Int);
+                    ucix_journal_add_int("bacnet_bi", idx_c, "value",
+                        value.type.Unsigned_Int, false);
                     cur_value_time = time(NULL);
-                    ucix_add_option_int(ctx, "bacnet_bi", idx_c, "value_time",
-                        cur_value_time);
-                    ucix_add_option_int(ctx, "bacnet_bi", idx_c, "write",
-                        1);
-                    ucix_save_state(ctx, "bacnet_bi");
+                    ucix_journal_add_int("bacnet_bi", idx_c, "value_time",
+                        cur_value_time, false);
+                    ucix_journal_add_int("bacnet_bi", idx_c, "write",
+                        1, false);
                 } else if (wp_data->priority == 6) {
                     /* Command priority 6 is reserved for use by Minimum On/Off
                        algorithm and may not be used for other purposes in any
@@ -1399,14 +1390,13 @@ bool Binary_Input_Write_Property(
                                 break;
                             }
                         }
-                        ucix_add_option_int(ctx, "bacnet_bi", idx_c, "value",
-                            pvalue);
+                        ucix_journal_add_int("bacnet_bi", idx_c, "value",
+                            pvalue, false);
                         cur_value_time = time(NULL);
-                        ucix_add_option_int(ctx, "bacnet_bi", idx_c, "value_time",
-                            cur_value_time);
-                        ucix_add_option_int(ctx, "bacnet_bi", idx_c, "write",
-                            1);
-                        ucix_save_state(ctx, "bacnet_bi");
+                        ucix_journal_add_int("bacnet_bi", idx_c, "value_time",
+                            cur_value_time, false);
+                        ucix_journal_add_int("bacnet_bi", idx_c, "write",
+                            1, false);
                     } else {
                         status = false;
                         wp_data->error_class = ERROR_CLASS_PROPERTY;
@@ -1473,9 +1463,8 @@ bool Binary_Input_Write_Property(
                     int array_index = 0;
                     alarm_value = wp_data->application_data[array_index];
                     CurrentBI->Alarm_Value = alarm_value;
-                    ucix_add_option_int(ctx, "bacnet_bi", idx_c, "alarmstate",
-                        alarm_value);
-                    ucix_commit(ctx, "bacnet_bi");
+                    ucix_journal_add_int("bacnet_bi", idx_c, "alarmstate",
+                        alarm_value, true);
                 }
             }
         case PROP_TIME_DELAY:
@@ -1486,8 +1475,7 @@ bool Binary_Input_Write_Property(
             if (status) {
                 CurrentBI->Time_Delay = value.type.Unsigned_Int;
                 CurrentBI->Remaining_Time_Delay = CurrentBI->Time_Delay;
-                ucix_add_option_int(ctx, "bacnet_bi", index_c, "time_delay", value.type.Unsigned_Int);
-                ucix_commit(ctx, "bacnet_bi");
+                ucix_journal_add_int("bacnet_bi", index_c, "time_delay", value.type.Unsigned_Int, true);
             }
             break;
 
@@ -1498,8 +1486,7 @@ bool Binary_Input_Write_Property(
 
             if (status) {
                 CurrentBI->Notification_Class = value.type.Unsigned_Int;
-                ucix_add_option_int(ctx, "bacnet_bi", index_c, "nc", value.type.Unsigned_Int);
-                ucix_commit(ctx, "bacnet_bi");
+                ucix_journal_add_int("bacnet_bi", index_c, "nc", value.type.Unsigned_Int, true);
             }
             break;
 
@@ -1511,8 +1498,7 @@ bool Binary_Input_Write_Property(
             if (status) {
                 if (value.type.Bit_String.bits_used == 3) {
                     CurrentBI->Event_Enable = value.type.Bit_String.value[0];
-                    ucix_add_option_int(ctx, "bacnet_bi", index_c, "event", value.type.Bit_String.value[0]);
-                    ucix_commit(ctx, "bacnet_bi");
+                    ucix_journal_add_int("bacnet_bi", index_c, "event", value.type.Bit_String.value[0], true);
                 } else {
                     wp_data->error_class = ERROR_CLASS_PROPERTY;
                     wp_data->error_code = ERROR_CODE_VALUE_OUT_OF_RANGE;
@@ -1589,7 +1575,12 @@ bool Binary_Input_Write_Property(
             wp_data->error_code = ERROR_CODE_UNKNOWN_PROPERTY;
             break;
     }
-    ucix_cleanup(ctx);
+#if defined(INTRINSIC_REPORTING)
+    if (status) {
+        Device_Intrinsic_Reporting_Request(OBJECT_BINARY_INPUT,
+            wp_data->object_instance);
+    }
+#endif
     return status;
 }
 
@@ -1815,6 +1806,15 @@ void Binary_Input_Intrinsic_Reporting(
                     break;
             }
         }
+        /* the object may have joined or left the event summary */
+        handler_event_summary_update(OBJECT_BINARY_INPUT, index);
+    }
+    /* evaluate again while the time delay is running, and after an
+       AckNotification that skipped the event state checks */
+    if ((CurrentBI->Remaining_Time_Delay != CurrentBI->Time_Delay) ||
+        (SendNotify && (event_data.notifyType == NOTIFY_ACK_NOTIFICATION))) {
+        Device_Intrinsic_Reporting_Request(OBJECT_BINARY_INPUT,
+            object_instance);
     }
 #endif /* defined(INTRINSIC_REPORTING) */
 }
@@ -1989,6 +1989,10 @@ int Binary_Input_Alarm_Ack(
     CurrentBI->Ack_notify_data.bSendAckNotify = true;
     CurrentBI->Ack_notify_data.EventState = alarmack_data->eventStateAcked;
 
+    Device_Intrinsic_Reporting_Request(OBJECT_BINARY_INPUT,
+        alarmack_data->eventObjectIdentifier.instance);
+    handler_event_summary_update(OBJECT_BINARY_INPUT, index);
+
     /* Return OK */
     return 1;
 }
@@ -43,6 +43,7 @@
 #include "handlers.h"
 #include "bo.h"
 #include "ucix.h"
+#include "keylist.h"
 
 /* number of demo objects */
 #ifndef MAX_BINARY_OUTPUTS
@@ -61,6 +62,9 @@ unsigned max_binary_outputs_int = 0;
 
 BINARY_OUTPUT_DESCR BO_Descr[MAX_BINARY_OUTPUTS];
 
+/* sorted Instance to BO_Descr[] slot lookup, rebuilt by Binary_Output_Init */
+static OS_Keylist BO_Instance_List = NULL;
+
 /* These three arrays are used by the ReadPropertyMultiple handler */
 static const int Binary_Output_Properties_Required[] = {
     PROP_OBJECT_IDENTIFIER,
@@ -136,6 +140,25 @@ void Binary_Output_Load_UCI_List(const char *sec_idx,
     return;
 }
 
+/* (re)build the Instance lookup from the configured BO_Descr[] slots */
+static void Binary_Output_Instance_List_Init(
+    void)
+{
+    unsigned i;
+
+    if (BO_Instance_List) {
+        Keylist_Delete(BO_Instance_List);
+    }
+    BO_Instance_List = Keylist_Create();
+    for (i = 0; i < max_binary_outputs_int; i++) {
+        /* keep the first slot of a duplicated instance, like a scan would */
+        if (!Keylist_Data(BO_Instance_List, BO_Descr[i].Instance)) {
+            Keylist_Data_Add(BO_Instance_List, BO_Descr[i].Instance,
+                &BO_Descr[i]);
+        }
+    }
+}
+
 /*
  * Things to do when starting up the stack for Binary Output.
  * Should be called whenever we reset the device or power it up
@@ -322,6 +345,10 @@ void Binary_Output_Init(
                 max_binary_outputs_int = i;
             }
         }
+        Binary_Output_Instance_List_Init();
+#if defined(INTRINSIC_REPORTING)
+        handler_event_summary_reset(OBJECT_BINARY_OUTPUT);
+#endif
 #if PRINT_ENABLED
         fprintf(stderr, "max_binary_outputs %i\n", max_binary_outputs_int);
 #endif
@@ -331,21 +358,18 @@ void Binary_Output_Init(
     return;
 }
 
-/* we simply have 0-n object instances.  Yours might be */
-/* more complex, and then you need to return the index */
-/* that correlates to the correct instance number */
+/* Instances come from the uci section names and may be sparse, */
+/* so the slot is found with a binary search of the sorted list */
 unsigned Binary_Output_Instance_To_Index(
     uint32_t object_instance)
 {
     BINARY_OUTPUT_DESCR *CurrentBO;
-    int index,i;
-    index = max_binary_outputs_int;
-    for (i = 0; i < index; i++) {
-    	CurrentBO = &BO_Descr[i];
-    	if (CurrentBO->Instance == object_instance) {
-    		return i;
-    	}
+
+    CurrentBO = Keylist_Data(BO_Instance_List, object_instance);
+    if (CurrentBO) {
+        return (unsigned) (CurrentBO - &BO_Descr[0]);
     }
+
     return MAX_BINARY_OUTPUTS;
 }
 
@@ -470,6 +494,7 @@ void Binary_Output_Out_Of_Service_Set(
         CurrentBO = &BO_Descr[index];
         if (CurrentBO->Out_Of_Service != value) {
             CurrentBO->Changed = true;
+            handler_cov_object_changed(OBJECT_BINARY_OUTPUT, object_instance);
         }
         CurrentBO->Out_Of_Service = value;
     }
@@ -584,16 +609,8 @@ static bool Binary_Output_Description_Write(
                 } else {
                     sprintf(idx_cc,"%d",index);
                     idx_c = idx_cc;
-                    if(ctx) {
-                        ucix_add_option(ctx, "bacnet_bo", idx_c,
-                            "description", char_string->value);
-                        ucix_commit(ctx, "bacnet_bo");
-#if PRINT_ENABLED
-                    } else {
-                        fprintf(stderr,
-                            "Failed to open config file bacnet_bo\n");
-#endif
-                    }
+                    ucix_journal_add("bacnet_bo", idx_c,
+                        "description", CurrentBO->Object_Description, true);
                 }
             } else {
                 *error_class = ERROR_CLASS_PROPERTY;
@@ -687,18 +704,12 @@ static bool Binary_Output_Object_Name_Write(
                     *error_class = ERROR_CLASS_PROPERTY;
                     *error_code = ERROR_CODE_VALUE_OUT_OF_RANGE;
                 } else {
+                    Device_Object_Name_Changed(OBJECT_BINARY_OUTPUT,
+                        object_instance);
                     sprintf(idx_cc,"%d",index);
                     idx_c = idx_cc;
-                    if(ctx) {
-                        ucix_add_option(ctx, "bacnet_bo", idx_c,
-                            "name", char_string->value);
-                        ucix_commit(ctx, "bacnet_bo");
-#if PRINT_ENABLED
-                    } else {
-                        fprintf(stderr,
-                            "Failed to open config file bacnet_bo\n");
-#endif
-                    }
+                    ucix_journal_add("bacnet_bo", idx_c,
+                        "name", CurrentBO->Object_Name, true);
                 }
             } else {
                 *error_class = ERROR_CLASS_PROPERTY;
@@ -819,6 +830,11 @@ bool Binary_Output_Present_Value_Set(
                 CurrentBO->Priority_Array[15] = (uint8_t) value;
             }
             CurrentBO->Changed = true;
+            handler_cov_object_changed(OBJECT_BINARY_OUTPUT, object_instance);
+#if defined(INTRINSIC_REPORTING)
+            Device_Intrinsic_Reporting_Request(OBJECT_BINARY_OUTPUT,
+                object_instance);
+#endif
             status = true;
         }
     }
@@ -857,18 +873,11 @@ bool Binary_Output_Polarity_Set(
         CurrentBO = &BO_Descr[index];
         CurrentBO->Polarity=polarity;
         CurrentBO->Changed = true;
+        handler_cov_object_changed(OBJECT_BINARY_OUTPUT, object_instance);
         sprintf(idx_cc,"%d",index);
         idx_c = idx_cc;
-        if(ctx) {
-            ucix_add_option_int(ctx, "bacnet_bo", idx_c,
-                "polarity", polarity);
-            ucix_commit(ctx, "bacnet_bo");
-#if PRINT_ENABLED
-        } else {
-            fprintf(stderr,
-                "Failed to open config file bacnet_bo\n");
-#endif
-        }
+        ucix_journal_add_int("bacnet_bo", idx_c,
+            "polarity", polarity, true);
     }
 
     return status;
@@ -903,16 +912,8 @@ static bool Binary_Output_Active_Text_Write(
                 } else {
                     sprintf(idx_cc,"%d",index);
                     idx_c = idx_cc;
-                    if(ctx) {
-                        ucix_add_option(ctx, "bacnet_bo", idx_c,
-                            "active", char_string->value);
-                        ucix_commit(ctx, "bacnet_bo");
-#if PRINT_ENABLED
-                    } else {
-                        fprintf(stderr,
-                            "Failed to open config file bacnet_bo\n");
-#endif
-                    }
+                    ucix_journal_add("bacnet_bo", idx_c,
+                        "active", char_string->value, true);
                 }
             } else {
                 *error_class = ERROR_CLASS_PROPERTY;
@@ -956,16 +957,8 @@ static bool Binary_Output_Inactive_Text_Write(
                 } else {
                     sprintf(idx_cc,"%d",index);
                     idx_c = idx_cc;
-                    if(ctx) {
-                        ucix_add_option(ctx, "bacnet_bo", idx_c,
-                            "inactive", char_string->value);
-                        ucix_commit(ctx, "bacnet_bo");
-#if PRINT_ENABLED
-                    } else {
-                        fprintf(stderr,
-                            "Failed to open config file bacnet_bo\n");
-#endif
-                    }
+                    ucix_journal_add("bacnet_bo", idx_c,
+                        "inactive", char_string->value, true);
                 }
             } else {
                 *error_class = ERROR_CLASS_PROPERTY;
@@ -1289,7 +1282,6 @@ bool Binary_Output_Write_Property(
     uint8_t level = BINARY_LEVEL_NULL;
     int len = 0;
     BACNET_APPLICATION_DATA_VALUE value;
-    ctx = ucix_init("bacnet_bo");
 #if defined(INTRINSIC_REPORTING)
     const char index_c[32] = "";
 #endif
@@ -1377,14 +1369,13 @@ bool Binary_Output_Write_Property(
                 if (Binary_Output_Present_Value_Set(wp_data->object_instance,
                         value.type.Unsigned_Int, wp_data->priority)) {
                     status = true;
-                    ucix_add_option_int(ctx, "bacnet_bo", idx_c, "value",
-                        value.type.Unsigned_Int);
+                    ucix_journal_add_int("bacnet_bo", idx_c, "value",
+                        value.type.Unsigned_Int, false);
                     cur_value_time = time(NULL);
-                    ucix_add_option_int(ctx, "bacnet_bo", idx_c, "value_time",
-                        cur_value_time);
-                    ucix_add_option_int(ctx, "bacnet_bo", idx_c, "write",
-                        1);
-                    ucix_save_state(ctx, "bacnet_bo");
+                    ucix_journal_add_int("bacnet_bo", idx_c, "value_time",
+                        cur_value_time, false);
+                    ucix_journal_add_int("bacnet_bo", idx_c, "write",
+                        1, false);
                 } else if (wp_data->priority == 6) {
                     /* Command priority 6 is reserved for use by Minimum On/Off
                        algorithm and may not be used for other purposes in any
@@ -1418,14 +1409,13 @@ bool Binary_Output_Write_Property(
                                 break;
                             }
                         }
-                        ucix_add_option_int(ctx, "bacnet_bo", idx_c, "value",
-                            pvalue);
+                        ucix_journal_add_int("bacnet_bo", idx_c, "value",
+                            pvalue, false);
                         cur_value_time = time(NULL);
-                        ucix_add_option_int(ctx, "bacnet_bo", idx_c, "value_time",
-                            cur_value_time);
-                        ucix_add_option_int(ctx, "bacnet_bo", idx_c, "write",
-                            1);
-                        ucix_save_state(ctx, "bacnet_bo");
+                        ucix_journal_add_int("bacnet_bo", idx_c, "value_time",
+                            cur_value_time, false);
+                        ucix_journal_add_int("bacnet_bo", idx_c, "write",
+                            1, false);
                     } else {
                         status = false;
                         wp_data->error_class = ERROR_CLASS_PROPERTY;
@@ -1492,9 +1482,8 @@ bool Binary_Output_Write_Property(
                     int array_index = 0;
                     fb_value = wp_data->application_data[array_index];
                     CurrentBO->Feedback_Value = fb_value;
-                    ucix_add_option_int(ctx, "bacnet_bo", idx_c, "fb_value",
-                        fb_value);
-                    ucix_commit(ctx, "bacnet_bo");
+                    ucix_journal_add_int("bacnet_bo", idx_c, "fb_value",
+                        fb_value, true);
                 }
             }
         case PROP_TIME_DELAY:
@@ -1505,8 +1494,7 @@ bool Binary_Output_Write_Property(
             if (status) {
                 CurrentBO->Time_Delay = value.type.Unsigned_Int;
                 CurrentBO->Remaining_Time_Delay = CurrentBO->Time_Delay;
-                ucix_add_option_int(ctx, "bacnet_bo", index_c, "time_delay", value.type.Unsigned_Int);
-                ucix_commit(ctx, "bacnet_bo");
+                ucix_journal_add_int("bacnet_bo", index_c, "time_delay", value.type.Unsigned_Int, true);
             }
             break;
 
@@ -1517,8 +1505,7 @@ bool Binary_Output_Write_Property(
 
             if (status) {
                 CurrentBO->Notification_Class = value.type.Unsigned_Int;
-                ucix_add_option_int(ctx, "bacnet_bo", index_c, "nc", value.type.Unsigned_Int);
-                ucix_commit(ctx, "bacnet_bo");
+                ucix_journal_add_int("bacnet_bo", index_c, "nc", value.type.Unsigned_Int, true);
             }
             break;
 
@@ -1530,8 +1517,7 @@ bool Binary_Output_Write_Property(
             if (status) {
                 if (value.type.Bit_String.bits_used == 3) {
                     CurrentBO->Event_Enable = value.type.Bit_String.value[0];
-                    ucix_add_option_int(ctx, "bacnet_bo", index_c, "event", value.type.Bit_String.value[0]);
-                    ucix_commit(ctx, "bacnet_bo");
+                    ucix_journal_add_int("bacnet_bo", index_c, "event", value.type.Bit_String.value[0], true);
                 } else {
                     wp_data->error_class = ERROR_CLASS_PROPERTY;
                     wp_data->error_code = ERROR_CODE_VALUE_OUT_OF_RANGE;
@@ -1608,7 +1594,12 @@ bool Binary_Output_Write_Property(
             wp_data->error_code = ERROR_CODE_UNKNOWN_PROPERTY;
             break;
     }
-    ucix_cleanup(ctx);
+#if defined(INTRINSIC_REPORTING)
+    if (status) {
+        Device_Intrinsic_Reporting_Request(OBJECT_BINARY_OUTPUT,
+            wp_data->object_instance);
+    }
+#endif
     return status;
 }
 
@@ -1832,6 +1823,15 @@ void Binary_Output_Intrinsic_Reporting(
                      break;
             }
         }
+        /* the object may have joined or left the event summary */
+        handler_event_summary_update(OBJECT_BINARY_OUTPUT, index);
+    }
+    /* evaluate again while the time delay is running, and after an
+       AckNotification that skipped the event state checks */
+    if ((CurrentBO->Remaining_Time_Delay != CurrentBO->Time_Delay) ||
+        (SendNotify && (event_data.notifyType == NOTIFY_ACK_NOTIFICATION))) {
+        Device_Intrinsic_Reporting_Request(OBJECT_BINARY_OUTPUT,
+            object_instance);
     }
 #endif /* defined(INTRINSIC_REPORTING) */
 }
@@ -2007,6 +2007,10 @@ int Binary_Output_Alarm_Ack(
     CurrentBO->Ack_notify_data.bSendAckNotify = true;
     CurrentBO->Ack_notify_data.EventState = alarmack_data->eventStateAcked;
 
+    Device_Intrinsic_Reporting_Request(OBJECT_BINARY_OUTPUT,
+        alarmack_data->eventObjectIdentifier.instance);
+    handler_event_summary_update(OBJECT_BINARY_OUTPUT, index);
+
     /* Return OK */
     return 1;
 }
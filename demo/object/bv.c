@@ -43,6 +43,7 @@
 #include "handlers.h"
 #include "bv.h"
 #include "ucix.h"
+#include "keylist.h"
 
 /* number of demo objects */
 #ifndef MAX_BINARY_VALUES
@@ -61,6 +62,9 @@ unsigned max_binary_values_int = 0;
 
 BINARY_VALUE_DESCR BV_Descr[MAX_BINARY_VALUES];
 
+/* sorted Instance to BV_Descr[] slot lookup, rebuilt by Binary_Value_Init */
+static OS_Keylist BV_Instance_List = NULL;
+
 /* These three arrays are used by the ReadPropertyMultiple handler */
 static const int Binary_Value_Properties_Required[] = {
     PROP_OBJECT_IDENTIFIER,
@@ -133,6 +137,25 @@ void Binary_Value_Load_UCI_List(const char *sec_idx,
     return;
 }
 
+/* (re)build the Instance lookup from the configured BV_Descr[] slots */
+static void Binary_Value_Instance_List_Init(
+    void)
+{
+    unsigned i;
+
+    if (BV_Instance_List) {
+        Keylist_Delete(BV_Instance_List);
+    }
+    BV_Instance_List = Keylist_Create();
+    for (i = 0; i < max_binary_values_int; i++) {
+        /* keep the first slot of a duplicated instance, like a scan would */
+        if (!Keylist_Data(BV_Instance_List, BV_Descr[i].Instance)) {
+            Keylist_Data_Add(BV_Instance_List, BV_Descr[i].Instance,
+                &BV_Descr[i]);
+        }
+    }
+}
+
 /*
  * Things to do when starting up the stack for Binary Value.
  * Should be called whenever we reset the device or power it up
@@ -317,6 +340,10 @@ void Binary_Value_Init(
                 max_binary_values_int = i;
             }
         }
+        Binary_Value_Instance_List_Init();
+#if defined(INTRINSIC_REPORTING)
+        handler_event_summary_reset(OBJECT_BINARY_VALUE);
+#endif
 #if PRINT_ENABLED
         fprintf(stderr, "max_binary_values %i\n", max_binary_values_int);
 #endif
@@ -326,21 +353,18 @@ void Binary_Value_Init(
     return;
 }
 
-/* we simply have 0-n object instances.  Yours might be */
-/* more complex, and then you need to return the index */
-/* that correlates to the correct instance number */
+/* Instances come from the uci section names and may be sparse, */
+/* so the slot is found with a binary search of the sorted list */
 unsigned Binary_Value_Instance_To_Index(
     uint32_t object_instance)
 {
     BINARY_VALUE_DESCR *CurrentBV;
-    int index,i;
-    index = max_binary_values_int;
-    for (i = 0; i < index; i++) {
-    	CurrentBV = &BV_Descr[i];
-    	if (CurrentBV->Instance == object_instance) {
-    		return i;
-    	}
+
+    CurrentBV = Keylist_Data(BV_Instance_List, object_instance);
+    if (CurrentBV) {
+        return (unsigned) (CurrentBV - &BV_Descr[0]);
     }
+
     return MAX_BINARY_VALUES;
 }
 
@@ -465,6 +489,7 @@ void Binary_Value_Out_Of_Service_Set(
         CurrentBV = &BV_Descr[index];
         if (CurrentBV->Out_Of_Service != value) {
             CurrentBV->Changed = true;
+            handler_cov_object_changed(OBJECT_BINARY_VALUE, object_instance);
         }
         CurrentBV->Out_Of_Service = value;
     }
@@ -579,16 +604,8 @@ static bool Binary_Value_Description_Write(
                 } else {
                     sprintf(idx_cc,"%d",index);
                     idx_c = idx_cc;
-                    if(ctx) {
-                        ucix_add_option(ctx, "bacnet_bv", idx_c,
-                            "description", char_string->value);
-                        ucix_commit(ctx, "bacnet_bv");
-#if PRINT_ENABLED
-                    } else {
-                        fprintf(stderr,
-                            "Failed to open config file bacnet_bv\n");
-#endif
-                    }
+                    ucix_journal_add("bacnet_bv", idx_c,
+                        "description", CurrentBV->Object_Description, true);
                 }
             } else {
                 *error_class = ERROR_CLASS_PROPERTY;
@@ -682,18 +699,12 @@ static bool Binary_Value_Object_Name_Write(
                     *error_class = ERROR_CLASS_PROPERTY;
                     *error_code = ERROR_CODE_VALUE_OUT_OF_RANGE;
                 } else {
+                    Device_Object_Name_Changed(OBJECT_BINARY_VALUE,
+                        object_instance);
                     sprintf(idx_cc,"%d",index);
                     idx_c = idx_cc;
-                    if(ctx) {
-                        ucix_add_option(ctx, "bacnet_bv", idx_c,
-                            "name", char_string->value);
-                        ucix_commit(ctx, "bacnet_bv");
-#if PRINT_ENABLED
-                    } else {
-                        fprintf(stderr,
-                            "Failed to open config file bacnet_bv\n");
-#endif
-                    }
+                    ucix_journal_add("bacnet_bv", idx_c,
+                        "name", CurrentBV->Object_Name, true);
                 }
             } else {
                 *error_class = ERROR_CLASS_PROPERTY;
@@ -807,6 +818,11 @@ bool Binary_Value_Present_Value_Set(
         CurrentBV->Present_Value = (uint8_t) value;
         CurrentBV->Priority_Array[priority - 1] = (uint8_t) value;
         CurrentBV->Changed = true;
+        handler_cov_object_changed(OBJECT_BINARY_VALUE, object_instance);
+#if defined(INTRINSIC_REPORTING)
+        Device_Intrinsic_Reporting_Request(OBJECT_BINARY_VALUE,
+            object_instance);
+#endif
         status = true;
     }
     return status;
@@ -844,18 +860,11 @@ bool Binary_Value_Polarity_Set(
         CurrentBV = &BV_Descr[index];
         CurrentBV->Polarity=polarity;
         CurrentBV->Changed = true;
+        handler_cov_object_changed(OBJECT_BINARY_VALUE, object_instance);
         sprintf(idx_cc,"%d",index);
         idx_c = idx_cc;
-        if(ctx) {
-            ucix_add_option_int(ctx, "bacnet_bv", idx_c,
-                "polarity", polarity);
-            ucix_commit(ctx, "bacnet_bv");
-#if PRINT_ENABLED
-        } else {
-            fprintf(stderr,
-                "Failed to open config file bacnet_bv\n");
-#endif
-        }
+        ucix_journal_add_int("bacnet_bv", idx_c,
+            "polarity", polarity, true);
     }
 
     return status;
@@ -890,16 +899,8 @@ static bool Binary_Value_Active_Text_Write(
                 } else {
                     sprintf(idx_cc,"%d",index);
                     idx_c = idx_cc;
-                    if(ctx) {
-                        ucix_add_option(ctx, "bacnet_bv", idx_c,
-                            "active", char_string->value);
-                        ucix_commit(ctx, "bacnet_bv");
-#if PRINT_ENABLED
-                    } else {
-                        fprintf(stderr,
-                            "Failed to open config file bacnet_bv\n");
-#endif
-                    }
+                    ucix_journal_add("bacnet_bv", idx_c,
+                        "active", char_string->value, true);
                 }
             } else {
                 *error_class = ERROR_CLASS_PROPERTY;
@@ -943,16 +944,8 @@ static bool Binary_Value_Inactive_Text_Write(
                 } else {
                     sprintf(idx_cc,"%d",index);
                     idx_c = idx_cc;
-                    if(ctx) {
-                        ucix_add_option(ctx, "bacnet_bv", idx_c,
-                            "inactive", char_string->value);
-                        ucix_commit(ctx, "bacnet_bv");
-#if PRINT_ENABLED
-                    } else {
-                        fprintf(stderr,
-                            "Failed to open config file bacnet_bv\n");
-#endif
-                    }
+                    ucix_journal_add("bacnet_bv", idx_c,
+                        "inactive", char_string->value, true);
                 }
             } else {
                 *error_class = ERROR_CLASS_PROPERTY;
@@ -1269,7 +1262,6 @@ bool Binary_Value_Write_Property(
     uint8_t level = BINARY_LEVEL_NULL;
     int len = 0;
     BACNET_APPLICATION_DATA_VALUE value;
-    ctx = ucix_init("bacnet_bv");
 #if defined(INTRINSIC_REPORTING)
     const char index_c[32] = "";
 #endif
@@ -1357,14 +1349,13 @@ bool Binary_Value_Write_Property(
                 if (Binary_Value_Present_Value_Set(wp_data->object_instance,
                         value.type.Unsigned_Int, wp_data->priority)) {
                     status = true;
-                    ucix_add_option_int(ctx, "bacnet_bv", idx_c, "value",
-                        value.type.Unsigned_Int);
+                    ucix_journal_add_int("bacnet_bv", idx_c, "value",
+                        value.type.Unsigned_Int, false);
                     cur_value_time = time(NULL);
-                    ucix_add_option_int(ctx, "bacnet_bv", idx_c, "value_time",
-                        cur_value_time);
-                    ucix_add_option_int(ctx, "bacnet_bv", idx_c, "write",
-                        1);
-                    ucix_save_state(ctx, "bacnet_bv");
+                    ucix_journal_add_int("bacnet_bv", idx_c, "value_time",
+                        cur_value_time, false);
+                    ucix_journal_add_int("bacnet_bv", idx_c, "write",
+                        1, false);
                 } else if (wp_data->priority == 6) {
                     /* Command priority 6 is reserved for use by Minimum On/Off
                        algorithm and may not be used for other purposes in any
@@ -1398,14 +1389,13 @@ bool Binary_Value_Write_Property(
                                 break;
                             }
                         }
-                        ucix_add_option_int(ctx, "bacnet_bv", idx_c, "value",
-                            pvalue);
+                        ucix_journal_add_int("bacnet_bv", idx_c, "value",
+                            pvalue, false);
                         cur_value_time = time(NULL);
-                        ucix_add_option_int(ctx, "bacnet_bv", idx_c, "value_time",
-                            cur_value_time);
-                        ucix_add_option_int(ctx, "bacnet_bv", idx_c, "write",
-                            1);
-                        ucix_save_state(ctx, "bacnet_bv");
+                        ucix_journal_add_int("bacnet_bv", idx_c, "value_time",
+                            cur_value_time, false);
+                        ucix_journal_add_int("bacnet_bv", idx_c, "write",
+                            1, false);
                     } else {
                         status = false;
                         wp_data->error_class = ERROR_CLASS_PROPERTY;
@@ -1472,9 +1462,8 @@ bool Binary_Value_Write_Property(
                     int array_index = 0;
                     alarm_value = wp_data->application_data[array_index];
                     CurrentBV->Alarm_Value = alarm_value;
-                    ucix_add_option_int(ctx, "bacnet_bv", idx_c, "alarmstate",
-                        alarm_value);
-                    ucix_commit(ctx, "bacnet_bv");
+                    ucix_journal_add_int("bacnet_bv", idx_c, "alarmstate",
+                        alarm_value, true);
                 }
             }
         case PROP_TIME_DELAY:
@@ -1485,8 +1474,7 @@ bool Binary_Value_Write_Property(
             if (status) {
                 CurrentBV->Time_Delay = value.type.Unsigned_Int;
                 CurrentBV->Remaining_Time_Delay = CurrentBV->Time_Delay;
-                ucix_add_option_int(ctx, "bacnet_bv", index_c, "time_delay", value.type.Unsigned_Int);
-                ucix_commit(ctx, "bacnet_bv");
+                ucix_journal_add_int("bacnet_bv", index_c, "time_delay", value.type.Unsigned_Int, true);
             }
             break;
 
@@ -1497,8 +1485,7 @@ bool Binary_Value_Write_Property(
 
             if (status) {
                 CurrentBV->Notification_Class = value.type.Unsigned_Int;
-                ucix_add_option_int(ctx, "bacnet_bv", index_c, "nc", value.type.Unsigned_Int);
-                ucix_commit(ctx, "bacnet_bv");
+                ucix_journal_add_int("bacnet_bv", index_c, "nc", value.type.Unsigned_Int, true);
             }
             break;
 
@@ -1510,8 +1497,7 @@ bool Binary_Value_Write_Property(
             if (status) {
                 if (value.type.Bit_String.bits_used == 3) {
                     CurrentBV->Event_Enable = value.type.Bit_String.value[0];
-                    ucix_add_option_int(ctx, "bacnet_bv", index_c, "event", value.type.Bit_String.value[0]);
-                    ucix_commit(ctx, "bacnet_bv");
+                    ucix_journal_add_int("bacnet_bv", index_c, "event", value.type.Bit_String.value[0], true);
                 } else {
                     wp_data->error_class = ERROR_CLASS_PROPERTY;
                     wp_data->error_code = ERROR_CODE_VALUE_OUT_OF_RANGE;
@@ -1588,7 +1574,12 @@ bool Binary_Value_Write_Property(
             wp_data->error_code = ERROR_CODE_UNKNOWN_PROPERTY;
             break;
     }
-    ucix_cleanup(ctx);
+#if defined(INTRINSIC_REPORTING)
+    if (status) {
+        Device_Intrinsic_Reporting_Request(OBJECT_BINARY_VALUE,
+            wp_data->object_instance);
+    }
+#endif
     return status;
 }
 
@@ -1814,6 +1805,15 @@ void Binary_Value_Intrinsic_Reporting(
                     break;
             }
         }
+        /* the object may have joined or left the event summary */
+        handler_event_summary_update(OBJECT_BINARY_VALUE, index);
+    }
+    /* evaluate again while the time delay is running, and after an
+       AckNotification that skipped the event state checks */
+    if ((CurrentBV->Remaining_Time_Delay != CurrentBV->Time_Delay) ||
+        (SendNotify && (event_data.notifyType == NOTIFY_ACK_NOTIFICATION))) {
+        Device_Intrinsic_Reporting_Request(OBJECT_BINARY_VALUE,
+            object_instance);
     }
 #endif /* defined(INTRINSIC_REPORTING) */
 }
@@ -1989,6 +1989,10 @@ int Binary_Value_Alarm_Ack(
     CurrentBV->Ack_notify_data.bSendAckNotify = true;
     CurrentBV->Ack_notify_data.EventState = alarmack_data->eventStateAcked;
 
+    Device_Intrinsic_Reporting_Request(OBJECT_BINARY_VALUE,
+        alarmack_data->eventObjectIdentifier.instance);
+    handler_event_summary_update(OBJECT_BINARY_VALUE, index);
+
     /* Return OK */
     return 1;
 }
@@ -760,6 +760,10 @@ static const int Device_Properties_Optional[] = {
     PROP_DAYLIGHT_SAVINGS_STATUS,
     PROP_LOCATION,
     PROP_ACTIVE_COV_SUBSCRIPTIONS,
+#if MAX_SEGMENTS_ACCEPTED
+    PROP_MAX_SEGMENTS_ACCEPTED,
+    PROP_APDU_SEGMENT_TIMEOUT,
+#endif
 #if defined(BACNET_TIME_MASTER)
     PROP_TIME_SYNCHRONIZATION_RECIPIENTS,
     PROP_TIME_SYNCHRONIZATION_INTERVAL,
@@ -830,6 +834,30 @@ static uint32_t Interval_Offset_Minutes;
 /* Max_Info_Frames - rely on MS/TP subsystem, if there is one */
 /* Device_Address_Binding - required, but relies on binding cache */
 static uint32_t Database_Revision = 0;
+/* Object_List cache - a flat copy of the Object_Table walk so that
+   reading the Object_List is linear instead of quadratic. It is
+   rebuilt when Object_List_Generation moves on, which happens via
+   Device_Inc_Database_Revision whenever objects come or go. */
+static BACNET_OBJECT_ID *Object_List_Cache = NULL;
+static unsigned Object_List_Cache_Size = 0;
+static unsigned Object_List_Cache_Count = 0;
+static uint32_t Object_List_Cache_Generation = 0;
+static uint32_t Object_List_Generation = 1;
+/* Object_Name index - hash of the object name to the object identifier,
+   so duplicate name checks and Who-Has by name don't read every name.
+   It is rebuilt with the Object_List, and object name writes move the
+   entry of the object to its new name through Device_Object_Name_Changed,
+   which finds the entry by the object identifier in a second index. */
+struct object_name_node {
+    uint32_t hash;
+    BACNET_OBJECT_ID id;
+    struct object_name_node *next;
+    struct object_name_node *id_next;
+};
+static struct object_name_node **Object_Name_Index = NULL;
+static struct object_name_node **Object_Id_Index = NULL;
+static unsigned Object_Name_Index_Size = 0;
+static uint32_t Object_Name_Index_Generation = 0;
 /* Configuration_Files */
 /* Last_Restore_Time */
 /* Backup_Failure_Timeout */
@@ -915,6 +943,7 @@ bool Device_Set_Object_Name(
         status = characterstring_copy(&My_Object_Name, object_name);
         Device_Inc_Database_Revision();
 #if defined(BAC_UCI)
+        char uci_name[MAX_CHARACTER_STRING_BYTES];
         char *pEnv = getenv("UCI_SECTION");
         if (!pEnv) {
         	pEnv = "0";
@@ -925,16 +954,9 @@ bool Device_Set_Object_Name(
 #endif
         }
 
-        ctx = ucix_init("bacnet_dev");
-        if(ctx) {
-            ucix_add_option(ctx, "bacnet_dev", pEnv, "name", object_name->value);
-            ucix_commit(ctx, "bacnet_dev");
-            ucix_cleanup(ctx);
-#if PRINT_ENABLED
-        } else {
-            fprintf(stderr,  "Failed to open config file bacnet_dev\n");
-#endif
-        }
+        /* written to the package later, by ucix_journal_task() */
+        characterstring_ansi_copy(uci_name, sizeof(uci_name), object_name);
+        ucix_journal_add("bacnet_dev", pEnv, "name", uci_name, true);
 #endif /* defined(BAC_UCI) */
     }
 
@@ -1113,16 +1135,9 @@ bool Device_Set_Description(
 #endif
         }
 
-        ctx = ucix_init("bacnet_dev");
-        if(ctx) {
-            ucix_add_option(ctx, "bacnet_dev", pEnv, "description", name);
-            ucix_commit(ctx, "bacnet_dev");
-            ucix_cleanup(ctx);
-#if PRINT_ENABLED
-        } else {
-            fprintf(stderr,  "Failed to open config file bacnet_dev\n");
-#endif
-        }
+        /* written to the package later, by ucix_journal_task() */
+        ucix_journal_add("bacnet_dev", pEnv, "description", Description,
+            true);
 #endif /* defined(BAC_UCI) */
         status = true;
     }
@@ -1156,16 +1171,8 @@ bool Device_Set_Location(
 #endif
         }
 
-        ctx = ucix_init("bacnet_dev");
-        if(ctx) {
-            ucix_add_option(ctx, "bacnet_dev", pEnv, "location", name);
-            ucix_commit(ctx, "bacnet_dev");
-            ucix_cleanup(ctx);
-#if PRINT_ENABLED
-        } else {
-            fprintf(stderr,  "Failed to open config file bacnet_dev\n");
-#endif
-        }
+        /* written to the package later, by ucix_journal_task() */
+        ucix_journal_add("bacnet_dev", pEnv, "location", Location, true);
 #endif /* defined(BAC_UCI) */
         status = true;
     }
@@ -1188,7 +1195,12 @@ uint8_t Device_Protocol_Revision(
 BACNET_SEGMENTATION Device_Segmentation_Supported(
     void)
 {
+#if MAX_SEGMENTS_ACCEPTED
+    /* the TSM receives segmented messages and sends segmented acks */
+    return SEGMENTATION_BOTH;
+#else
     return SEGMENTATION_NONE;
+#endif
 }
 
 uint32_t Device_Database_Revision(
@@ -1201,6 +1213,7 @@ void Device_Set_Database_Revision(
     uint32_t revision)
 {
     Database_Revision = revision;
+    Object_List_Generation++;
 }
 
 /*
@@ -1212,14 +1225,24 @@ void Device_Inc_Database_Revision(
     void)
 {
     Database_Revision++;
+    Object_List_Generation++;
 }
 
-/** Get the total count of objects supported by this Device Object.
- * @note Since many network clients depend on the object list
- *       for discovery, it must be consistent!
+/** Get the generation of the Object_List.
+ * Anything that caches a view of the objects in this Device can compare
+ * the value it was built with against this one to know it is stale.
+ * @return The Object_List generation, bumped when the objects change.
+ */
+uint32_t Device_Object_List_Generation(
+    void)
+{
+    return Object_List_Generation;
+}
+
+/** Count the objects by asking each Object type in the Object_Table.
  * @return The count of objects, for all supported Object types.
  */
-unsigned Device_Object_List_Count(
+static unsigned Object_Table_Count(
     void)
 {
     unsigned count = 0; /* number of objects */
@@ -1237,17 +1260,16 @@ unsigned Device_Object_List_Count(
     return count;
 }
 
-/** Lookup the Object at the given array index in the Device's Object List.
- * Even though we don't keep a single linear array of objects in the Device,
- * this method acts as though we do and works through a virtual, concatenated
- * array of all of our object type arrays.
+/** Lookup the Object at the given array index by walking the Object_Table.
+ * This works through a virtual, concatenated array of all of our object
+ * type arrays, and is only used when the Object_List cache is unavailable.
  *
  * @param array_index [in] The desired array index (1 to N)
  * @param object_type [out] The object's type, if found.
  * @param instance [out] The object's instance number, if found.
  * @return True if found, else false.
  */
-bool Device_Object_List_Identifier(
+static bool Object_Table_Identifier(
     uint32_t array_index,
     int *object_type,
     uint32_t * instance)
@@ -1298,15 +1320,310 @@ bool Device_Object_List_Identifier(
     return status;
 }
 
-/** Determine if we have an object with the given object_name.
- * If the object_type and object_instance pointers are not null,
- * and the lookup succeeds, they will be given the resulting values.
- * @param object_name [in] The desired Object Name to look for.
- * @param object_type [out] The BACNET_OBJECT_TYPE of the matching Object.
- * @param object_instance [out] The object instance number of the matching Object.
- * @return True on success or else False if not found.
+/** Rebuild the Object_List cache if the objects have changed since it
+ * was last built.  Each object type is walked once, using its iterator
+ * when it has one, so the whole rebuild is O(N).
+ * @return True if the cache is usable, false if it could not be allocated.
  */
-bool Device_Valid_Object_Name(
+static bool Object_List_Cache_Refresh(
+    void)
+{
+    unsigned count = 0;
+    unsigned object_count = 0;
+    unsigned object_index = 0;
+    unsigned i = 0;
+    BACNET_OBJECT_ID *new_cache = NULL;
+    struct object_functions *pObject = NULL;
+
+    if (Object_List_Cache &&
+        (Object_List_Cache_Generation == Object_List_Generation)) {
+        return true;
+    }
+    count = Object_Table_Count();
+    if (count > Object_List_Cache_Size) {
+        new_cache =
+            realloc(Object_List_Cache, count * sizeof(BACNET_OBJECT_ID));
+        if (!new_cache) {
+            return false;
+        }
+        Object_List_Cache = new_cache;
+        Object_List_Cache_Size = count;
+    } else if (!Object_List_Cache) {
+        /* no objects yet - keep a small list so the cache is valid */
+        Object_List_Cache = calloc(1, sizeof(BACNET_OBJECT_ID));
+        if (!Object_List_Cache) {
+            return false;
+        }
+        Object_List_Cache_Size = 1;
+    }
+    Object_List_Cache_Count = 0;
+    pObject = Object_Table;
+    while (pObject->Object_Type < MAX_BACNET_OBJECT_TYPE) {
+        if (pObject->Object_Count && pObject->Object_Index_To_Instance) {
+            object_count = pObject->Object_Count();
+            if (pObject->Object_Iterator && object_count) {
+                object_index = pObject->Object_Iterator(~(unsigned) 0);
+            } else {
+                object_index = 0;
+            }
+            for (i = 0; (i < object_count) &&
+                (Object_List_Cache_Count < count); i++) {
+                Object_List_Cache[Object_List_Cache_Count].type =
+                    (uint16_t) pObject->Object_Type;
+                Object_List_Cache[Object_List_Cache_Count].instance =
+                    pObject->Object_Index_To_Instance(object_index);
+                Object_List_Cache_Count++;
+                if (pObject->Object_Iterator) {
+                    object_index = pObject->Object_Iterator(object_index);
+                } else {
+                    object_index++;
+                }
+            }
+        }
+        pObject++;
+    }
+    Object_List_Cache_Generation = Object_List_Generation;
+
+    return true;
+}
+
+/** Get the total count of objects supported by this Device Object.
+ * @note Since many network clients depend on the object list
+ *       for discovery, it must be consistent!
+ * @return The count of objects, for all supported Object types.
+ */
+unsigned Device_Object_List_Count(
+    void)
+{
+    if (Object_List_Cache_Refresh()) {
+        return Object_List_Cache_Count;
+    }
+
+    return Object_Table_Count();
+}
+
+/** Lookup the Object at the given array index in the Device's Object List.
+ * The list is served from the Object_List cache, which is the virtual,
+ * concatenated array of all of our object type arrays.
+ *
+ * @param array_index [in] The desired array index (1 to N)
+ * @param object_type [out] The object's type, if found.
+ * @param instance [out] The object's instance number, if found.
+ * @return True if found, else false.
+ */
+bool Device_Object_List_Identifier(
+    uint32_t array_index,
+    int *object_type,
+    uint32_t * instance)
+{
+    if (!Object_List_Cache_Refresh()) {
+        return Object_Table_Identifier(array_index, object_type, instance);
+    }
+    /* array index zero is length - so invalid */
+    if ((array_index == 0) || (array_index > Object_List_Cache_Count)) {
+        return false;
+    }
+    *object_type = Object_List_Cache[array_index - 1].type;
+    *instance = Object_List_Cache[array_index - 1].instance;
+
+    return true;
+}
+
+/* FNV-1a of the name octets - the encoding is checked on compare */
+static uint32_t Object_Name_Hash(
+    BACNET_CHARACTER_STRING * object_name)
+{
+    uint32_t hash = 2166136261UL;
+    size_t length = 0;
+    size_t i = 0;
+    const char *value = NULL;
+
+    length = characterstring_length(object_name);
+    value = characterstring_value(object_name);
+    for (i = 0; i < length; i++) {
+        hash ^= (uint8_t) value[i];
+        hash *= 16777619UL;
+    }
+
+    return hash;
+}
+
+/* bucket of an object identifier in Object_Id_Index */
+static unsigned Object_Id_Bucket(
+    int object_type,
+    uint32_t object_instance)
+{
+    uint32_t hash = ((uint32_t) object_type << 22) ^ object_instance;
+
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3bUL;
+    hash ^= hash >> 16;
+
+    return hash & (Object_Name_Index_Size - 1);
+}
+
+static void Object_Name_Index_Clear(
+    void)
+{
+    unsigned i = 0;
+    struct object_name_node *node = NULL;
+
+    for (i = 0; i < Object_Name_Index_Size; i++) {
+        while (Object_Name_Index[i]) {
+            node = Object_Name_Index[i];
+            Object_Name_Index[i] = node->next;
+            free(node);
+        }
+        Object_Id_Index[i] = NULL;
+    }
+}
+
+/* puts a node in the chain of its name hash */
+static void Object_Name_Index_Link(
+    struct object_name_node *node)
+{
+    unsigned bucket = node->hash & (Object_Name_Index_Size - 1);
+
+    node->next = Object_Name_Index[bucket];
+    Object_Name_Index[bucket] = node;
+}
+
+/* takes a node out of the chain of its name hash */
+static void Object_Name_Index_Unlink(
+    struct object_name_node *node)
+{
+    struct object_name_node **pNode = NULL;
+
+    pNode = &Object_Name_Index[node->hash & (Object_Name_Index_Size - 1)];
+    while (*pNode) {
+        if (*pNode == node) {
+            *pNode = node->next;
+            break;
+        }
+        pNode = &(*pNode)->next;
+    }
+}
+
+static bool Object_Name_Index_Add(
+    int object_type,
+    uint32_t object_instance)
+{
+    struct object_functions *pObject = NULL;
+    struct object_name_node *node = NULL;
+    BACNET_CHARACTER_STRING object_name;
+    unsigned bucket = 0;
+
+    pObject = Device_Objects_Find_Functions(object_type);
+    if ((pObject == NULL) || (pObject->Object_Name == NULL) ||
+        !pObject->Object_Name(object_instance, &object_name)) {
+        /* nothing to index */
+        return true;
+    }
+    node = malloc(sizeof(struct object_name_node));
+    if (!node) {
+        return false;
+    }
+    node->hash = Object_Name_Hash(&object_name);
+    node->id.type = (uint16_t) object_type;
+    node->id.instance = object_instance;
+    Object_Name_Index_Link(node);
+    bucket = Object_Id_Bucket(object_type, object_instance);
+    node->id_next = Object_Id_Index[bucket];
+    Object_Id_Index[bucket] = node;
+
+    return true;
+}
+
+/** Rebuild the Object_Name index if the Object_List has changed since
+ * it was last built.
+ * @return True if the index is usable, false if it could not be allocated.
+ */
+static bool Object_Name_Index_Refresh(
+    void)
+{
+    struct object_name_node **new_index = NULL;
+    struct object_name_node **new_id_index = NULL;
+    unsigned count = 0;
+    unsigned size = 8;
+    unsigned i = 0;
+    int type = 0;
+    uint32_t instance = 0;
+
+    if (Object_Name_Index &&
+        (Object_Name_Index_Generation == Object_List_Generation)) {
+        return true;
+    }
+    Object_Name_Index_Clear();
+    count = Device_Object_List_Count();
+    /* keep the chains short - at least twice the buckets as objects */
+    while (size < (count * 2)) {
+        size <<= 1;
+    }
+    if (size != Object_Name_Index_Size) {
+        new_index = calloc(size, sizeof(struct object_name_node *));
+        new_id_index = calloc(size, sizeof(struct object_name_node *));
+        if (!new_index || !new_id_index) {
+            free(new_index);
+            free(new_id_index);
+            return false;
+        }
+        free(Object_Name_Index);
+        free(Object_Id_Index);
+        Object_Name_Index = new_index;
+        Object_Id_Index = new_id_index;
+        Object_Name_Index_Size = size;
+    }
+    for (i = 1; i <= count; i++) {
+        if (Device_Object_List_Identifier(i, &type, &instance) &&
+            !Object_Name_Index_Add(type, instance)) {
+            Object_Name_Index_Clear();
+            return false;
+        }
+    }
+    Object_Name_Index_Generation = Object_List_Generation;
+
+    return true;
+}
+
+/** Tell the Device that an object has a new name, so that it can be
+ * found by the new name.  Called by the object name write paths.
+ * @param object_type [in] The BACNET_OBJECT_TYPE of the renamed Object.
+ * @param object_instance [in] The object instance number of the Object.
+ */
+void Device_Object_Name_Changed(
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance)
+{
+    struct object_name_node *node = NULL;
+    struct object_functions *pObject = NULL;
+    BACNET_CHARACTER_STRING object_name;
+
+    if (!Object_Name_Index ||
+        (Object_Name_Index_Generation != Object_List_Generation)) {
+        return;
+    }
+    node = Object_Id_Index[Object_Id_Bucket(object_type, object_instance)];
+    while (node && ((node->id.type != object_type) ||
+            (node->id.instance != object_instance))) {
+        node = node->id_next;
+    }
+    if (node) {
+        /* move the entry from the old name to the new one */
+        pObject = Device_Objects_Find_Functions(object_type);
+        if ((pObject != NULL) && (pObject->Object_Name != NULL) &&
+            pObject->Object_Name(object_instance, &object_name)) {
+            Object_Name_Index_Unlink(node);
+            node->hash = Object_Name_Hash(&object_name);
+            Object_Name_Index_Link(node);
+        }
+    } else if (!Object_Name_Index_Add(object_type, object_instance)) {
+        /* out of memory - rebuild on the next lookup */
+        Object_Name_Index_Generation = Object_List_Generation - 1;
+    }
+}
+
+/* look for the object_name by reading the name of every object */
+static bool Object_Name_Search(
     BACNET_CHARACTER_STRING * object_name1,
     int *object_type,
     uint32_t * object_instance)
@@ -1342,6 +1659,54 @@ bool Device_Valid_Object_Name(
     return found;
 }
 
+/** Determine if we have an object with the given object_name.
+ * If the object_type and object_instance pointers are not null,
+ * and the lookup succeeds, they will be given the resulting values.
+ * @param object_name [in] The desired Object Name to look for.
+ * @param object_type [out] The BACNET_OBJECT_TYPE of the matching Object.
+ * @param object_instance [out] The object instance number of the matching Object.
+ * @return True on success or else False if not found.
+ */
+bool Device_Valid_Object_Name(
+    BACNET_CHARACTER_STRING * object_name1,
+    int *object_type,
+    uint32_t * object_instance)
+{
+    bool found = false;
+    uint32_t hash = 0;
+    struct object_name_node *node = NULL;
+    BACNET_CHARACTER_STRING object_name2;
+    struct object_functions *pObject = NULL;
+
+    if (!Object_Name_Index_Refresh()) {
+        return Object_Name_Search(object_name1, object_type,
+            object_instance);
+    }
+    hash = Object_Name_Hash(object_name1);
+    node = Object_Name_Index[hash & (Object_Name_Index_Size - 1)];
+    while (node) {
+        if (node->hash == hash) {
+            pObject = Device_Objects_Find_Functions(node->id.type);
+            if ((pObject != NULL) && (pObject->Object_Name != NULL) &&
+                pObject->Object_Name(node->id.instance, &object_name2)) {
+                if (characterstring_same(object_name1, &object_name2)) {
+                    found = true;
+                    if (object_type) {
+                        *object_type = node->id.type;
+                    }
+                    if (object_instance) {
+                        *object_instance = node->id.instance;
+                    }
+                    break;
+                }
+            }
+        }
+        node = node->next;
+    }
+
+    return found;
+}
+
 /** Determine if we have an object of this type and instance number.
  * @param object_type [in] The desired BACNET_OBJECT_TYPE
  * @param object_instance [in] The object instance number to be looked up.
@@ -1736,6 +2101,16 @@ int Device_Read_Property_Local(
         case PROP_NUMBER_OF_APDU_RETRIES:
             apdu_len = encode_application_unsigned(&apdu[0], apdu_retries());
             break;
+#if MAX_SEGMENTS_ACCEPTED
+        case PROP_MAX_SEGMENTS_ACCEPTED:
+            apdu_len =
+                encode_application_unsigned(&apdu[0], MAX_SEGMENTS_ACCEPTED);
+            break;
+        case PROP_APDU_SEGMENT_TIMEOUT:
+            apdu_len =
+                encode_application_unsigned(&apdu[0], apdu_segment_timeout());
+            break;
+#endif
         case PROP_DEVICE_ADDRESS_BINDING:
             apdu_len = address_list_encode(&apdu[0], apdu_max);
             break;
@@ -2113,6 +2488,10 @@ bool Device_Write_Property_Local(
         case PROP_DEVICE_ADDRESS_BINDING:
         case PROP_DATABASE_REVISION:
         case PROP_ACTIVE_COV_SUBSCRIPTIONS:
+#if MAX_SEGMENTS_ACCEPTED
+        case PROP_MAX_SEGMENTS_ACCEPTED:
+        case PROP_APDU_SEGMENT_TIMEOUT:
+#endif
 #if defined(BACNET_TIME_MASTER)
         case PROP_TIME_SYNCHRONIZATION_RECIPIENTS:
 #endif
@@ -2255,30 +2634,191 @@ void Device_COV_Clear(
 }
 
 #if defined(INTRINSIC_REPORTING)
-void Device_local_reporting(
+/* Intrinsic reporting schedule - the objects with an intrinsic reporting
+   function, sorted by type and instance, and the ones among them that
+   need to be evaluated on the next pass.  An object asks to be evaluated
+   when its value, its configuration or its acknowledgment changes, and
+   again after each evaluation while its Time_Delay is running, so the
+   work done every second follows the activity and not the object count.
+   The list is rebuilt from the Object_Table whenever the Object_List
+   generation moves on. */
+struct reporting_object {
+    BACNET_OBJECT_ID id;
+    object_intrinsic_reporting_function Intrinsic_Reporting;
+    bool pending;
+};
+static struct reporting_object *Reporting_List = NULL;
+static unsigned Reporting_Size = 0;
+static unsigned Reporting_Count = 0;
+/* pending objects, and the ones being evaluated by the current pass */
+static BACNET_OBJECT_ID *Reporting_Pending = NULL;
+static BACNET_OBJECT_ID *Reporting_Due = NULL;
+static unsigned Reporting_Pending_Count = 0;
+static uint32_t Reporting_Generation = 0;
+
+/* binary search of the reporting list - returns the position
+   of the object, or the position where it would be inserted */
+static unsigned reporting_search(
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance,
+    bool * found)
+{
+    unsigned low = 0;
+    unsigned high = Reporting_Count;
+    unsigned mid;
+    struct reporting_object *entry;
+
+    while (low < high) {
+        mid = low + ((high - low) / 2);
+        entry = &Reporting_List[mid];
+        if ((entry->id.type < object_type) ||
+            ((entry->id.type == object_type) &&
+                (entry->id.instance < object_instance))) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    *found = (low < Reporting_Count) &&
+        (Reporting_List[low].id.type == object_type) &&
+        (Reporting_List[low].id.instance == object_instance);
+
+    return low;
+}
+
+static bool reporting_grow(
     void)
 {
-    struct object_functions *pObject;
-    uint32_t objects_count;
-    uint32_t object_instance;
-    int object_type;
-    uint32_t idx;
+    struct reporting_object *list;
+    BACNET_OBJECT_ID *pending;
+    BACNET_OBJECT_ID *due;
+    unsigned size;
 
-    objects_count = Device_Object_List_Count();
+    size = Reporting_Size ? (Reporting_Size * 2) : 64;
+    list = realloc(Reporting_List, size * sizeof(*list));
+    if (!list) {
+        return false;
+    }
+    Reporting_List = list;
+    pending = realloc(Reporting_Pending, size * sizeof(*pending));
+    if (!pending) {
+        return false;
+    }
+    Reporting_Pending = pending;
+    due = realloc(Reporting_Due, size * sizeof(*due));
+    if (!due) {
+        return false;
+    }
+    Reporting_Due = due;
+    Reporting_Size = size;
 
-    /* loop for all objects */
-    for (idx = 1; idx <= objects_count; idx++) {
-        Device_Object_List_Identifier(idx, &object_type, &object_instance);
+    return true;
+}
 
+/** Asks for the intrinsic reporting of an object to be evaluated
+ * by the next call to Device_local_reporting.  Objects call this when
+ * their Present_Value, Out_Of_Service or event properties change, and
+ * when an alarm is acknowledged.
+ * @ingroup ObjHelpers
+ * @param [in] The object type of the object.
+ * @param [in] The object instance of the object.
+ */
+void Device_Intrinsic_Reporting_Request(
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance)
+{
+    struct object_functions *pObject = NULL;
+    struct reporting_object *entry;
+    unsigned pos;
+    bool found = false;
+
+    if (!Object_Table) {
+        /* not initialized yet - Device_local_reporting will find it */
+        return;
+    }
+    pos = reporting_search(object_type, object_instance, &found);
+    if (!found) {
         pObject = Device_Objects_Find_Functions(object_type);
-        if (pObject != NULL) {
-            if (pObject->Object_Valid_Instance &&
-                pObject->Object_Valid_Instance(object_instance)) {
-                if (pObject->Object_Intrinsic_Reporting) {
-                    pObject->Object_Intrinsic_Reporting(object_instance);
-                }
+        if (!pObject || !pObject->Object_Intrinsic_Reporting) {
+            return;
+        }
+        if ((Reporting_Count >= Reporting_Size) && !reporting_grow()) {
+            return;
+        }
+        memmove(&Reporting_List[pos + 1], &Reporting_List[pos],
+            (Reporting_Count - pos) * sizeof(Reporting_List[0]));
+        entry = &Reporting_List[pos];
+        entry->id.type = object_type;
+        entry->id.instance = object_instance;
+        entry->Intrinsic_Reporting = pObject->Object_Intrinsic_Reporting;
+        entry->pending = false;
+        Reporting_Count++;
+    }
+    entry = &Reporting_List[pos];
+    if (!entry->pending) {
+        entry->pending = true;
+        Reporting_Pending[Reporting_Pending_Count] = entry->id;
+        Reporting_Pending_Count++;
+    }
+}
+
+/* registers every object that has intrinsic reporting,
+   and has each of them evaluated once */
+static void reporting_rebuild(
+    void)
+{
+    struct object_functions *pObject = NULL;
+    unsigned count;
+    unsigned i;
+
+    Reporting_Count = 0;
+    Reporting_Pending_Count = 0;
+    pObject = Object_Table;
+    while (pObject->Object_Type < MAX_BACNET_OBJECT_TYPE) {
+        if (pObject->Object_Intrinsic_Reporting && pObject->Object_Count &&
+            pObject->Object_Index_To_Instance) {
+            count = pObject->Object_Count();
+            for (i = 0; i < count; i++) {
+                Device_Intrinsic_Reporting_Request(pObject->Object_Type,
+                    pObject->Object_Index_To_Instance(i));
             }
         }
+        pObject++;
+    }
+    Reporting_Generation = Object_List_Generation;
+}
+
+/** Evaluates the intrinsic reporting of the objects that asked for it
+ * since the last call.  Called once a second.
+ * @ingroup ObjHelpers
+ */
+void Device_local_reporting(
+    void)
+{
+    BACNET_OBJECT_ID *due;
+    struct reporting_object *entry;
+    unsigned due_count;
+    unsigned pos;
+    unsigned i;
+    bool found = false;
+
+    if (Reporting_Generation != Object_List_Generation) {
+        reporting_rebuild();
+    }
+    /* requests made during this pass are for the next one */
+    due = Reporting_Due;
+    Reporting_Due = Reporting_Pending;
+    Reporting_Pending = due;
+    due_count = Reporting_Pending_Count;
+    Reporting_Pending_Count = 0;
+    for (i = 0; i < due_count; i++) {
+        pos = reporting_search((BACNET_OBJECT_TYPE) Reporting_Due[i].type,
+            Reporting_Due[i].instance, &found);
+        if (found) {
+            entry = &Reporting_List[pos];
+            entry->pending = false;
+            entry->Intrinsic_Reporting(entry->id.instance);
+        }
     }
 }
 #endif
@@ -2379,6 +2919,8 @@ void Device_Init(
         }
         pObject++;
     }
+    /* the objects were (re)loaded - the Object_List must follow */
+    Object_List_Generation++;
 }
 
 bool DeviceGetRRInfo(
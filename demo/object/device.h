@@ -354,7 +354,12 @@ extern "C" {
         uint32_t revision);
     void Device_Inc_Database_Revision(
         void);
+    uint32_t Device_Object_List_Generation(
+        void);
 
+    void Device_Object_Name_Changed(
+        BACNET_OBJECT_TYPE object_type,
+        uint32_t object_instance);
     bool Device_Valid_Object_Name(
         BACNET_CHARACTER_STRING * object_name,
         int *object_type,
@@ -378,6 +383,9 @@ extern "C" {
         BACNET_WRITE_PROPERTY_DATA * wp_data);
 
 #if defined(INTRINSIC_REPORTING)
+    void Device_Intrinsic_Reporting_Request(
+        BACNET_OBJECT_TYPE object_type,
+        uint32_t object_instance);
     void Device_local_reporting(
         void);
 #endif
@@ -43,6 +43,7 @@
 #include "handlers.h"
 #include "mso.h"
 #include "ucix.h"
+#include "keylist.h"
 
 /* number of demo objects */
 #ifndef MAX_MULTI_STATE_OUTPUTS
@@ -61,6 +62,9 @@ unsigned max_multi_state_outputs_int = 0;
 
 MULTI_STATE_OUTPUT_DESCR MSO_Descr[MAX_MULTI_STATE_OUTPUTS];
 
+/* sorted Instance to MSO_Descr[] slot lookup, rebuilt by Multistate_Output_Init */
+static OS_Keylist MSO_Instance_List = NULL;
+
 /* These three arrays are used by the ReadPropertyMultiple handler */
 static const int Multistate_Output_Properties_Required[] = {
     PROP_OBJECT_IDENTIFIER,
@@ -133,6 +137,25 @@ void Multistate_Output_Load_UCI_List(const char *sec_idx,
 }
 
 
+/* (re)build the Instance lookup from the configured MSO_Descr[] slots */
+static void Multistate_Output_Instance_List_Init(
+    void)
+{
+    unsigned i;
+
+    if (MSO_Instance_List) {
+        Keylist_Delete(MSO_Instance_List);
+    }
+    MSO_Instance_List = Keylist_Create();
+    for (i = 0; i < max_multi_state_outputs_int; i++) {
+        /* keep the first slot of a duplicated instance, like a scan would */
+        if (!Keylist_Data(MSO_Instance_List, MSO_Descr[i].Instance)) {
+            Keylist_Data_Add(MSO_Instance_List, MSO_Descr[i].Instance,
+                &MSO_Descr[i]);
+        }
+    }
+}
+
 /*
  * Things to do when starting up the stack for Multistate Value.
  * Should be called whenever we reset the device or power it up
@@ -342,6 +365,10 @@ void Multistate_Output_Init(
                 max_multi_state_outputs_int = i;
             }
         }
+        Multistate_Output_Instance_List_Init();
+#if defined(INTRINSIC_REPORTING)
+        handler_event_summary_reset(OBJECT_MULTI_STATE_OUTPUT);
+#endif
 #if PRINT_ENABLED
         fprintf(stderr, "max_multi_state_outputs: %i\n", max_multi_state_outputs_int);
 #endif
@@ -351,21 +378,18 @@ void Multistate_Output_Init(
     return;
 }
 
-/* we simply have 0-n object instances.  Yours might be */
-/* more complex, and then you need to return the index */
-/* that correlates to the correct instance number */
+/* Instances come from the uci section names and may be sparse, */
+/* so the slot is found with a binary search of the sorted list */
 unsigned Multistate_Output_Instance_To_Index(
     uint32_t object_instance)
 {
     MULTI_STATE_OUTPUT_DESCR *CurrentMSO;
-    int index,i;
-    index = max_multi_state_outputs_int;
-    for (i = 0; i < index; i++) {
-    	CurrentMSO = &MSO_Descr[i];
-    	if (CurrentMSO->Instance == object_instance) {
-    		return i;
-    	}
+
+    CurrentMSO = Keylist_Data(MSO_Instance_List, object_instance);
+    if (CurrentMSO) {
+        return (unsigned) (CurrentMSO - &MSO_Descr[0]);
     }
+
     return MAX_MULTI_STATE_OUTPUTS;
 }
 
@@ -551,6 +575,12 @@ bool Multistate_Output_Present_Value_Set(
                 CurrentMSO->Priority_Array[15] = (uint8_t) value;
             }
             CurrentMSO->Changed = true;
+            handler_cov_object_changed(OBJECT_MULTI_STATE_OUTPUT,
+                object_instance);
+#if defined(INTRINSIC_REPORTING)
+            Device_Intrinsic_Reporting_Request(OBJECT_MULTI_STATE_OUTPUT,
+                object_instance);
+#endif
             status = true;
         }
     }
@@ -585,6 +615,8 @@ void Multistate_Output_Out_Of_Service_Set(
         CurrentMSO = &MSO_Descr[index];
         CurrentMSO->Out_Of_Service = value;
         CurrentMSO->Changed = true;
+        handler_cov_object_changed(OBJECT_MULTI_STATE_OUTPUT,
+            object_instance);
     }
 }
 
@@ -695,16 +727,8 @@ static bool Multistate_Output_Description_Write(
                 } else {
                     sprintf(idx_cc,"%d",CurrentMSO->Instance);
                     idx_c = idx_cc;
-                    if(ctx) {
-                        ucix_add_option(ctx, "bacnet_mo", idx_c,
-                            "description", char_string->value);
-                        ucix_commit(ctx, "bacnet_mo");
-#if PRINT_ENABLED
-                    } else {
-                        fprintf(stderr,
-                            "Failed to open config file bacnet_mo\n");
-#endif
-                    }
+                    ucix_journal_add("bacnet_mo", idx_c,
+                        "description", CurrentMSO->Object_Description, true);
                 }
             } else {
                 *error_class = ERROR_CLASS_PROPERTY;
@@ -798,18 +822,12 @@ static bool Multistate_Output_Object_Name_Write(
                     *error_class = ERROR_CLASS_PROPERTY;
                     *error_code = ERROR_CODE_VALUE_OUT_OF_RANGE;
                 } else {
+                    Device_Object_Name_Changed(OBJECT_MULTI_STATE_OUTPUT,
+                        object_instance);
                     sprintf(idx_cc,"%d",CurrentMSO->Instance);
                     idx_c = idx_cc;
-                    if(ctx) {
-                        ucix_add_option(ctx, "bacnet_mo", idx_c,
-                            "name", char_string->value);
-                        ucix_commit(ctx, "bacnet_mo");
-#if PRINT_ENABLED
-                    } else {
-                        fprintf(stderr,
-                            "Failed to open config file bacnet_mo\n");
-#endif
-                    }
+                    ucix_journal_add("bacnet_mo", idx_c,
+                        "name", CurrentMSO->Object_Name, true);
                 }
             } else {
                 *error_class = ERROR_CLASS_PROPERTY;
@@ -908,8 +926,9 @@ static bool Multistate_Output_State_Text_Write(
                     status =
                         characterstring_ansi_copy(CurrentMSO->State_Text[state_index],
                     sizeof(CurrentMSO->State_Text[state_index]), char_string);
-                    ucix_set_list(ctx, "bacnet_mo", idx_c, "state",
-                        CurrentMSO->State_Text, CurrentMSO->number_of_states);
+                    ucix_journal_add_list("bacnet_mo", idx_c, "state",
+                        CurrentMSO->State_Text, CurrentMSO->number_of_states,
+                        true);
                     if (!status) {
                         *error_class = ERROR_CLASS_PROPERTY;
                         *error_code = ERROR_CODE_VALUE_OUT_OF_RANGE;
@@ -1278,7 +1297,6 @@ bool Multistate_Output_Write_Property(
     BACNET_APPLICATION_DATA_VALUE value;
     uint32_t max_states = 0;
     uint32_t array_index = 0;
-    ctx = ucix_init("bacnet_mo");
 #if defined(INTRINSIC_REPORTING)
     const char index_c[32] = "";
 #endif
@@ -1356,16 +1374,15 @@ bool Multistate_Output_Write_Property(
                         value.type.Unsigned_Int, wp_data->priority)) {
                     status = true;
                     sprintf(cur_value,"%d",value.type.Unsigned_Int);
-                    ucix_add_option(ctx, "bacnet_mo", idx_c, "value",
-                        cur_value);
-                    ucix_add_option(ctx, "bacnet_mo", idx_c, "fb_value",
-                        cur_value);
+                    ucix_journal_add("bacnet_mo", idx_c, "value",
+                        cur_value, false);
+                    ucix_journal_add("bacnet_mo", idx_c, "fb_value",
+                        cur_value, false);
                     cur_value_time = time(NULL);
-                    ucix_add_option_int(ctx, "bacnet_mo", idx_c, "value_time",
-                        cur_value_time);
-                    ucix_add_option_int(ctx, "bacnet_mo", idx_c, "write",
-                        1);
-                    ucix_save_state(ctx, "bacnet_mo");
+                    ucix_journal_add_int("bacnet_mo", idx_c, "value_time",
+                        cur_value_time, false);
+                    ucix_journal_add_int("bacnet_mo", idx_c, "write",
+                        1, false);
                 } else if (wp_data->priority == 6) {
                     /* Command priority 6 is reserved for use by Minimum On/Off
                        algorithm and may not be used for other purposes in any
@@ -1501,8 +1518,7 @@ bool Multistate_Output_Write_Property(
             if (status) {
                 CurrentMSO->Time_Delay = value.type.Unsigned_Int;
                 CurrentMSO->Remaining_Time_Delay = CurrentMSO->Time_Delay;
-                ucix_add_option_int(ctx, "bacnet_mo", index_c, "time_delay", value.type.Unsigned_Int);
-                ucix_commit(ctx, "bacnet_mo");
+                ucix_journal_add_int("bacnet_mo", index_c, "time_delay", value.type.Unsigned_Int, true);
             }
             break;
 
@@ -1513,8 +1529,7 @@ bool Multistate_Output_Write_Property(
 
             if (status) {
                 CurrentMSO->Notification_Class = value.type.Unsigned_Int;
-                ucix_add_option_int(ctx, "bacnet_mo", index_c, "nc", value.type.Unsigned_Int);
-                ucix_commit(ctx, "bacnet_mo");
+                ucix_journal_add_int("bacnet_mo", index_c, "nc", value.type.Unsigned_Int, true);
             }
             break;
 
@@ -1526,8 +1541,7 @@ bool Multistate_Output_Write_Property(
             if (status) {
                 if (value.type.Bit_String.bits_used == 3) {
                     CurrentMSO->Event_Enable = value.type.Bit_String.value[0];
-                    ucix_add_option_int(ctx, "bacnet_mo", index_c, "event", value.type.Bit_String.value[0]);
-                    ucix_commit(ctx, "bacnet_mo");
+                    ucix_journal_add_int("bacnet_mo", index_c, "event", value.type.Bit_String.value[0], true);
                 } else {
                     wp_data->error_class = ERROR_CLASS_PROPERTY;
                     wp_data->error_code = ERROR_CODE_VALUE_OUT_OF_RANGE;
@@ -1579,7 +1593,12 @@ bool Multistate_Output_Write_Property(
             wp_data->error_code = ERROR_CODE_UNKNOWN_PROPERTY;
             break;
     }
-    ucix_cleanup(ctx);
+#if defined(INTRINSIC_REPORTING)
+    if (status) {
+        Device_Intrinsic_Reporting_Request(OBJECT_MULTI_STATE_OUTPUT,
+            wp_data->object_instance);
+    }
+#endif
     return status;
 }
 
@@ -1807,6 +1826,15 @@ void Multistate_Output_Intrinsic_Reporting(
                     break;
             }
         }
+        /* the object may have joined or left the event summary */
+        handler_event_summary_update(OBJECT_MULTI_STATE_OUTPUT, index);
+    }
+    /* evaluate again while the time delay is running, and after an
+       AckNotification that skipped the event state checks */
+    if ((CurrentMSO->Remaining_Time_Delay != CurrentMSO->Time_Delay) ||
+        (SendNotify && (event_data.notifyType == NOTIFY_ACK_NOTIFICATION))) {
+        Device_Intrinsic_Reporting_Request(OBJECT_MULTI_STATE_OUTPUT,
+            object_instance);
     }
 #endif /* defined(INTRINSIC_REPORTING) */
 }
@@ -1982,6 +2010,10 @@ int Multistate_Output_Alarm_Ack(
     CurrentMSO->Ack_notify_data.bSendAckNotify = true;
     CurrentMSO->Ack_notify_data.EventState = alarmack_data->eventStateAcked;
 
+    Device_Intrinsic_Reporting_Request(OBJECT_MULTI_STATE_OUTPUT,
+        alarmack_data->eventObjectIdentifier.instance);
+    handler_event_summary_update(OBJECT_MULTI_STATE_OUTPUT, index);
+
     /* Return OK */
     return 1;
 }
@@ -43,6 +43,7 @@
 #include "handlers.h"
 #include "msv.h"
 #include "ucix.h"
+#include "keylist.h"
 
 /* number of demo objects */
 #ifndef MAX_MULTI_STATE_VALUES
@@ -61,6 +62,9 @@ unsigned max_multi_state_values_int = 0;
 
 MULTI_STATE_VALUE_DESCR MSV_Descr[MAX_MULTI_STATE_VALUES];
 
+/* sorted Instance to MSV_Descr[] slot lookup, rebuilt by Multistate_Value_Init */
+static OS_Keylist MSV_Instance_List = NULL;
+
 /* These three arrays are used by the ReadPropertyMultiple handler */
 static const int Multistate_Value_Properties_Required[] = {
     PROP_OBJECT_IDENTIFIER,
@@ -133,6 +137,25 @@ void Multistate_Value_Load_UCI_List(const char *sec_idx,
 }
 
 
+/* (re)build the Instance lookup from the configured MSV_Descr[] slots */
+static void Multistate_Value_Instance_List_Init(
+    void)
+{
+    unsigned i;
+
+    if (MSV_Instance_List) {
+        Keylist_Delete(MSV_Instance_List);
+    }
+    MSV_Instance_List = Keylist_Create();
+    for (i = 0; i < max_multi_state_values_int; i++) {
+        /* keep the first slot of a duplicated instance, like a scan would */
+        if (!Keylist_Data(MSV_Instance_List, MSV_Descr[i].Instance)) {
+            Keylist_Data_Add(MSV_Instance_List, MSV_Descr[i].Instance,
+                &MSV_Descr[i]);
+        }
+    }
+}
+
 /*
  * Things to do when starting up the stack for Multistate Value.
  * Should be called whenever we reset the device or power it up
@@ -333,6 +356,10 @@ void Multistate_Value_Init(
                 max_multi_state_values_int = i;
             }
         }
+        Multistate_Value_Instance_List_Init();
+#if defined(INTRINSIC_REPORTING)
+        handler_event_summary_reset(OBJECT_MULTI_STATE_VALUE);
+#endif
 #if PRINT_ENABLED
         fprintf(stderr, "max_multi_state_values: %i\n", max_multi_state_values_int);
 #endif
@@ -342,21 +369,18 @@ void Multistate_Value_Init(
     return;
 }
 
-/* we simply have 0-n object instances.  Yours might be */
-/* more complex, and then you need to return the index */
-/* that correlates to the correct instance number */
+/* Instances come from the uci section names and may be sparse, */
+/* so the slot is found with a binary search of the sorted list */
 unsigned Multistate_Value_Instance_To_Index(
     uint32_t object_instance)
 {
     MULTI_STATE_VALUE_DESCR *CurrentMSV;
-    int index,i;
-    index = max_multi_state_values_int;
-    for (i = 0; i < index; i++) {
-    	CurrentMSV = &MSV_Descr[i];
-    	if (CurrentMSV->Instance == object_instance) {
-    		return i;
-    	}
+
+    CurrentMSV = Keylist_Data(MSV_Instance_List, object_instance);
+    if (CurrentMSV) {
+        return (unsigned) (CurrentMSV - &MSV_Descr[0]);
     }
+
     return MAX_MULTI_STATE_VALUES;
 }
 
@@ -539,6 +563,12 @@ bool Multistate_Value_Present_Value_Set(
                 CurrentMSV->Priority_Array[15] = (uint8_t) value;
             }
             CurrentMSV->Changed = true;
+            handler_cov_object_changed(OBJECT_MULTI_STATE_VALUE,
+                object_instance);
+#if defined(INTRINSIC_REPORTING)
+            Device_Intrinsic_Reporting_Request(OBJECT_MULTI_STATE_VALUE,
+                object_instance);
+#endif
             status = true;
         }
     }
@@ -573,6 +603,8 @@ void Multistate_Value_Out_Of_Service_Set(
         CurrentMSV = &MSV_Descr[index];
         CurrentMSV->Out_Of_Service = value;
         CurrentMSV->Changed = true;
+        handler_cov_object_changed(OBJECT_MULTI_STATE_VALUE,
+            object_instance);
     }
 }
 
@@ -683,16 +715,8 @@ static bool Multistate_Value_Description_Write(
                 } else {
                     sprintf(idx_cc,"%d",CurrentMSV->Instance);
                     idx_c = idx_cc;
-                    if(ctx) {
-                        ucix_add_option(ctx, "bacnet_mv", idx_c,
-                            "description", char_string->value);
-                        ucix_commit(ctx, "bacnet_mv");
-#if PRINT_ENABLED
-                    } else {
-                        fprintf(stderr,
-                            "Failed to open config file bacnet_mv\n");
-#endif
-                    }
+                    ucix_journal_add("bacnet_mv", idx_c,
+                        "description", CurrentMSV->Object_Description, true);
                 }
             } else {
                 *error_class = ERROR_CLASS_PROPERTY;
@@ -786,18 +810,12 @@ static bool Multistate_Value_Object_Name_Write(
                     *error_class = ERROR_CLASS_PROPERTY;
                     *error_code = ERROR_CODE_VALUE_OUT_OF_RANGE;
                 } else {
+                    Device_Object_Name_Changed(OBJECT_MULTI_STATE_VALUE,
+                        object_instance);
                     sprintf(idx_cc,"%d",CurrentMSV->Instance);
                     idx_c = idx_cc;
-                    if(ctx) {
-                        ucix_add_option(ctx, "bacnet_mv", idx_c,
-                            "name", char_string->value);
-                        ucix_commit(ctx, "bacnet_mv");
-#if PRINT_ENABLED
-                    } else {
-                        fprintf(stderr,
-                            "Failed to open config file bacnet_mv\n");
-#endif
-                    }
+                    ucix_journal_add("bacnet_mv", idx_c,
+                        "name", CurrentMSV->Object_Name, true);
                 }
             } else {
                 *error_class = ERROR_CLASS_PROPERTY;
@@ -900,8 +918,9 @@ static bool Multistate_Value_State_Text_Write(
                     status =
                         characterstring_ansi_copy(CurrentMSV->State_Text[state_index],
                     sizeof(CurrentMSV->State_Text[state_index]), char_string);
-                    ucix_set_list(ctx, "bacnet_mv", idx_c, "state",
-                        CurrentMSV->State_Text, CurrentMSV->number_of_states);
+                    ucix_journal_add_list("bacnet_mv", idx_c, "state",
+                        CurrentMSV->State_Text, CurrentMSV->number_of_states,
+                        true);
 #if defined(INTRINSIC_REPORTING)
                     ucialarmstate_n = CurrentMSV->number_of_alarmstates;
                     for (j = 0; j < ucialarmstate_n; j++) {
@@ -910,8 +929,8 @@ static bool Multistate_Value_State_Text_Write(
                         sprintf(ucialarmstate[j], "%s",
                             CurrentMSV->State_Text[alarm_value-1]);
                     }
-                    ucix_set_list(ctx, "bacnet_mv", idx_c, "alarmstate",
-                        ucialarmstate, ucialarmstate_n);
+                    ucix_journal_add_list("bacnet_mv", idx_c, "alarmstate",
+                        ucialarmstate, ucialarmstate_n, true);
 #endif
                     if (!status) {
                         *error_class = ERROR_CLASS_PROPERTY;
@@ -1285,7 +1304,6 @@ bool Multistate_Value_Write_Property(
     BACNET_APPLICATION_DATA_VALUE value;
     uint32_t max_states = 0;
     uint32_t array_index = 0;
-    ctx = ucix_init("bacnet_mv");
 #if defined(INTRINSIC_REPORTING)
     const char index_c[32] = "";
 #endif
@@ -1363,14 +1381,13 @@ bool Multistate_Value_Write_Property(
                         value.type.Unsigned_Int, wp_data->priority)) {
                     status = true;
                     sprintf(cur_value,"%d",value.type.Unsigned_Int);
-                    ucix_add_option(ctx, "bacnet_mv", idx_c, "value",
-                        cur_value);
+                    ucix_journal_add("bacnet_mv", idx_c, "value",
+                        cur_value, false);
                     cur_value_time = time(NULL);
-                    ucix_add_option_int(ctx, "bacnet_mv", idx_c, "value_time",
-                        cur_value_time);
-                    ucix_add_option_int(ctx, "bacnet_mv", idx_c, "write",
-                        1);
-                    ucix_save_state(ctx, "bacnet_mv");
+                    ucix_journal_add_int("bacnet_mv", idx_c, "value_time",
+                        cur_value_time, false);
+                    ucix_journal_add_int("bacnet_mv", idx_c, "write",
+                        1, false);
                 } else if (wp_data->priority == 6) {
                     /* Command priority 6 is reserved for use by Minimum On/Off
                        algorithm and may not be used for other purposes in any
@@ -1515,9 +1532,8 @@ bool Multistate_Value_Write_Property(
                         array_index++;        
                     }
                     CurrentMSV->number_of_alarmstates = ucialarmstate_n;
-                    ucix_set_list(ctx, "bacnet_mv", idx_c, "alarmstate",
-                        ucialarmstate, ucialarmstate_n);
-                    ucix_commit(ctx, "bacnet_mv");
+                    ucix_journal_add_list("bacnet_mv", idx_c, "alarmstate",
+                        ucialarmstate, ucialarmstate_n, true);
                 }
             }
         case PROP_TIME_DELAY:
@@ -1528,8 +1544,7 @@ bool Multistate_Value_Write_Property(
             if (status) {
                 CurrentMSV->Time_Delay = value.type.Unsigned_Int;
                 CurrentMSV->Remaining_Time_Delay = CurrentMSV->Time_Delay;
-                ucix_add_option_int(ctx, "bacnet_mv", index_c, "time_delay", value.type.Unsigned_Int);
-                ucix_commit(ctx, "bacnet_mv");
+                ucix_journal_add_int("bacnet_mv", index_c, "time_delay", value.type.Unsigned_Int, true);
             }
             break;
 
@@ -1540,8 +1555,7 @@ bool Multistate_Value_Write_Property(
 
             if (status) {
                 CurrentMSV->Notification_Class = value.type.Unsigned_Int;
-                ucix_add_option_int(ctx, "bacnet_mv", index_c, "nc", value.type.Unsigned_Int);
-                ucix_commit(ctx, "bacnet_mv");
+                ucix_journal_add_int("bacnet_mv", index_c, "nc", value.type.Unsigned_Int, true);
             }
             break;
 
@@ -1553,8 +1567,7 @@ bool Multistate_Value_Write_Property(
             if (status) {
                 if (value.type.Bit_String.bits_used == 3) {
                     CurrentMSV->Event_Enable = value.type.Bit_String.value[0];
-                    ucix_add_option_int(ctx, "bacnet_mv", index_c, "event", value.type.Bit_String.value[0]);
-                    ucix_commit(ctx, "bacnet_mv");
+                    ucix_journal_add_int("bacnet_mv", index_c, "event", value.type.Bit_String.value[0], true);
                 } else {
                     wp_data->error_class = ERROR_CLASS_PROPERTY;
                     wp_data->error_code = ERROR_CODE_VALUE_OUT_OF_RANGE;
@@ -1606,7 +1619,12 @@ bool Multistate_Value_Write_Property(
             wp_data->error_code = ERROR_CODE_UNKNOWN_PROPERTY;
             break;
     }
-    ucix_cleanup(ctx);
+#if defined(INTRINSIC_REPORTING)
+    if (status) {
+        Device_Intrinsic_Reporting_Request(OBJECT_MULTI_STATE_VALUE,
+            wp_data->object_instance);
+    }
+#endif
     return status;
 }
 
@@ -1843,6 +1861,15 @@ void Multistate_Value_Intrinsic_Reporting(
                     break;
             }
         }
+        /* the object may have joined or left the event summary */
+        handler_event_summary_update(OBJECT_MULTI_STATE_VALUE, index);
+    }
+    /* evaluate again while the time delay is running, and after an
+       AckNotification that skipped the event state checks */
+    if ((CurrentMSV->Remaining_Time_Delay != CurrentMSV->Time_Delay) ||
+        (SendNotify && (event_data.notifyType == NOTIFY_ACK_NOTIFICATION))) {
+        Device_Intrinsic_Reporting_Request(OBJECT_MULTI_STATE_VALUE,
+            object_instance);
     }
 #endif /* defined(INTRINSIC_REPORTING) */
 }
@@ -2018,6 +2045,10 @@ int Multistate_Value_Alarm_Ack(
     CurrentMSV->Ack_notify_data.bSendAckNotify = true;
     CurrentMSV->Ack_notify_data.EventState = alarmack_data->eventStateAcked;
 
+    Device_Intrinsic_Reporting_Request(OBJECT_MULTI_STATE_VALUE,
+        alarmack_data->eventObjectIdentifier.instance);
+    handler_event_summary_update(OBJECT_MULTI_STATE_VALUE, index);
+
     /* Return OK */
     return 1;
 }
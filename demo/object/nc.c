@@ -43,6 +43,7 @@
 #include "handlers.h"
 #include "nc.h"
 #include "ucix.h"
+#include "keylist.h"
 #include "address.h"
 #include "client.h"
 #include "txbuf.h"
@@ -57,6 +58,9 @@ unsigned max_notificaton_classes_int = 0;
 #if defined(INTRINSIC_REPORTING)
 static NOTIFICATION_CLASS_DESCR NC_Descr[MAX_NOTIFICATION_CLASSES];
 
+/* sorted Instance to NC_Descr[] slot lookup, rebuilt by Notification_Class_Init */
+static OS_Keylist NC_Instance_List = NULL;
+
 /* These three arrays are used by the ReadPropertyMultiple handler */
 static const int Notification_Properties_Required[] = {
     PROP_OBJECT_IDENTIFIER,
@@ -113,6 +117,25 @@ void Notification_Class_Load_UCI_List(const char *sec_idx,
     return;
 }
 
+/* (re)build the Instance lookup from the configured NC_Descr[] slots */
+static void Notification_Class_Instance_List_Init(
+    void)
+{
+    unsigned i;
+
+    if (NC_Instance_List) {
+        Keylist_Delete(NC_Instance_List);
+    }
+    NC_Instance_List = Keylist_Create();
+    for (i = 0; i < max_notificaton_classes_int; i++) {
+        /* keep the first slot of a duplicated instance, like a scan would */
+        if (!Keylist_Data(NC_Instance_List, NC_Descr[i].Instance)) {
+            Keylist_Data_Add(NC_Instance_List, NC_Descr[i].Instance,
+                &NC_Descr[i]);
+        }
+    }
+}
+
 /*
  * Things to do when starting up the stack for Notification Class.
  * Should be called whenever we reset the device or power it up
@@ -284,6 +307,7 @@ void Notification_Class_Init(
 				max_notificaton_classes_int = i;
             }
         }
+        Notification_Class_Instance_List_Init();
 #if PRINT_ENABLED
         fprintf(stderr, "max_notificaton_classes: %i\n", max_notificaton_classes_int);
 #endif
@@ -294,23 +318,18 @@ void Notification_Class_Init(
 }
 
 
-/* we simply have 0-n object instances.  Yours might be */
-/* more complex, and then you need to return the index */
-/* that correlates to the correct instance number */
+/* Instances come from the uci section names and may be sparse, */
+/* so the slot is found with a binary search of the sorted list */
 unsigned Notification_Class_Instance_To_Index(
     uint32_t object_instance)
 {
     NOTIFICATION_CLASS_DESCR *CurrentNC;
-    int index,i;
-    //int instance;
-    index = max_notificaton_classes_int;
-    for (i = 0; i < index; i++) {
-    	CurrentNC = &NC_Descr[i];
-    	//instance = CurrentNC->Instance;
-    	if (CurrentNC->Instance == object_instance) {
-    		return i;
-    	}
+
+    CurrentNC = Keylist_Data(NC_Instance_List, object_instance);
+    if (CurrentNC) {
+        return (unsigned) (CurrentNC - &NC_Descr[0]);
     }
+
     return MAX_NOTIFICATION_CLASSES;
 }
 
@@ -434,16 +453,8 @@ static bool Notification_Class_Description_Write(
                 } else {
                     sprintf(idx_cc,"%d",index);
                     idx_c = idx_cc;
-                    if(ctx) {
-                        ucix_add_option(ctx, "bacnet_nc", idx_c, 
-                            "description", char_string->value);
-                        ucix_commit(ctx, "bacnet_nc");
-#if PRINT_ENABLED
-                    } else {
-                        fprintf(stderr, 
-                            "Failed to open config file bacnet_nc\n");
-#endif
-                    }
+                    ucix_journal_add("bacnet_nc", idx_c,
+                        "description", CurrentNC->Object_Description, true);
                 }
             } else {
                 *error_class = ERROR_CLASS_PROPERTY;
@@ -537,18 +548,12 @@ static bool Notification_Class_Object_Name_Write(
                     *error_class = ERROR_CLASS_PROPERTY;
                     *error_code = ERROR_CODE_VALUE_OUT_OF_RANGE;
                 } else {
+                    Device_Object_Name_Changed(OBJECT_NOTIFICATION_CLASS,
+                        object_instance);
                     sprintf(idx_cc,"%d",index);
                     idx_c = idx_cc;
-                    if(ctx) {
-                        ucix_add_option(ctx, "bacnet_nc", idx_c,
-                            "name", char_string->value);
-                        ucix_commit(ctx, "bacnet_nc");
-#if PRINT_ENABLED
-                    } else {
-                        fprintf(stderr,
-                            "Failed to open config file bacnet_nc\n");
-#endif
-                    }
+                    ucix_journal_add("bacnet_nc", idx_c,
+                        "name", CurrentNC->Object_Name, true);
                 }
             } else {
                 *error_class = ERROR_CLASS_PROPERTY;
@@ -807,7 +812,6 @@ bool Notification_Class_Write_Property(
     unsigned index = 0;
     int object_type = 0;
     uint32_t object_instance = 0;
-    ctx = ucix_init("bacnet_nc");
     const char *idx_c;
     char idx_cc[64];
 
@@ -955,10 +959,6 @@ bool Notification_Class_Write_Property(
             char ucirecp[NC_MAX_RECIPIENTS][64];
             int ucirecp_n = 0;
             char uci_str[64];
-#if PRINT_ENABLED
-            if (!ctx)
-                fprintf(stderr,  "Failed to open config file bacnet_nc\n");
-#endif
             idx = 0;
             iOffset = 0;
             /* decode all packed */
@@ -1106,10 +1106,8 @@ bool Notification_Class_Write_Property(
                             TmpNotify.Recipient_List[idx].Recipient._.
                                 Address.mac[3],
                             src_port);
-                        if(ctx) {
-                                sprintf(ucirecp[ucirecp_n], "%s", uci_str);
-                                ucirecp_n++;
-                        }
+                        sprintf(ucirecp[ucirecp_n], "%s", uci_str);
+                        ucirecp_n++;
                     } else if (TmpNotify.Recipient_List[idx].Recipient._.Address.
                         net != 65535) {
                         memcpy(TmpNotify.Recipient_List[idx].Recipient._.
@@ -1132,17 +1130,13 @@ bool Notification_Class_Write_Property(
                             Address.adr[2],
                             TmpNotify.Recipient_List[idx].Recipient._.
                             Address.adr[3], src_port);
-                        if(ctx) {
-                                sprintf(ucirecp[ucirecp_n], "%s", uci_str);
-                                ucirecp_n++;
-                        }
+                        sprintf(ucirecp[ucirecp_n], "%s", uci_str);
+                        ucirecp_n++;
                     } else {
                         sprintf(uci_str,  "%i\n", TmpNotify.
                             Recipient_List[idx].Recipient._.Address.net);
-                        if(ctx) {
-                                sprintf(ucirecp[ucirecp_n], "%s", uci_str);
-                                ucirecp_n++;
-                        }
+                        sprintf(ucirecp[ucirecp_n], "%s", uci_str);
+                        ucirecp_n++;
                     }
 
                     iOffset += len;
@@ -1260,11 +1254,8 @@ bool Notification_Class_Write_Property(
                 }
             }
 
-            if(ctx) {
-                ucix_set_list(ctx, "bacnet_nc", idx_c, "recipient",
-                    ucirecp, ucirecp_n);
-                ucix_commit(ctx, "bacnet_nc");
-            }
+            ucix_journal_add_list("bacnet_nc", idx_c, "recipient",
+                ucirecp, ucirecp_n, true);
 
             status = true;
 
@@ -1275,9 +1266,6 @@ bool Notification_Class_Write_Property(
             wp_data->error_code = ERROR_CODE_UNKNOWN_PROPERTY;
             break;
     }
-    if(ctx) {
-        ucix_cleanup(ctx);
-    }
     return status;
 }
 
@@ -1493,7 +1481,7 @@ void Notification_Class_find_recipient(
                     DeviceIdentifier;
                 /* Send who_ is request only when address of device is unknown. */
                 if (!address_bind_request(DeviceID, &max_apdu, &src))
-                    Send_WhoIs(DeviceID, DeviceID);
+                    Send_WhoIs_Discover(DeviceID);
             } else if (CurrentNC->Recipient_List[idx].Recipient.
                 RecipientType == RECIPIENT_TYPE_ADDRESS) {
 
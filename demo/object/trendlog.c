@@ -34,15 +34,20 @@
 #include <stdlib.h>
 
 #include "bacdef.h"
+#include "bacaddr.h"
 #include "bacdcode.h"
 #include "bacenum.h"
 #include "bacapp.h"
 #include "bactext.h"
 #include "config.h"
+#include "address.h"
+#include "client.h"
 #include "device.h"
 #include "handlers.h"
 #include "trendlog.h"
+#include "tsm.h"
 #include "ucix.h"
+#include "keylist.h"
 
 /* number of demo objects */
 #ifndef MAX_TREND_LOGS
@@ -50,9 +55,26 @@
 #endif
 unsigned max_trend_logs_int = 0;
 
-TL_DATA_REC Logs[MAX_TREND_LOGS][TL_MAX_ENTRIES];
 static TREND_LOG_DESCR TL_Descr[MAX_TREND_LOGS];
 
+/* sorted Instance to TL_Descr[] slot lookup, rebuilt by Trend_Log_Init */
+static OS_Keylist TL_Instance_List = NULL;
+
+/* local object to the first of its COV logs, the rest chained by pNextCOV */
+static OS_Keylist TL_COV_List = NULL;
+/* COV logs whose local source changed, logged by trend_log_task */
+static unsigned TL_COV_Pending[MAX_TREND_LOGS];
+static unsigned TL_COV_Pending_Count = 0;
+/* seconds to wait for a binding or a free TSM slot before subscribing again */
+#define TL_COV_RETRY_SECONDS 10
+
+static void TL_COV_Object_Changed(
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance);
+static void TL_COV_Notification(
+    BACNET_ADDRESS * src,
+    BACNET_COV_DATA * cov_data);
+
 /* These three arrays are used by the ReadPropertyMultiple handler */
 static const int Trend_Log_Properties_Required[] = {
     PROP_OBJECT_IDENTIFIER,
@@ -76,10 +98,8 @@ static const int Trend_Log_Properties_Optional[] = {
     PROP_STOP_TIME,
     PROP_LOG_DEVICE_OBJECT_PROPERTY,
     PROP_LOG_INTERVAL,
-
-/* Required if COV logging supported
     PROP_COV_RESUBSCRIPTION_INTERVAL,
-    PROP_CLIENT_COV_INCREMENT, */
+    PROP_CLIENT_COV_INCREMENT,
 
 /* Required if intrinsic reporting supported
     PROP_NOTIFICATION_THRESHOLD,
@@ -137,6 +157,146 @@ void Trend_Log_Load_UCI_List(const char *sec_idx,
     return;
 }
 
+/*****************************************************************************
+ * The buffer of each log is a ring of compact records kept by tlstore.c.    *
+ * These convert between its records and TL_DATA_REC, and keep the record    *
+ * counts of the log in step with the ring. A record stamped before the last *
+ * one, as after the clock was set back, follows a time-change record.       *
+ *****************************************************************************/
+
+static void TL_Store_Rec(
+    int i,
+    TL_DATA_REC * pRec)
+{
+    TREND_LOG_DESCR *CurrentTL;
+    TL_STORE_RECORD TempRec;
+    TL_STORE_RECORD *pLast;
+    float fTime;
+
+    CurrentTL = &TL_Descr[i];
+    pLast = tl_store_record(&CurrentTL->Store, CurrentTL->Store.count);
+    if (pLast && ((uint32_t) pRec->tTimeStamp < pLast->timestamp) &&
+        (pRec->ucRecType != TL_TYPE_DELTA)) {
+        memset(&TempRec, 0, sizeof(TempRec));
+        TempRec.timestamp = (uint32_t) pRec->tTimeStamp;
+        TempRec.type = TL_TYPE_DELTA;
+        fTime = -(float) (pLast->timestamp - TempRec.timestamp);
+        memcpy(TempRec.datum, &fTime, sizeof(fTime));
+        tl_store_append(&CurrentTL->Store, &TempRec);
+    }
+    memset(&TempRec, 0, sizeof(TempRec));
+    TempRec.timestamp = (uint32_t) pRec->tTimeStamp;
+    TempRec.type = pRec->ucRecType;
+    TempRec.status = pRec->ucStatus;
+    /* the Datum union is at most 8 bytes */
+    memcpy(TempRec.datum, &pRec->Datum, sizeof(pRec->Datum));
+    tl_store_append(&CurrentTL->Store, &TempRec);
+    CurrentTL->ulRecordCount = CurrentTL->Store.count;
+    CurrentTL->ulTotalRecordCount = CurrentTL->Store.total;
+}
+
+static void TL_Load_Rec(
+    TL_STORE_RECORD * pSource,
+    TL_DATA_REC * pRec)
+{
+    pRec->tTimeStamp = (time_t) pSource->timestamp;
+    pRec->ucRecType = pSource->type;
+    pRec->ucStatus = pSource->status;
+    memcpy(&pRec->Datum, pSource->datum, sizeof(pRec->Datum));
+}
+
+/* BACnet 1 based position of the oldest entry stamped at or after tTime,
+ * or one past the last entry if they are all older */
+static uint32_t TL_Find_Time(
+    int i,
+    time_t tTime)
+{
+    if (tTime <= 0)
+        return 1;
+    if ((uint64_t) tTime > UINT32_MAX)
+        return TL_Descr[i].ulRecordCount + 1;
+
+    return tl_store_find(&TL_Descr[i].Store, (uint32_t) tTime);
+}
+
+static void TL_Clear_Recs(
+    int i)
+{
+    tl_store_clear(&TL_Descr[i].Store);
+    TL_Descr[i].ulRecordCount = 0;
+}
+
+/* true if the logged property is in this device */
+static bool TL_Source_Local(
+    TREND_LOG_DESCR * CurrentTL)
+{
+    return (CurrentTL->Source.deviceIdentifier.instance ==
+        Device_Object_Instance_Number());
+}
+
+/* (re)build the lookup of the COV logs of local objects */
+static void TL_COV_List_Init(
+    void)
+{
+    TREND_LOG_DESCR *CurrentTL;
+    KEY key;
+    unsigned i;
+
+    if (TL_COV_List) {
+        Keylist_Delete(TL_COV_List);
+    }
+    TL_COV_List = Keylist_Create();
+    for (i = 0; i < max_trend_logs_int; i++) {
+        CurrentTL = &TL_Descr[i];
+        CurrentTL->pNextCOV = NULL;
+        if ((CurrentTL->LoggingType != LOGGING_TYPE_COV) ||
+            !TL_Source_Local(CurrentTL)) {
+            continue;
+        }
+        key =
+            KEY_ENCODE(CurrentTL->Source.objectIdentifier.type,
+            CurrentTL->Source.objectIdentifier.instance);
+        /* push it on the front of the chain of this object */
+        CurrentTL->pNextCOV = Keylist_Data_Delete(TL_COV_List, key);
+        Keylist_Data_Add(TL_COV_List, key, CurrentTL);
+    }
+}
+
+/* the logging type or source of a log changed: look it up again,
+ * and subscribe to a remote source at the next timer tick */
+static void TL_COV_Update(
+    int i)
+{
+    if (TL_Descr[i].ucCOVInvokeID) {
+        /* the reply to the old subscription no longer matters */
+        tsm_free_invoke_id(TL_Descr[i].ucCOVInvokeID);
+        TL_Descr[i].ucCOVInvokeID = 0;
+    }
+    TL_Descr[i].ulCOVTimer = 0;
+    TL_Descr[i].bCOVSubscribed = false;
+    TL_Descr[i].bCOVObject = false;
+    TL_COV_List_Init();
+}
+
+/* (re)build the Instance lookup from the configured TL_Descr[] slots */
+static void Trend_Log_Instance_List_Init(
+    void)
+{
+    unsigned i;
+
+    if (TL_Instance_List) {
+        Keylist_Delete(TL_Instance_List);
+    }
+    TL_Instance_List = Keylist_Create();
+    for (i = 0; i < max_trend_logs_int; i++) {
+        /* keep the first slot of a duplicated instance, like a scan would */
+        if (!Keylist_Data(TL_Instance_List, TL_Descr[i].Instance)) {
+            Keylist_Data_Add(TL_Instance_List, TL_Descr[i].Instance,
+                &TL_Descr[i]);
+        }
+    }
+}
+
 /*
  * Things to do when starting up the stack for Trend Logs.
  * Should be called whenever we reset the device or power it up
@@ -162,11 +322,18 @@ void Trend_Log_Init(
     int uciobject_instance;
     int uciinterval;
     int uciinterval_default;
+    int ucicapacity;
+    int ucicapacity_default;
+    const char *ucistorage;
+    int ucilogging_type;
+    int ucilogging_type_default;
+    uint32_t ucidevice_instance;
+    int ucicov_resubscription;
+    int ucicov_resubscription_default;
+    struct uci_context *ucisrc_ctx;
+    const char *ucisrc_sec;
+    const char *ucisrc_idx;
     char i_instance_string[64];
-#if 0
-    struct tm TempTime;
-    time_t tClock;
-#endif
     const char *sec = "bacnet_tl";
 
 	char *section;
@@ -201,6 +368,16 @@ void Trend_Log_Init(
             "default", "device_type", OBJECT_DEVICE);
         uciobject_type_default = ucix_get_option_int(ctx, sec,
             "default", "object_type", 255);
+        ucicapacity_default = ucix_get_option_int(ctx, sec,
+            "default", "capacity", TL_MAX_ENTRIES);
+        /* an empty storage option keeps the logs in memory only */
+        ucistorage = ucix_get_option(ctx, sec, "default", "storage");
+        if (!ucistorage)
+            ucistorage = TL_STORE_PATH;
+        ucilogging_type_default = ucix_get_option_int(ctx, sec,
+            "default", "logging_type", LOGGING_TYPE_POLLED);
+        ucicov_resubscription_default = ucix_get_option_int(ctx, sec,
+            "default", "cov_resubscription", 3600);
 
         /* initialize all the values */
 
@@ -226,6 +403,9 @@ void Trend_Log_Init(
                 idx_c, "object_type", uciobject_type_default);
             uciobject_instance = ucix_get_option_int(ctx, sec,
                 idx_c, "object_instance", i);
+            /* a source in another device is logged by COV */
+            ucidevice_instance = ucix_get_option_int(ctx, sec,
+                idx_c, "device_instance", Device_Object_Instance_Number());
             sprintf(i_instance_string, "%lu",
                 (unsigned long) uciobject_instance);
             switch (uciobject_type) {
@@ -284,10 +464,20 @@ void Trend_Log_Init(
                     }
                     break;
             }
-            uciname = ucix_get_option(ctxd, uciobject_s,
-                i_instance_string, "name");
-            ucidisable = ucix_get_option_int(ctxd, uciobject_s,
-                i_instance_string, "disable", 0);
+            if (ucidevice_instance == Device_Object_Instance_Number()) {
+                ucisrc_ctx = ctxd;
+                ucisrc_sec = uciobject_s;
+                ucisrc_idx = i_instance_string;
+            } else {
+                /* no local uci section for a remote source */
+                ucisrc_ctx = ctx;
+                ucisrc_sec = sec;
+                ucisrc_idx = idx_c;
+            }
+            uciname = ucix_get_option(ucisrc_ctx, ucisrc_sec,
+                ucisrc_idx, "name");
+            ucidisable = ucix_get_option_int(ucisrc_ctx, ucisrc_sec,
+                ucisrc_idx, "disable", 0);
             if ((uciname != 0) && (ucidisable == 0)) {
                 memset(&TL_Descr[i], 0x00, sizeof(TREND_LOG_DESCR));
                 TL_Descr[i].Instance=atoi(idx_cc);
@@ -295,8 +485,8 @@ void Trend_Log_Init(
                 sprintf(name, "%s_TL", uciname);
                 ucix_string_copy(TL_Descr[i].Object_Name,
                     sizeof(TL_Descr[i].Object_Name), name);
-                ucidescription = ucix_get_option(ctxd, uciobject_s,
-                    i_instance_string, "description");
+                ucidescription = ucix_get_option(ucisrc_ctx, ucisrc_sec,
+                    ucisrc_idx, "description");
                 if (ucidescription != 0) {
                     sprintf(description, "%s", ucidescription);
                 } else if (ucidescription_default != 0) {
@@ -310,47 +500,45 @@ void Trend_Log_Init(
                     sizeof(TL_Descr[i].Object_Description), description);
                 uciinterval = ucix_get_option_int(ctx, sec,
                     idx_c, "interval", uciinterval_default);
-
-#if 0
-                /* We will just fill the logs with some entries for testing
-                 * purposes.
-                 */
-                TempTime.tm_year = 2000;
-                TempTime.tm_mon = 1;
-                TempTime.tm_mday = 1;
-                TempTime.tm_hour = 0;
-                TempTime.tm_min = 0;
-                TempTime.tm_sec = 0;
-                tClock = mktime(&TempTime);
-                for (iEntry = 0; iEntry < TL_INIT_ENTRIES; iEntry++) {
-                    Logs[i][iEntry].tTimeStamp = tClock;
-                    Logs[i][iEntry].ucRecType = TL_TYPE_REAL;
-                    Logs[i][iEntry].Datum.fReal = 0;
-                    //    (float) (iEntry + (i * TL_MAX_ENTRIES));
-                    /* Put status flags with every second log */
-                    if ((i & 1) == 0)
-                        Logs[i][iEntry].ucStatus = 128;
-                    else
-                        Logs[i][iEntry].ucStatus = 0;
-                    tClock += 900;  /* advance 15 minutes */
+                ucicapacity = ucix_get_option_int(ctx, sec,
+                    idx_c, "capacity", ucicapacity_default);
+                ucilogging_type = ucix_get_option_int(ctx, sec,
+                    idx_c, "logging_type", ucilogging_type_default);
+                ucicov_resubscription = ucix_get_option_int(ctx, sec,
+                    idx_c, "cov_resubscription",
+                    ucicov_resubscription_default);
+                if ((ucilogging_type < LOGGING_TYPE_POLLED) ||
+                    (ucilogging_type > LOGGING_TYPE_TRIGGERED) ||
+                    (ucidevice_instance != Device_Object_Instance_Number())) {
+                    ucilogging_type = LOGGING_TYPE_COV;
                 }
-                TL_Descr[i].tLastDataTime = tClock - 900;
-#endif
                 TL_Descr[i].bAlignIntervals = true;
                 TL_Descr[i].bEnable = true;
                 TL_Descr[i].bStopWhenFull = false;
                 TL_Descr[i].bTrigger = false;
-                TL_Descr[i].LoggingType = LOGGING_TYPE_POLLED;
+                TL_Descr[i].LoggingType = ucilogging_type;
                 TL_Descr[i].Source.arrayIndex = 0;
 //                TL_Descr[i].ucTimeFlags = 0;
                 TL_Descr[i].ulIntervalOffset = 0;
-                TL_Descr[i].iIndex = 0;
-                TL_Descr[i].ulLogInterval = uciinterval;
-                TL_Descr[i].ulRecordCount = TL_INIT_ENTRIES;
-                TL_Descr[i].ulTotalRecordCount = TL_INIT_ENTRIES;
+                if (ucilogging_type == LOGGING_TYPE_POLLED) {
+                    TL_Descr[i].ulLogInterval = uciinterval;
+                } else {
+                    /* As per 12.25.27 */
+                    TL_Descr[i].ulLogInterval = 0;
+                }
+                TL_Descr[i].ulCOVResubscriptionInterval =
+                    (ucicov_resubscription > 0) ?
+                    (uint32_t) ucicov_resubscription : 0;
+                /* Pick up whatever the log held before the restart */
+                tl_store_open(&TL_Descr[i].Store, ucistorage,
+                    TL_Descr[i].Instance,
+                    (ucicapacity > 0) ? (uint32_t) ucicapacity : 1);
+                TL_Descr[i].ulBufferSize = TL_Descr[i].Store.capacity;
+                TL_Descr[i].ulRecordCount = TL_Descr[i].Store.count;
+                TL_Descr[i].ulTotalRecordCount = TL_Descr[i].Store.total;
 
                 TL_Descr[i].Source.deviceIdentifier.instance =
-                    Device_Object_Instance_Number();
+                    ucidevice_instance;
                 TL_Descr[i].Source.deviceIdentifier.type = ucidevice_type;
                 TL_Descr[i].Source.objectIdentifier.instance = uciobject_instance;
                 TL_Descr[i].Source.objectIdentifier.type = uciobject_type;
@@ -360,10 +548,19 @@ void Trend_Log_Init(
                 datetime_set_values(&TL_Descr[i].StartTime, 2000, 1, 1, 0, 0, 0,
                     0);
                 TL_Descr[i].ucTimeFlags |= TL_T_STOP_WILD;
+                if (TL_Descr[i].ulRecordCount != 0) {
+                    /* Readings were missed while we were down */
+                    TL_Insert_Status_Rec(i, LOG_STATUS_LOG_INTERRUPTED,
+                        true);
+                }
                 i++;
                 max_trend_logs_int = i;
             }
         }
+        Trend_Log_Instance_List_Init();
+        TL_COV_List_Init();
+        handler_cov_object_changed_set_callback(TL_COV_Object_Changed);
+        handler_cov_notification_set_callback(TL_COV_Notification);
 #if PRINT_ENABLED
         fprintf(stderr, "max_trend_logs: %i\n", max_trend_logs_int);
 #endif
@@ -373,23 +570,18 @@ void Trend_Log_Init(
     return;
 }
 
-/* we simply have 0-n object instances.  Yours might be */
-/* more complex, and then you need to return the index */
-/* that correlates to the correct instance number */
+/* Instances come from the uci section names and may be sparse, */
+/* so the slot is found with a binary search of the sorted list */
 unsigned Trend_Log_Instance_To_Index(
     uint32_t object_instance)
 {
     TREND_LOG_DESCR *CurrentTL;
-    int index,i;
-    //int instance;
-    index = max_trend_logs_int;
-    for (i = 0; i < index; i++) {
-    	CurrentTL = &TL_Descr[i];
-    	//instance = CurrentTL->Instance;
-    	if (CurrentTL->Instance == object_instance) {
-    		return i;
-    	}
+
+    CurrentTL = Keylist_Data(TL_Instance_List, object_instance);
+    if (CurrentTL) {
+        return (unsigned) (CurrentTL - &TL_Descr[0]);
     }
+
     return MAX_TREND_LOGS;
 }
 
@@ -512,16 +704,8 @@ static bool Trend_Log_Description_Write(
                 } else {
                     sprintf(idx_cc, "%u", index);
                     idx_c = idx_cc;
-                    if(ctx) {
-                        ucix_add_option(ctx, "bacnet_tl", idx_c,
-                            "description", char_string->value);
-                        ucix_commit(ctx, "bacnet_bv");
-#if PRINT_ENABLED
-                    } else {
-                        fprintf(stderr,
-                            "Failed to open config file bacnet_tl\n");
-#endif
-                    }
+                    ucix_journal_add("bacnet_tl", idx_c,
+                        "description", CurrentTL->Object_Description, true);
                 }
             } else {
                 *error_class = ERROR_CLASS_PROPERTY;
@@ -586,18 +770,12 @@ static bool Trend_Log_Object_Name_Write(
                     *error_class = ERROR_CLASS_PROPERTY;
                     *error_code = ERROR_CODE_VALUE_OUT_OF_RANGE;
                 } else {
+                    Device_Object_Name_Changed(OBJECT_TRENDLOG,
+                        object_instance);
                     sprintf(idx_cc, "%d", index);
                     idx_c = idx_cc;
-                    if(ctx) {
-                        ucix_add_option(ctx, "bacnet_tl", idx_c,
-                            "name", char_string->value);
-                        ucix_commit(ctx, "bacnet_tl");
-#if PRINT_ENABLED
-                    } else {
-                        fprintf(stderr,
-                            "Failed to open config file bacnet_tl\n");
-#endif
-                    }
+                    ucix_journal_add("bacnet_tl", idx_c,
+                        "name", CurrentTL->Object_Name, true);
                 }
             } else {
                 *error_class = ERROR_CLASS_PROPERTY;
@@ -678,7 +856,9 @@ int Trend_Log_Read_Property(
             break;
 
         case PROP_BUFFER_SIZE:
-            apdu_len = encode_application_unsigned(&apdu[0], TL_MAX_ENTRIES);
+            apdu_len =
+                encode_application_unsigned(&apdu[0],
+                CurrentTL->ulBufferSize);
             break;
 
         case PROP_LOG_BUFFER:
@@ -765,6 +945,24 @@ int Trend_Log_Read_Property(
                 CurrentTL->ulLogInterval * 100);
             break;
 
+        case PROP_COV_RESUBSCRIPTION_INTERVAL:
+            apdu_len =
+                encode_application_unsigned(&apdu[0],
+                CurrentTL->ulCOVResubscriptionInterval);
+            break;
+
+        case PROP_CLIENT_COV_INCREMENT:
+            /* NULL means the source's own COV_Increment applies; a local
+             * source never reports below its own, whatever is set here */
+            if (CurrentTL->bClientCOVIncrement) {
+                apdu_len =
+                    encode_application_real(&apdu[0],
+                    CurrentTL->fClientCOVIncrement);
+            } else {
+                apdu_len = encode_application_null(&apdu[0]);
+            }
+            break;
+
         case PROP_ALIGN_INTERVALS:
             apdu_len =
                 encode_application_boolean(&apdu[0],
@@ -815,7 +1013,6 @@ bool Trend_Log_Write_Property(
     BACNET_DATE TempDate;       /* build here in case of error in time half of datetime */
     BACNET_DEVICE_OBJECT_PROPERTY_REFERENCE TempSource;
     bool bEffectiveEnable;
-    ctx = ucix_init("bacnet_tl");
     //const char *idx_c;
     char idx_cc[64];
 
@@ -893,7 +1090,7 @@ bool Trend_Log_Write_Property(
                 /* Section 12.25.5 can't enable a full log with stop when full set */
                 if ((CurrentTL->bEnable == false) &&
                     (CurrentTL->bStopWhenFull == true) &&
-                    (CurrentTL->ulRecordCount == TL_MAX_ENTRIES) &&
+                    (CurrentTL->ulRecordCount == CurrentTL->ulBufferSize) &&
                     (value.type.Boolean == true)) {
                     status = false;
                     wp_data->error_class = ERROR_CLASS_OBJECT;
@@ -936,7 +1133,7 @@ bool Trend_Log_Write_Property(
                     CurrentTL->bStopWhenFull = value.type.Boolean;
 
                     if ((value.type.Boolean == true) &&
-                        (CurrentTL->ulRecordCount == TL_MAX_ENTRIES) &&
+                        (CurrentTL->ulRecordCount == CurrentTL->ulBufferSize) &&
                         (CurrentTL->bEnable == true)) {
 
                         /* When full log is switched from normal to stop when full
@@ -966,8 +1163,7 @@ bool Trend_Log_Write_Property(
             if (status) {
                 if (value.type.Unsigned_Int == 0) {
                     /* Time to clear down the log */
-                    CurrentTL->ulRecordCount = 0;
-                    CurrentTL->iIndex = 0;
+                    TL_Clear_Recs(index);
                     TL_Insert_Status_Rec(index, LOG_STATUS_BUFFER_PURGED,
                         true);
                 }
@@ -982,25 +1178,30 @@ bool Trend_Log_Write_Property(
                 WPValidateArgType(&value, BACNET_APPLICATION_TAG_ENUMERATED,
                 &wp_data->error_class, &wp_data->error_code);
             if (status) {
-                if (value.type.Enumerated != LOGGING_TYPE_COV) {
+                if (value.type.Enumerated > LOGGING_TYPE_TRIGGERED) {
+                    status = false;
+                    wp_data->error_class = ERROR_CLASS_PROPERTY;
+                    wp_data->error_code = ERROR_CODE_VALUE_OUT_OF_RANGE;
+                } else if ((value.type.Enumerated != LOGGING_TYPE_COV) &&
+                    !TL_Source_Local(CurrentTL)) {
+                    /* A remote source can only be fed by COV notifications */
+                    status = false;
+                    wp_data->error_class = ERROR_CLASS_PROPERTY;
+                    wp_data->error_code =
+                        ERROR_CODE_OPTIONAL_FUNCTIONALITY_NOT_SUPPORTED;
+                } else {
                     CurrentTL->LoggingType = value.type.Enumerated;
                     if (value.type.Enumerated == LOGGING_TYPE_POLLED) {
                         /* As per 12.25.27 pick a suitable default if interval is 0 */
                         if (CurrentTL->ulLogInterval == 0) {
                             CurrentTL->ulLogInterval = 900;
                         }
-                    }
-                    if (value.type.Enumerated == LOGGING_TYPE_TRIGGERED) {
-                        /* As per 12.25.27 0 the interval if triggered logging selected */
+                    } else {
+                        /* As per 12.25.27 0 the interval if COV or triggered
+                         * logging selected */
                         CurrentTL->ulLogInterval = 0;
                     }
-                } else {
-                	//TODO
-                    /* We don't currently support COV */
-                    status = false;
-                    wp_data->error_class = ERROR_CLASS_PROPERTY;
-                    wp_data->error_code =
-                        ERROR_CODE_OPTIONAL_FUNCTIONALITY_NOT_SUPPORTED;
+                    TL_COV_Update(index);
                 }
             }
             break;
@@ -1112,6 +1313,10 @@ bool Trend_Log_Write_Property(
         case PROP_LOG_DEVICE_OBJECT_PROPERTY:
             memset(&TempSource, 0, sizeof(TempSource)); /* Start with clean sheet */
             TempSource.arrayIndex = BACNET_ARRAY_ALL;   /* Need this so if no array index set we read properties in full */
+            /* Device ID is ours in case not supplied */
+            TempSource.deviceIdentifier.type = OBJECT_DEVICE;
+            TempSource.deviceIdentifier.instance =
+                Device_Object_Instance_Number();
 
             /* First up is the object ID */
             len =
@@ -1183,10 +1388,15 @@ bool Trend_Log_Write_Property(
                 if (value.context_tag == 3) {
                     /* Got a device ID so deal with it */
                     TempSource.deviceIdentifier = value.type.Object_Id;
+                    if (TempSource.deviceIdentifier.type != OBJECT_DEVICE) {
+                        wp_data->error_class = ERROR_CLASS_PROPERTY;
+                        wp_data->error_code = ERROR_CODE_VALUE_OUT_OF_RANGE;
+                        break;
+                    }
                     if ((TempSource.deviceIdentifier.instance !=
-                            Device_Object_Instance_Number()) ||
-                        (TempSource.deviceIdentifier.type != OBJECT_DEVICE)) {
-                        /* Not our ID so can't handle it at the moment */
+                            Device_Object_Instance_Number()) &&
+                        (CurrentTL->LoggingType != LOGGING_TYPE_COV)) {
+                        /* We can only poll or trigger our own objects */
                         wp_data->error_class = ERROR_CLASS_PROPERTY;
                         wp_data->error_code =
                             ERROR_CODE_OPTIONAL_FUNCTIONALITY_NOT_SUPPORTED;
@@ -1194,20 +1404,16 @@ bool Trend_Log_Write_Property(
                     }
                 }
             }
-            /* Make sure device ID is set to ours in case not supplied */
-            TempSource.deviceIdentifier.type = OBJECT_DEVICE;
-            TempSource.deviceIdentifier.instance =
-                Device_Object_Instance_Number();
             /* Quick comparison if structures are packed ... */
             if (memcmp(&TempSource, &CurrentTL->Source,
                     sizeof(BACNET_DEVICE_OBJECT_PROPERTY_REFERENCE)) != 0) {
                 /* Clear buffer if property being logged is changed */
-                CurrentTL->ulRecordCount = 0;
-                CurrentTL->iIndex = 0;
+                TL_Clear_Recs(index);
                 TL_Insert_Status_Rec(index, LOG_STATUS_BUFFER_PURGED,
                     true);
             }
             CurrentTL->Source = TempSource;
+            TL_COV_Update(index);
             status = true;
             break;
 
@@ -1222,15 +1428,24 @@ bool Trend_Log_Write_Property(
                 WPValidateArgType(&value, BACNET_APPLICATION_TAG_UNSIGNED_INT,
                 &wp_data->error_class, &wp_data->error_code);
             if (status) {
-                if ((CurrentTL->LoggingType == LOGGING_TYPE_POLLED) &&
-                    (value.type.Unsigned_Int == 0)) {
-                    /* We don't support COV at the moment so don't allow switching
-                     * to it by clearing interval whilst in polling mode */
+                if (value.type.Unsigned_Int == 0) {
+                    /* As per 12.25.14 clearing the interval selects COV */
+                    CurrentTL->LoggingType = LOGGING_TYPE_COV;
+                    CurrentTL->ulLogInterval = 0;
+                    TL_COV_Update(index);
+                } else if ((CurrentTL->LoggingType == LOGGING_TYPE_COV) &&
+                    !TL_Source_Local(CurrentTL)) {
+                    /* A remote source can't be polled */
                     wp_data->error_class = ERROR_CLASS_PROPERTY;
                     wp_data->error_code =
                         ERROR_CODE_OPTIONAL_FUNCTIONALITY_NOT_SUPPORTED;
                     status = false;
                 } else {
+                    /* and setting it selects polling */
+                    if (CurrentTL->LoggingType == LOGGING_TYPE_COV) {
+                        CurrentTL->LoggingType = LOGGING_TYPE_POLLED;
+                        TL_COV_Update(index);
+                    }
                     /* We only log to 1 sec accuracy so must divide by 100 before passing it on */
                     CurrentTL->ulLogInterval = value.type.Unsigned_Int / 100;
 					if(0 == CurrentTL->ulLogInterval)
@@ -1239,6 +1454,42 @@ bool Trend_Log_Write_Property(
             }
             break;
 
+        case PROP_COV_RESUBSCRIPTION_INTERVAL:
+            status =
+                WPValidateArgType(&value, BACNET_APPLICATION_TAG_UNSIGNED_INT,
+                &wp_data->error_class, &wp_data->error_code);
+            if (status) {
+                CurrentTL->ulCOVResubscriptionInterval =
+                    value.type.Unsigned_Int;
+                /* Resubscribe with the new lifetime */
+                TL_COV_Update(index);
+            }
+            break;
+
+        case PROP_CLIENT_COV_INCREMENT:
+            if (value.tag == BACNET_APPLICATION_TAG_NULL) {
+                CurrentTL->bClientCOVIncrement = false;
+                CurrentTL->fClientCOVIncrement = 0.0;
+                status = true;
+            } else if (value.tag == BACNET_APPLICATION_TAG_REAL) {
+                if (value.type.Real < 0.0) {
+                    wp_data->error_class = ERROR_CLASS_PROPERTY;
+                    wp_data->error_code = ERROR_CODE_VALUE_OUT_OF_RANGE;
+                } else {
+                    CurrentTL->bClientCOVIncrement = true;
+                    CurrentTL->fClientCOVIncrement = value.type.Real;
+                    status = true;
+                }
+            } else {
+                wp_data->error_class = ERROR_CLASS_PROPERTY;
+                wp_data->error_code = ERROR_CODE_INVALID_DATA_TYPE;
+            }
+            if (status) {
+                /* Resubscribe with the new increment */
+                TL_COV_Update(index);
+            }
+            break;
+
         case PROP_ALIGN_INTERVALS:
             status =
                 WPValidateArgType(&value, BACNET_APPLICATION_TAG_BOOLEAN,
@@ -1285,10 +1536,6 @@ bool Trend_Log_Write_Property(
             break;
     }
 
-    if(ctx) {
-        ucix_cleanup(ctx);
-    }
-
     return status;
 }
 
@@ -1324,11 +1571,8 @@ void TL_Insert_Status_Rec(
     BACNET_LOG_STATUS eStatus,
     bool bState)
 {
-    TREND_LOG_DESCR *CurrentTL;
     TL_DATA_REC TempRec;
 
-    CurrentTL = &TL_Descr[i];
-
     TempRec.tTimeStamp = time(NULL);
     TempRec.ucRecType = TL_TYPE_STATUS;
     TempRec.ucStatus = 0;
@@ -1351,14 +1595,7 @@ void TL_Insert_Status_Rec(
             break;
     }
 
-    Logs[i][CurrentTL->iIndex++] = TempRec;
-    if (CurrentTL->iIndex >= TL_MAX_ENTRIES)
-        CurrentTL->iIndex = 0;
-
-    CurrentTL->ulTotalRecordCount++;
-
-    if (CurrentTL->ulRecordCount < TL_MAX_ENTRIES)
-        CurrentTL->ulRecordCount++;
+    TL_Store_Rec(i, &TempRec);
 }
 
 /*****************************************************************************
@@ -1502,6 +1739,55 @@ void TL_Local_Time_To_BAC(
 
 #define TL_MAX_ENC 23   /* Maximum size of encoded log entry, see above */
 
+static int TL_encode_rec(
+    uint8_t * apdu,
+    TL_DATA_REC * pSource);
+
+/****************************************************************************
+ * Encode up to uiCount entries starting at BACnet 1 based position uiIndex *
+ * and stopping early if the APDU fills up. The entries are consecutive in  *
+ * the ring, so we step through it rather than looking each one up. The     *
+ * number of entries encoded is added to the request item count.            *
+ ****************************************************************************/
+
+static int TL_encode_entries(
+    uint8_t * apdu,
+    int i,
+    uint32_t uiIndex,
+    uint32_t uiCount,
+    uint32_t uiRemaining,
+    BACNET_READ_RANGE_DATA * pRequest)
+{
+    TL_STORE_RECORD *pSource;
+    TL_DATA_REC TempRec;
+    int iLen = 0;
+    int iTemp = 0;
+
+    pSource = tl_store_record(&TL_Descr[i].Store, uiIndex);
+    while ((uiCount != 0) && (pSource != NULL)) {
+        if (uiRemaining < TL_MAX_ENC) {
+            /*
+             * Can't fit any more in! We just set the result flag to say there
+             * was more and drop out of the loop early
+             */
+            bitstring_set_bit(&pRequest->ResultFlags, RESULT_FLAG_MORE_ITEMS,
+                true);
+            break;
+        }
+
+        TL_Load_Rec(pSource, &TempRec);
+        iTemp = TL_encode_rec(&apdu[iLen], &TempRec);
+
+        uiRemaining -= iTemp;   /* Reduce the remaining space */
+        iLen += iTemp;  /* and increase the length consumed */
+        pRequest->ItemCount++;  /* Chalk up another one for the response count */
+        uiCount--;
+        pSource = tl_store_next(&TL_Descr[i].Store, pSource);
+    }
+
+    return (iLen);
+}
+
 int rr_trend_log_encode(
     uint8_t * apdu,
     BACNET_READ_RANGE_DATA * pRequest)
@@ -1546,7 +1832,6 @@ int TL_encode_by_position(
     int32_t iTemp = 0;
     TREND_LOG_DESCR *CurrentTL = NULL;
 
-    uint32_t uiIndex = 0;       /* Current entry number */
     uint32_t uiFirst = 0;       /* Entry number we started encoding from */
     uint32_t uiLast = 0;        /* Entry number we finished encoding on */
     uint32_t uiTarget = 0;      /* Last entry we are required to encode */
@@ -1602,27 +1887,12 @@ int TL_encode_by_position(
     if (uiTarget > CurrentTL->ulRecordCount)   /* Capped at end of list if necessary */
         uiTarget = CurrentTL->ulRecordCount;
 
-    uiIndex = pRequest->Range.RefIndex;
-    uiFirst = uiIndex;  /* Record where we started from */
-    while (uiIndex <= uiTarget) {
-        if (uiRemaining < TL_MAX_ENC) {
-            /*
-             * Can't fit any more in! We just set the result flag to say there
-             * was more and drop out of the loop early
-             */
-            bitstring_set_bit(&pRequest->ResultFlags, RESULT_FLAG_MORE_ITEMS,
-                true);
-            break;
-        }
-
-        iTemp = TL_encode_entry(&apdu[iLen], index, uiIndex);
-
-        uiRemaining -= iTemp;   /* Reduce the remaining space */
-        iLen += iTemp;  /* and increase the length consumed */
-        uiLast = uiIndex;       /* Record the last entry encoded */
-        uiIndex++;      /* and get ready for next one */
-        pRequest->ItemCount++;  /* Chalk up another one for the response count */
-    }
+    uiFirst = pRequest->Range.RefIndex; /* Record where we started from */
+    iLen =
+        TL_encode_entries(apdu, index, uiFirst, uiTarget - uiFirst + 1,
+        uiRemaining, pRequest);
+    if (pRequest->ItemCount != 0)
+        uiLast = uiFirst + pRequest->ItemCount - 1;
 
     /* Set remaining result flags if necessary */
     if (uiFirst == 1)
@@ -1649,13 +1919,10 @@ int TL_encode_by_sequence(
 {
     unsigned index = 0;
     int iLen = 0;
-    int32_t iTemp = 0;
     TREND_LOG_DESCR *CurrentTL = NULL;
 
-    uint32_t uiIndex = 0;       /* Current entry number */
     uint32_t uiFirst = 0;       /* Entry number we started encoding from */
     uint32_t uiLast = 0;        /* Entry number we finished encoding on */
-    uint32_t uiSequence = 0;    /* Tracking sequenc number when encoding */
     uint32_t uiRemaining = 0;   /* Amount of unused space in packet */
     uint32_t uiFirstSeq = 0;    /* Sequence number for 1st record in log */
 
@@ -1738,29 +2005,12 @@ int TL_encode_by_sequence(
     /* We now have a range that lies completely within the log buffer
      * and we need to figure out where that starts in the buffer.
      */
-    uiIndex = uiBegin - uiFirstSeq + 1;
-    uiSequence = uiBegin;
-    uiFirst = uiIndex;  /* Record where we started from */
-    while (uiSequence != uiEnd + 1) {
-        if (uiRemaining < TL_MAX_ENC) {
-            /*
-             * Can't fit any more in! We just set the result flag to say there
-             * was more and drop out of the loop early
-             */
-            bitstring_set_bit(&pRequest->ResultFlags, RESULT_FLAG_MORE_ITEMS,
-                true);
-            break;
-        }
-
-        iTemp = TL_encode_entry(&apdu[iLen], index, uiIndex);
-
-        uiRemaining -= iTemp;   /* Reduce the remaining space */
-        iLen += iTemp;  /* and increase the length consumed */
-        uiLast = uiIndex;       /* Record the last entry encoded */
-        uiIndex++;      /* and get ready for next one */
-        uiSequence++;
-        pRequest->ItemCount++;  /* Chalk up another one for the response count */
-    }
+    uiFirst = uiBegin - uiFirstSeq + 1; /* Record where we started from */
+    iLen =
+        TL_encode_entries(apdu, index, uiFirst, uiEnd - uiBegin + 1,
+        uiRemaining, pRequest);
+    if (pRequest->ItemCount != 0)
+        uiLast = uiFirst + pRequest->ItemCount - 1;
 
     /* Set remaining result flags if necessary */
     if (uiFirst == 1)
@@ -1788,11 +2038,10 @@ int TL_encode_by_time(
 {
     unsigned index = 0;
     int iLen = 0;
-    int32_t iTemp = 0;
-    int iCount = 0;
     TREND_LOG_DESCR *CurrentTL = NULL;
 
     uint32_t uiIndex = 0;       /* Current entry number */
+    uint32_t uiCount = 0;       /* Number of entries to encode */
     uint32_t uiFirst = 0;       /* Entry number we started encoding from */
     uint32_t uiLast = 0;        /* Entry number we finished encoding on */
     uint32_t uiRemaining = 0;   /* Amount of unused space in packet */
@@ -1808,29 +2057,16 @@ int TL_encode_by_time(
     CurrentTL = &TL_Descr[index];
 
     tRefTime = TL_BAC_Time_To_Local(&pRequest->Range.RefTime);
-    /* Find correct position for oldest entry in log */
-    if (CurrentTL->ulRecordCount < TL_MAX_ENTRIES)
-        uiIndex = 0;
-    else
-        uiIndex = CurrentTL->iIndex;
 
     if (pRequest->Count < 0) {
-        /* Start at end of log and look for record which has
-         * timestamp greater than or equal to the reference.
+        /* Find the newest record which has a timestamp before the
+         * reference, the entries are searched in time order unless the
+         * clock was set back (see tlstore.h).
          */
-        iCount = CurrentTL->ulRecordCount - 1;
-        /* Start out with the sequence number for the last record */
-        uiFirstSeq = CurrentTL->ulTotalRecordCount;
-        for (;;) {
-            if (Logs[index][(uiIndex +
-                        iCount) % TL_MAX_ENTRIES].tTimeStamp < tRefTime)
-                break;
-
-            uiFirstSeq--;
-            iCount--;
-            if (iCount < 0)
-                return (0);
-        }
+        uiIndex = TL_Find_Time(index, tRefTime);
+        if (uiIndex == 1)
+            return (0);
+        uiIndex--;
 
         /* We have an and point for our request,
          * now work backwards to find where we should start from
@@ -1839,66 +2075,38 @@ int TL_encode_by_time(
         pRequest->Count = -pRequest->Count;     /* Conveert to +ve count */
         /* If count would bring us back beyond the limits
          * Of the buffer then pin it to the start of the buffer
-         * otherwise adjust starting point and sequence number
-         * appropriately.
+         * otherwise adjust starting point appropriately.
          */
-        iTemp = pRequest->Count - 1;
-        if (iTemp > iCount) {
-            uiFirstSeq -= iCount;
-            pRequest->Count = iCount + 1;
-            iCount = 0;
+        if ((uint32_t) pRequest->Count > uiIndex) {
+            pRequest->Count = uiIndex;
+            uiIndex = 1;
         } else {
-            uiFirstSeq -= iTemp;
-            iCount -= iTemp;
+            uiIndex -= pRequest->Count - 1;
         }
     } else {
-        /* Start at beginning of log and look for 1st record which has
-         * timestamp greater than the reference time.
+        /* Find the oldest record which has a timestamp after the
+         * reference time.
          */
-        iCount = 0;
-        /* Figure out the sequence number for the first record, last is ulTotalRecordCount */
-        uiFirstSeq =
-            CurrentTL->ulTotalRecordCount - (CurrentTL->ulRecordCount - 1);
-        for (;;) {
-            if (Logs[index][(uiIndex +
-                        iCount) % TL_MAX_ENTRIES].tTimeStamp > tRefTime)
-                break;
-
-            uiFirstSeq++;
-            iCount++;
-            if ((uint32_t) iCount == CurrentTL->ulRecordCount)
-                return (0);
-        }
+        uiIndex = TL_Find_Time(index, tRefTime + 1);
+        if (uiIndex > CurrentTL->ulRecordCount)
+            return (0);
     }
 
     /* We now have a starting point for the operation and a +ve count */
 
-    uiIndex = iCount + 1;       /* Convert to BACnet 1 based reference */
     uiFirst = uiIndex;  /* Record where we started from */
-    iCount = pRequest->Count;
-    while (iCount != 0) {
-        if (uiRemaining < TL_MAX_ENC) {
-            /*
-             * Can't fit any more in! We just set the result flag to say there
-             * was more and drop out of the loop early
-             */
-            bitstring_set_bit(&pRequest->ResultFlags, RESULT_FLAG_MORE_ITEMS,
-                true);
-            break;
-        }
-
-        iTemp = TL_encode_entry(&apdu[iLen], index, uiIndex);
-
-        uiRemaining -= iTemp;   /* Reduce the remaining space */
-        iLen += iTemp;  /* and increase the length consumed */
-        uiLast = uiIndex;       /* Record the last entry encoded */
-        uiIndex++;      /* and get ready for next one */
-        pRequest->ItemCount++;  /* Chalk up another one for the response count */
-        iCount--;       /* And finally cross another one off the requested count */
-
-        if (uiIndex > CurrentTL->ulRecordCount)        /* Finish up if we hit the end of the log */
-            break;
-    }
+    /* Figure out the sequence number for it, last is ulTotalRecordCount */
+    uiFirstSeq =
+        CurrentTL->ulTotalRecordCount - (CurrentTL->ulRecordCount - uiIndex);
+    /* Finish up if we hit the end of the log */
+    uiCount = CurrentTL->ulRecordCount - uiIndex + 1;
+    if ((uint32_t) pRequest->Count < uiCount)
+        uiCount = pRequest->Count;
+    iLen =
+        TL_encode_entries(apdu, index, uiFirst, uiCount, uiRemaining,
+        pRequest);
+    if (pRequest->ItemCount != 0)
+        uiLast = uiFirst + pRequest->ItemCount - 1;
 
     /* Set remaining result flags if necessary */
     if (uiFirst == 1)
@@ -1918,23 +2126,28 @@ int TL_encode_entry(
     uint8_t * apdu,
     int i,
     int iEntry)
+{
+    TL_STORE_RECORD *pSource;
+    TL_DATA_REC TempRec;
+
+    /* Copy the entry out of the circular buffer, positions are 1 based */
+    pSource = tl_store_record(&TL_Descr[i].Store, iEntry);
+    if (!pSource)
+        return 0;
+    TL_Load_Rec(pSource, &TempRec);
+
+    return TL_encode_rec(apdu, &TempRec);
+}
+
+static int TL_encode_rec(
+    uint8_t * apdu,
+    TL_DATA_REC * pSource)
 {
     int iLen = 0;
-    TL_DATA_REC *pSource = NULL;
     BACNET_BIT_STRING TempBits;
     uint8_t ucCount = 0;
     BACNET_DATE_TIME TempTime;
 
-    /* Convert from BACnet 1 based to 0 based array index and then
-     * handle wrap around of the circular buffer */
-
-    if (TL_Descr[i].ulRecordCount < TL_MAX_ENTRIES)
-        pSource = &Logs[i][(iEntry - 1) % TL_MAX_ENTRIES];
-    else
-        pSource =
-            &Logs[i][(TL_Descr[i].iIndex + iEntry - 1) % TL_MAX_ENTRIES];
-
-    iLen = 0;
     /* First stick the time stamp in with tag [0] */
     TL_Local_Time_To_BAC(&TempTime, pSource->tTimeStamp);
     iLen += bacapp_encode_context_datetime(apdu, 0, &TempTime);
@@ -2083,17 +2296,58 @@ static int local_read_property(
 }
 
 /****************************************************************************
- * Attempt to fetch the logged property and store it in the Trend Log       *
+ * A COV log with a Client_COV_Increment only records a REAL that moved at  *
+ * least that far from the last one logged. Anything else is always logged. *
+ * A remote source is asked for the increment with SubscribeCOVProperty,    *
+ * but a local one still only reports when its own COV_Increment trips, so  *
+ * the increment that applies there is the larger of the two.               *
  ****************************************************************************/
 
-static void TL_fetch_property(
-    int i)
+static bool TL_COV_Increment_Met(
+    int i,
+    TL_DATA_REC * pRec)
+{
+    TREND_LOG_DESCR *CurrentTL;
+    TL_STORE_RECORD *pLast;
+    TL_DATA_REC LastRec;
+    float fDelta;
+
+    CurrentTL = &TL_Descr[i];
+    if ((CurrentTL->LoggingType != LOGGING_TYPE_COV) ||
+        !CurrentTL->bClientCOVIncrement ||
+        (pRec->ucRecType != TL_TYPE_REAL) || (CurrentTL->ulRecordCount == 0)) {
+        return true;
+    }
+    pLast = tl_store_record(&CurrentTL->Store, CurrentTL->ulRecordCount);
+    if (!pLast) {
+        return true;
+    }
+    TL_Load_Rec(pLast, &LastRec);
+    if ((LastRec.ucRecType != TL_TYPE_REAL) ||
+        (LastRec.ucStatus != pRec->ucStatus)) {
+        return true;
+    }
+    fDelta = pRec->Datum.fReal - LastRec.Datum.fReal;
+    if (fDelta < 0.0) {
+        fDelta = -fDelta;
+    }
+
+    return (fDelta >= CurrentTL->fClientCOVIncrement);
+}
+
+/****************************************************************************
+ * Store a value read from the source, or the error returned in its place,  *
+ * in the Trend Log. The status flags are optional for a COV notification.  *
+ ****************************************************************************/
+
+static void TL_store_value(
+    int i,
+    int iLen,
+    uint8_t * ValueBuf,
+    uint8_t * StatusBuf,
+    BACNET_ERROR_CLASS error_class,
+    BACNET_ERROR_CODE error_code)
 {
-    uint8_t ValueBuf[MAX_APDU]; /* This is a big buffer in case someone selects the device object list for example */
-    uint8_t StatusBuf[3];       /* Should be tag, bits unused in last octet and 1 byte of data */
-    BACNET_ERROR_CLASS error_class = 0;
-    BACNET_ERROR_CODE error_code = 0;
-    int iLen;
     uint8_t ucCount;
     TREND_LOG_DESCR *CurrentTL;
     TL_DATA_REC TempRec;
@@ -2109,9 +2363,6 @@ static void TL_fetch_property(
     CurrentTL->tLastDataTime = TempRec.tTimeStamp;
     TempRec.ucStatus = 0;
 
-    iLen =
-        local_read_property(ValueBuf, StatusBuf, &TL_Descr[i].Source,
-        &error_class, &error_code);
     if (iLen < 0) {
         /* Insert error code into log */
         TempRec.Datum.Error.usClass = error_class;
@@ -2188,21 +2439,331 @@ static void TL_fetch_property(
                 break;
         }
         /* Finally insert the status flags into the record */
-        iLen =
-            decode_tag_number_and_value(StatusBuf, &tag_number,
-            &len_value_type);
-        decode_bitstring(&StatusBuf[iLen], len_value_type, &TempBits);
-        TempRec.ucStatus = 128 | bitstring_octet(&TempBits, 0);
+        if (StatusBuf != NULL) {
+            iLen =
+                decode_tag_number_and_value(StatusBuf, &tag_number,
+                &len_value_type);
+            decode_bitstring(&StatusBuf[iLen], len_value_type, &TempBits);
+            TempRec.ucStatus = 128 | bitstring_octet(&TempBits, 0);
+        }
     }
 
-    Logs[i][CurrentTL->iIndex++] = TempRec;
-    if (CurrentTL->iIndex >= TL_MAX_ENTRIES)
-        CurrentTL->iIndex = 0;
+    if (TL_COV_Increment_Met(i, &TempRec)) {
+        TL_Store_Rec(i, &TempRec);
+    }
+}
 
-    CurrentTL->ulTotalRecordCount++;
+/****************************************************************************
+ * Attempt to fetch the logged property and store it in the Trend Log       *
+ ****************************************************************************/
 
-    if (CurrentTL->ulRecordCount < TL_MAX_ENTRIES)
-        CurrentTL->ulRecordCount++;
+static void TL_fetch_property(
+    int i)
+{
+    uint8_t ValueBuf[MAX_APDU]; /* This is a big buffer in case someone selects the device object list for example */
+    uint8_t StatusBuf[3];       /* Should be tag, bits unused in last octet and 1 byte of data */
+    BACNET_ERROR_CLASS error_class = 0;
+    BACNET_ERROR_CODE error_code = 0;
+    int iLen;
+
+    iLen =
+        local_read_property(ValueBuf, StatusBuf, &TL_Descr[i].Source,
+        &error_class, &error_code);
+    TL_store_value(i, iLen, ValueBuf, StatusBuf, error_class, error_code);
+}
+
+/****************************************************************************
+ * A local object reported a change of value: queue its COV logs. The value *
+ * is read by trend_log_task, as some objects report before they store it.  *
+ ****************************************************************************/
+
+static void TL_COV_Object_Changed(
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance)
+{
+    TREND_LOG_DESCR *CurrentTL;
+
+    CurrentTL =
+        Keylist_Data(TL_COV_List, KEY_ENCODE(object_type, object_instance));
+    while (CurrentTL) {
+        /* each log is queued once, so the queue can't overflow */
+        if (!CurrentTL->bCOVPending) {
+            CurrentTL->bCOVPending = true;
+            TL_COV_Pending[TL_COV_Pending_Count++] =
+                (unsigned) (CurrentTL - &TL_Descr[0]);
+        }
+        CurrentTL = CurrentTL->pNextCOV;
+    }
+}
+
+/****************************************************************************
+ * True if src is the address the source device of the log is bound to.    *
+ ****************************************************************************/
+
+static bool TL_COV_Source_Address(
+    TREND_LOG_DESCR * CurrentTL,
+    BACNET_ADDRESS * src)
+{
+    BACNET_ADDRESS dest;
+    unsigned max_apdu = 0;
+
+    return address_get_by_device(CurrentTL->Source.deviceIdentifier.instance,
+        &max_apdu, &dest) && bacnet_address_same(&dest, src);
+}
+
+/****************************************************************************
+ * A COV notification arrived. We subscribe with the Instance of the log as *
+ * the process identifier, so it tells us which log it is for, and only    *
+ * take it from the address the source device is bound to.                  *
+ ****************************************************************************/
+
+static void TL_COV_Notification(
+    BACNET_ADDRESS * src,
+    BACNET_COV_DATA * cov_data)
+{
+    uint8_t ValueBuf[MAX_APDU];
+    uint8_t StatusBuf[3];
+    bool bValue = false;
+    bool bStatus = false;
+    int iLen = 0;
+    TREND_LOG_DESCR *CurrentTL;
+    BACNET_PROPERTY_VALUE *pValue;
+
+    CurrentTL =
+        Keylist_Data(TL_Instance_List, cov_data->subscriberProcessIdentifier);
+    if (!CurrentTL || (CurrentTL->LoggingType != LOGGING_TYPE_COV) ||
+        TL_Source_Local(CurrentTL) ||
+        (CurrentTL->Source.deviceIdentifier.instance !=
+            cov_data->initiatingDeviceIdentifier) ||
+        (CurrentTL->Source.objectIdentifier.type !=
+            cov_data->monitoredObjectIdentifier.type) ||
+        (CurrentTL->Source.objectIdentifier.instance !=
+            cov_data->monitoredObjectIdentifier.instance) ||
+        !TL_Is_Enabled(CurrentTL - &TL_Descr[0]) ||
+        !TL_COV_Source_Address(CurrentTL, src)) {
+        return;
+    }
+    for (pValue = cov_data->listOfValues; pValue; pValue = pValue->next) {
+        if ((pValue->propertyIdentifier ==
+                CurrentTL->Source.propertyIdentifier) &&
+            (pValue->propertyArrayIndex == CurrentTL->Source.arrayIndex)) {
+            iLen =
+                bacapp_encode_application_data(ValueBuf, &pValue->value);
+            bValue = (iLen > 0);
+        } else if ((pValue->propertyIdentifier == PROP_STATUS_FLAGS) &&
+            (pValue->value.tag == BACNET_APPLICATION_TAG_BIT_STRING) &&
+            (bitstring_bits_used(&pValue->value.type.Bit_String) <= 8)) {
+            (void) encode_application_bitstring(StatusBuf,
+                &pValue->value.type.Bit_String);
+            bStatus = true;
+        }
+    }
+    if (bValue) {
+        TL_store_value(CurrentTL - &TL_Descr[0], iLen, ValueBuf,
+            bStatus ? StatusBuf : NULL, 0, 0);
+    }
+}
+
+/****************************************************************************
+ * Log the local COV sources that changed since the last call. Called from  *
+ * the main loop after the handlers, when the objects hold the new values.  *
+ ****************************************************************************/
+
+void trend_log_task(
+    void)
+{
+    unsigned uCount;
+    int i;
+
+    for (uCount = 0; uCount < TL_COV_Pending_Count; uCount++) {
+        i = TL_COV_Pending[uCount];
+        TL_Descr[i].bCOVPending = false;
+        if ((TL_Descr[i].LoggingType == LOGGING_TYPE_COV) &&
+            TL_Is_Enabled(i)) {
+            TL_fetch_property(i);
+        }
+    }
+    TL_COV_Pending_Count = 0;
+}
+
+/****************************************************************************
+ * The remote COV log whose SubscribeCOV to src got this invoke ID, if any. *
+ ****************************************************************************/
+
+static TREND_LOG_DESCR *TL_COV_Request(
+    BACNET_ADDRESS * src,
+    uint8_t invoke_id)
+{
+    TREND_LOG_DESCR *CurrentTL;
+    int iCount;
+
+    if (invoke_id == 0) {
+        return NULL;
+    }
+    for (iCount = 0; iCount < max_trend_logs_int; iCount++) {
+        CurrentTL = &TL_Descr[iCount];
+        if ((CurrentTL->ucCOVInvokeID == invoke_id) &&
+            TL_COV_Source_Address(CurrentTL, src)) {
+            return CurrentTL;
+        }
+    }
+
+    return NULL;
+}
+
+/****************************************************************************
+ * A SubscribeCOV failed. If the device would not take the property form,  *
+ * subscribe to the object at once and apply the increment here instead,   *
+ * otherwise try again shortly.                                             *
+ ****************************************************************************/
+
+static void TL_COV_Failed(
+    TREND_LOG_DESCR * CurrentTL,
+    bool bRefused)
+{
+    CurrentTL->ucCOVInvokeID = 0;
+    if (bRefused && CurrentTL->bClientCOVIncrement && !CurrentTL->bCOVObject) {
+        CurrentTL->bCOVObject = true;
+        CurrentTL->ulCOVTimer = 0;
+    } else {
+        CurrentTL->ulCOVTimer = TL_COV_RETRY_SECONDS;
+    }
+}
+
+/* SimpleACK of a SubscribeCOV or SubscribeCOVProperty */
+void trend_log_cov_subscribe_ack(
+    BACNET_ADDRESS * src,
+    uint8_t invoke_id)
+{
+    TREND_LOG_DESCR *CurrentTL;
+
+    CurrentTL = TL_COV_Request(src, invoke_id);
+    if (!CurrentTL) {
+        return;
+    }
+    CurrentTL->ucCOVInvokeID = 0;
+    if (CurrentTL->ulCOVResubscriptionInterval == 0) {
+        /* subscribed for good */
+        CurrentTL->bCOVSubscribed = true;
+    } else {
+        CurrentTL->ulCOVTimer = CurrentTL->ulCOVResubscriptionInterval;
+    }
+}
+
+/* Error of a SubscribeCOV or SubscribeCOVProperty */
+void trend_log_cov_subscribe_error(
+    BACNET_ADDRESS * src,
+    uint8_t invoke_id,
+    BACNET_ERROR_CLASS error_class,
+    BACNET_ERROR_CODE error_code)
+{
+    TREND_LOG_DESCR *CurrentTL;
+
+    unused_var(error_class);
+    unused_var(error_code);
+    CurrentTL = TL_COV_Request(src, invoke_id);
+    if (CurrentTL) {
+        TL_COV_Failed(CurrentTL, true);
+    }
+}
+
+/* Abort of any confirmed request: only ours are looked at */
+void trend_log_cov_subscribe_abort(
+    BACNET_ADDRESS * src,
+    uint8_t invoke_id,
+    uint8_t abort_reason,
+    bool server)
+{
+    TREND_LOG_DESCR *CurrentTL;
+
+    unused_var(abort_reason);
+    unused_var(server);
+    CurrentTL = TL_COV_Request(src, invoke_id);
+    if (CurrentTL) {
+        TL_COV_Failed(CurrentTL, false);
+    }
+}
+
+/* Reject of any confirmed request: only ours are looked at */
+void trend_log_cov_subscribe_reject(
+    BACNET_ADDRESS * src,
+    uint8_t invoke_id,
+    uint8_t reject_reason)
+{
+    TREND_LOG_DESCR *CurrentTL;
+
+    unused_var(reject_reason);
+    CurrentTL = TL_COV_Request(src, invoke_id);
+    if (CurrentTL) {
+        TL_COV_Failed(CurrentTL, true);
+    }
+}
+
+/****************************************************************************
+ * Keep the subscription to the source of a remote COV log alive. Until the *
+ * device is bound, ask for it with Who-Is and try again shortly. A reply   *
+ * is taken by the handlers above; a request that timed out is retried.     *
+ ****************************************************************************/
+
+static void TL_COV_Subscribe(
+    int i,
+    uint16_t uSeconds)
+{
+    TREND_LOG_DESCR *CurrentTL;
+    BACNET_SUBSCRIBE_COV_DATA cov_data;
+    uint8_t uInvokeID;
+
+    CurrentTL = &TL_Descr[i];
+    if (CurrentTL->bCOVSubscribed) {
+        return;
+    }
+    if (CurrentTL->ucCOVInvokeID) {
+        if (tsm_invoke_id_failed(CurrentTL->ucCOVInvokeID)) {
+            tsm_free_invoke_id(CurrentTL->ucCOVInvokeID);
+            TL_COV_Failed(CurrentTL, false);
+        } else if (tsm_invoke_id_free(CurrentTL->ucCOVInvokeID)) {
+            /* the reply didn't reach the handlers */
+            TL_COV_Failed(CurrentTL, false);
+        }
+        return;
+    }
+    if (CurrentTL->ulCOVTimer > uSeconds) {
+        CurrentTL->ulCOVTimer -= uSeconds;
+        return;
+    }
+    memset(&cov_data, 0, sizeof(cov_data));
+    cov_data.subscriberProcessIdentifier = CurrentTL->Instance;
+    cov_data.monitoredObjectIdentifier.type =
+        CurrentTL->Source.objectIdentifier.type;
+    cov_data.monitoredObjectIdentifier.instance =
+        CurrentTL->Source.objectIdentifier.instance;
+    cov_data.cancellationRequest = false;
+    cov_data.issueConfirmedNotifications = false;
+    /* outlive the interval, so a late renewal doesn't drop notifications */
+    cov_data.lifetime = CurrentTL->ulCOVResubscriptionInterval * 2;
+    if (CurrentTL->bClientCOVIncrement && !CurrentTL->bCOVObject) {
+        /* only a property subscription carries our increment */
+        cov_data.monitoredProperty.propertyIdentifier =
+            CurrentTL->Source.propertyIdentifier;
+        cov_data.monitoredProperty.propertyArrayIndex =
+            CurrentTL->Source.arrayIndex;
+        cov_data.covIncrementPresent = true;
+        cov_data.covIncrement = CurrentTL->fClientCOVIncrement;
+        uInvokeID =
+            Send_COV_Subscribe_Property(CurrentTL->Source.deviceIdentifier.
+            instance, &cov_data);
+    } else {
+        uInvokeID =
+            Send_COV_Subscribe(CurrentTL->Source.deviceIdentifier.instance,
+            &cov_data);
+    }
+    if (uInvokeID == 0) {
+        /* not bound yet, or no free TSM slot */
+        Send_WhoIs_Discover(CurrentTL->Source.deviceIdentifier.instance);
+        CurrentTL->ulCOVTimer = TL_COV_RETRY_SECONDS;
+    } else {
+        CurrentTL->ucCOVInvokeID = uInvokeID;
+    }
 }
 
 /****************************************************************************
@@ -2270,6 +2831,9 @@ void trend_log_timer(
                     TL_fetch_property(iCount);
                     CurrentTL->bTrigger = false;
                 }
+            } else if (!TL_Source_Local(CurrentTL)) {
+                /* Remote COV logs are fed by the notifications */
+                TL_COV_Subscribe(iCount, uSeconds);
             }
         }
     }
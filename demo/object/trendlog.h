@@ -32,6 +32,7 @@
 #include "cov.h"
 #include "rp.h"
 #include "wp.h"
+#include "tlstore.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -80,7 +81,7 @@ extern "C" {
 #define TL_T_START_WILD 1       /* Start time is wild carded */
 #define TL_T_STOP_WILD  2       /* Stop Time is wild carded */
 
-#define TL_MAX_ENTRIES 1000     /* Entries per datalog */
+#define TL_MAX_ENTRIES 1000     /* Default entries per datalog */
 #define TL_INIT_ENTRIES 0       /* Entries per datalog */
 
 /* Structure containing config and status info for a Trend Log */
@@ -101,14 +102,24 @@ extern "C" {
         BACNET_DEVICE_OBJECT_PROPERTY_REFERENCE Source; /* Where the data comes from */
         uint32_t ulLogInterval; /* Time between entries in seconds */
         bool bStopWhenFull;     /* Log halts when full if true */
+        uint32_t ulBufferSize;  /* Count of items the buffer can hold */
         uint32_t ulRecordCount; /* Count of items currently in the buffer */
         uint32_t ulTotalRecordCount;    /* Count of all items that have ever been inserted into the buffer */
         BACNET_LOGGING_TYPE LoggingType;        /* Polled/cov/triggered */
         bool bAlignIntervals;   /* If true align to the clock */
         uint32_t ulIntervalOffset;      /* Offset from start of period for taking reading in seconds */
         bool bTrigger;  /* Set to 1 to cause a reading to be taken */
-        int iIndex;     /* Current insertion point */
+        TL_STORE Store; /* The buffer itself */
         time_t tLastDataTime;
+        uint32_t ulCOVResubscriptionInterval;   /* Seconds between SubscribeCOVs for a remote source, 0 for one indefinite subscription */
+        uint32_t ulCOVTimer;    /* Seconds until the next SubscribeCOV */
+        bool bCOVSubscribed;    /* Indefinite subscription was confirmed */
+        uint8_t ucCOVInvokeID;  /* SubscribeCOV awaiting its reply, or 0 */
+        bool bCOVObject;        /* SubscribeCOVProperty failed, use SubscribeCOV */
+        bool bClientCOVIncrement;       /* Client_COV_Increment is a REAL, not NULL */
+        float fClientCOVIncrement;      /* Least change of a REAL to log */
+        bool bCOVPending;       /* Local source changed, log it in the next task */
+        struct trend_log_descr *pNextCOV;       /* Next COV log of the same local object */
     } TREND_LOG_DESCR;
 
 /*
@@ -230,6 +241,28 @@ struct tl_inst_itr_ctx {
     void trend_log_timer(
         uint16_t uSeconds);
 
+    void trend_log_task(
+        void);
+
+/* replies to the SubscribeCOVs of remote COV logs, see apdu.h */
+    void trend_log_cov_subscribe_ack(
+        BACNET_ADDRESS * src,
+        uint8_t invoke_id);
+    void trend_log_cov_subscribe_error(
+        BACNET_ADDRESS * src,
+        uint8_t invoke_id,
+        BACNET_ERROR_CLASS error_class,
+        BACNET_ERROR_CODE error_code);
+    void trend_log_cov_subscribe_abort(
+        BACNET_ADDRESS * src,
+        uint8_t invoke_id,
+        uint8_t abort_reason,
+        bool server);
+    void trend_log_cov_subscribe_reject(
+        BACNET_ADDRESS * src,
+        uint8_t invoke_id,
+        uint8_t reject_reason);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -759,6 +759,19 @@ bool Device_Object_List_Identifier(
     return status;
 }
 
+/** Object names are looked up by reading every name, so there is no
+ * index to update when an object is renamed.
+ * @param object_type [in] The BACNET_OBJECT_TYPE of the renamed Object.
+ * @param object_instance [in] The object instance number of the Object.
+ */
+void Device_Object_Name_Changed(
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance)
+{
+    (void) object_type;
+    (void) object_instance;
+}
+
 /** Determine if we have an object with the given object_name.
  * If the object_type and object_instance pointers are not null,
  * and the lookup succeeds, they will be given the resulting values.
@@ -1517,6 +1530,21 @@ void Device_COV_Clear(
 }
 
 #if defined(INTRINSIC_REPORTING)
+/** Asks for the intrinsic reporting of an object to be evaluated.
+ * The PiFace has a handful of points, so Device_local_reporting
+ * evaluates all of them every time and there is nothing to schedule.
+ * @ingroup ObjHelpers
+ * @param [in] The object type of the object.
+ * @param [in] The object instance of the object.
+ */
+void Device_Intrinsic_Reporting_Request(
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance)
+{
+    (void) object_type;
+    (void) object_instance;
+}
+
 void Device_local_reporting(
     void)
 {
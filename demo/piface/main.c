@@ -264,6 +264,7 @@ int main(
             elapsed_milliseconds = elapsed_seconds * 1000;
             handler_cov_timer_seconds(elapsed_seconds);
             tsm_timer_milliseconds(elapsed_milliseconds);
+            Send_WhoIs_Discover_Timer(elapsed_milliseconds);
         }
         handler_cov_task();
         /* scan cache address */
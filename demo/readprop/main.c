@@ -388,14 +388,17 @@ int main(
         if (found) {
             if (Request_Invoke_ID == 0) {
                 Request_Invoke_ID =
-                    Send_Read_Property_Request(Target_Device_Object_Instance,
-                    Target_Object_Type, Target_Object_Instance,
-                    Target_Object_Property, Target_Object_Index);
-            } else if (tsm_invoke_id_free(Request_Invoke_ID))
+                    Send_Read_Property_Request_Peer(&Target_Address,
+                    (uint16_t) max_apdu, Target_Object_Type,
+                    Target_Object_Instance, Target_Object_Property,
+                    Target_Object_Index);
+            } else if (tsm_invoke_id_free_peer(&Target_Address,
+                    Request_Invoke_ID))
                 break;
-            else if (tsm_invoke_id_failed(Request_Invoke_ID)) {
+            else if (tsm_invoke_id_failed_peer(&Target_Address,
+                    Request_Invoke_ID)) {
                 fprintf(stderr, "\rError: TSM Timeout!\n");
-                tsm_free_invoke_id(Request_Invoke_ID);
+                tsm_free_invoke_id_peer(&Target_Address, Request_Invoke_ID);
                 Error_Detected = true;
                 /* try again or abort? */
                 break;
@@ -0,0 +1,378 @@
+/**
+* @file
+* @brief Throughput benchmark of the router packet path
+*
+* @section LICENSE
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/msg.h>
+#include "network_layer.h"
+
+/* Moves routed packets from input ports to one output port, and counts
+   the packets that the output port thread receives.
+
+   ring: the router as it is.  Each input port thread gets a buffer
+   from the packet pool and calls route_msg(), which rewrites the NPDU
+   in place and sends the packet to the message box of the output port.
+
+   sysv: the router as it was, for comparison.  The input port threads
+   malloc each packet and send it to the SysV message queue of a router
+   thread, which decodes the NPDU, encodes the routed one into a new
+   malloc'd buffer and sends it to the SysV message queue of the output
+   port; the output port thread frees it under a lock.
+
+   usage: bench [ring|sysv [packets [input ports [packet size]]]] */
+
+#define BENCH_PACKETS 1000000
+#define BENCH_PORTS 1
+#define BENCH_PDU_LEN 64
+#define BENCH_MAX_PORTS 8
+/* network of the output port, the input ports are 1 and up */
+#define BENCH_DNET 100
+/* packets that an input port lets wait for the output port, so that
+   the message box of the output port never overflows */
+#define BENCH_IN_FLIGHT (MSGBOX_SIZE / 2)
+
+ROUTER_PORT *head = NULL;
+int port_count;
+
+static ROUTER_PORT Port[BENCH_MAX_PORTS + 1];
+static ROUTER_PORT *Output_Port = &Port[BENCH_MAX_PORTS];
+static bool SysV = false;
+static unsigned long Packets = BENCH_PACKETS;
+static unsigned Ports = BENCH_PORTS;
+static unsigned Pdu_Len = BENCH_PDU_LEN;
+static uint8_t Pdu[MSG_DATA_PDU_SIZE];
+static volatile unsigned long Sent;
+static volatile unsigned long Received;
+static volatile bool Inputs_Done;
+
+/* the packet and message queue message of the SysV router */
+typedef struct sysv_data {
+    BACNET_ADDRESS dest;
+    BACNET_ADDRESS src;
+    uint8_t *pdu;
+    uint16_t pdu_len;
+    uint8_t ref_count;
+} SYSV_DATA;
+
+typedef struct sysv_msg {
+    long mtype;
+    MSGBOX_ID origin;
+    SYSV_DATA *data;
+} SYSV_MSG;
+
+static int SysV_Router_Box;
+static int SysV_Output_Box;
+static pthread_mutex_t SysV_Lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void sysv_send(
+    int box,
+    MSGBOX_ID origin,
+    SYSV_DATA * data)
+{
+    SYSV_MSG msg;
+
+    msg.mtype = DATA;
+    msg.origin = origin;
+    msg.data = data;
+    msgsnd(box, &msg, sizeof(SYSV_MSG) - sizeof(long), 0);
+}
+
+static SYSV_DATA *sysv_recv(
+    int box,
+    MSGBOX_ID * origin)
+{
+    SYSV_MSG msg;
+
+    if (msgrcv(box, &msg, sizeof(SYSV_MSG) - sizeof(long), 0,
+            IPC_NOWAIT) <= 0) {
+        return NULL;
+    }
+    if (origin) {
+        *origin = msg.origin;
+    }
+
+    return msg.data;
+}
+
+static void sysv_free(
+    SYSV_DATA * data)
+{
+    pthread_mutex_lock(&SysV_Lock);
+    if (--data->ref_count == 0) {
+        free(data->pdu);
+        free(data);
+    }
+    pthread_mutex_unlock(&SysV_Lock);
+}
+
+/* the router thread of the SysV router */
+static void sysv_route(
+    void)
+{
+    SYSV_DATA *data;
+    SYSV_DATA *routed;
+    BACNET_ADDRESS addr;
+    BACNET_NPDU_DATA npdu_data;
+    uint8_t npdu[MAX_NPDU];
+    MSGBOX_ID origin = 0;
+    unsigned long count = 0;
+    int apdu_offset;
+    int npdu_len;
+
+    while (count < Packets) {
+        data = sysv_recv(SysV_Router_Box, &origin);
+        if (!data) {
+            sched_yield();
+            continue;
+        }
+        count++;
+        routed = malloc(sizeof(SYSV_DATA));
+        *routed = *data;
+        apdu_offset =
+            npdu_decode(data->pdu, &routed->dest, &addr, &npdu_data);
+        routed->src.net = Port[origin].route_info.net;
+        npdu_len = npdu_encode_pdu(npdu, NULL, &routed->src, &npdu_data);
+        routed->pdu_len = npdu_len + data->pdu_len - apdu_offset;
+        routed->pdu = malloc(routed->pdu_len);
+        memmove(routed->pdu, npdu, npdu_len);
+        memmove(routed->pdu + npdu_len, &data->pdu[apdu_offset],
+            data->pdu_len - apdu_offset);
+        routed->ref_count = 1;
+        free(data->pdu);
+        free(data);
+        sysv_send(SysV_Output_Box, Output_Port->port_id, routed);
+    }
+}
+
+static void *input_port_thread(
+    void *arg)
+{
+    unsigned port = (unsigned) (size_t) arg;
+    unsigned long count = Packets / Ports;
+    unsigned long i;
+    MSG_DATA *data;
+    SYSV_DATA *sysv_data;
+
+    if (port == 0) {
+        count += Packets % Ports;
+    }
+    for (i = 0; i < count; i++) {
+        if (SysV) {
+            sysv_data = malloc(sizeof(SYSV_DATA));
+            memset(sysv_data, 0, sizeof(SYSV_DATA));
+            sysv_data->pdu = malloc(Pdu_Len);
+            memcpy(sysv_data->pdu, Pdu, Pdu_Len);
+            sysv_data->pdu_len = (uint16_t) Pdu_Len;
+            sysv_data->src.len = 1;
+            sysv_data->src.adr[0] = (uint8_t) port;
+            sysv_send(SysV_Router_Box, (MSGBOX_ID) port, sysv_data);
+            continue;
+        }
+        while ((Sent - Received) >= BENCH_IN_FLIGHT) {
+            sched_yield();
+        }
+        while ((data = alloc_data()) == NULL) {
+            sched_yield();
+        }
+        memcpy(data->pdu, Pdu, Pdu_Len);
+        data->pdu_len = (uint16_t) Pdu_Len;
+        data->src.len = 1;
+        data->src.adr[0] = (uint8_t) port;
+        __sync_fetch_and_add(&Sent, 1);
+        route_msg(&Port[port], data);
+    }
+
+    return NULL;
+}
+
+static void *output_port_thread(
+    void *arg)
+{
+    BACMSG msg_storage;
+    BACMSG *bacmsg;
+    SYSV_DATA *sysv_data;
+
+    (void) arg;
+    for (;;) {
+        if (SysV) {
+            sysv_data = sysv_recv(SysV_Output_Box, NULL);
+            if (sysv_data) {
+                sysv_free(sysv_data);
+                Received++;
+            } else if (Received >= Packets) {
+                break;
+            } else {
+                sched_yield();
+            }
+            continue;
+        }
+        bacmsg = recv_from_msgbox(Output_Port->port_id, &msg_storage,
+            MSGBOX_NOWAIT);
+        if (bacmsg) {
+            check_data((MSG_DATA *) bacmsg->data);
+            Received++;
+        } else if (Inputs_Done) {
+            break;
+        } else {
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+/* the input ports and the output port, with their networks */
+static bool init_ports(
+    void)
+{
+    unsigned port;
+
+    for (port = 0; port <= BENCH_MAX_PORTS; port++) {
+        if ((port < Ports) || (&Port[port] == Output_Port)) {
+            Port[port].type = BIP;
+            Port[port].state = RUNNING;
+            Port[port].route_info.net =
+                (&Port[port] == Output_Port) ? BENCH_DNET : port + 1;
+            if (SysV) {
+                Port[port].port_id = (MSGBOX_ID) port;
+            } else {
+                Port[port].port_id = create_shared_msgbox();
+                if (Port[port].port_id == INVALID_MSGBOX_ID) {
+                    return false;
+                }
+                Port[port].next = head;
+                head = &Port[port];
+                port_count++;
+                add_port_dnet(&Port[port]);
+            }
+        }
+    }
+    if (SysV) {
+        SysV_Router_Box = msgget(IPC_PRIVATE, 0666 | IPC_CREAT);
+        SysV_Output_Box = msgget(IPC_PRIVATE, 0666 | IPC_CREAT);
+        if ((SysV_Router_Box == -1) || (SysV_Output_Box == -1)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void cleanup_ports(
+    void)
+{
+    ROUTER_PORT *port;
+
+    if (SysV) {
+        msgctl(SysV_Router_Box, IPC_RMID, NULL);
+        msgctl(SysV_Output_Box, IPC_RMID, NULL);
+        return;
+    }
+    for (port = head; port != NULL; port = port->next) {
+        del_msgbox(port->port_id);
+    }
+    cleanup_dnets();
+}
+
+int main(
+    int argc,
+    char *argv[])
+{
+    pthread_t input[BENCH_MAX_PORTS];
+    pthread_t output;
+    struct timespec start, end;
+    BACNET_ADDRESS dest;
+    BACNET_NPDU_DATA npdu_data;
+    unsigned port;
+    int npdu_len;
+    double seconds;
+
+    if (argc > 1) {
+        SysV = (strcmp(argv[1], "sysv") == 0);
+        if (!SysV && (strcmp(argv[1], "ring") != 0)) {
+            Packets = 0;
+        }
+    }
+    if (argc > 2) {
+        Packets = strtoul(argv[2], NULL, 0);
+    }
+    if (argc > 3) {
+        Ports = (unsigned) strtoul(argv[3], NULL, 0);
+    }
+    if (argc > 4) {
+        Pdu_Len = (unsigned) strtoul(argv[4], NULL, 0);
+    }
+    /* a confirmed request to a station on the output network */
+    memset(&dest, 0, sizeof(dest));
+    dest.net = BENCH_DNET;
+    dest.len = 1;
+    dest.adr[0] = 1;
+    npdu_encode_npdu_data(&npdu_data, true, MESSAGE_PRIORITY_NORMAL);
+    npdu_len = npdu_encode_pdu(Pdu, &dest, NULL, &npdu_data);
+    if ((Packets == 0) || (Ports == 0) || (Ports > BENCH_MAX_PORTS) ||
+        (Pdu_Len <= (unsigned) npdu_len) || (Pdu_Len > MAX_APDU)) {
+        fprintf(stderr, "usage: %s [ring|sysv [packets [input ports (1-%u) "
+            "[packet size (%u-%u)]]]]\n", argv[0], BENCH_MAX_PORTS,
+            (unsigned) npdu_len + 1, (unsigned) MAX_APDU);
+        return 1;
+    }
+    memset(&Pdu[npdu_len], 0x55, Pdu_Len - npdu_len);
+    if (!init_ports()) {
+        fprintf(stderr, "bench: can't create the message boxes\n");
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_create(&output, NULL, output_port_thread, NULL);
+    for (port = 0; port < Ports; port++) {
+        pthread_create(&input[port], NULL, input_port_thread,
+            (void *) (size_t) port);
+    }
+    if (SysV) {
+        sysv_route();
+    }
+    for (port = 0; port < Ports; port++) {
+        pthread_join(input[port], NULL);
+    }
+    Inputs_Done = true;
+    pthread_join(output, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    cleanup_ports();
+
+    seconds =
+        (double) (end.tv_sec - start.tv_sec) + (double) (end.tv_nsec -
+        start.tv_nsec) / 1e9;
+    printf("%s: %lu of %lu packets of %u octets from %u port(s) in %.3f s: "
+        "%.0f packets/s\n", SysV ? "sysv" : "ring", Received, Packets,
+        Pdu_Len, Ports, seconds, (double) Received / seconds);
+
+    return 0;
+}
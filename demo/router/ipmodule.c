@@ -29,8 +29,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/ipc.h>
 #include "ipmodule.h"
+#include "network_layer.h"
 #include "bacint.h"
 
 #ifdef TEST_PACKET
@@ -72,7 +72,8 @@ void *dl_ip_thread(
         return NULL;
     }
 
-    msgboxid = create_msgbox();
+    /* every port thread routes packets to this port */
+    msgboxid = create_shared_msgbox();
     if (msgboxid == INVALID_MSGBOX_ID) {
         PRINT(ERROR, "Error: Failed to create message box");
         port->state = INIT_FAILED;
@@ -85,7 +86,7 @@ void *dl_ip_thread(
     while (!shutdown) {
 
         /* check for incoming messages */
-         bacmsg = recv_from_msgbox(port->port_id, &msg_storage, IPC_NOWAIT);
+        bacmsg = recv_from_msgbox(port->port_id, &msg_storage, MSGBOX_NOWAIT);
 
         if (bacmsg) {
             switch (bacmsg->type) {
@@ -124,13 +125,7 @@ void *dl_ip_thread(
             if (status > 0) {
                 memmove(&msg_data->src.len, &address.mac_len, 1);
                 memmove(&msg_data->src.adr[0], &address.mac[0], MAX_MAC_LEN);
-                msg_storage.origin = port->port_id;
-                msg_storage.type = DATA;
-                msg_storage.data = msg_data;
-
-                if (!send_to_msgbox(port->main_id, &msg_storage)) {
-                    free_data(msg_data);
-                }
+                route_msg(port, msg_data);
             }
         }
     }
@@ -347,19 +342,17 @@ int dl_ip_recv(
                     (void) decode_unsigned16(&data->buff[2], &buff_len);
                     /* subtract off the BVLC header */
                     buff_len -= 4;
-                    if (buff_len < data->max_buff) {
-                        /* allocate data message stucture */
-                        (*msg_data) = (MSG_DATA *) malloc(sizeof(MSG_DATA));
+                    if ((buff_len <= MSG_DATA_PDU_SIZE) &&
+                        ((*msg_data) = alloc_data())) {
                         (*msg_data)->pdu_len = buff_len;
-                        (*msg_data)->pdu =
-                            (uint8_t *) malloc((*msg_data)->pdu_len);
                         /* fill up data message structure */
                         memmove(&(*msg_data)->pdu[0], &data->buff[4],
                             (*msg_data)->pdu_len);
                         memmove(&(*msg_data)->src, src,
                             sizeof(BACNET_ADDRESS));
                     }
-                    /* ignore packets that are too large */
+                    /* ignore packets that are too large,
+                       or that we have no buffer for */
                     else {
                         buff_len = 0;
 
@@ -384,19 +377,17 @@ int dl_ip_recv(
                     (void) decode_unsigned16(&data->buff[2], &buff_len);
                     /* subtract off the BVLC header */
                     buff_len -= 10;
-                    if (buff_len < data->max_buff) {
-                        /* allocate data message stucture */
-                        (*msg_data) = (MSG_DATA *) malloc(sizeof(MSG_DATA));
+                    if ((buff_len <= MSG_DATA_PDU_SIZE) &&
+                        ((*msg_data) = alloc_data())) {
                         (*msg_data)->pdu_len = buff_len;
-                        (*msg_data)->pdu =
-                            (uint8_t *) malloc((*msg_data)->pdu_len);
                         /* fill up data message structure */
                         memmove(&(*msg_data)->pdu[0], &data->buff[4 + 6],
                             (*msg_data)->pdu_len);
                         memmove(&(*msg_data)->src, src,
                             sizeof(BACNET_ADDRESS));
                     } else {
-                        /* ignore packets that are too large */
+                        /* ignore packets that are too large,
+                           or that we have no buffer for */
                         buff_len = 0;
                     }
                 }
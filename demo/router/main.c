@@ -53,6 +53,11 @@
 #include "mstpmodule.h"
 
 #define KEY_ESC 27
+#define KEY_ROUTES 'r'
+/* milliseconds between two looks at the keyboard */
+#define IDLE_MS 100
+/* milliseconds to wait at exit for the ports to stop */
+#define SHUTDOWN_MS 5000
 
 ROUTER_PORT *head = NULL;       /* pointer to list of router ports */
 
@@ -80,29 +85,19 @@ void cleanup(
 void print_msg(
     BACMSG * msg);
 
-uint16_t process_msg(
-    BACMSG * msg,
-    MSG_DATA * data,
-    uint8_t ** buff);
-
 uint16_t get_next_free_dnet(
     );
 
 int kbhit(
     );
 
-inline bool is_network_msg(
-    BACMSG * msg);
-
 int main(
     int argc,
     char *argv[])
 {
-    ROUTER_PORT *port;
-    BACMSG msg_storage, *bacmsg = NULL;
-    MSG_DATA *msg_data = NULL;
     uint8_t *buff = NULL;
-    int16_t buff_len = 0;
+    time_t aged = 0;
+    time_t now;
 
     atexit(cleanup);
 
@@ -117,103 +112,27 @@ int main(
     }
 
 
-    send_network_message(NETWORK_MESSAGE_I_AM_ROUTER_TO_NETWORK, msg_data,
+    send_network_message(NETWORK_MESSAGE_I_AM_ROUTER_TO_NETWORK, NULL,
         &buff, NULL);
 
+    /* the port threads route the packets: this one minds the keyboard
+       and the age of the routes */
     while (true) {
         if (kbhit()) {
             char ch = getchar();
             if (ch == KEY_ESC) {
                 PRINT(INFO, "Received shutdown. Exiting...\n");
                 break;
+            } else if (ch == KEY_ROUTES) {
+                dump_dnets(stderr);
             }
         }
-          // blocking dequeue here
-        bacmsg = recv_from_msgbox(head->main_id, &msg_storage, 0);
-        if (bacmsg) {
-            switch (bacmsg->type) {
-                case DATA:
-                    {
-                        MSGBOX_ID msg_src = bacmsg->origin;
-
-                        /* allocate message structure */
-                        msg_data = malloc(sizeof(MSG_DATA));
-                        if (!msg_data) {
-                            PRINT(ERROR, "Error: Could not allocate memory\n");
-                            break;
-                        }
-
-                        //print_msg(bacmsg);
-
-                        if (is_network_msg(bacmsg)) {
-                            buff_len =
-                                process_network_message(bacmsg, msg_data,
-                                &buff);
-                            if (buff_len == 0) {
-                                free_data(bacmsg->data);
-                                break;
-                            }
-                        } else {
-                            buff_len = process_msg(bacmsg, msg_data, &buff);
-                        }
-
-                        /* if buff_len */
-                        /* >0 - form new message and send */
-                        /* =-1 - try to find next router */
-                        /* other value - discard message */
-
-                        if (buff_len > 0) {
-                            /* form new message */
-                            msg_data->pdu = buff;
-                            msg_data->pdu_len = buff_len;
-                            msg_storage.origin = head->main_id;
-                            msg_storage.type = DATA;
-                            msg_storage.data = msg_data;
-
-                            //print_msg(bacmsg);
-
-                            if (is_network_msg(bacmsg)) {
-                                msg_data->ref_count = 1;
-                                send_to_msgbox(msg_src, &msg_storage);
-                            } else if (msg_data->dest.net !=
-                                BACNET_BROADCAST_NETWORK) {
-                                msg_data->ref_count = 1;
-                                port =
-                                    find_dnet(msg_data->dest.net,
-                                    &msg_data->dest);
-                                send_to_msgbox(port->port_id, &msg_storage);
-                            } else {
-                                port = head;
-                                msg_data->ref_count = port_count - 1;
-                                while (port != NULL) {
-                                    if (port->port_id == msg_src ||
-                                        port->state == FINISHED) {
-                                        port = port->next;
-                                        continue;
-                                    }
-                                    send_to_msgbox(port->port_id,
-                                        &msg_storage);
-                                    port = port->next;
-                                }
-                            }
-                        } else if (buff_len == -1) {
-                            uint16_t net = msg_data->dest.net;  /* NET to find */
-                            PRINT(INFO, "Searching NET...\n");
-                            send_network_message
-                                (NETWORK_MESSAGE_WHO_IS_ROUTER_TO_NETWORK,
-                                msg_data, &buff, &net);
-                        } else {
-                            /* if invalid message send Reject-Message-To-Network */
-                            PRINT(ERROR, "Error: Invalid message\n");
-                            free_data(msg_data);
-                        }
-                    }
-                    break;
-                case SERVICE:
-                default:
-                    break;
-            }
+        now = time(NULL);
+        if (now != aged) {
+            age_dnets(now);
+            aged = now;
         }
+        usleep(IDLE_MS * 1000);
     }
 
     return 0;
@@ -488,17 +407,12 @@ void init_port_threads(
 bool init_router(
     )
 {
-    MSGBOX_ID msgboxid;
     ROUTER_PORT *port;
 
-    msgboxid = create_msgbox();
-    if (msgboxid == INVALID_MSGBOX_ID)
-        return false;
-
+    /* directly connected networks, before the first packet comes in */
     port = head;
-    /* add main message box id to all ports */
     while (port != NULL) {
-        port->main_id = msgboxid;
+        add_port_dnet(port);
         port = port->next;
     }
 
@@ -528,36 +442,48 @@ void cleanup(
 {
     ROUTER_PORT *port;
     BACMSG msg;
+    unsigned waited;
+    bool stopping;
 
     if (head == NULL)
         return;
 
-    msg.origin = head->main_id;
+    msg.origin = INVALID_MSGBOX_ID;
     msg.type = SERVICE;
     msg.subtype = SHUTDOWN;
 
-    del_msgbox(head->main_id);  /* close routers message box */
-
-    /* send shutdown message to all router ports */
-    port = head;
-    while (port != NULL) {
-        if (port->state == RUNNING)
-            send_to_msgbox(port->port_id, &msg);
-        port = port->next;
+    /* shut down each router port once it runs, and wait for all of them
+       before freeing any: they route to each other */
+    for (waited = 0; ; waited += IDLE_MS) {
+        stopping = false;
+        for (port = head; port != NULL; port = port->next) {
+            if ((port->state == RUNNING) && !port->shutdown) {
+                send_to_msgbox(port->port_id, &msg);
+                port->shutdown = true;
+            }
+            if ((port->state == INIT) || (port->state == RUNNING)) {
+                stopping = true;
+            }
+        }
+        if (!stopping) {
+            break;
+        }
+        if (waited >= SHUTDOWN_MS) {
+            /* a port thread may still use the ports: leave them be */
+            PRINT(ERROR, "Error: Router ports did not stop\n");
+            return;
+        }
+        usleep(IDLE_MS * 1000);
     }
 
     port = head;
     while (port != NULL) {
-        if (port->state == FINISHED) {
-            cleanup_dnets(port->route_info.dnets);
-            port = port->next;
-            free(head->iface);
-            free(head);
-            head = port;
-        }
+        port = port->next;
+        free(head->iface);
+        free(head);
+        head = port;
     }
-
-    pthread_mutex_destroy(&msg_lock);
+    cleanup_dnets();
 }
 
 void print_msg(
@@ -576,65 +502,6 @@ void print_msg(
     }
 }
 
-uint16_t process_msg(
-    BACMSG * msg,
-    MSG_DATA * data,
-    uint8_t ** buff)
-{
-
-    BACNET_ADDRESS addr;
-    BACNET_NPDU_DATA npdu_data;
-    ROUTER_PORT *srcport;
-    ROUTER_PORT *destport;
-    uint8_t npdu[MAX_NPDU];
-    int16_t buff_len = 0;
-    int apdu_offset;
-    int apdu_len;
-    int npdu_len;
-
-    memmove(data, msg->data, sizeof(MSG_DATA));
-
-    apdu_offset = npdu_decode(data->pdu, &data->dest, &addr, &npdu_data);
-    apdu_len = data->pdu_len - apdu_offset;
-
-    srcport = find_snet(msg->origin);
-    destport = find_dnet(data->dest.net, NULL);
-    assert(srcport);
-
-    if (srcport && destport) {
-        data->src.net = srcport->route_info.net;
-
-        /* if received from another router save real source address (not other router source address) */
-        if (addr.net > 0 && addr.net < BACNET_BROADCAST_NETWORK &&
-            data->src.net != addr.net)
-            memmove(&data->src, &addr, sizeof(BACNET_ADDRESS));
-
-        /* encode both source and destination for broadcast and router-to-router communication */
-        if (data->dest.net == BACNET_BROADCAST_NETWORK ||
-            destport->route_info.net != data->dest.net) {
-            npdu_len =
-                npdu_encode_pdu(npdu, &data->dest, &data->src, &npdu_data);
-        } else {
-            npdu_len = npdu_encode_pdu(npdu, NULL, &data->src, &npdu_data);
-        }
-
-        buff_len = npdu_len + data->pdu_len - apdu_offset;
-
-        *buff = (uint8_t *) malloc(buff_len);
-        memmove(*buff, npdu, npdu_len); /* copy newly formed NPDU */
-        memmove(*buff + npdu_len, &data->pdu[apdu_offset], apdu_len);   /* copy APDU */
-
-    } else {
-        /* request net search */
-        return -1;
-    }
-
-    /* delete received message */
-    free_data((MSG_DATA *) msg->data);
-
-    return buff_len;
-}
-
 int kbhit(
     )
 {
@@ -656,18 +523,6 @@ int kbhit(
     return bytesWaiting;
 }
 
-bool is_network_msg(
-    BACMSG * msg)
-{
-
-    uint8_t control_byte;       /* NPDU control byte */
-    MSG_DATA *data = (MSG_DATA *) msg->data;
-
-    control_byte = data->pdu[1];
-
-    return control_byte & 0x80; /* check 7th bit */
-}
-
 uint16_t get_next_free_dnet(
     )
 {
@@ -30,85 +30,323 @@
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
 #include <pthread.h>
 #include "msgqueue.h"
 
-pthread_mutex_t msg_lock = PTHREAD_MUTEX_INITIALIZER;
+/* polls of an empty message box before a blocking receive sleeps,
+   when there is another CPU to fill it meanwhile */
+#define MSGBOX_SPIN 1000
+#define CACHE_LINE 64
 
-MSGBOX_ID create_msgbox(
-    )
+/* A bounded ring of messages.  Each slot has a sequence number that
+   tells whose turn it is: the producer may fill slot i when its
+   sequence is i, and the consumer may take it when it is i + 1.
+   Producers of a shared box claim a slot with a compare-and-swap;
+   a box with one producer just advances the head. */
+typedef struct _msgbox {
+    volatile uint32_t head;     /* next slot to fill */
+    uint8_t pad1[CACHE_LINE - sizeof(uint32_t)];
+    volatile uint32_t tail;     /* next slot to take */
+    uint8_t pad2[CACHE_LINE - sizeof(uint32_t)];
+    volatile uint32_t sequence[MSGBOX_SIZE];
+    BACMSG slot[MSGBOX_SIZE];
+    bool shared;
+    bool used;
+    /* set by a consumer that sleeps on an empty box */
+    volatile int sleeping;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} MSGBOX;
+
+static MSGBOX *Msgbox[MAX_MSGBOX];
+static unsigned Msgbox_Spin;
+static pthread_mutex_t Msgbox_Lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* packet pool: a lock-free stack of free packets, linked by index.
+   The top is (tag << 16) | (index + 1), or a tag and zero when empty;
+   the tag changes on each push and pop so a stale top can't win. */
+static MSG_DATA *Pool_Slab[MSG_DATA_MAX_SLABS];
+static unsigned Pool_Slabs;
+static volatile uint32_t Pool_Free;
+static pthread_mutex_t Pool_Lock = PTHREAD_MUTEX_INITIALIZER;
+
+static MSGBOX_ID msgbox_create(
+    bool shared)
 {
-    MSGBOX_ID msgboxid;
+    MSGBOX *box;
+    MSGBOX_ID id;
+    uint32_t i;
 
-    msgboxid = msgget(IPC_PRIVATE, 0666 | IPC_CREAT);
-    if (msgboxid == INVALID_MSGBOX_ID) {
+    box = (MSGBOX *) calloc(1, sizeof(MSGBOX));
+    if (!box) {
+        return INVALID_MSGBOX_ID;
+    }
+    for (i = 0; i < MSGBOX_SIZE; i++) {
+        box->sequence[i] = i;
+    }
+    box->shared = shared;
+    box->used = true;
+    if (sysconf(_SC_NPROCESSORS_ONLN) > 1) {
+        Msgbox_Spin = MSGBOX_SPIN;
+    }
+    pthread_mutex_init(&box->lock, NULL);
+    pthread_cond_init(&box->cond, NULL);
+    pthread_mutex_lock(&Msgbox_Lock);
+    for (id = 0; id < MAX_MSGBOX; id++) {
+        if (!Msgbox[id]) {
+            Msgbox[id] = box;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&Msgbox_Lock);
+    if (id == MAX_MSGBOX) {
+        free(box);
         return INVALID_MSGBOX_ID;
     }
 
-    return msgboxid;
+    return id;
+}
+
+static MSGBOX *msgbox_get(
+    MSGBOX_ID id)
+{
+    if ((id < 0) || (id >= MAX_MSGBOX)) {
+        return NULL;
+    }
+
+    return Msgbox[id];
+}
+
+/* takes a message if there is one */
+static bool msgbox_take(
+    MSGBOX * box,
+    BACMSG * msg)
+{
+    uint32_t pos = box->tail;
+    uint32_t index = pos & (MSGBOX_SIZE - 1);
+
+    if (box->sequence[index] != pos + 1) {
+        return false;
+    }
+    __sync_synchronize();
+    *msg = box->slot[index];
+    __sync_synchronize();
+    /* free the slot for the next lap of the producers */
+    box->sequence[index] = pos + MSGBOX_SIZE;
+    box->tail = pos + 1;
+
+    return true;
+}
+
+MSGBOX_ID create_msgbox(
+    void)
+{
+    return msgbox_create(false);
+}
+
+MSGBOX_ID create_shared_msgbox(
+    void)
+{
+    return msgbox_create(true);
 }
 
 bool send_to_msgbox(
     MSGBOX_ID dest,
     BACMSG * msg)
 {
+    MSGBOX *box = msgbox_get(dest);
+    uint32_t pos, index;
+    int32_t diff;
 
-    int err;
-
-    err = msgsnd(dest, msg, sizeof(BACMSG)-sizeof(MSGTYPE), 0);
-    if (err) {
+    if (!box || !box->used) {
         return false;
     }
+    pos = box->head;
+    for (;;) {
+        index = pos & (MSGBOX_SIZE - 1);
+        diff = (int32_t) (box->sequence[index] - pos);
+        if (diff < 0) {
+            /* full: the consumer hasn't taken this slot yet */
+            return false;
+        }
+        if (diff > 0) {
+            /* another producer took the slot */
+            pos = box->head;
+            continue;
+        }
+        if (!box->shared) {
+            box->head = pos + 1;
+            break;
+        }
+        if (__sync_bool_compare_and_swap(&box->head, pos, pos + 1)) {
+            break;
+        }
+        pos = box->head;
+    }
+    box->slot[index] = *msg;
+    /* publish the message, then look for a sleeping consumer */
+    __sync_synchronize();
+    box->sequence[index] = pos + 1;
+    __sync_synchronize();
+    if (box->sleeping) {
+        pthread_mutex_lock(&box->lock);
+        pthread_cond_signal(&box->cond);
+        pthread_mutex_unlock(&box->lock);
+    }
+
     return true;
 }
 
 BACMSG *recv_from_msgbox(
     MSGBOX_ID src,
-    BACMSG * msg, int flags)
+    BACMSG * msg,
+    int flags)
 {
+    MSGBOX *box = msgbox_get(src);
+    struct timespec abstime;
+    unsigned spin;
 
-    int recv_bytes;
-
-    recv_bytes = msgrcv(src, msg, sizeof(BACMSG)-sizeof(MSGTYPE), 0, flags);
-    if (recv_bytes > 0) {
+    if (!box || !box->used) {
+        return NULL;
+    }
+    if (msgbox_take(box, msg)) {
         return msg;
-    } else {
+    }
+    if (flags & MSGBOX_NOWAIT) {
         return NULL;
     }
+    for (spin = 0; spin < Msgbox_Spin; spin++) {
+        if (msgbox_take(box, msg)) {
+            return msg;
+        }
+    }
+    /* sleep until a producer signals, or the wait is over */
+    clock_gettime(CLOCK_REALTIME, &abstime);
+    abstime.tv_nsec += (long) MSGBOX_WAIT_MS * 1000000L;
+    if (abstime.tv_nsec >= 1000000000L) {
+        abstime.tv_sec += abstime.tv_nsec / 1000000000L;
+        abstime.tv_nsec %= 1000000000L;
+    }
+    pthread_mutex_lock(&box->lock);
+    box->sleeping = 1;
+    __sync_synchronize();
+    if (!msgbox_take(box, msg)) {
+        pthread_cond_timedwait(&box->cond, &box->lock, &abstime);
+        box->sleeping = 0;
+        pthread_mutex_unlock(&box->lock);
+        return msgbox_take(box, msg) ? msg : NULL;
+    }
+    box->sleeping = 0;
+    pthread_mutex_unlock(&box->lock);
+
+    return msg;
 }
 
 void del_msgbox(
     MSGBOX_ID msgboxid)
 {
+    MSGBOX *box = msgbox_get(msgboxid);
 
-    if (msgboxid == INVALID_MSGBOX_ID)
-        return;
-    else
-        msgctl(msgboxid, IPC_RMID, NULL);
+    /* the memory stays: another thread may still be sending to it */
+    if (box) {
+        box->used = false;
+    }
 }
 
-void free_data(
+static MSG_DATA *pool_get(
+    uint16_t index)
+{
+    return &Pool_Slab[index / MSG_DATA_SLAB_SIZE][index % MSG_DATA_SLAB_SIZE];
+}
+
+static void pool_push(
     MSG_DATA * data)
 {
+    uint32_t top, next;
+
+    do {
+        top = Pool_Free;
+        data->pool_next = (uint16_t) (top & 0xFFFF);
+        next = (((top >> 16) + 1) << 16) | (uint32_t) (data->pool_index + 1);
+    } while (!__sync_bool_compare_and_swap(&Pool_Free, top, next));
+}
+
+/* adds a slab of packets to the pool, when it runs out */
+static bool pool_grow(
+    void)
+{
+    MSG_DATA *slab;
+    unsigned i;
+    bool status = false;
+
+    pthread_mutex_lock(&Pool_Lock);
+    if ((Pool_Free & 0xFFFF) != 0) {
+        /* another thread grew it, or a packet came back */
+        status = true;
+    } else if (Pool_Slabs < MSG_DATA_MAX_SLABS) {
+        slab = (MSG_DATA *) malloc(MSG_DATA_SLAB_SIZE * sizeof(MSG_DATA));
+        if (slab) {
+            Pool_Slab[Pool_Slabs] = slab;
+            for (i = 0; i < MSG_DATA_SLAB_SIZE; i++) {
+                slab[i].pool_index =
+                    (uint16_t) (Pool_Slabs * MSG_DATA_SLAB_SIZE + i);
+            }
+            Pool_Slabs++;
+            for (i = 0; i < MSG_DATA_SLAB_SIZE; i++) {
+                pool_push(&slab[i]);
+            }
+            status = true;
+        }
+    }
+    pthread_mutex_unlock(&Pool_Lock);
+
+    return status;
+}
+
+MSG_DATA *alloc_data(
+    void)
+{
+    MSG_DATA *data;
+    uint32_t top, next;
+    uint16_t index;
 
-    if (data->pdu) {
-        free(data->pdu);
-        data->pdu = NULL;
+    for (;;) {
+        top = Pool_Free;
+        index = (uint16_t) (top & 0xFFFF);
+        if (index == 0) {
+            if (!pool_grow()) {
+                return NULL;
+            }
+            continue;
+        }
+        data = pool_get(index - 1);
+        next = (((top >> 16) + 1) << 16) | data->pool_next;
+        if (__sync_bool_compare_and_swap(&Pool_Free, top, next)) {
+            break;
+        }
     }
+    data->pdu = &data->buffer[0];
+    data->pdu_len = 0;
+    data->ref_count = 1;
+
+    return data;
+}
+
+void free_data(
+    MSG_DATA * data)
+{
     if (data) {
-        free(data);
-        data = NULL;
+        pool_push(data);
     }
 }
 
 void check_data(
     MSG_DATA * data)
 {
-
-    /* lock and decrement messages reference count */
-    pthread_mutex_lock(&msg_lock);
-    if (--data->ref_count == 0) {
+    /* decrement messages reference count, the last one frees it */
+    if (__sync_sub_and_fetch(&data->ref_count, 1) == 0) {
         free_data(data);
     }
-    pthread_mutex_unlock(&msg_lock);
 }
@@ -31,16 +31,42 @@
 
 #include <stdint.h>
 #include <stdbool.h>
-#include <sys/types.h>
-#include <sys/ipc.h>
-#include <sys/msg.h>
+#include <pthread.h>
 #include "bacdef.h"
 #include "npdu.h"
 
-extern pthread_mutex_t msg_lock;
+/* Message boxes are in-process lock-free rings, and the routed packets
+   come from a pool of buffers allocated a slab at a time, so a packet
+   goes from one port thread to another without a system call or a
+   malloc. */
 
 #define INVALID_MSGBOX_ID -1
 
+/* recv_from_msgbox() flags */
+#define MSGBOX_NOWAIT 1
+/* longest wait of a blocking recv_from_msgbox(), in milliseconds */
+#ifndef MSGBOX_WAIT_MS
+#define MSGBOX_WAIT_MS 100
+#endif
+
+/* messages that a message box holds, a power of two */
+#ifndef MSGBOX_SIZE
+#define MSGBOX_SIZE 1024
+#endif
+/* message boxes: one for the router and one for each port */
+#ifndef MAX_MSGBOX
+#define MAX_MSGBOX 32
+#endif
+/* packet buffers that the pool allocates at a time */
+#ifndef MSG_DATA_SLAB_SIZE
+#define MSG_DATA_SLAB_SIZE 256
+#endif
+#ifndef MSG_DATA_MAX_SLABS
+#define MSG_DATA_MAX_SLABS 64
+#endif
+/* room for a routed packet, whose NPDU grows with the SNET and SADR */
+#define MSG_DATA_PDU_SIZE (MAX_NPDU + MAX_APDU)
+
 typedef int MSGBOX_ID;
 
 typedef enum {
@@ -66,20 +92,29 @@ typedef struct _message {
 typedef struct _msg_data {
     BACNET_ADDRESS dest;
     BACNET_ADDRESS src;
-    uint8_t *pdu;
+    uint8_t *pdu;       /* points into buffer */
     uint16_t pdu_len;
     uint8_t ref_count;
+    uint16_t pool_index;        /* owned by the packet pool */
+    uint16_t pool_next;
+    uint8_t buffer[MSG_DATA_PDU_SIZE];
 } MSG_DATA;
 
+/* message box that only one thread sends to */
 MSGBOX_ID create_msgbox(
-    );
+    void);
 
-/* returns sent byte count */
+/* message box that any thread may send to */
+MSGBOX_ID create_shared_msgbox(
+    void);
+
+/* returns false if the message box is full */
 bool send_to_msgbox(
     MSGBOX_ID dest,
     BACMSG * msg);
 
-/* returns received message */
+/* returns received message, or NULL if none arrived;
+   without MSGBOX_NOWAIT, waits up to MSGBOX_WAIT_MS for one */
 BACMSG *recv_from_msgbox(
     MSGBOX_ID src,
     BACMSG * msg,
@@ -88,7 +123,11 @@ BACMSG *recv_from_msgbox(
 void del_msgbox(
     MSGBOX_ID msgboxid);
 
-/* free message data structure */
+/* get a packet from the pool, with a reference count of one */
+MSG_DATA *alloc_data(
+    void);
+
+/* return message data structure to the pool */
 void free_data(
     MSG_DATA * data);
 
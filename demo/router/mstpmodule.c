@@ -29,8 +29,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/ipc.h>
 #include "mstpmodule.h"
+#include "network_layer.h"
 #include "bacint.h"
 #include "dlmstp_linux.h"
 #include <termios.h>
@@ -97,7 +97,8 @@ void *dl_mstp_thread(
     if (!dlmstp_init(&mstp_port, port->iface))
         printf("MSTP %s init failed. Stop.\n", port->iface);
 
-    port->port_id = create_msgbox();
+    /* every port thread routes packets to this port */
+    port->port_id = create_shared_msgbox();
     if (port->port_id == INVALID_MSGBOX_ID) {
         port->state = INIT_FAILED;
         return NULL;
@@ -110,7 +111,7 @@ void *dl_mstp_thread(
         BACMSG msg_storage, *bacmsg;
         MSG_DATA *msg_data;
 
-        bacmsg = recv_from_msgbox(port->port_id, &msg_storage, IPC_NOWAIT);
+        bacmsg = recv_from_msgbox(port->port_id, &msg_storage, MSGBOX_NOWAIT);
 
         if (bacmsg) {
             switch (bacmsg->type) {
@@ -147,27 +148,22 @@ void *dl_mstp_thread(
         } else {
             pdu_len = dlmstp_receive(&mstp_port, NULL, NULL, 0, 5);
 
-            if (pdu_len > 0) {
-                msg_data = (MSG_DATA *) malloc(sizeof(MSG_DATA));
+            if ((pdu_len > 0) && (pdu_len <= MSG_DATA_PDU_SIZE)) {
+                msg_data = alloc_data();
+                if (!msg_data) {
+                    continue;
+                }
                 memmove(&(msg_data->src),
                     (const void *) &(shared_port_data.Receive_Packet.address),
                     sizeof(shared_port_data.Receive_Packet.address));
                 msg_data->src.adr[0] = msg_data->src.mac[0];
                 msg_data->src.len = 1;
-                msg_data->pdu = (uint8_t *) malloc(pdu_len);
                 memmove(msg_data->pdu,
                     (const void *) &(shared_port_data.Receive_Packet.pdu),
                     pdu_len);
                 msg_data->pdu_len = pdu_len;
 
-                msg_storage.type = DATA;
-                msg_storage.subtype = (MSGSUBTYPE) 0;
-                msg_storage.origin = port->port_id;
-                msg_storage.data = msg_data;
-
-                if (!send_to_msgbox(port->main_id, &msg_storage)) {
-                    free_data(msg_data);
-                }
+                route_msg(port, msg_data);
             }
         }
     }
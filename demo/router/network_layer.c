@@ -29,6 +29,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <assert.h>
 #include "network_layer.h"
 #include "bacint.h"
 
@@ -47,8 +48,6 @@ uint16_t process_network_message(
     int apdu_offset;
     int apdu_len;
 
-    memmove(data, msg->data, sizeof(MSG_DATA));
-
     apdu_offset = npdu_decode(data->pdu, &data->dest, NULL, &npdu_data);
     apdu_len = data->pdu_len - apdu_offset;
 
@@ -96,7 +95,7 @@ uint16_t process_network_message(
                 int i;
                 for (i = 0; i < net_count; i++) {
                     decode_unsigned16(&data->pdu[apdu_offset + 2 * i], &net);   /* decode received NET values */
-                    add_dnet(&srcport->route_info, net, data->src);     /* and update routing table */
+                    add_dnet(srcport, net, data->src);     /* and update routing table */
                 }
                 break;
             }
@@ -131,7 +130,7 @@ uint16_t process_network_message(
                 while (net_count--) {
                     int i = 1;
                     decode_unsigned16(&data->pdu[apdu_offset + i], &net);       /* decode received NET values */
-                    add_dnet(&srcport->route_info, net, data->src);     /* and update routing table */
+                    add_dnet(srcport, net, data->src);     /* and update routing table */
                     if (data->pdu[apdu_offset + i + 3] > 0)     /* find next NET value */
                         i = data->pdu[apdu_offset + i + 3] + 4;
                     else
@@ -153,7 +152,7 @@ uint16_t process_network_message(
                 while (net_count--) {
                     int i = 1;
                     decode_unsigned16(&data->pdu[apdu_offset + i], &net);       /* decode received NET values */
-                    add_dnet(&srcport->route_info, net, data->src);     /* and update routing table */
+                    add_dnet(srcport, net, data->src);     /* and update routing table */
                     if (data->pdu[apdu_offset + i + 3] > 0)     /* find next NET value */
                         i = data->pdu[apdu_offset + i + 3] + 4;
                     else
@@ -211,7 +210,8 @@ uint16_t create_network_message(
         data_expecting_reply = true;
     init_npdu(&npdu_data, network_message_type, data_expecting_reply);
 
-    *buff = (uint8_t *) malloc(128);    /* resolve different length */
+    /* built in place of the received message */
+    *buff = &data->buffer[0];
 
     /* manual destination setup for Init-RT-Table-Ack message */
     data->dest.net = BACNET_BROADCAST_NETWORK;
@@ -233,29 +233,15 @@ uint16_t create_network_message(
                 uint16_t val16 = (valptr[0]) + (valptr[1] << 8);
                 buff_len += encode_unsigned16(*buff + buff_len, val16);
             } else {
-                ROUTER_PORT *port = head;
-                DNET *dnet;
-                while (port != NULL) {
-                    if (port->route_info.net != data->src.net) {
-                        buff_len +=
-                            encode_unsigned16(*buff + buff_len,
-                            port->route_info.net);
-                        dnet = port->route_info.dnets;
-                        while (dnet != NULL) {
-                            buff_len +=
-                                encode_unsigned16(*buff + buff_len, dnet->net);
-                            dnet = dnet->next;
-                        }
-                        port = port->next;
-                    } else {
-                        dnet = port->route_info.dnets;
-                        while (dnet != NULL) {
-                            buff_len +=
-                                encode_unsigned16(*buff + buff_len, dnet->net);
-                            dnet = dnet->next;
-                        }
-                        port = port->next;
-                    }
+                /* every reachable network but the one of the asking port */
+                uint16_t nets[ROUTE_TABLE_SIZE];
+                unsigned count, i;
+
+                count =
+                    get_dnets(nets, (MSG_DATA_PDU_SIZE - buff_len) / 2,
+                    data->src.net);
+                for (i = 0; i < count; i++) {
+                    buff_len += encode_unsigned16(*buff + buff_len, nets[i]);
                 }
             }
             break;
@@ -329,9 +315,13 @@ void send_network_message(
     int16_t buff_len;
 
     if (!data) {
-        data = (MSG_DATA *) malloc(sizeof(MSG_DATA));
+        data = alloc_data();
+        if (!data) {
+            return;
+        }
         data->dest.net = BACNET_BROADCAST_NETWORK;
         data->dest.len = 0;
+        data->src.net = 0;
     }
 
     buff_len = create_network_message(network_message_type, data, buff, val);
@@ -339,19 +329,187 @@ void send_network_message(
     /* form network message */
     data->pdu = *buff;
     data->pdu_len = buff_len;
-    msg.origin = head->main_id;
+    msg.origin = INVALID_MSGBOX_ID;
     msg.type = DATA;
     msg.data = data;
 
-    data->ref_count = port_count;
+    /* one reference for each port, and one held until all are sent */
+    data->ref_count = 1;
     while (port != NULL) {
-        if (port->state == FINISHED) {
-            port = port->next;
-            continue;
+        if (port->state == RUNNING) {
+            data->ref_count++;
         }
-        send_to_msgbox(port->port_id, &msg);
         port = port->next;
     }
+    port = head;
+    while (port != NULL) {
+        if (port->state == RUNNING) {
+            if (!send_to_msgbox(port->port_id, &msg)) {
+                check_data(data);
+            }
+        }
+        port = port->next;
+    }
+    check_data(data);
+}
+
+uint16_t process_msg(
+    BACMSG * msg,
+    MSG_DATA * data,
+    uint8_t ** buff)
+{
+
+    BACNET_ADDRESS addr;
+    BACNET_NPDU_DATA npdu_data;
+    ROUTER_PORT *srcport;
+    ROUTER_PORT *destport;
+    uint8_t npdu[MAX_NPDU];
+    int16_t buff_len = 0;
+    int apdu_offset;
+    int apdu_len;
+    int npdu_len;
+
+    apdu_offset = npdu_decode(data->pdu, &data->dest, &addr, &npdu_data);
+    apdu_len = data->pdu_len - apdu_offset;
+
+    srcport = find_snet(msg->origin);
+    destport = find_dnet(data->dest.net, NULL);
+    assert(srcport);
+
+    if (srcport && destport) {
+        data->src.net = srcport->route_info.net;
+
+        /* if received from another router save real source address (not other router source address) */
+        if (addr.net > 0 && addr.net < BACNET_BROADCAST_NETWORK &&
+            data->src.net != addr.net) {
+            memmove(&data->src, &addr, sizeof(BACNET_ADDRESS));
+            /* the network is alive: keep its route */
+            refresh_dnet(addr.net, srcport);
+        }
+
+        /* encode both source and destination for broadcast and router-to-router communication */
+        if (data->dest.net == BACNET_BROADCAST_NETWORK ||
+            destport->route_info.net != data->dest.net) {
+            npdu_len =
+                npdu_encode_pdu(npdu, &data->dest, &data->src, &npdu_data);
+        } else {
+            npdu_len = npdu_encode_pdu(npdu, NULL, &data->src, &npdu_data);
+        }
+
+        buff_len = npdu_len + data->pdu_len - apdu_offset;
+        if (buff_len > MSG_DATA_PDU_SIZE) {
+            /* discard */
+            return 0;
+        }
+
+        /* rewrite the packet in its own buffer */
+        *buff = &data->buffer[0];
+        memmove(*buff + npdu_len, &data->pdu[apdu_offset], apdu_len);   /* move APDU */
+        memmove(*buff, npdu, npdu_len); /* copy newly formed NPDU */
+
+    } else {
+        /* request net search */
+        return -1;
+    }
+
+    return buff_len;
+}
+
+bool is_network_msg(
+    BACMSG * msg)
+{
+
+    uint8_t control_byte;       /* NPDU control byte */
+    MSG_DATA *data = (MSG_DATA *) msg->data;
+
+    control_byte = data->pdu[1];
+
+    return control_byte & 0x80; /* check 7th bit */
+}
+
+/* Routes a packet received on a router port.  The port threads call this
+   themselves, and hand the packet to the message boxes of the ports that
+   send it on; a broadcast is one packet shared by all of them. */
+void route_msg(
+    ROUTER_PORT * srcport,
+    MSG_DATA * data)
+{
+    BACMSG msg;
+    ROUTER_PORT *port;
+    uint8_t *buff = NULL;
+    int16_t buff_len;
+
+    msg.origin = srcport->port_id;
+    msg.type = DATA;
+    msg.subtype = (MSGSUBTYPE) 0;
+    msg.data = data;
+    srcport->routed++;
+
+    if (is_network_msg(&msg)) {
+        buff_len = process_network_message(&msg, data, &buff);
+        if (buff_len == 0) {
+            free_data(data);
+            return;
+        }
+    } else {
+        buff_len = process_msg(&msg, data, &buff);
+    }
+
+    /* if buff_len */
+    /* >0 - form new message and send */
+    /* =-1 - try to find next router */
+    /* other value - discard message */
+
+    if (buff_len > 0) {
+        /* form new message */
+        data->pdu = buff;
+        data->pdu_len = buff_len;
+
+        if (is_network_msg(&msg)) {
+            /* the reply goes out on the port it came in */
+            data->ref_count = 1;
+            if (!send_to_msgbox(srcport->port_id, &msg)) {
+                check_data(data);
+            }
+        } else if (data->dest.net != BACNET_BROADCAST_NETWORK) {
+            data->ref_count = 1;
+            port = find_dnet(data->dest.net, &data->dest);
+            if (!port || (port->state != RUNNING) ||
+                !send_to_msgbox(port->port_id, &msg)) {
+                check_data(data);
+            }
+        } else {
+            /* one reference for each port it goes to,
+               and one held until they are all sent */
+            port = head;
+            data->ref_count = 1;
+            while (port != NULL) {
+                if (port != srcport && port->state == RUNNING) {
+                    data->ref_count++;
+                }
+                port = port->next;
+            }
+            port = head;
+            while (port != NULL) {
+                if (port != srcport && port->state == RUNNING) {
+                    if (!send_to_msgbox(port->port_id, &msg)) {
+                        check_data(data);
+                    }
+                }
+                port = port->next;
+            }
+            check_data(data);
+        }
+    } else if (buff_len == -1) {
+        uint16_t net = data->dest.net;  /* NET to find */
+        PRINT(INFO, "Searching NET...\n");
+        send_network_message(NETWORK_MESSAGE_WHO_IS_ROUTER_TO_NETWORK, data,
+            &buff, &net);
+    } else {
+        /* if invalid message send Reject-Message-To-Network */
+        PRINT(ERROR, "Error: Invalid message\n");
+        free_data(data);
+    }
 }
 
 void init_npdu(
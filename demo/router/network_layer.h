@@ -57,6 +57,19 @@ void send_network_message(
     uint8_t ** buff,
     void *val);
 
+uint16_t process_msg(
+    BACMSG * msg,
+    MSG_DATA * data,
+    uint8_t ** buff);
+
+bool is_network_msg(
+    BACMSG * msg);
+
+/* route a packet received on a router port */
+void route_msg(
+    ROUTER_PORT * srcport,
+    MSG_DATA * data);
+
 void init_npdu(
     BACNET_NPDU_DATA * npdu_data,
     BACNET_NETWORK_MESSAGE_TYPE network_message_type,
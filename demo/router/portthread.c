@@ -31,6 +31,141 @@
 #include <string.h>
 #include "portthread.h"
 
+static DNET Route_Table[ROUTE_TABLE_SIZE];
+static DNET Route_Rehash[ROUTE_TABLE_SIZE];
+static unsigned Route_Used;     /* used entries */
+static unsigned Route_Deleted;  /* deleted entries */
+static ROUTE_STATS Route_Stats;
+/* odd while a writer changes the table */
+static volatile unsigned Route_Sequence;
+static pthread_mutex_t Route_Lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned route_hash(
+    uint16_t net)
+{
+    return (unsigned) (((uint32_t) net * 2654435761UL) >> 16) &
+        (ROUTE_TABLE_SIZE - 1);
+}
+
+/* returns the entry of a network, or NULL */
+static DNET *route_find(
+    uint16_t net)
+{
+    unsigned index = route_hash(net);
+    unsigned i;
+
+    for (i = 0; i < ROUTE_TABLE_SIZE; i++) {
+        if (Route_Table[index].state == ROUTE_FREE) {
+            break;
+        }
+        if ((Route_Table[index].state == ROUTE_USED) &&
+            (Route_Table[index].net == net)) {
+            return &Route_Table[index];
+        }
+        index = (index + 1) & (ROUTE_TABLE_SIZE - 1);
+    }
+
+    return NULL;
+}
+
+/* returns a slot for a new network, with the lock held */
+static DNET *route_slot(
+    uint16_t net)
+{
+    unsigned index = route_hash(net);
+
+    while (Route_Table[index].state == ROUTE_USED) {
+        index = (index + 1) & (ROUTE_TABLE_SIZE - 1);
+    }
+    if (Route_Table[index].state == ROUTE_DELETED) {
+        Route_Deleted--;
+    }
+    Route_Used++;
+
+    return &Route_Table[index];
+}
+
+static void route_write_begin(
+    void)
+{
+    pthread_mutex_lock(&Route_Lock);
+    Route_Sequence++;
+    __sync_synchronize();
+}
+
+static void route_write_end(
+    void)
+{
+    __sync_synchronize();
+    Route_Sequence++;
+    pthread_mutex_unlock(&Route_Lock);
+}
+
+/* clears the deleted entries, with the lock held */
+static void route_rehash(
+    void)
+{
+    unsigned i;
+
+    memcpy(Route_Rehash, Route_Table, sizeof(Route_Table));
+    memset(Route_Table, 0, sizeof(Route_Table));
+    Route_Used = 0;
+    Route_Deleted = 0;
+    for (i = 0; i < ROUTE_TABLE_SIZE; i++) {
+        if (Route_Rehash[i].state == ROUTE_USED) {
+            *route_slot(Route_Rehash[i].net) = Route_Rehash[i];
+        }
+    }
+}
+
+static void route_add(
+    ROUTER_PORT * port,
+    uint16_t net,
+    BACNET_ADDRESS * addr)
+{
+    DNET *dnet;
+    bool learned = (addr != NULL);
+
+    route_write_begin();
+    dnet = route_find(net);
+    if (dnet) {
+        if (learned && !dnet->learned) {
+            /* directly connected networks stay */
+            route_write_end();
+            return;
+        }
+        if ((dnet->port != port) || (learned &&
+                ((dnet->mac_len != addr->len) ||
+                    (memcmp(dnet->mac, addr->adr, addr->len) != 0)))) {
+            Route_Stats.moved++;
+        }
+    } else {
+        if ((Route_Used + Route_Deleted + 1) > (ROUTE_TABLE_SIZE * 3 / 4)) {
+            if ((Route_Used + 1) > (ROUTE_TABLE_SIZE * 3 / 4)) {
+                Route_Stats.full++;
+                route_write_end();
+                return;
+            }
+            route_rehash();
+        }
+        dnet = route_slot(net);
+        Route_Stats.added++;
+    }
+    dnet->net = net;
+    dnet->port = port;
+    dnet->learned = learned;
+    if (learned) {
+        dnet->mac_len = addr->len;
+        memmove(&dnet->mac[0], &addr->adr[0], MAX_MAC_LEN);
+    } else {
+        dnet->mac_len = 0;
+        memset(&dnet->mac[0], 0, MAX_MAC_LEN);
+    }
+    dnet->updated = time(NULL);
+    dnet->state = ROUTE_USED;
+    route_write_end();
+}
+
 ROUTER_PORT *find_snet(
     MSGBOX_ID id)
 {
@@ -50,83 +185,162 @@ ROUTER_PORT *find_dnet(
     uint16_t net,
     BACNET_ADDRESS * addr)
 {
-
-    ROUTER_PORT *port = head;
+    ROUTER_PORT *port;
     DNET *dnet;
+    DNET entry;
+    unsigned sequence;
 
     /* for broadcast messages no search is needed */
     if (net == BACNET_BROADCAST_NETWORK)
-        return port;
-
-    while (port != NULL) {
+        return head;
 
-        /* check if DNET is directly connected to the router */
-        if (net == port->route_info.net)
-            return port;
-
-        /* else search router ports DNET list */
-        else if (port->route_info.dnets) {
-            dnet = port->route_info.dnets;
-            while (dnet != NULL) {
-                if (net == dnet->net) {
-                    if (addr) {
-                        memmove(&addr->len, &dnet->mac_len, 1);
-                        memmove(&addr->adr[0], &dnet->mac[0], MAX_MAC_LEN);
-                    }
-                    return port;
-                }
-                dnet = dnet->next;
-            }
+    do {
+        /* copy the entry while no writer is busy */
+        sequence = Route_Sequence;
+        if (sequence & 1) {
+            continue;
         }
-        port = port->next;
+        __sync_synchronize();
+        dnet = route_find(net);
+        if (dnet) {
+            entry = *dnet;
+        }
+        __sync_synchronize();
+    } while ((sequence & 1) || (sequence != Route_Sequence));
+    if (!dnet) {
+        return NULL;
+    }
+    port = entry.port;
+    /* next router for networks that are not directly connected */
+    if (entry.learned && addr) {
+        memmove(&addr->len, &entry.mac_len, 1);
+        memmove(&addr->adr[0], &entry.mac[0], MAX_MAC_LEN);
     }
 
-    return NULL;
+    return port;
+}
+
+void add_port_dnet(
+    ROUTER_PORT * port)
+{
+    route_add(port, port->route_info.net, NULL);
 }
 
 void add_dnet(
-    RT_ENTRY * route_info,
+    ROUTER_PORT * port,
     uint16_t net,
     BACNET_ADDRESS addr)
 {
+    route_add(port, net, &addr);
+}
 
-    DNET *dnet = route_info->dnets;
-    DNET *tmp;
+void refresh_dnet(
+    uint16_t net,
+    ROUTER_PORT * port)
+{
+    DNET *dnet;
+    time_t now = time(NULL);
 
-    if (dnet == NULL) {
-        route_info->dnets = (DNET *) malloc(sizeof(DNET));
-        memmove(&route_info->dnets->mac_len, &addr.len, 1);
-        memmove(&route_info->dnets->mac[0], &addr.adr[0], MAX_MAC_LEN);
-        route_info->dnets->net = net;
-        route_info->dnets->state = true;
-        route_info->dnets->next = NULL;
-    } else {
+    /* the lock keeps route_rehash from moving the entry meanwhile;
+       lookups don't use the time, so the sequence stays as it is */
+    pthread_mutex_lock(&Route_Lock);
+    dnet = route_find(net);
+    if (dnet && (dnet->port == port) && (dnet->updated != now)) {
+        dnet->updated = now;
+    }
+    pthread_mutex_unlock(&Route_Lock);
+}
 
-        while (dnet != NULL) {
-            if (dnet->net == net)       /* make sure NETs are not repeated */
-                return;
-            tmp = dnet;
-            dnet = dnet->next;
+void age_dnets(
+    time_t now)
+{
+    unsigned i;
+
+    if (ROUTE_MAX_AGE == 0) {
+        return;
+    }
+    route_write_begin();
+    for (i = 0; i < ROUTE_TABLE_SIZE; i++) {
+        if ((Route_Table[i].state == ROUTE_USED) && Route_Table[i].learned &&
+            ((now - Route_Table[i].updated) > ROUTE_MAX_AGE)) {
+            Route_Table[i].state = ROUTE_DELETED;
+            Route_Used--;
+            Route_Deleted++;
+            Route_Stats.aged++;
         }
+    }
+    route_write_end();
+}
+
+unsigned get_dnets(
+    uint16_t * nets,
+    unsigned max,
+    uint16_t except)
+{
+    unsigned i;
+    unsigned count = 0;
 
-        dnet = (DNET *) malloc(sizeof(DNET));
-        memmove(&dnet->mac_len, &addr.len, 1);
-        memmove(&dnet->mac[0], &addr.adr[0], MAX_MAC_LEN);
-        dnet->net = net;
-        dnet->state = true;
-        dnet->next = NULL;
-        tmp->next = dnet;
+    pthread_mutex_lock(&Route_Lock);
+    for (i = 0; (i < ROUTE_TABLE_SIZE) && (count < max); i++) {
+        if ((Route_Table[i].state == ROUTE_USED) &&
+            (Route_Table[i].net != except)) {
+            nets[count++] = Route_Table[i].net;
+        }
     }
+    pthread_mutex_unlock(&Route_Lock);
+
+    return count;
 }
 
-void cleanup_dnets(
-    DNET * dnets)
+void dump_dnets(
+    FILE * stream)
 {
+    time_t now = time(NULL);
+    unsigned long routed = 0;
+    unsigned i, j;
+    ROUTER_PORT *port;
+    DNET *dnet;
 
-    DNET *dnet = dnets;
-    while (dnet != NULL) {
-        dnet = dnet->next;
-        free(dnets);
-        dnets = dnet;
+    pthread_mutex_lock(&Route_Lock);
+    fprintf(stream, "DNET  Port  Next router        Age\n");
+    for (i = 0; i < ROUTE_TABLE_SIZE; i++) {
+        dnet = &Route_Table[i];
+        if (dnet->state != ROUTE_USED) {
+            continue;
+        }
+        fprintf(stream, "%-5u %-5u ", (unsigned) dnet->net,
+            (unsigned) dnet->port->route_info.net);
+        if (dnet->learned) {
+            for (j = 0; j < MAX_MAC_LEN; j++) {
+                if (j < dnet->mac_len) {
+                    fprintf(stream, "%02X", dnet->mac[j]);
+                } else {
+                    fprintf(stream, "  ");
+                }
+            }
+            fprintf(stream, "     %lds\n", (long) (now - dnet->updated));
+        } else {
+            fprintf(stream, "direct\n");
+        }
     }
+    /* each port counts its own packets, so the sum is approximate */
+    for (port = head; port != NULL; port = port->next) {
+        routed += port->routed;
+    }
+    fprintf(stream,
+        "%u networks, %u deleted slots; %lu packets, %lu added, "
+        "%lu moved, %lu aged, %lu did not fit\n", Route_Used, Route_Deleted,
+        routed, Route_Stats.added, Route_Stats.moved, Route_Stats.aged,
+        Route_Stats.full);
+    pthread_mutex_unlock(&Route_Lock);
+}
+
+void cleanup_dnets(
+    void)
+{
+    route_write_begin();
+    memset(Route_Table, 0, sizeof(Route_Table));
+    Route_Used = 0;
+    Route_Deleted = 0;
+    route_write_end();
 }
@@ -31,6 +31,8 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
 #include <pthread.h>
 #include "msgqueue.h"
 #include "bacdef.h"
@@ -85,28 +87,19 @@ typedef union _port_params {
     } mstp_params;
 } PORT_PARAMS;
 
-/* list node for reacheble networks */
-typedef struct _dnet {
-    uint8_t mac[MAX_MAC_LEN];
-    uint8_t mac_len;
-    uint16_t net;
-    bool state; /* enabled or disabled */
-    struct _dnet *next;
-} DNET;
-
 /* information for routing table */
 typedef struct _routing_table_entry {
     uint8_t mac[MAX_MAC_LEN];
     uint8_t mac_len;
     uint16_t net;
-    DNET *dnets;
 } RT_ENTRY;
 
 typedef struct _port {
     DL_TYPE type;
     PORT_STATE state;
-    MSGBOX_ID main_id;  /* same for every router port */
+    bool shutdown;      /* SHUTDOWN was sent to the port */
     MSGBOX_ID port_id;  /* different for every router port */
+    unsigned long routed;       /* packets received, counted by the port */
     char *iface;
     PORT_FUNC func;
     RT_ENTRY route_info;
@@ -114,6 +107,45 @@ typedef struct _port {
     struct _port *next; /* pointer to next list node */
 } ROUTER_PORT;
 
+/* The routing table maps each reachable network (DNET) to the router
+   port and the MAC of the next router, in an open addressing hash table.
+   Writers take a lock; lookups don't, and retry if a writer was busy. */
+
+/* table slots, a power of two; a quarter is kept free */
+#ifndef ROUTE_TABLE_SIZE
+#define ROUTE_TABLE_SIZE 1024
+#endif
+/* seconds without news of a learned network before it is dropped,
+   or 0 to keep learned networks */
+#ifndef ROUTE_MAX_AGE
+#define ROUTE_MAX_AGE 600
+#endif
+
+typedef enum {
+    ROUTE_FREE,
+    ROUTE_USED,
+    ROUTE_DELETED       /* keeps the probe sequence going */
+} ROUTE_STATE;
+
+/* routing table entry for one reachable network */
+typedef struct _dnet {
+    uint8_t mac[MAX_MAC_LEN];   /* next router, none if directly connected */
+    uint8_t mac_len;
+    uint16_t net;
+    ROUTE_STATE state;
+    bool learned;       /* from a router, so it ages */
+    struct _port *port;
+    volatile time_t updated;
+} DNET;
+
+/* routing table statistics, for finding route churn */
+typedef struct _route_stats {
+    unsigned long added;
+    unsigned long moved;        /* learned on another port or router */
+    unsigned long aged;
+    unsigned long full; /* networks that didn't fit */
+} ROUTE_STATS;
+
 extern ROUTER_PORT *head;
 extern int port_count;
 
@@ -126,13 +158,36 @@ ROUTER_PORT *find_dnet(
     uint16_t net,
     BACNET_ADDRESS * addr);
 
+/* add directly connected network of a router port */
+void add_port_dnet(
+    ROUTER_PORT * port);
+
 /* add reacheble network for specified router port */
 void add_dnet(
-    RT_ENTRY * route_info,
+    ROUTER_PORT * port,
     uint16_t net,
     BACNET_ADDRESS addr);
 
+/* note traffic from a network, which keeps its route from aging */
+void refresh_dnet(
+    uint16_t net,
+    ROUTER_PORT * port);
+
+/* drop learned networks not heard of since ROUTE_MAX_AGE */
+void age_dnets(
+    time_t now);
+
+/* copy the reachable networks, except one, and return how many */
+unsigned get_dnets(
+    uint16_t * nets,
+    unsigned max,
+    uint16_t except);
+
+/* print the routing table and its statistics */
+void dump_dnets(
+    FILE * stream);
+
 void cleanup_dnets(
-    DNET * dnets);
+    void);
 
 #endif /* end of PORTTHREAD_H */
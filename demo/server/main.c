@@ -69,7 +69,13 @@
 
 #if defined(BAC_UCI)
 #include "ucix.h"
+#endif /* defined(BAC_UCI) */
+
+#if defined(BAC_SHM)
+#include "shmpoint.h"
+#endif /* defined(BAC_SHM) */
 
+#if defined(BAC_UCI) || defined(BAC_SHM)
 #if defined(AI)
 #include "ai.h"
 #endif
@@ -106,7 +112,7 @@
 #include "msv.h"
 #endif
 
-#endif /* defined(BAC_UCI) */
+#endif /* defined(BAC_UCI) || defined(BAC_SHM) */
 
 
 /** @file server/main.c  Example server application using the BACnet Stack. */
@@ -119,17 +125,283 @@
 /** Buffer used for receiving */
 static uint8_t Rx_Buf[MAX_MPDU] = { 0 };
 
+#if defined(BAC_UCI) || defined(BAC_SHM)
+#if defined(AI) || defined(AO) || defined(AV) || defined(BI) || defined(BO) || defined(BV) || defined(MSI) || defined(MSO) || defined(MSV)
+/* applies a present value and the out-of-service state to an object */
+static void point_Update(
+	BACNET_OBJECT_TYPE object_type,
+	uint32_t object_instance,
+	float value,
+	bool out_of_service
+	)
+{
+	if (false) {
+	}
+/* update Analog Input */
+#if defined(AI)
+	else if (object_type == OBJECT_ANALOG_INPUT) {
+		float ai_val, ai_pval;
+		ai_val = value;
+		ai_pval = Analog_Input_Present_Value(object_instance);
+		if ( ai_val != ai_pval ) {
+			Analog_Input_Present_Value_Set(object_instance,ai_val,16);
+		}
+		if (!out_of_service) {
+			if (Analog_Input_Out_Of_Service(object_instance))
+				Analog_Input_Out_Of_Service_Set(object_instance,0);
+			if (Analog_Input_Reliability(object_instance))
+				Analog_Input_Reliability_Set(object_instance,
+					RELIABILITY_NO_FAULT_DETECTED);
+		} else {
+#if PRINT_ENABLED
+			printf("idx %u ",(unsigned) object_instance);
+			printf("Out_Of_Service\n");
+#endif
+			Analog_Input_Out_Of_Service_Set(object_instance,1);
+			Analog_Input_Reliability_Set(object_instance,
+				RELIABILITY_COMMUNICATION_FAILURE);
+		}
+	}
+#endif
+/* update Analog Output */
+#if defined(AO)
+	else if (object_type == OBJECT_ANALOG_OUTPUT) {
+		float ao_val, ao_pval;
+		ao_val = value;
+		ao_pval = Analog_Output_Present_Value(object_instance);
+		if ( ao_val != ao_pval ) {
+			Analog_Output_Present_Value_Set(object_instance,ao_val,16);
+		}
+		if (!out_of_service) {
+			if (Analog_Output_Out_Of_Service(object_instance))
+				Analog_Output_Out_Of_Service_Set(object_instance,0);
+			if (Analog_Output_Reliability(object_instance))
+				Analog_Output_Reliability_Set(object_instance,
+					RELIABILITY_NO_FAULT_DETECTED);
+		} else {
+#if PRINT_ENABLED
+			printf("idx %u ",(unsigned) object_instance);
+			printf("Out_Of_Service\n");
+#endif
+			Analog_Output_Out_Of_Service_Set(object_instance,1);
+			Analog_Output_Reliability_Set(object_instance,
+				RELIABILITY_COMMUNICATION_FAILURE);
+		}
+	}
+#endif
+/* update Analog Value */
+#if defined(AV)
+	else if (object_type == OBJECT_ANALOG_VALUE) {
+		float av_val, av_pval;
+		av_val = value;
+		av_pval = Analog_Value_Present_Value(object_instance);
+		if ( av_val != av_pval ) {
+			Analog_Value_Present_Value_Set(object_instance,av_val,16);
+		}
+		if (!out_of_service) {
+			if (Analog_Value_Out_Of_Service(object_instance))
+				Analog_Value_Out_Of_Service_Set(object_instance,0);
+			if (Analog_Value_Reliability(object_instance))
+				Analog_Value_Reliability_Set(object_instance,
+					RELIABILITY_NO_FAULT_DETECTED);
+		} else {
+#if PRINT_ENABLED
+			printf("idx %u ",(unsigned) object_instance);
+			printf("Out_Of_Service\n");
+#endif
+			Analog_Value_Out_Of_Service_Set(object_instance,1);
+			Analog_Value_Reliability_Set(object_instance,
+				RELIABILITY_COMMUNICATION_FAILURE);
+		}
+	}
+#endif
+/* update Binary Input */
+#if defined(BI)
+	else if (object_type == OBJECT_BINARY_INPUT) {
+		int bi_val, bi_pval;
+		bi_val = (int) value;
+		bi_pval = Binary_Input_Present_Value(object_instance);
+		if ( bi_val != bi_pval ) {
+			Binary_Input_Present_Value_Set(object_instance,bi_val,16);
+		}
+		if (!out_of_service) {
+			if (Binary_Input_Out_Of_Service(object_instance))
+				Binary_Input_Out_Of_Service_Set(object_instance,0);
+			if (Binary_Input_Reliability(object_instance))
+				Binary_Input_Reliability_Set(object_instance,
+					RELIABILITY_NO_FAULT_DETECTED);
+		} else {
+#if PRINT_ENABLED
+			printf("idx %u ",(unsigned) object_instance);
+			printf("Out_Of_Service\n");
+#endif
+			Binary_Input_Out_Of_Service_Set(object_instance,1);
+			Binary_Input_Reliability_Set(object_instance,
+				RELIABILITY_COMMUNICATION_FAILURE);
+		}
+	}
+#endif
+/* update Binary Output */
+#if defined(BO)
+	else if (object_type == OBJECT_BINARY_OUTPUT) {
+		int bo_val, bo_pval;
+		bo_val = (int) value;
+		bo_pval = Binary_Output_Present_Value(object_instance);
+		if ( bo_val != bo_pval ) {
+			Binary_Output_Present_Value_Set(object_instance,bo_val,16);
+		}
+		if (!out_of_service) {
+			if (Binary_Output_Out_Of_Service(object_instance))
+				Binary_Output_Out_Of_Service_Set(object_instance,0);
+			if (Binary_Output_Reliability(object_instance))
+				Binary_Output_Reliability_Set(object_instance,
+					RELIABILITY_NO_FAULT_DETECTED);
+		} else {
+#if PRINT_ENABLED
+			printf("idx %u ",(unsigned) object_instance);
+			printf("Out_Of_Service\n");
+#endif
+			Binary_Output_Out_Of_Service_Set(object_instance,1);
+			Binary_Output_Reliability_Set(object_instance,
+				RELIABILITY_COMMUNICATION_FAILURE);
+		}
+	}
+#endif
+/* update Binary Value */
+#if defined(BV)
+	else if (object_type == OBJECT_BINARY_VALUE) {
+		int bv_val, bv_pval;
+		bv_val = (int) value;
+		bv_pval = Binary_Value_Present_Value(object_instance);
+		if ( bv_val != bv_pval ) {
+			Binary_Value_Present_Value_Set(object_instance,bv_val,16);
+		}
+		if (!out_of_service) {
+			if (Binary_Value_Out_Of_Service(object_instance))
+				Binary_Value_Out_Of_Service_Set(object_instance,0);
+			if (Binary_Value_Reliability(object_instance))
+				Binary_Value_Reliability_Set(object_instance,
+					RELIABILITY_NO_FAULT_DETECTED);
+		} else {
+#if PRINT_ENABLED
+			printf("idx %u ",(unsigned) object_instance);
+			printf("Out_Of_Service\n");
+#endif
+			Binary_Value_Out_Of_Service_Set(object_instance,1);
+			Binary_Value_Reliability_Set(object_instance,
+				RELIABILITY_COMMUNICATION_FAILURE);
+		}
+	}
+#endif
+/* update Multistate Input */
+#if defined(MSI)
+	else if (object_type == OBJECT_MULTI_STATE_INPUT) {
+		int msi_val, msi_pval;
+		msi_val = (int) value;
+		msi_pval = Multistate_Input_Present_Value(object_instance);
+		if ( msi_val != msi_pval ) {
+			Multistate_Input_Present_Value_Set(object_instance,msi_val,16);
+		}
+		if (!out_of_service) {
+			if (Multistate_Input_Out_Of_Service(object_instance))
+				Multistate_Input_Out_Of_Service_Set(object_instance,0);
+			if (Multistate_Input_Reliability(object_instance))
+				Multistate_Input_Reliability_Set(object_instance,
+					RELIABILITY_NO_FAULT_DETECTED);
+		} else {
+#if PRINT_ENABLED
+			printf("idx %u ",(unsigned) object_instance);
+			printf("Out_Of_Service\n");
+#endif
+			Multistate_Input_Out_Of_Service_Set(object_instance,1);
+			Multistate_Input_Reliability_Set(object_instance,
+				RELIABILITY_COMMUNICATION_FAILURE);
+		}
+	}
+#endif
+/* update Multistate Output */
+#if defined(MSO)
+	else if (object_type == OBJECT_MULTI_STATE_OUTPUT) {
+		int mso_val, mso_pval;
+		mso_val = (int) value;
+		mso_pval = Multistate_Output_Present_Value(object_instance);
+		if ( mso_val != mso_pval ) {
+			Multistate_Output_Present_Value_Set(object_instance,mso_val,16);
+		}
+		if (!out_of_service) {
+			if (Multistate_Output_Out_Of_Service(object_instance))
+				Multistate_Output_Out_Of_Service_Set(object_instance,0);
+			if (Multistate_Output_Reliability(object_instance))
+				Multistate_Output_Reliability_Set(object_instance,
+					RELIABILITY_NO_FAULT_DETECTED);
+		} else {
+#if PRINT_ENABLED
+			printf("idx %u ",(unsigned) object_instance);
+			printf("Out_Of_Service\n");
+#endif
+			Multistate_Output_Out_Of_Service_Set(object_instance,1);
+			Multistate_Output_Reliability_Set(object_instance,
+				RELIABILITY_COMMUNICATION_FAILURE);
+		}
+	}
+#endif
+/* update Multistate Value */
+#if defined(MSV)
+	else if (object_type == OBJECT_MULTI_STATE_VALUE) {
+		int msv_val, msv_pval;
+		msv_val = (int) value;
+		msv_pval = Multistate_Value_Present_Value(object_instance);
+		if ( msv_val != msv_pval ) {
+			Multistate_Value_Present_Value_Set(object_instance,msv_val,16);
+		}
+		if (!out_of_service) {
+			if (Multistate_Value_Out_Of_Service(object_instance))
+				Multistate_Value_Out_Of_Service_Set(object_instance,0);
+			if (Multistate_Value_Reliability(object_instance))
+				Multistate_Value_Reliability_Set(object_instance,
+					RELIABILITY_NO_FAULT_DETECTED);
+		} else {
+#if PRINT_ENABLED
+			printf("idx %u ",(unsigned) object_instance);
+			printf("Out_Of_Service\n");
+#endif
+			Multistate_Value_Out_Of_Service_Set(object_instance,1);
+			Multistate_Value_Reliability_Set(object_instance,
+				RELIABILITY_COMMUNICATION_FAILURE);
+		}
+	}
+#endif
+}
+#endif
+#endif
+
+#if defined(BAC_SHM)
+#if defined(AI) || defined(AO) || defined(AV) || defined(BI) || defined(BO) || defined(BV) || defined(MSI) || defined(MSO) || defined(MSV)
+/* applies a point published to the shared-memory point table */
+static void shm_Update(
+	BACNET_OBJECT_TYPE object_type,
+	uint32_t object_instance,
+	SHM_POINT_VALUE *point)
+{
+	point_Update(object_type, object_instance, point->value,
+		(point->flags & SHM_POINT_OUT_OF_SERVICE) != 0);
+}
+#endif
+#endif
+
 #if defined(BAC_UCI)
 #if defined(AI) || defined(AO) || defined(AV) || defined(BI) || defined(BO) || defined(BV) || defined(MSI) || defined(MSO) || defined(MSV)
-static time_t uci_Update(
-	time_t ucimodtime,
+/* the values of the last load of each package, by object type */
+static struct uci_itr_ctx Uci_Values[OBJECT_MULTI_STATE_VALUE + 1];
+
+static void uci_Update(
 	BACNET_OBJECT_TYPE update_object_type,
 	int ucirewrite
 	)
 {
 	char *section;
 	char *type;
-	time_t chk_mtime = 0;
+	bool changed = false;
 	struct uci_context *ctx;
 	int uci_idx;
 	/* update Value from uci */
@@ -184,276 +456,58 @@ static time_t uci_Update(
 		type = "mv";
 #endif
 	} else {
-		return 0;
+		return;
 	}
+	/* a change is reported once the package was renamed into place,
+	   or, when the files are polled, once its file time is a second
+	   old (see ucix_watch_poll) */
+	changed = ucix_watch_changed(section);
 	if ( ucirewrite == 0) {
-		chk_mtime = ucimodtime;
+		changed = true;
 #if PRINT_ENABLED
 		printf("rewrite type: %s\n", type);
 #endif
-	} else {
-		chk_mtime = check_uci_update(section, ucimodtime);
 	}
-	if(chk_mtime != 0) {
-		sleep(1);
-		ucimodtime = chk_mtime;
+	if(changed) {
 #if PRINT_ENABLED
 		printf("Config changed, reloading %s\n",section);
 #endif
 		ctx = ucix_init(section);
-		struct uci_itr_ctx itr;
+		if (!ctx)
+			return;
+		struct uci_itr_ctx *itr = &Uci_Values[update_object_type];
 		value_tuple_t *cur;
-		itr.list = NULL;
-		itr.section = section;
-		itr.ctx = ctx;
+		int uci_changed;
+		itr->section = section;
+		itr->ctx = ctx;
+		load_value_begin(itr);
 		ucix_for_each_section_type(ctx, section, type,
-			(void *)load_value, &itr);
-		for( cur = itr.list; cur; cur = cur->next ) {
+			(void *)load_value, itr);
+		uci_changed = load_value_end(itr);
+#if PRINT_ENABLED
+		printf("%s: %i of %i points changed\n", section, uci_changed,
+			itr->count);
+#endif
+		if ((uci_changed == 0) && (ucirewrite != 0))
+			cur = NULL;	/* nothing to apply */
+		else
+			cur = itr->list;
+		for( ; cur; cur = cur->next ) {
+			/* apply only the sections that changed since the last load,
+			   or all of them on a rewrite */
+			if (!cur->changed && (ucirewrite != 0))
+				continue;
 			uci_idx = atoi(cur->idx);
 #if PRINT_ENABLED
 			printf("section %s idx %i \n", section, uci_idx);
 #endif
-			if (false) {
-			}
-/* update Analog Input from uci */
-#if defined(AI)
-			else if (update_object_type == OBJECT_ANALOG_INPUT) {
-				float ai_val, ai_pval;
-				ai_val = strtof(cur->value,NULL);
-				ai_pval = Analog_Input_Present_Value(uci_idx);
-				if ( ai_val != ai_pval ) {
-					Analog_Input_Present_Value_Set(uci_idx,ai_val,16);
-				}
-				if (cur->Out_Of_Service == 0) {
-					if (Analog_Input_Out_Of_Service(uci_idx))
-						Analog_Input_Out_Of_Service_Set(uci_idx,0);
-					if (Analog_Input_Reliability(uci_idx))
-						Analog_Input_Reliability_Set(uci_idx,
-							RELIABILITY_NO_FAULT_DETECTED);
-				} else {
-#if PRINT_ENABLED
-					printf("idx %s ",cur->idx);
-					printf("Out_Of_Service\n");
-#endif
-					Analog_Input_Out_Of_Service_Set(uci_idx,1);
-					Analog_Input_Reliability_Set(uci_idx,
-						RELIABILITY_COMMUNICATION_FAILURE);
-				}
-			}
-#endif
-/* update Analog Output from uci */
-#if defined(AO)
-			else if (update_object_type == OBJECT_ANALOG_OUTPUT) {
-				float ao_val, ao_pval;
-				ao_val = strtof(cur->value,NULL);
-				ao_pval = Analog_Output_Present_Value(uci_idx);
-				if ( ao_val != ao_pval ) {
-					Analog_Output_Present_Value_Set(uci_idx,ao_val,16);
-				}
-				if (cur->Out_Of_Service == 0) {
-					if (Analog_Output_Out_Of_Service(uci_idx))
-						Analog_Output_Out_Of_Service_Set(uci_idx,0);
-					if (Analog_Output_Reliability(uci_idx))
-						Analog_Output_Reliability_Set(uci_idx,
-							RELIABILITY_NO_FAULT_DETECTED);
-				} else {
-#if PRINT_ENABLED
-					printf("idx %s ",cur->idx);
-					printf("Out_Of_Service\n");
-#endif
-					Analog_Output_Out_Of_Service_Set(uci_idx,1);
-					Analog_Output_Reliability_Set(uci_idx,
-						RELIABILITY_COMMUNICATION_FAILURE);
-				}
-			}
-#endif
-/* update Analog Value from uci */
-#if defined(AV)
-			else if (update_object_type == OBJECT_ANALOG_VALUE) {
-				float av_val, av_pval;
-				av_val = strtof(cur->value,NULL);
-				av_pval = Analog_Value_Present_Value(uci_idx);
-				if ( av_val != av_pval ) {
-					Analog_Value_Present_Value_Set(uci_idx,av_val,16);
-				}
-				if (cur->Out_Of_Service == 0) {
-					if (Analog_Value_Out_Of_Service(uci_idx))
-						Analog_Value_Out_Of_Service_Set(uci_idx,0);
-					if (Analog_Value_Reliability(uci_idx))
-						Analog_Value_Reliability_Set(uci_idx,
-							RELIABILITY_NO_FAULT_DETECTED);
-				} else {
-#if PRINT_ENABLED
-					printf("idx %s ",cur->idx);
-					printf("Out_Of_Service\n");
-#endif
-					Analog_Value_Out_Of_Service_Set(uci_idx,1);
-					Analog_Value_Reliability_Set(uci_idx,
-						RELIABILITY_COMMUNICATION_FAILURE);
-				}
-			}
-#endif
-/* update Binary Input from uci */
-#if defined(BI)
-			else if (update_object_type == OBJECT_BINARY_INPUT) {
-				int bi_val, bi_pval;
-				bi_val = atoi(cur->value);
-				bi_pval = Binary_Input_Present_Value(uci_idx);
-				if ( bi_val != bi_pval ) {
-					Binary_Input_Present_Value_Set(uci_idx,bi_val,16);
-				}
-				if (cur->Out_Of_Service == 0) {
-					if (Binary_Input_Out_Of_Service(uci_idx))
-						Binary_Input_Out_Of_Service_Set(uci_idx,0);
-					if (Binary_Input_Reliability(uci_idx))
-						Binary_Input_Reliability_Set(uci_idx,
-							RELIABILITY_NO_FAULT_DETECTED);
-				} else {
-#if PRINT_ENABLED
-					printf("idx %s ",cur->idx);
-					printf("Out_Of_Service\n");
-#endif
-					Binary_Input_Out_Of_Service_Set(uci_idx,1);
-					Binary_Input_Reliability_Set(uci_idx,
-						RELIABILITY_COMMUNICATION_FAILURE);
-				}
-			}
-#endif
-/* update Binary Output from uci */
-#if defined(BO)
-			else if (update_object_type == OBJECT_BINARY_OUTPUT) {
-				int bo_val, bo_pval;
-				bo_val = atoi(cur->value);
-				bo_pval = Binary_Output_Present_Value(uci_idx);
-				if ( bo_val != bo_pval ) {
-					Binary_Output_Present_Value_Set(uci_idx,bo_val,16);
-				}
-				if (cur->Out_Of_Service == 0) {
-					if (Binary_Output_Out_Of_Service(uci_idx))
-						Binary_Output_Out_Of_Service_Set(uci_idx,0);
-					if (Binary_Output_Reliability(uci_idx))
-						Binary_Output_Reliability_Set(uci_idx,
-							RELIABILITY_NO_FAULT_DETECTED);
-				} else {
-#if PRINT_ENABLED
-					printf("idx %s ",cur->idx);
-					printf("Out_Of_Service\n");
-#endif
-					Binary_Output_Out_Of_Service_Set(uci_idx,1);
-					Binary_Output_Reliability_Set(uci_idx,
-						RELIABILITY_COMMUNICATION_FAILURE);
-				}
-			}
-#endif
-/* update Binary Value from uci */
-#if defined(BV)
-			else if (update_object_type == OBJECT_BINARY_VALUE) {
-				int bv_val, bv_pval;
-				bv_val = atoi(cur->value);
-				bv_pval = Binary_Value_Present_Value(uci_idx);
-				if ( bv_val != bv_pval ) {
-					Binary_Value_Present_Value_Set(uci_idx,bv_val,16);
-				}
-				if (cur->Out_Of_Service == 0) {
-					if (Binary_Value_Out_Of_Service(uci_idx))
-						Binary_Value_Out_Of_Service_Set(uci_idx,0);
-					if (Binary_Value_Reliability(uci_idx))
-						Binary_Value_Reliability_Set(uci_idx,
-							RELIABILITY_NO_FAULT_DETECTED);
-				} else {
-#if PRINT_ENABLED
-					printf("idx %s ",cur->idx);
-					printf("Out_Of_Service\n");
-#endif
-					Binary_Value_Out_Of_Service_Set(uci_idx,1);
-					Binary_Value_Reliability_Set(uci_idx,
-						RELIABILITY_COMMUNICATION_FAILURE);
-				}
-			}
-#endif
-/* update Multistate Input from uci */
-#if defined(MSI)
-			else if (update_object_type == OBJECT_MULTI_STATE_INPUT) {
-				int msi_val, msi_pval;
-				msi_val = atoi(cur->value);
-				msi_pval = Multistate_Input_Present_Value(uci_idx);
-				if ( msi_val != msi_pval ) {
-					Multistate_Input_Present_Value_Set(uci_idx,msi_val,16);
-				}
-				if (cur->Out_Of_Service == 0) {
-					if (Multistate_Input_Out_Of_Service(uci_idx))
-						Multistate_Input_Out_Of_Service_Set(uci_idx,0);
-					if (Multistate_Input_Reliability(uci_idx))
-						Multistate_Input_Reliability_Set(uci_idx,
-							RELIABILITY_NO_FAULT_DETECTED);
-				} else {
-#if PRINT_ENABLED
-					printf("idx %s ",cur->idx);
-					printf("Out_Of_Service\n");
-#endif
-					Multistate_Input_Out_Of_Service_Set(uci_idx,1);
-					Multistate_Input_Reliability_Set(uci_idx,
-						RELIABILITY_COMMUNICATION_FAILURE);
-				}
-			}
-#endif
-/* update Multistate Output from uci */
-#if defined(MSO)
-			else if (update_object_type == OBJECT_MULTI_STATE_OUTPUT) {
-				int mso_val, mso_pval;
-				mso_val = atoi(cur->value);
-				mso_pval = Multistate_Output_Present_Value(uci_idx);
-				if ( mso_val != mso_pval ) {
-					Multistate_Output_Present_Value_Set(uci_idx,mso_val,16);
-				}
-				if (cur->Out_Of_Service == 0) {
-					if (Multistate_Output_Out_Of_Service(uci_idx))
-						Multistate_Output_Out_Of_Service_Set(uci_idx,0);
-					if (Multistate_Output_Reliability(uci_idx))
-						Multistate_Output_Reliability_Set(uci_idx,
-							RELIABILITY_NO_FAULT_DETECTED);
-				} else {
-#if PRINT_ENABLED
-					printf("idx %s ",cur->idx);
-					printf("Out_Of_Service\n");
-#endif
-					Multistate_Output_Out_Of_Service_Set(uci_idx,1);
-					Multistate_Output_Reliability_Set(uci_idx,
-						RELIABILITY_COMMUNICATION_FAILURE);
-				}
-			}
-#endif
-/* update Multistate Value from uci */
-#if defined(MSV)
-			else if (update_object_type == OBJECT_MULTI_STATE_VALUE) {
-				int msv_val, msv_pval;
-				msv_val = atoi(cur->value);
-				msv_pval = Multistate_Value_Present_Value(uci_idx);
-				if ( msv_val != msv_pval ) {
-					Multistate_Value_Present_Value_Set(uci_idx,msv_val,16);
-				}
-				if (cur->Out_Of_Service == 0) {
-					if (Multistate_Value_Out_Of_Service(uci_idx))
-						Multistate_Value_Out_Of_Service_Set(uci_idx,0);
-					if (Multistate_Value_Reliability(uci_idx))
-						Multistate_Value_Reliability_Set(uci_idx,
-							RELIABILITY_NO_FAULT_DETECTED);
-				} else {
-#if PRINT_ENABLED
-					printf("idx %s ",cur->idx);
-					printf("Out_Of_Service\n");
-#endif
-					Multistate_Value_Out_Of_Service_Set(uci_idx,1);
-					Multistate_Value_Reliability_Set(uci_idx,
-						RELIABILITY_COMMUNICATION_FAILURE);
-				}
-			}
-#endif
+			point_Update(update_object_type, uci_idx,
+				strtof(cur->value,NULL), cur->Out_Of_Service != 0);
 		}
 		ucix_cleanup(ctx);
+		itr->ctx = NULL;
 	}
 	/* update end */
-	return ucimodtime;
 }
 #endif
 #endif
@@ -515,6 +569,23 @@ static void Init_Service_Handlers(
         handler_cov_subscribe);
     apdu_set_unconfirmed_handler(SERVICE_UNCONFIRMED_COV_NOTIFICATION,
         handler_ucov_notification);
+#if defined(TRENDLOG)
+    /* remote sources of COV trend logs, and the replies to their
+       subscriptions */
+    apdu_set_confirmed_handler(SERVICE_CONFIRMED_COV_NOTIFICATION,
+        handler_ccov_notification);
+    apdu_set_confirmed_simple_ack_handler(SERVICE_CONFIRMED_SUBSCRIBE_COV,
+        trend_log_cov_subscribe_ack);
+    apdu_set_confirmed_simple_ack_handler
+        (SERVICE_CONFIRMED_SUBSCRIBE_COV_PROPERTY,
+        trend_log_cov_subscribe_ack);
+    apdu_set_error_handler(SERVICE_CONFIRMED_SUBSCRIBE_COV,
+        trend_log_cov_subscribe_error);
+    apdu_set_error_handler(SERVICE_CONFIRMED_SUBSCRIBE_COV_PROPERTY,
+        trend_log_cov_subscribe_error);
+    apdu_set_abort_handler(trend_log_cov_subscribe_abort);
+    apdu_set_reject_handler(trend_log_cov_subscribe_reject);
+#endif
     /* handle communication so we can shutup when asked */
     apdu_set_confirmed_handler(SERVICE_CONFIRMED_DEVICE_COMMUNICATION_CONTROL,
         handler_device_communication_control);
@@ -561,7 +632,7 @@ static void print_help(const char *filename)
  *      datalink_receive, npdu_handler,
  *      dcc_timer_seconds, bvlc_maintenance_timer,
  *      Load_Control_State_Machine_Handler, handler_cov_task,
- *      tsm_timer_milliseconds
+ *      tsm_timer_milliseconds, Send_WhoIs_Discover_Timer
  *
  * @param argc [in] Arg count.
  * @param argv [in] Takes one argument: the Device Instance #.
@@ -591,33 +662,6 @@ int main(
     int uciId = 0;
     const char *uciName;
     struct uci_context *ctx;
-#if defined(AI)
-    time_t ucimodtime_bacnet_ai = 0;
-#endif
-#if defined(AO)
-    time_t ucimodtime_bacnet_ao = 0;
-#endif
-#if defined(AV)
-    time_t ucimodtime_bacnet_av = 0;
-#endif
-#if defined(BI)
-    time_t ucimodtime_bacnet_bi = 0;
-#endif
-#if defined(BO)
-    time_t ucimodtime_bacnet_bo = 0;
-#endif
-#if defined(BV)
-    time_t ucimodtime_bacnet_bv = 0;
-#endif
-#if defined(MSI)
-    time_t ucimodtime_bacnet_mi = 0;
-#endif
-#if defined(MSO)
-    time_t ucimodtime_bacnet_mo = 0;
-#endif
-#if defined(MSV)
-    time_t ucimodtime_bacnet_mv = 0;
-#endif
     int rewrite = 0;
 #endif
     int argi = 0;
@@ -679,68 +723,34 @@ int main(
 #if defined(BAC_UCI)
     }
 
+    /* watch before the objects load their packages in
+       Init_Service_Handlers, so that no change can slip in between */
 #if defined(AI)
-    char ai_path[128];
-    struct stat ai_s;
-	snprintf(ai_path, sizeof(ai_path), "/etc/config/bacnet_ai");
-	if( stat(ai_path, &ai_s) > -1 )
-		ucimodtime_bacnet_ai = ai_s.st_mtime;
+    ucix_watch_add("bacnet_ai");
 #endif
 #if defined(AO)
-    char ao_path[128];
-    struct stat ao_s;
-	snprintf(ao_path, sizeof(ao_path), "/etc/config/bacnet_ao");
-	if( stat(ao_path, &ao_s) > -1 )
-		ucimodtime_bacnet_ao = ao_s.st_mtime;
+    ucix_watch_add("bacnet_ao");
 #endif
 #if defined(AV)
-    char av_path[128];
-    struct stat av_s;
-	snprintf(av_path, sizeof(av_path), "/etc/config/bacnet_av");
-	if( stat(av_path, &av_s) > -1 )
-		ucimodtime_bacnet_av = av_s.st_mtime;
+    ucix_watch_add("bacnet_av");
 #endif
 #if defined(BI)
-    char bi_path[128];
-    struct stat bi_s;
-	snprintf(bi_path, sizeof(bi_path), "/etc/config/bacnet_bi");
-	if( stat(bi_path, &bi_s) > -1 )
-		ucimodtime_bacnet_bi = bi_s.st_mtime;
+    ucix_watch_add("bacnet_bi");
 #endif
 #if defined(BO)
-    char bo_path[128];
-    struct stat bo_s;
-	snprintf(bo_path, sizeof(bo_path), "/etc/config/bacnet_bo");
-	if( stat(bo_path, &bo_s) > -1 )
-		ucimodtime_bacnet_bo = bo_s.st_mtime;
+    ucix_watch_add("bacnet_bo");
 #endif
 #if defined(BV)
-    char bv_path[128];
-    struct stat bv_s;
-	snprintf(bv_path, sizeof(bv_path), "/etc/config/bacnet_bv");
-	if( stat(bv_path, &bv_s) > -1 )
-		ucimodtime_bacnet_bv = bv_s.st_mtime;
+    ucix_watch_add("bacnet_bv");
 #endif
 #if defined(MSI)
-    char msi_path[128];
-    struct stat msi_s;
-	snprintf(msi_path, sizeof(msi_path), "/etc/config/bacnet_mi");
-	if( stat(msi_path, &msi_s) > -1 )
-		ucimodtime_bacnet_mi = msi_s.st_mtime;
+    ucix_watch_add("bacnet_mi");
 #endif
 #if defined(MSO)
-    char mso_path[128];
-    struct stat mso_s;
-	snprintf(mso_path, sizeof(mso_path), "/etc/config/bacnet_mo");
-	if( stat(mso_path, &mso_s) > -1 )
-		ucimodtime_bacnet_mo = mso_s.st_mtime;
+    ucix_watch_add("bacnet_mo");
 #endif
 #if defined(MSV)
-    char msv_path[128];
-    struct stat msv_s;
-	snprintf(msv_path, sizeof(msv_path), "/etc/config/bacnet_mv");
-	if( stat(msv_path, &msv_s) > -1 )
-		ucimodtime_bacnet_mv = msv_s.st_mtime;
+    ucix_watch_add("bacnet_mv");
 #endif
 #endif /* defined(BAC_UCI) */
 
@@ -755,6 +765,18 @@ int main(
     Init_Service_Handlers();
     dlenv_init();
     atexit(datalink_cleanup);
+#if defined(BAC_SHM)
+    /* UCI stays the configuration, the I/O process publishes the values */
+    if (!shm_point_open(getenv("BACNET_SHM_NAME"), true)) {
+#if PRINT_ENABLED
+        fprintf(stderr, "Failed to open the shared-memory point table\n");
+#endif
+    }
+    atexit(shm_point_close);
+#endif
+#if defined(BAC_UCI)
+    atexit(ucix_journal_flush);
+#endif
     /* configure the timeout values */
     last_seconds = time(NULL);
     /* broadcast an I-Am on startup */
@@ -786,6 +808,7 @@ int main(
             elapsed_milliseconds = elapsed_seconds * 1000;
             handler_cov_timer_seconds(elapsed_seconds);
             tsm_timer_milliseconds(elapsed_milliseconds);
+            Send_WhoIs_Discover_Timer(elapsed_milliseconds);
 #if defined(TRENDLOG)
             trend_log_timer(elapsed_seconds);
 #endif
@@ -798,6 +821,9 @@ int main(
 #endif
         }
         handler_cov_task();
+#if defined(TRENDLOG)
+        trend_log_task();
+#endif
         /* scan cache address */
         address_binding_tmr += elapsed_seconds;
         if (address_binding_tmr >= 60) {
@@ -821,43 +847,89 @@ int main(
 #endif
             rewrite=0;
         }
+        /* one non-blocking check of all the packages */
+        if ((ucix_watch_poll() > 0) || (rewrite == 0)) {
 #if defined(AI)
-        /* update Analog Input from uci */
-        ucimodtime_bacnet_ai = uci_Update(ucimodtime_bacnet_ai,OBJECT_ANALOG_INPUT,rewrite);
+            /* update Analog Input from uci */
+            uci_Update(OBJECT_ANALOG_INPUT,rewrite);
 #endif
 #if defined(AO)
-        /* update Analog Output from uci */
-        ucimodtime_bacnet_ao = uci_Update(ucimodtime_bacnet_ao,OBJECT_ANALOG_OUTPUT,rewrite);
+            /* update Analog Output from uci */
+            uci_Update(OBJECT_ANALOG_OUTPUT,rewrite);
 #endif
 #if defined(AV)
-        /* update Analog Value from uci */
-        ucimodtime_bacnet_av = uci_Update(ucimodtime_bacnet_av,OBJECT_ANALOG_VALUE,rewrite);
+            /* update Analog Value from uci */
+            uci_Update(OBJECT_ANALOG_VALUE,rewrite);
 #endif
 #if defined(BI)
-        /* update Binary Input from uci */
-        ucimodtime_bacnet_bi = uci_Update(ucimodtime_bacnet_bi,OBJECT_BINARY_INPUT,rewrite);
+            /* update Binary Input from uci */
+            uci_Update(OBJECT_BINARY_INPUT,rewrite);
 #endif
 #if defined(BO)
-        /* update Binary Output from uci */
-        ucimodtime_bacnet_bo = uci_Update(ucimodtime_bacnet_bo,OBJECT_BINARY_OUTPUT,rewrite);
+            /* update Binary Output from uci */
+            uci_Update(OBJECT_BINARY_OUTPUT,rewrite);
 #endif
 #if defined(BV)
-        /* update Binary Value from uci */
-        ucimodtime_bacnet_bv = uci_Update(ucimodtime_bacnet_bv,OBJECT_BINARY_VALUE,rewrite);
+            /* update Binary Value from uci */
+            uci_Update(OBJECT_BINARY_VALUE,rewrite);
 #endif
 #if defined(MSI)
-        /* update Multistate Input from uci */
-        ucimodtime_bacnet_mi = uci_Update(ucimodtime_bacnet_mi,OBJECT_MULTI_STATE_INPUT,rewrite);
+            /* update Multistate Input from uci */
+            uci_Update(OBJECT_MULTI_STATE_INPUT,rewrite);
 #endif
 #if defined(MSO)
-        /* update Multistate Output from uci */
-        ucimodtime_bacnet_mo = uci_Update(ucimodtime_bacnet_mo,OBJECT_MULTI_STATE_OUTPUT,rewrite);
+            /* update Multistate Output from uci */
+            uci_Update(OBJECT_MULTI_STATE_OUTPUT,rewrite);
 #endif
 #if defined(MSV)
-        /* update Multistate Value from uci */
-        ucimodtime_bacnet_mv = uci_Update(ucimodtime_bacnet_mv,OBJECT_MULTI_STATE_VALUE,rewrite);
+            /* update Multistate Value from uci */
+            uci_Update(OBJECT_MULTI_STATE_VALUE,rewrite);
+#endif
+        }
+        /* write back the values of the requests answered so far */
+        if (ucix_journal_task()) {
+#if PRINT_ENABLED
+            struct ucix_journal_stats journal;
+
+            ucix_journal_get_stats(&journal);
+            printf("uci journal: %lu written, max depth %u, "
+                "latency %lu ms (max %lu), flush %lu ms (max %lu)\n",
+                journal.written, journal.max_depth,
+                journal.last_latency_ms, journal.max_latency_ms,
+                journal.last_flush_ms, journal.max_flush_ms);
 #endif
+        }
 #endif /* defined(BAC_UCI) */
+#if defined(BAC_SHM)
+        /* a single load per type when nothing was published */
+#if defined(AI)
+        shm_point_poll(OBJECT_ANALOG_INPUT, shm_Update);
+#endif
+#if defined(AO)
+        shm_point_poll(OBJECT_ANALOG_OUTPUT, shm_Update);
+#endif
+#if defined(AV)
+        shm_point_poll(OBJECT_ANALOG_VALUE, shm_Update);
+#endif
+#if defined(BI)
+        shm_point_poll(OBJECT_BINARY_INPUT, shm_Update);
+#endif
+#if defined(BO)
+        shm_point_poll(OBJECT_BINARY_OUTPUT, shm_Update);
+#endif
+#if defined(BV)
+        shm_point_poll(OBJECT_BINARY_VALUE, shm_Update);
+#endif
+#if defined(MSI)
+        shm_point_poll(OBJECT_MULTI_STATE_INPUT, shm_Update);
+#endif
+#if defined(MSO)
+        shm_point_poll(OBJECT_MULTI_STATE_OUTPUT, shm_Update);
+#endif
+#if defined(MSV)
+        shm_point_poll(OBJECT_MULTI_STATE_VALUE, shm_Update);
+#endif
+#endif /* defined(BAC_SHM) */
 
         /* blink LEDs, Turn on or off outputs, etc */
     }
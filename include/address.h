@@ -73,6 +73,9 @@ extern "C" {
     unsigned address_count(
         void);
 
+    unsigned address_cache_size(
+        void);
+
     bool address_match(
         BACNET_ADDRESS * dest,
         BACNET_ADDRESS * src);
@@ -109,6 +112,12 @@ extern "C" {
     void address_cache_timer(
         uint16_t uSeconds);
 
+    bool address_snapshot_save(
+        const char *pFilename);
+
+    bool address_snapshot_load(
+        const char *pFilename);
+
     void address_mac_init(
         BACNET_MAC_ADDRESS *mac,
         uint8_t *adr,
@@ -183,6 +183,10 @@ extern "C" {
         void);
     void apdu_retries_set(
         uint8_t value);
+    uint16_t apdu_segment_timeout(
+        void);
+    void apdu_segment_timeout_set(
+        uint16_t milliseconds);
 
     void apdu_handler(
         BACNET_ADDRESS * src,   /* source address */
@@ -73,6 +73,13 @@ extern "C" {
         uint8_t * pdu,  /* any data to be sent - may be null */
         unsigned pdu_len);      /* number of bytes of data */
 
+    /* receives the next datagram from the BACnet/IP socket */
+    int bip_receive_mpdu(
+        struct sockaddr_in *sin,
+        uint8_t * mtu,
+        uint16_t max_mtu,
+        unsigned timeout);
+
     /* receives a BACnet/IP packet */
     /* returns the number of octets in the PDU, or zero on failure */
     uint16_t bip_receive(
@@ -41,6 +41,16 @@
 #include "alarm_ack.h"
 #include "ptransfer.h"
 
+/* counters of the Who-Is discovery scheduler */
+typedef struct whois_discover_stats {
+    uint32_t requested; /* calls to Send_WhoIs_Discover */
+    uint32_t deduplicated;      /* already bound, pending or held off */
+    uint32_t dropped;   /* the queue was full */
+    uint32_t broadcasts;        /* Who-Is requests sent */
+    uint32_t ranges_merged;     /* device ids sent in another id's Who-Is */
+    uint32_t outstanding;       /* device ids pending or held off */
+} WHOIS_DISCOVER_STATS;
+
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
@@ -89,6 +99,13 @@ extern "C" {
         int32_t low_limit,
         int32_t high_limit);
 
+    bool Send_WhoIs_Discover(
+        uint32_t device_id);
+    void Send_WhoIs_Discover_Timer(
+        uint32_t milliseconds);
+    void Send_WhoIs_Discover_Stats(
+        WHOIS_DISCOVER_STATS * stats);
+
     void Send_WhoHas_Object(
         int32_t low_limit,
         int32_t high_limit,
@@ -119,6 +136,9 @@ extern "C" {
     uint8_t Send_COV_Subscribe(
         uint32_t device_id,
         BACNET_SUBSCRIBE_COV_DATA * cov_data);
+    uint8_t Send_COV_Subscribe_Property(
+        uint32_t device_id,
+        BACNET_SUBSCRIBE_COV_DATA * cov_data);
 
 /* returns the invoke ID for confirmed request, or 0 if failed */
     uint8_t Send_GetEvent(
@@ -134,6 +154,14 @@ extern "C" {
         uint32_t object_instance,
         BACNET_PROPERTY_ID object_property,
         uint32_t array_index);
+/* with an invoke ID of the peer's space, see tsm_next_free_invokeID_peer() */
+    uint8_t Send_Read_Property_Request_Peer(
+        BACNET_ADDRESS * dest,
+        uint16_t max_apdu,
+        BACNET_OBJECT_TYPE object_type,
+        uint32_t object_instance,
+        BACNET_PROPERTY_ID object_property,
+        uint32_t array_index);
     uint8_t Send_Read_Property_Request(
         uint32_t device_id,     /* destination device */
         BACNET_OBJECT_TYPE object_type,
@@ -155,6 +183,16 @@ extern "C" {
         BACNET_APPLICATION_DATA_VALUE * object_value,
         uint8_t priority,
         uint32_t array_index);
+/* with an invoke ID of the peer's space, see tsm_next_free_invokeID_peer() */
+    uint8_t Send_Write_Property_Request_Peer(
+        BACNET_ADDRESS * dest,
+        uint16_t max_apdu,
+        BACNET_OBJECT_TYPE object_type,
+        uint32_t object_instance,
+        BACNET_PROPERTY_ID object_property,
+        BACNET_APPLICATION_DATA_VALUE * object_value,
+        uint8_t priority,
+        uint32_t array_index);
     uint8_t Send_Write_Property_Request_Data(
         uint32_t device_id,
         BACNET_OBJECT_TYPE object_type,
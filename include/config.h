@@ -112,10 +112,33 @@
 /* that we hold in a queue waiting for timeout. */
 /* Configure to zero if you don't want any confirmed messages */
 /* Configure from 1..255 for number of outstanding confirmed */
-/* requests available. */
+/* requests available, or more with invoke IDs per peer, */
+/* see tsm_next_free_invokeID_peer() and TSM_PEER_INVOKE_ID_FIRST. */
 #if !defined(MAX_TSM_TRANSACTIONS)
 #define MAX_TSM_TRANSACTIONS 255
 #endif
+/* Segmentation of confirmed requests and complex acks is done by the TSM. */
+/* This is the number of segments of a message that we accept, */
+/* which sizes the buffer of each segmented transaction. */
+/* Segmentation is off by default, as its buffers take about 70KB */
+/* of RAM with 16 segments; the hosted demos build it in. */
+#if !defined(MAX_SEGMENTS_ACCEPTED)
+#define MAX_SEGMENTS_ACCEPTED 0
+#endif
+#if !MAX_TSM_TRANSACTIONS
+#undef MAX_SEGMENTS_ACCEPTED
+#define MAX_SEGMENTS_ACCEPTED 0
+#endif
+/* largest APDU that we assemble or send in segments */
+#if MAX_SEGMENTS_ACCEPTED
+#define MAX_APDU_SEGMENTED (MAX_APDU * MAX_SEGMENTS_ACCEPTED)
+#else
+#define MAX_APDU_SEGMENTED MAX_APDU
+#endif
+/* number of segmented messages sent or received at the same time */
+#if !defined(MAX_TSM_SEGMENTED_TRANSACTIONS)
+#define MAX_TSM_SEGMENTED_TRANSACTIONS 2
+#endif
 /* The address cache is used for binding to BACnet devices */
 /* The number of entries corresponds to the number of */
 /* devices that might respond to an I-Am on the network. */
@@ -130,6 +153,17 @@
 #define PRINT_ENABLED 0
 #endif
 
+/* The address cache grows as more devices are bound, a block at a time, */
+/* up to this many entries (at most 65535).  This needs malloc, so by */
+/* default the cache has a fixed size of MAX_ADDRESS_CACHE entries. */
+#if !defined(MAX_ADDRESS_CACHE_GROWN)
+#define MAX_ADDRESS_CACHE_GROWN MAX_ADDRESS_CACHE
+#endif
+
+/* Define BACNET_ADDRESS_CACHE_FILE to load static bindings from the */
+/* address_cache file, and the bindings of the last run, when the */
+/* address cache is initialized.  This needs a file system. */
+
 /* BACAPP decodes WriteProperty service requests
    Choose the datatypes that your application supports */
 #if !(defined(BACAPP_ALL) || \
@@ -52,6 +52,18 @@ typedef struct BACnet_Subscribe_COV_Data {
     struct BACnet_Subscribe_COV_Data *next;
 } BACNET_SUBSCRIBE_COV_DATA;
 
+/* given each COV notification received, confirmed or unconfirmed */
+typedef void (
+    *cov_notification_function) (
+    BACNET_ADDRESS * src,
+    BACNET_COV_DATA * cov_data);
+
+/* given each local object that reports a change of value */
+typedef void (
+    *cov_object_changed_function) (
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance);
+
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
@@ -41,6 +41,7 @@
 #include "getevent.h"
 #include "get_alarm_sum.h"
 #include "alarm_ack.h"
+#include "cov.h"
 
 
 #ifdef __cplusplus
@@ -262,6 +263,11 @@ extern "C" {
         void);
     void handler_cov_timer_seconds(
         uint32_t elapsed_seconds);
+    void handler_cov_object_changed(
+        BACNET_OBJECT_TYPE object_type,
+        uint32_t object_instance);
+    void handler_cov_object_changed_set_callback(
+        cov_object_changed_function callback);
     void handler_cov_init(
         void);
     int handler_cov_encode_subscriptions(
@@ -272,6 +278,11 @@ extern "C" {
         uint8_t * service_request,
         uint16_t service_len,
         BACNET_ADDRESS * src);
+    void handler_cov_notification_set_callback(
+        cov_notification_function callback);
+    void handler_cov_notification_callback(
+        BACNET_ADDRESS * src,
+        BACNET_COV_DATA * cov_data);
     void handler_ccov_notification(
         uint8_t * service_request,
         uint16_t service_len,
@@ -336,6 +347,15 @@ extern "C" {
         BACNET_ADDRESS * src,
         BACNET_CONFIRMED_SERVICE_DATA * service_data);
 
+    void handler_event_summary_reset(
+        BACNET_OBJECT_TYPE object_type);
+    void handler_event_summary_update(
+        BACNET_OBJECT_TYPE object_type,
+        unsigned index);
+    int handler_event_summary_list(
+        BACNET_OBJECT_TYPE object_type,
+        const unsigned **index);
+
     void handler_get_alarm_summary_set(
         BACNET_OBJECT_TYPE object_type,
         get_alarm_summary_function pFunction);
@@ -154,6 +154,11 @@ extern "C" {
     uint8_t Send_ReadRange_Request(
         uint32_t device_id,     /* destination device */
         BACNET_READ_RANGE_DATA * read_access_data);
+/* with an invoke ID of the peer's space, see tsm_next_free_invokeID_peer() */
+    uint8_t Send_ReadRange_Request_Peer(
+        BACNET_ADDRESS * dest,
+        uint16_t max_apdu,
+        BACNET_READ_RANGE_DATA * read_access_data);
 
 #ifdef __cplusplus
 }
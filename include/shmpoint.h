@@ -0,0 +1,129 @@
+/**************************************************************************
+*
+* Copyright (C) 2016 Steve Karg <skarg@users.sourceforge.net>
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*********************************************************************/
+#ifndef SHMPOINT_H
+#define SHMPOINT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "bacenum.h"
+
+/* Shared-memory point table.
+   An I/O process publishes the present values of the input, output
+   and value objects into a POSIX shared-memory object, and the server
+   picks up the changed points without any file I/O or parsing.
+   The layout is fixed: a header with one table descriptor per object
+   type, followed by SHM_POINT_TABLE_SIZE point slots for each type.
+   The instances come from sparse uci section numbers, so a slot is
+   found by hashing the instance, and the first side to use an instance
+   claims a free slot for it.  Each point is guarded by a sequence lock,
+   so there must be a single writer per point. */
+
+#ifndef SHM_POINT_NAME
+#define SHM_POINT_NAME "/bacnet_points"
+#endif
+/* point slots per object type, a power of two: twice the 1024 objects
+   of a type that the demo objects hold, to keep the probes short */
+#ifndef SHM_POINT_TABLE_SIZE
+#define SHM_POINT_TABLE_SIZE 2048
+#endif
+#if (SHM_POINT_TABLE_SIZE & (SHM_POINT_TABLE_SIZE - 1)) != 0
+#error SHM_POINT_TABLE_SIZE must be a power of two
+#endif
+#define SHM_POINT_MAGIC 0x42504e54UL   /* "BPNT" */
+#define SHM_POINT_VERSION 2
+#define SHM_POINT_TABLES 9
+
+/* point flags, the first four in BACnet Status_Flags order */
+#define SHM_POINT_IN_ALARM       0x0001
+#define SHM_POINT_FAULT          0x0002
+#define SHM_POINT_OVERRIDDEN     0x0004
+#define SHM_POINT_OUT_OF_SERVICE 0x0008
+#define SHM_POINT_VALID          0x8000 /* written at least once */
+
+/* one point, 24 bytes */
+typedef struct shm_point {
+    volatile uint32_t sequence; /* odd while the writer is updating */
+    uint32_t flags;
+    float value;        /* REAL, or the BINARY_PV / state number */
+    volatile uint32_t key;      /* object instance + 1, 0 while free */
+    uint32_t seconds;   /* CLOCK_REALTIME of the update */
+    uint32_t nanoseconds;
+} SHM_POINT;
+
+typedef struct shm_point_table {
+    uint32_t object_type;
+    uint32_t count;     /* points */
+    uint32_t offset;    /* of the first point from the start of the header */
+    volatile uint32_t generation;       /* incremented after each update */
+} SHM_POINT_TABLE;
+
+typedef struct shm_point_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t tables;
+    uint32_t size;      /* of the whole mapping */
+    uint32_t point_size;
+    SHM_POINT_TABLE table[SHM_POINT_TABLES];
+} SHM_POINT_HEADER;
+
+/* a consistent copy of a point */
+typedef struct shm_point_value {
+    float value;
+    uint32_t flags;
+    uint32_t seconds;
+    uint32_t nanoseconds;
+} SHM_POINT_VALUE;
+
+typedef void (
+    *shm_point_function) (
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance,
+    SHM_POINT_VALUE * point);
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+    bool shm_point_open(
+        const char *name,
+        bool create);
+    void shm_point_close(
+        void);
+    bool shm_point_write(
+        BACNET_OBJECT_TYPE object_type,
+        uint32_t object_instance,
+        float value,
+        uint32_t flags);
+    bool shm_point_read(
+        BACNET_OBJECT_TYPE object_type,
+        uint32_t object_instance,
+        SHM_POINT_VALUE * point);
+    int shm_point_poll(
+        BACNET_OBJECT_TYPE object_type,
+        shm_point_function callback);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif
@@ -0,0 +1,148 @@
+/**************************************************************************
+*
+* Copyright (C) 2016 Steve Karg <skarg@users.sourceforge.net>
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*********************************************************************/
+#ifndef TLSTORE_H
+#define TLSTORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Trend log storage.
+   Each trend log keeps its records in a ring of fixed-size records in
+   a file of its own, mapped with mmap, so a log can hold millions of
+   records without using resident memory and survives a restart.
+   The ring has one slot more than its capacity: the next record is
+   always written into the spare slot before the ring position is
+   committed, so the valid records are never overwritten in place.
+   The ring position is kept in two metadata slots that are written
+   alternately; each carries a sequence number, written last, and a
+   check of its fields, and the newest slot with a good check wins on
+   open.
+   Without a directory, or if the file cannot be made, the ring is
+   mapped from anonymous memory and lasts only as long as the process.
+   A crash of the process loses no record, as the kernel keeps the
+   mapped pages.  Against a power loss, each record is scheduled for
+   writing (MS_ASYNC) before the metadata that refers to it, and every
+   TL_STORE_SYNC_RECORDS records the new records and then the metadata
+   are written out (MS_SYNC).  The kernel may still write the metadata
+   page first, so after a power loss up to that many of the newest
+   records may hold older values.
+   The records are normally in time order, and a time is found with a
+   binary search.  When the clock is stepped back, e.g. by NTP, a
+   record is stamped earlier than the one before it; the metadata keeps
+   the number of the newest such record, and until the record before
+   it has been pushed out of the ring a time is found by a linear scan
+   instead.  The trend log marks the step with a time-change record. */
+
+#ifndef TL_STORE_PATH
+#define TL_STORE_PATH "/var/lib/bacnet"
+#endif
+/* records in a log, so a file is at most 256MB */
+#ifndef TL_STORE_CAPACITY_MAX
+#define TL_STORE_CAPACITY_MAX 16777216UL
+#endif
+/* records between the writes of the ring to the disk */
+#ifndef TL_STORE_SYNC_RECORDS
+#define TL_STORE_SYNC_RECORDS 64
+#endif
+#define TL_STORE_MAGIC 0x544c4f47UL     /* "TLOG" */
+#define TL_STORE_VERSION 2
+
+/* one record, 16 bytes */
+typedef struct tl_store_record {
+    uint32_t timestamp; /* seconds since the epoch */
+    uint8_t type;       /* TL_TYPE_ */
+    uint8_t status;     /* b0-b2 status flags, b7 set if used */
+    uint16_t reserved;
+    uint8_t datum[8];   /* the value, as stored by the trend log */
+} TL_STORE_RECORD;
+
+/* ring position */
+typedef struct tl_store_meta {
+    volatile uint32_t sequence; /* the highest valid one is current */
+    uint32_t head;      /* the spare slot, where the next record goes */
+    uint32_t count;     /* records in the ring */
+    uint32_t total;     /* records ever written */
+    uint32_t step;      /* total at the newest record older than the */
+                        /* one before it, 0 if none */
+    uint32_t check;     /* FNV-1a of the five fields above */
+} TL_STORE_META;
+
+typedef struct tl_store_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t capacity;  /* records, the ring has one slot more */
+    uint32_t offset;    /* of the first slot from the start of the file */
+    TL_STORE_META meta[2];
+} TL_STORE_HEADER;
+
+typedef struct tl_store {
+    TL_STORE_HEADER *header;
+    TL_STORE_RECORD *records;
+    size_t size;        /* of the mapping */
+    bool persistent;    /* false for an anonymous mapping */
+    uint32_t capacity;
+    /* copy of the current metadata slot */
+    uint32_t sequence;
+    uint32_t head;
+    uint32_t count;
+    uint32_t total;
+    uint32_t step;
+    /* records appended since the ring was last written to the disk */
+    uint32_t unsynced;
+} TL_STORE;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+    bool tl_store_open(
+        TL_STORE * store,
+        const char *directory,
+        uint32_t instance,
+        uint32_t capacity);
+    void tl_store_close(
+        TL_STORE * store);
+    bool tl_store_append(
+        TL_STORE * store,
+        const TL_STORE_RECORD * record);
+    void tl_store_clear(
+        TL_STORE * store);
+    TL_STORE_RECORD *tl_store_record(
+        TL_STORE * store,
+        uint32_t position);
+    TL_STORE_RECORD *tl_store_next(
+        TL_STORE * store,
+        TL_STORE_RECORD * record);
+    bool tl_store_ordered(
+        TL_STORE * store);
+    uint32_t tl_store_find(
+        TL_STORE * store,
+        uint32_t timestamp);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif
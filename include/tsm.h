@@ -29,18 +29,38 @@
 #include <stddef.h>
 #include "bacdef.h"
 #include "npdu.h"
+#include "apdu.h"
 
 /* note: TSM functionality is optional - only needed if we are
    doing client requests */
 #if (!MAX_TSM_TRANSACTIONS)
 #define tsm_free_invoke_id(x) (void)x;
+#define tsm_free_invoke_id_peer(s,x) (void)x;
 #else
+/* default number of outstanding requests to one peer, for the */
+/* invoke IDs from tsm_next_free_invokeID_peer() */
+#ifndef TSM_PEER_WINDOW
+#define TSM_PEER_WINDOW 16
+#endif
+/* the invoke IDs of the peer spaces are this one and up.  With 1, */
+/* tsm_next_free_invokeID() also uses all of 1 to 255, and each skips */
+/* the IDs the other has in use.  Above 1 it only uses the ones below, */
+/* so that neither space can use up the other. */
+#ifndef TSM_PEER_INVOKE_ID_FIRST
+#define TSM_PEER_INVOKE_ID_FIRST 1
+#endif
+#if (TSM_PEER_INVOKE_ID_FIRST < 1) || (TSM_PEER_INVOKE_ID_FIRST > 255)
+#error TSM_PEER_INVOKE_ID_FIRST must be from 1 to 255
+#endif
+
+
 typedef enum {
     TSM_STATE_IDLE,
     TSM_STATE_AWAIT_CONFIRMATION,
     TSM_STATE_AWAIT_RESPONSE,
     TSM_STATE_SEGMENTED_REQUEST,
-    TSM_STATE_SEGMENTED_CONFIRMATION
+    TSM_STATE_SEGMENTED_CONFIRMATION,
+    TSM_STATE_SEGMENTED_RESPONSE
 } BACNET_TSM_STATE;
 
 /* 5.4.1 Variables And Parameters */
@@ -64,10 +84,22 @@ typedef struct BACnet_TSM_Data {
     /*uint8_t ProposedWindowSize;  */
     /*  used to perform timeout on PDU segments */
     /*uint8_t SegmentTimer; */
-    /* used to perform timeout on Confirmed Requests */
-    /* in milliseconds */
-    uint16_t RequestTimer;
-    /* unique id */
+    /* used to perform timeout on Confirmed Requests: */
+    /* the timer wheel tick when it expires */
+    uint32_t RequestTimer;
+    /* timer wheel bucket + 1, or 0 when the timer is stopped, */
+    /* and the neighbours (slot + 1) in the bucket or the free list */
+    uint8_t TimerBucket;
+    uint16_t TimerNext;
+    uint16_t TimerPrev;
+    /* next (slot + 1) with the same hash of dest and invoke ID, */
+    /* and true while in the hash table */
+    uint16_t HashNext;
+    bool Hashed;
+    /* the peer (index + 1) whose invoke ID space is used, */
+    /* or 0 for an invoke ID that is unique among all peers */
+    uint16_t Peer;
+    /* unique id, per peer or among all peers */
     uint8_t InvokeID;
     /* state that the TSM is in */
     BACNET_TSM_STATE state;
@@ -75,7 +107,8 @@ typedef struct BACnet_TSM_Data {
     BACNET_ADDRESS dest;
     /* the network layer info */
     BACNET_NPDU_DATA npdu_data;
-    /* copy of the APDU, should we need to send it again */
+    /* the PDU, should we need to send it again; the request may be */
+    /* encoded here in place, see tsm_transaction_buffer() */
     uint8_t apdu[MAX_PDU];
     unsigned apdu_len;
 } BACNET_TSM_DATA;
@@ -84,6 +117,55 @@ typedef void (
     *tsm_timeout_function) (
     uint8_t invoke_id);
 
+typedef void (
+    *tsm_timeout_peer_function) (
+    BACNET_ADDRESS * dest,
+    uint8_t invoke_id);
+
+#if MAX_SEGMENTS_ACCEPTED
+/* A segmented message that we send or receive.  The client side of */
+/* a transaction keeps its BACNET_TSM_DATA, which waits in the */
+/* SEGMENTED_CONFIRMATION state while the ComplexACK segments arrive. */
+typedef struct BACnet_TSM_Segmented_Data {
+    /* SEGMENTED_REQUEST or SEGMENTED_CONFIRMATION while receiving, */
+    /* SEGMENTED_RESPONSE while sending, or IDLE */
+    BACNET_TSM_STATE state;
+    /* true if we are the server of the transaction */
+    bool server;
+    /* true once all the segments were received */
+    bool complete;
+    uint8_t InvokeID;
+    uint8_t service_choice;
+    /* used to count segment retries */
+    uint8_t SegmentRetryCount;
+    /* stores the sequence number of the last segment received in order */
+    uint8_t LastSequenceNumber;
+    /* stores the sequence number of the first segment of */
+    /* a sequence of segments that fill a window */
+    uint8_t InitialSequenceNumber;
+    /* stores the current window size */
+    uint8_t ActualWindowSize;
+    /* receiving: a Segment-NAK asked for the segments after */
+    /* LastSequenceNumber; sending: the window was resent for a NAK */
+    bool nak;
+    /* used to perform timeout on PDU segments, in milliseconds */
+    uint16_t SegmentTimer;
+    /* sending: the first segment of the window, the segments sent */
+    /* in the window, the number of segments and their size */
+    unsigned window_start;
+    unsigned window_sent;
+    unsigned segment_count;
+    unsigned segment_size;
+    /* the peer */
+    BACNET_ADDRESS dest;
+    BACNET_NPDU_DATA npdu_data;
+    /* sending: the service data of the ComplexACK; receiving: */
+    /* the message assembled with an unsegmented APDU header */
+    uint8_t apdu[MAX_APDU_SEGMENTED];
+    unsigned apdu_len;
+} BACNET_TSM_SEGMENTED_DATA;
+#endif
+
 
 #ifdef __cplusplus
 extern "C" {
@@ -91,10 +173,12 @@ extern "C" {
 
     void tsm_set_timeout_handler(
         tsm_timeout_function pFunction);
+    void tsm_set_timeout_peer_handler(
+        tsm_timeout_peer_function pFunction);
 
     bool tsm_transaction_available(
         void);
-    uint8_t tsm_transaction_idle_count(
+    uint16_t tsm_transaction_idle_count(
         void);
     void tsm_timer_milliseconds(
         uint16_t milliseconds);
@@ -106,6 +190,26 @@ extern "C" {
         void);
     void tsm_invokeID_set(
         uint8_t invokeID);
+/* invoke IDs that are only unique for the peer, use with the _peer
+   functions; returns 0 if none are available or the window is full */
+    uint8_t tsm_next_free_invokeID_peer(
+        BACNET_ADDRESS * dest);
+    bool tsm_peer_window_set(
+        BACNET_ADDRESS * dest,
+        uint8_t window);
+    void tsm_free_invoke_id_peer(
+        BACNET_ADDRESS * dest,
+        uint8_t invokeID);
+    bool tsm_invoke_id_free_peer(
+        BACNET_ADDRESS * dest,
+        uint8_t invokeID);
+    bool tsm_invoke_id_failed_peer(
+        BACNET_ADDRESS * dest,
+        uint8_t invokeID);
+/* the retained PDU buffer of a reserved invoke ID, MAX_PDU bytes */
+    uint8_t *tsm_transaction_buffer(
+        BACNET_ADDRESS * dest,
+        uint8_t invokeID);
 /* returns the same invoke ID that was given */
     void tsm_set_confirmed_unsegmented_transaction(
         uint8_t invokeID,
@@ -120,12 +224,49 @@ extern "C" {
         BACNET_NPDU_DATA * ndpu_data,
         uint8_t * apdu,
         uint16_t * apdu_len);
+    bool tsm_get_transaction_pdu_peer(
+        BACNET_ADDRESS * dest,
+        uint8_t invokeID,
+        BACNET_NPDU_DATA * ndpu_data,
+        uint8_t * apdu,
+        uint16_t * apdu_len);
 
     bool tsm_invoke_id_free(
         uint8_t invokeID);
     bool tsm_invoke_id_failed(
         uint8_t invokeID);
 
+#if MAX_SEGMENTS_ACCEPTED
+/* largest ComplexACK that can be sent to the requester */
+    unsigned tsm_segmented_complex_ack_max(
+        BACNET_CONFIRMED_SERVICE_DATA * service_data);
+/* sends a ComplexACK, encoded as unsegmented, in segments */
+    bool tsm_segmented_complex_ack_send(
+        BACNET_ADDRESS * dest,
+        BACNET_NPDU_DATA * npdu_data,
+        BACNET_CONFIRMED_SERVICE_DATA * service_data,
+        uint8_t * apdu,
+        unsigned apdu_len,
+        BACNET_ERROR_CODE * error_code);
+/* returns the assembled APDU once the last segment is received */
+    uint8_t *tsm_segment_received(
+        BACNET_ADDRESS * src,
+        uint8_t * apdu,
+        uint16_t apdu_len,
+        uint16_t * assembled_len);
+    void tsm_segment_ack_received(
+        BACNET_ADDRESS * src,
+        uint8_t invokeID,
+        uint8_t sequence_number,
+        uint8_t actual_window_size,
+        bool nak,
+        bool server);
+    void tsm_segmented_free(
+        BACNET_ADDRESS * src,
+        uint8_t invokeID,
+        bool server);
+#endif
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -31,5 +31,8 @@
 #include "datalink.h"
 
 extern uint8_t Handler_Transmit_Buffer[MAX_PDU];
+#if MAX_SEGMENTS_ACCEPTED
+extern uint8_t Handler_Segmented_Buffer[MAX_APDU_SEGMENTED];
+#endif
 
 #endif
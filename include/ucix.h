@@ -30,14 +30,22 @@ struct value_tuple {
 	time_t value_time;
 	int Out_Of_Service;
 	char idx[18];
+	bool changed;		/* by the last load */
+	unsigned generation;	/* of the last load that saw the section */
 	struct value_tuple *next;
 };
 
-/* structure to hold tuple-list and uci context during iteration */
+/* structure to hold tuple-list and uci context during iteration.
+   The list is kept from one load to the next, in section order. */
 struct uci_itr_ctx {
 	struct value_tuple *list;
 	struct uci_context *ctx;
 	char *section;
+	struct value_tuple *cursor;	/* tuple expected for the next section */
+	struct value_tuple *prev;	/* tuple of the last section */
+	unsigned generation;
+	int changed;			/* tuples changed by the load */
+	int count;			/* tuples seen by the load */
 };
 typedef struct value_tuple value_tuple_t;
 
@@ -69,6 +77,36 @@ void ucix_for_each_section_type(struct uci_context *ctx,
 	void (*cb)(const char*, void*), void *priv);
 /* Check if given uci file was updated */
 time_t check_uci_update(const char *config, time_t mtime);
+/* Watch uci packages for changes, with inotify if available */
+int ucix_watch_add(const char *config);
+int ucix_watch_poll(void);
+bool ucix_watch_changed(const char *config);
+/* Write-behind journal of options, written by ucix_journal_task */
+struct ucix_journal_stats {
+	unsigned depth;			/* options waiting */
+	unsigned max_depth;
+	unsigned long added;		/* options queued */
+	unsigned long coalesced;	/* values replaced while queued */
+	unsigned long written;
+	unsigned long flushes;
+	unsigned long last_latency_ms;	/* age of the oldest flushed option */
+	unsigned long max_latency_ms;
+	unsigned long last_flush_ms;	/* time spent writing */
+	unsigned long max_flush_ms;
+};
+bool ucix_journal_add(const char *p, const char *s, const char *o,
+	const char *t, bool commit);
+bool ucix_journal_add_list(const char *p, const char *s, const char *o,
+	char t[254][64], int l, bool commit);
+bool ucix_journal_add_int(const char *p, const char *s, const char *o,
+	int t, bool commit);
+void ucix_journal_flush(void);
+bool ucix_journal_task(void);
+void ucix_journal_get_stats(struct ucix_journal_stats *stats);
 /* Add tuple */
 void load_value(const char *sec_idx, struct uci_itr_ctx *itr);
+/* Start and finish a load of the tuples, finish returns the changed count */
+void load_value_begin(struct uci_itr_ctx *itr);
+int load_value_end(struct uci_itr_ctx *itr);
+void load_value_free(struct uci_itr_ctx *itr);
 #endif
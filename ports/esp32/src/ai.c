@@ -221,6 +221,8 @@ static void Analog_Input_COV_Detect(unsigned int index,
         if (cov_delta >= cov_increment) {
             AI_Descr[index].Changed = true;
             AI_Descr[index].Prior_Value = value;
+            handler_cov_object_changed(OBJECT_ANALOG_INPUT,
+                Analog_Input_Index_To_Instance(index));
         }
     }
 }
@@ -398,6 +400,7 @@ void Analog_Input_Out_Of_Service_Set(
     		review by all interested parties. Say 6 months -> September 2016 */
         if (AI_Descr[index].Out_Of_Service != value) {
             AI_Descr[index].Changed = true;
+            handler_cov_object_changed(OBJECT_ANALOG_INPUT, object_instance);
         }
         AI_Descr[index].Out_Of_Service = value;
     }
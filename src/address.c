@@ -36,36 +36,63 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include "config.h"
 #include "bacaddr.h"
 #include "address.h"
 #include "bacdef.h"
 #include "bacdcode.h"
+#include "bacint.h"
 #include "readrange.h"
 
-/* we are likely compiling the demo command line tools if print enabled */
-#if !defined(BACNET_ADDRESS_CACHE_FILE)
-#if PRINT_ENABLED
-#define BACNET_ADDRESS_CACHE_FILE
-#endif
-#endif
-
 /** @file address.c  Handle address binding */
 
 /* This module is used to handle the address binding that */
 /* occurs in BACnet.  A device id is bound to a MAC address. */
 /* The normal method is using Who-Is, and using the data from I-Am */
 
+/* The entries are found through two hash indexes, one by device id
+   and one by address, and the entries that expire are kept in a heap
+   ordered by expiry time, so the timer only looks at the entries that
+   expire.  Where there is a heap, the cache grows a block at a time
+   up to MAX_ADDRESS_CACHE_GROWN entries. */
+
 static uint32_t Top_Protected_Entry;
 static uint32_t Own_Device_ID = 0xFFFFFFFF;
 
-static struct Address_Cache_Entry {
+struct Address_Cache_Entry {
     uint8_t Flags;
     uint32_t device_id;
     unsigned max_apdu;
     BACNET_ADDRESS address;
-    uint32_t TimeToLive;
-} Address_Cache[MAX_ADDRESS_CACHE];
+    uint32_t Expires;   /* Address_Clock at expiry, unless static */
+    uint16_t device_next;       /* next of the device id index, or free */
+    uint16_t address_next;      /* next of the address index */
+    uint16_t ttl_index; /* place in the expiry heap */
+};
+
+/* no entry */
+#define ADDRESS_NONE 0xFFFF
+
+static struct Address_Cache_Entry Address_Cache_Block[MAX_ADDRESS_CACHE];
+static uint16_t Address_Index_Block[MAX_ADDRESS_CACHE * 3];
+static struct Address_Cache_Entry *Address_Cache = Address_Cache_Block;
+/* first entry of each bucket of the indexes */
+static uint16_t *Address_Device_Index = &Address_Index_Block[0];
+static uint16_t *Address_MAC_Index = &Address_Index_Block[MAX_ADDRESS_CACHE];
+/* entries that expire, the next one first */
+static uint16_t *Address_TTL_Heap = &Address_Index_Block[MAX_ADDRESS_CACHE * 2];
+static unsigned Address_TTL_Count;
+/* entries, and buckets of each index */
+static unsigned Address_Cache_Size = MAX_ADDRESS_CACHE;
+static uint16_t Address_Free = ADDRESS_NONE;
+/* seconds counted by address_cache_timer() */
+static uint32_t Address_Clock;
+/* the indexes are built, on first use if address_init() wasn't called */
+static bool Address_Ready;
+/* the bindings changed since the last snapshot */
+static bool Address_Snapshot_Dirty;
 
 /* State flags for cache entries */
 
@@ -82,6 +109,315 @@ static struct Address_Cache_Entry {
 #define BAC_ADDR_SHORT_TIME BAC_ADDR_SECS_1HOUR
 #define BAC_ADDR_FOREVER    0xFFFFFFFF  /* Permenant entry */
 
+static unsigned address_device_hash(
+    uint32_t device_id)
+{
+    return (unsigned) ((uint32_t) (device_id * 2654435761UL) %
+        Address_Cache_Size);
+}
+
+/* hashes the parts of an address that bacnet_address_same() compares */
+static unsigned address_mac_hash(
+    BACNET_ADDRESS * src)
+{
+    uint32_t hash = 2166136261UL;
+    uint8_t i, len;
+
+    hash = (hash ^ (src->net & 0xFF)) * 16777619UL;
+    hash = (hash ^ (src->net >> 8)) * 16777619UL;
+    len = src->len;
+    if (len > MAX_MAC_LEN)
+        len = MAX_MAC_LEN;
+    for (i = 0; i < len; i++) {
+        hash = (hash ^ src->adr[i]) * 16777619UL;
+    }
+    if (src->net == 0) {
+        len = src->mac_len;
+        if (len > MAX_MAC_LEN)
+            len = MAX_MAC_LEN;
+        for (i = 0; i < len; i++) {
+            hash = (hash ^ src->mac[i]) * 16777619UL;
+        }
+    }
+
+    return (unsigned) ((uint32_t) hash % Address_Cache_Size);
+}
+
+static void address_device_link(
+    uint16_t index)
+{
+    unsigned bucket = address_device_hash(Address_Cache[index].device_id);
+
+    Address_Cache[index].device_next = Address_Device_Index[bucket];
+    Address_Device_Index[bucket] = index;
+}
+
+static void address_device_unlink(
+    uint16_t index)
+{
+    unsigned bucket = address_device_hash(Address_Cache[index].device_id);
+    uint16_t *pNext = &Address_Device_Index[bucket];
+
+    while (*pNext != ADDRESS_NONE) {
+        if (*pNext == index) {
+            *pNext = Address_Cache[index].device_next;
+            break;
+        }
+        pNext = &Address_Cache[*pNext].device_next;
+    }
+}
+
+static void address_mac_link(
+    uint16_t index)
+{
+    unsigned bucket = address_mac_hash(&Address_Cache[index].address);
+
+    Address_Cache[index].address_next = Address_MAC_Index[bucket];
+    Address_MAC_Index[bucket] = index;
+}
+
+static void address_mac_unlink(
+    uint16_t index)
+{
+    unsigned bucket = address_mac_hash(&Address_Cache[index].address);
+    uint16_t *pNext = &Address_MAC_Index[bucket];
+
+    while (*pNext != ADDRESS_NONE) {
+        if (*pNext == index) {
+            *pNext = Address_Cache[index].address_next;
+            break;
+        }
+        pNext = &Address_Cache[*pNext].address_next;
+    }
+}
+
+static void address_ttl_place(
+    unsigned place,
+    uint16_t index)
+{
+    Address_TTL_Heap[place] = index;
+    Address_Cache[index].ttl_index = (uint16_t) place;
+}
+
+/* restores the heap order around an entry whose expiry changed */
+static void address_ttl_sift(
+    unsigned place)
+{
+    uint16_t index = Address_TTL_Heap[place];
+    uint32_t expires = Address_Cache[index].Expires;
+    unsigned child;
+
+    while (place > 0) {
+        child = (place - 1) / 2;        /* the parent */
+        if (Address_Cache[Address_TTL_Heap[child]].Expires <= expires)
+            break;
+        address_ttl_place(place, Address_TTL_Heap[child]);
+        place = child;
+    }
+    for (;;) {
+        child = (place * 2) + 1;
+        if (child >= Address_TTL_Count)
+            break;
+        if (((child + 1) < Address_TTL_Count) &&
+            (Address_Cache[Address_TTL_Heap[child + 1]].Expires <
+                Address_Cache[Address_TTL_Heap[child]].Expires))
+            child++;
+        if (expires <= Address_Cache[Address_TTL_Heap[child]].Expires)
+            break;
+        address_ttl_place(place, Address_TTL_Heap[child]);
+        place = child;
+    }
+    address_ttl_place(place, index);
+}
+
+static void address_ttl_remove(
+    uint16_t index)
+{
+    unsigned place = Address_Cache[index].ttl_index;
+
+    if (place == ADDRESS_NONE)
+        return;
+    Address_Cache[index].ttl_index = ADDRESS_NONE;
+    Address_TTL_Count--;
+    if (place < Address_TTL_Count) {
+        address_ttl_place(place, Address_TTL_Heap[Address_TTL_Count]);
+        address_ttl_sift(place);
+    }
+}
+
+/* sets the time to live of an entry, or makes it static */
+static void address_ttl_set(
+    uint16_t index,
+    uint32_t TimeToLive)
+{
+    struct Address_Cache_Entry *pMatch = &Address_Cache[index];
+
+    if (pMatch->Flags & BAC_ADDR_STATIC) {
+        pMatch->Expires = BAC_ADDR_FOREVER;
+        address_ttl_remove(index);
+        return;
+    }
+    if (TimeToLive >= (BAC_ADDR_FOREVER - Address_Clock))
+        pMatch->Expires = BAC_ADDR_FOREVER - 1;
+    else
+        pMatch->Expires = Address_Clock + TimeToLive;
+    if (pMatch->ttl_index == ADDRESS_NONE) {
+        address_ttl_place(Address_TTL_Count, index);
+        Address_TTL_Count++;
+    }
+    address_ttl_sift(pMatch->ttl_index);
+}
+
+static uint32_t address_ttl_get(
+    struct Address_Cache_Entry *pMatch)
+{
+    if (pMatch->Flags & BAC_ADDR_STATIC)
+        return BAC_ADDR_FOREVER;
+    if (pMatch->Expires < Address_Clock)
+        return 0;
+
+    return pMatch->Expires - Address_Clock;
+}
+
+/* rebuilds the indexes, the heap and the free list from the flags */
+static void address_rebuild(
+    void)
+{
+    struct Address_Cache_Entry *pMatch;
+    unsigned i;
+
+    for (i = 0; i < Address_Cache_Size; i++) {
+        Address_Device_Index[i] = ADDRESS_NONE;
+        Address_MAC_Index[i] = ADDRESS_NONE;
+    }
+    Address_TTL_Count = 0;
+    Address_Free = ADDRESS_NONE;
+    /* backwards, so the free list hands out the first entries first */
+    for (i = Address_Cache_Size; i > 0; i--) {
+        pMatch = &Address_Cache[i - 1];
+        pMatch->ttl_index = ADDRESS_NONE;
+        if ((pMatch->Flags & BAC_ADDR_IN_USE) != 0) {
+            address_device_link((uint16_t) (i - 1));
+            address_mac_link((uint16_t) (i - 1));
+            if ((pMatch->Flags & BAC_ADDR_STATIC) == 0) {
+                address_ttl_place(Address_TTL_Count, (uint16_t) (i - 1));
+                Address_TTL_Count++;
+                address_ttl_sift(Address_TTL_Count - 1);
+            }
+        } else {
+            pMatch->Flags = 0;
+            pMatch->device_next = Address_Free;
+            Address_Free = (uint16_t) (i - 1);
+        }
+    }
+    Address_Ready = true;
+}
+
+#if (MAX_ADDRESS_CACHE_GROWN > MAX_ADDRESS_CACHE)
+/* doubles the cache, up to MAX_ADDRESS_CACHE_GROWN entries */
+static bool address_grow(
+    void)
+{
+    struct Address_Cache_Entry *pCache;
+    uint16_t *pIndex;
+    unsigned size;
+
+    if (Address_Cache_Size >= MAX_ADDRESS_CACHE_GROWN)
+        return false;
+    size = Address_Cache_Size * 2;
+    if (size > MAX_ADDRESS_CACHE_GROWN)
+        size = MAX_ADDRESS_CACHE_GROWN;
+    pCache = calloc(size, sizeof(struct Address_Cache_Entry));
+    pIndex = calloc(size * 3, sizeof(uint16_t));
+    if (!pCache || !pIndex) {
+        free(pCache);
+        free(pIndex);
+        return false;
+    }
+    memcpy(pCache, Address_Cache,
+        Address_Cache_Size * sizeof(struct Address_Cache_Entry));
+    if (Address_Cache != Address_Cache_Block) {
+        free(Address_Cache);
+        free(Address_Device_Index);
+    }
+    Address_Cache = pCache;
+    Address_Device_Index = &pIndex[0];
+    Address_MAC_Index = &pIndex[size];
+    Address_TTL_Heap = &pIndex[size * 2];
+    Address_Cache_Size = size;
+    address_rebuild();
+
+    return true;
+}
+#endif
+
+static uint16_t address_find_device(
+    uint32_t device_id)
+{
+    uint16_t index;
+
+    if (!Address_Ready)
+        address_rebuild();
+    index = Address_Device_Index[address_device_hash(device_id)];
+    while (index != ADDRESS_NONE) {
+        if (Address_Cache[index].device_id == device_id)
+            break;
+        index = Address_Cache[index].device_next;
+    }
+
+    return index;
+}
+
+/* changes the address of an entry in use */
+static void address_entry_set(
+    uint16_t index,
+    BACNET_ADDRESS * src)
+{
+    address_mac_unlink(index);
+    bacnet_address_copy(&Address_Cache[index].address, src);
+    address_mac_link(index);
+    Address_Snapshot_Dirty = true;
+}
+
+static void address_entry_free(
+    uint16_t index)
+{
+    struct Address_Cache_Entry *pMatch = &Address_Cache[index];
+
+    if ((pMatch->Flags & BAC_ADDR_IN_USE) != 0) {
+        address_device_unlink(index);
+        address_mac_unlink(index);
+        address_ttl_remove(index);
+        Address_Snapshot_Dirty = true;
+    }
+    pMatch->Flags = 0;
+    pMatch->device_next = Address_Free;
+    Address_Free = index;
+}
+
+/* takes a free entry and puts it in use, with an empty address */
+static uint16_t address_entry_new(
+    uint32_t device_id,
+    uint8_t Flags)
+{
+    struct Address_Cache_Entry *pMatch;
+    uint16_t index = Address_Free;
+
+    if (index == ADDRESS_NONE)
+        return index;
+    pMatch = &Address_Cache[index];
+    Address_Free = pMatch->device_next;
+    pMatch->Flags = Flags;
+    pMatch->device_id = device_id;
+    pMatch->max_apdu = 0;
+    memset(&pMatch->address, 0, sizeof(pMatch->address));
+    pMatch->ttl_index = ADDRESS_NONE;
+    address_device_link(index);
+    address_mac_link(index);
+    address_ttl_set(index, BAC_ADDR_SHORT_TIME);
+
+    return index;
+}
 
 void address_protected_entry_index_set(uint32_t top_protected_entry_index)
 {
@@ -132,90 +468,103 @@ bool address_match(
 void address_remove_device(
     uint32_t device_id)
 {
-    struct Address_Cache_Entry *pMatch;
-    uint32_t index = 0;
+    uint16_t index;
 
-    pMatch = Address_Cache;
-    while (pMatch <= &Address_Cache[MAX_ADDRESS_CACHE - 1]) {
-        if (((pMatch->Flags & BAC_ADDR_IN_USE) != 0) &&
-            (pMatch->device_id == device_id)) {
-            pMatch->Flags = 0;
-            if (index < Top_Protected_Entry) {
-                Top_Protected_Entry--;
-            }
-            break;
+    index = address_find_device(device_id);
+    if (index != ADDRESS_NONE) {
+        address_entry_free(index);
+        if (index < Top_Protected_Entry) {
+            Top_Protected_Entry--;
         }
-        pMatch++;
-        index++;
     }
 
     return;
 }
 
 /*****************************************************************************
- * Search the cache for the entry nearest expiry and delete it. Mark the     *
- * entry as reserved with a 1 hour TTL and return a pointer to the reserved  *
- * entry. Will not delete a static entry and returns NULL pointer if no      *
- * entry available to free up. Does not check for free entries as it is      *
- * assumed we are calling this due to the lack of those.                     *
+ * Search the cache for the entry nearest expiry and free it, as the next    *
+ * entry handed out. Returns ADDRESS_NONE if no entry could be freed.        *
+ * Will not delete a static or protected entry. Does not check for           *
+ * free entries as it is assumed we are calling this due to the lack of      *
+ * those, so it only runs once the cache is as large as it gets.             *
  *****************************************************************************/
 
-
-static struct Address_Cache_Entry *address_remove_oldest(
+static uint16_t address_remove_oldest(
     void)
 {
     struct Address_Cache_Entry *pMatch;
-    struct Address_Cache_Entry *pCandidate;
-    uint32_t ulTime;
+    uint16_t candidate = ADDRESS_NONE;
+    uint32_t ulTime = BAC_ADDR_FOREVER;
+    unsigned place;
+    uint16_t index;
 
-    pCandidate = NULL;
-    if (Top_Protected_Entry > (MAX_ADDRESS_CACHE - 1)) {
-       return pCandidate;
+    if (Top_Protected_Entry >= Address_Cache_Size) {
+        return candidate;
     }
-    ulTime = BAC_ADDR_FOREVER - 1;      /* Longest possible non static time to live */
 
     /* First pass - try only in use and bound entries */
-
-    pMatch = &Address_Cache[Top_Protected_Entry];
-    while (pMatch <= &Address_Cache[MAX_ADDRESS_CACHE - 1]) {
-        if ((pMatch->
-                Flags & (BAC_ADDR_IN_USE | BAC_ADDR_BIND_REQ |
-                    BAC_ADDR_STATIC)) == BAC_ADDR_IN_USE) {
-            if (pMatch->TimeToLive <= ulTime) { /* Shorter lived entry found */
-                ulTime = pMatch->TimeToLive;
-                pCandidate = pMatch;
-            }
+    /* (the heap holds all the entries that are not static,
+       so its first one will do if it is bound and not protected) */
+    if (Address_TTL_Count > 0) {
+        index = Address_TTL_Heap[0];
+        if ((index >= Top_Protected_Entry) &&
+            ((Address_Cache[index].Flags & BAC_ADDR_BIND_REQ) == 0)) {
+            address_entry_free(index);
+            return index;
         }
-        pMatch++;
     }
-
-    if (pCandidate != NULL) {   /* Found something to free up */
-        pCandidate->Flags = BAC_ADDR_RESERVED;
-        pCandidate->TimeToLive = BAC_ADDR_SHORT_TIME;   /* only reserve it for a short while */
-        return (pCandidate);
+    for (place = 0; place < Address_TTL_Count; place++) {
+        index = Address_TTL_Heap[place];
+        pMatch = &Address_Cache[index];
+        if ((index >= Top_Protected_Entry) &&
+            ((pMatch->Flags & BAC_ADDR_BIND_REQ) == 0) &&
+            (pMatch->Expires < ulTime)) {
+            ulTime = pMatch->Expires;
+            candidate = index;
+        }
     }
 
     /* Second pass - try in use and un bound as last resort */
-    pMatch = Address_Cache;
-    while (pMatch <= &Address_Cache[MAX_ADDRESS_CACHE - 1]) {
-        if ((pMatch->
-                Flags & (BAC_ADDR_IN_USE | BAC_ADDR_BIND_REQ |
-                    BAC_ADDR_STATIC)) ==
-            ((uint8_t) (BAC_ADDR_IN_USE | BAC_ADDR_BIND_REQ))) {
-            if (pMatch->TimeToLive <= ulTime) { /* Shorter lived entry found */
-                ulTime = pMatch->TimeToLive;
-                pCandidate = pMatch;
+    if (candidate == ADDRESS_NONE) {
+        for (place = 0; place < Address_TTL_Count; place++) {
+            index = Address_TTL_Heap[place];
+            pMatch = &Address_Cache[index];
+            if ((index >= Top_Protected_Entry) &&
+                (pMatch->Expires < ulTime)) {
+                ulTime = pMatch->Expires;
+                candidate = index;
             }
         }
-        pMatch++;
     }
 
-    if (pCandidate != NULL) {   /* Found something to free up */
-        pCandidate->Flags = BAC_ADDR_RESERVED;
-        pCandidate->TimeToLive = BAC_ADDR_SHORT_TIME;   /* only reserve it for a short while */
+    if (candidate != ADDRESS_NONE) {    /* Found something to free up */
+        /* the next entry handed out */
+        address_entry_free(candidate);
     }
 
-    return (pCandidate);
+    return candidate;
+}
+
+/* returns a free entry for a new device, making room if need be */
+static uint16_t address_entry_alloc(
+    uint32_t device_id,
+    uint8_t Flags)
+{
+    uint16_t index;
+
+    if (!Address_Ready)
+        address_rebuild();
+#if (MAX_ADDRESS_CACHE_GROWN > MAX_ADDRESS_CACHE)
+    if (Address_Free == ADDRESS_NONE) {
+        address_grow();
+    }
+#endif
+    if (Address_Free == ADDRESS_NONE) {
+        address_remove_oldest();
+    }
+    index = address_entry_new(device_id, Flags);
+
+    return index;
 }
 
 /** Initialize a BACNET_MAC_ADDRESS
@@ -359,6 +708,179 @@ static void address_file_init(
 
     return;
 }
+
+/* Binary snapshot of the learned bindings, saved now and then by
+   address_cache_timer() and loaded by address_init(), so a restart
+   starts with warm bindings instead of a Who-Is for every device.
+   Big endian: a header, then one record per bound entry. */
+static const char *Address_Snapshot_Filename = "address_cache.bin";
+static uint32_t Address_Snapshot_Seconds;
+
+#define ADDRESS_SNAPSHOT_MAGIC 0x42414331UL     /* "BAC1" */
+#define ADDRESS_SNAPSHOT_HEADER 16
+#define ADDRESS_SNAPSHOT_RECORD (4 + 2 + 1 + 4 + 2 + 1 + MAX_MAC_LEN + 1 + \
+    MAX_MAC_LEN)
+/* seconds between two snapshots, when the bindings changed */
+#ifndef ADDRESS_SNAPSHOT_INTERVAL
+#define ADDRESS_SNAPSHOT_INTERVAL 300
+#endif
+
+/****************************************************************************
+ * Save the bound entries that are not static, with their time to live,    *
+ * to a snapshot file. The file is written aside and then renamed, so a    *
+ * crash never leaves half a snapshot behind.                               *
+ ****************************************************************************/
+
+bool address_snapshot_save(
+    const char *pFilename)
+{
+    FILE *pFile = NULL; /* stream pointer */
+    char temp_name[256];
+    uint8_t record[ADDRESS_SNAPSHOT_RECORD];
+    struct Address_Cache_Entry *pMatch;
+    uint32_t count = 0;
+    unsigned i;
+    int len;
+    bool status = true;
+
+    if (!pFilename) {
+        pFilename = Address_Snapshot_Filename;
+    }
+    if (snprintf(temp_name, sizeof(temp_name), "%s.tmp",
+            pFilename) >= (int) sizeof(temp_name)) {
+        return false;
+    }
+    for (i = 0; i < Address_Cache_Size; i++) {
+        pMatch = &Address_Cache[i];
+        if ((pMatch->Flags & (BAC_ADDR_IN_USE | BAC_ADDR_BIND_REQ |
+                    BAC_ADDR_STATIC)) == BAC_ADDR_IN_USE) {
+            count++;
+        }
+    }
+    pFile = fopen(temp_name, "wb");
+    if (!pFile) {
+        return false;
+    }
+    len = encode_unsigned32(&record[0], ADDRESS_SNAPSHOT_MAGIC);
+    len += encode_unsigned32(&record[len], (uint32_t) time(NULL));
+    len += encode_unsigned16(&record[len], ADDRESS_SNAPSHOT_RECORD);
+    len += encode_unsigned16(&record[len], MAX_MAC_LEN);
+    len += encode_unsigned32(&record[len], count);
+    if (fwrite(record, len, 1, pFile) != 1) {
+        status = false;
+    }
+    for (i = 0; status && (i < Address_Cache_Size); i++) {
+        pMatch = &Address_Cache[i];
+        if ((pMatch->Flags & (BAC_ADDR_IN_USE | BAC_ADDR_BIND_REQ |
+                    BAC_ADDR_STATIC)) != BAC_ADDR_IN_USE) {
+            continue;
+        }
+        len = encode_unsigned32(&record[0], pMatch->device_id);
+        len += encode_unsigned16(&record[len], (uint16_t) pMatch->max_apdu);
+        record[len++] = pMatch->Flags & BAC_ADDR_SHORT_TTL;
+        len += encode_unsigned32(&record[len], address_ttl_get(pMatch));
+        len += encode_unsigned16(&record[len], pMatch->address.net);
+        record[len++] = pMatch->address.mac_len;
+        memcpy(&record[len], pMatch->address.mac, MAX_MAC_LEN);
+        len += MAX_MAC_LEN;
+        record[len++] = pMatch->address.len;
+        memcpy(&record[len], pMatch->address.adr, MAX_MAC_LEN);
+        len += MAX_MAC_LEN;
+        if (fwrite(record, len, 1, pFile) != 1) {
+            status = false;
+        }
+    }
+    if (fclose(pFile) != 0) {
+        status = false;
+    }
+    if (status && (rename(temp_name, pFilename) != 0)) {
+        status = false;
+    }
+    if (!status) {
+        remove(temp_name);
+    } else {
+        Address_Snapshot_Dirty = false;
+    }
+
+    return status;
+}
+
+/****************************************************************************
+ * Load the bindings of a snapshot file. The time to live of each entry is  *
+ * reduced by the time since the snapshot, and entries that expired or     *
+ * that the cache already holds are skipped. Returns false if the file is   *
+ * missing or is not a snapshot of this build.                              *
+ ****************************************************************************/
+
+bool address_snapshot_load(
+    const char *pFilename)
+{
+    FILE *pFile = NULL; /* stream pointer */
+    uint8_t record[ADDRESS_SNAPSHOT_RECORD];
+    BACNET_ADDRESS src;
+    uint32_t magic = 0, saved = 0, count = 0;
+    uint32_t device_id = 0, TimeToLive = 0, elapsed = 0;
+    uint16_t record_len = 0, mac_len = 0, max_apdu = 0;
+    uint16_t index;
+    uint8_t Flags;
+    time_t now;
+    int len;
+
+    if (!pFilename) {
+        pFilename = Address_Snapshot_Filename;
+    }
+    pFile = fopen(pFilename, "rb");
+    if (!pFile) {
+        return false;
+    }
+    if (fread(record, ADDRESS_SNAPSHOT_HEADER, 1, pFile) == 1) {
+        len = decode_unsigned32(&record[0], &magic);
+        len += decode_unsigned32(&record[len], &saved);
+        len += decode_unsigned16(&record[len], &record_len);
+        len += decode_unsigned16(&record[len], &mac_len);
+        (void) decode_unsigned32(&record[len], &count);
+    }
+    if ((magic != ADDRESS_SNAPSHOT_MAGIC) ||
+        (record_len != ADDRESS_SNAPSHOT_RECORD) || (mac_len != MAX_MAC_LEN)) {
+        fclose(pFile);
+        return false;
+    }
+    now = time(NULL);
+    if ((uint32_t) now > saved) {
+        elapsed = (uint32_t) now - saved;
+    }
+    while (count-- && (fread(record, ADDRESS_SNAPSHOT_RECORD, 1, pFile) == 1)) {
+        len = decode_unsigned32(&record[0], &device_id);
+        len += decode_unsigned16(&record[len], &max_apdu);
+        Flags = record[len++] & BAC_ADDR_SHORT_TTL;
+        len += decode_unsigned32(&record[len], &TimeToLive);
+        memset(&src, 0, sizeof(src));
+        len += decode_unsigned16(&record[len], &src.net);
+        src.mac_len = record[len++];
+        memcpy(src.mac, &record[len], MAX_MAC_LEN);
+        len += MAX_MAC_LEN;
+        src.len = record[len++];
+        memcpy(src.adr, &record[len], MAX_MAC_LEN);
+        if ((TimeToLive <= elapsed) || (src.mac_len > MAX_MAC_LEN) ||
+            (src.len > MAX_MAC_LEN) || (device_id == Own_Device_ID) ||
+            (address_find_device(device_id) != ADDRESS_NONE)) {
+            continue;
+        }
+        index = address_entry_alloc(device_id,
+            (uint8_t) (BAC_ADDR_IN_USE | Flags));
+        if (index == ADDRESS_NONE) {
+            break;
+        }
+        address_entry_set(index, &src);
+        Address_Cache[index].max_apdu = max_apdu;
+        address_ttl_set(index, TimeToLive - elapsed);
+    }
+    fclose(pFile);
+    /* what we have is what the file has */
+    Address_Snapshot_Dirty = false;
+
+    return true;
+}
 #endif
 
 /****************************************************************************
@@ -369,16 +891,16 @@ static void address_file_init(
 void address_init(
     void)
 {
-    struct Address_Cache_Entry *pMatch;
+    unsigned i;
 
-   Top_Protected_Entry = 0;
+    Top_Protected_Entry = 0;
 
-    pMatch = Address_Cache;
-    while (pMatch <= &Address_Cache[MAX_ADDRESS_CACHE - 1]) {
-        pMatch->Flags = 0;
-        pMatch++;
+    for (i = 0; i < Address_Cache_Size; i++) {
+        Address_Cache[i].Flags = 0;
     }
+    address_rebuild();
 #ifdef BACNET_ADDRESS_CACHE_FILE
+    address_snapshot_load(Address_Snapshot_Filename);
     address_file_init(Address_Cache_Filename);
 #endif
     return;
@@ -396,29 +918,28 @@ void address_init_partial(
     void)
 {
     struct Address_Cache_Entry *pMatch;
+    unsigned i;
 
-    pMatch = Address_Cache;
-    while (pMatch <= &Address_Cache[MAX_ADDRESS_CACHE - 1]) {
+    for (i = 0; i < Address_Cache_Size; i++) {
+        pMatch = &Address_Cache[i];
         if ((pMatch->Flags & BAC_ADDR_IN_USE) != 0) {   /* It's in use so let's check further */
             if (((pMatch->Flags & BAC_ADDR_BIND_REQ) != 0) ||
-                (pMatch->TimeToLive == 0))
+                (address_ttl_get(pMatch) == 0))
                 pMatch->Flags = 0;
         }
 
         if ((pMatch->Flags & BAC_ADDR_RESERVED) != 0) { /* Reserved entries should be cleared */
             pMatch->Flags = 0;
         }
-
-        pMatch++;
     }
- #ifdef BACNET_ADDRESS_CACHE_FILE
+    address_rebuild();
+#ifdef BACNET_ADDRESS_CACHE_FILE
     address_file_init(Address_Cache_Filename);
 #endif
 
     return;
 }
 
-
 /****************************************************************************
  * Set the TTL info for the given device entry. If it is a bound entry we   *
  * set it to static or normal and can change the TTL. If it is unbound we   *
@@ -432,25 +953,19 @@ void address_set_device_TTL(
     bool StaticFlag)
 {
     struct Address_Cache_Entry *pMatch;
+    uint16_t index;
 
-    pMatch = Address_Cache;
-    while (pMatch <= &Address_Cache[MAX_ADDRESS_CACHE - 1]) {
-        if (((pMatch->Flags & BAC_ADDR_IN_USE) != 0) &&
-            (pMatch->device_id == device_id)) {
-            if ((pMatch->Flags & BAC_ADDR_BIND_REQ) == 0) {     /* If bound then we have either static or normaal */
-                if (StaticFlag) {
-                    pMatch->Flags |= BAC_ADDR_STATIC;
-                    pMatch->TimeToLive = BAC_ADDR_FOREVER;
-                } else {
-                    pMatch->Flags &= ~BAC_ADDR_STATIC;
-                    pMatch->TimeToLive = TimeOut;
-                }
+    index = address_find_device(device_id);
+    if (index != ADDRESS_NONE) {
+        pMatch = &Address_Cache[index];
+        if ((pMatch->Flags & BAC_ADDR_BIND_REQ) == 0) { /* If bound then we have either static or normaal */
+            if (StaticFlag) {
+                pMatch->Flags |= BAC_ADDR_STATIC;
             } else {
-                pMatch->TimeToLive = TimeOut;   /* For unbound we can only set the time to live */
+                pMatch->Flags &= ~BAC_ADDR_STATIC;
             }
-            break;      /* Exit now if found at all - bound or unbound */
         }
-        pMatch++;
+        address_ttl_set(index, TimeOut);
     }
 }
 
@@ -461,20 +976,17 @@ bool address_get_by_device(
     BACNET_ADDRESS * src)
 {
     struct Address_Cache_Entry *pMatch;
+    uint16_t index;
     bool found = false; /* return value */
 
-    pMatch = Address_Cache;
-    while (pMatch <= &Address_Cache[MAX_ADDRESS_CACHE - 1]) {
-        if (((pMatch->Flags & BAC_ADDR_IN_USE) != 0) &&
-            (pMatch->device_id == device_id)) {
-            if ((pMatch->Flags & BAC_ADDR_BIND_REQ) == 0) {     /* If bound then fetch data */
-                bacnet_address_copy(src, &pMatch->address);
-                *max_apdu = pMatch->max_apdu;
-                found = true;   /* Prove we found it */
-            }
-            break;      /* Exit now if found at all - bound or unbound */
+    index = address_find_device(device_id);
+    if (index != ADDRESS_NONE) {
+        pMatch = &Address_Cache[index];
+        if ((pMatch->Flags & BAC_ADDR_BIND_REQ) == 0) { /* If bound then fetch data */
+            bacnet_address_copy(src, &pMatch->address);
+            *max_apdu = pMatch->max_apdu;
+            found = true;       /* Prove we found it */
         }
-        pMatch++;
     }
 
     return found;
@@ -487,11 +999,15 @@ bool address_get_device_id(
     uint32_t * device_id)
 {
     struct Address_Cache_Entry *pMatch;
+    uint16_t index;
     bool found = false; /* return value */
 
-    pMatch = Address_Cache;
-    while (pMatch <= &Address_Cache[MAX_ADDRESS_CACHE - 1]) {
-        if ((pMatch->Flags & (BAC_ADDR_IN_USE | BAC_ADDR_BIND_REQ)) == BAC_ADDR_IN_USE) {       /* If bound */
+    if (!Address_Ready)
+        address_rebuild();
+    index = Address_MAC_Index[address_mac_hash(src)];
+    while (index != ADDRESS_NONE) {
+        pMatch = &Address_Cache[index];
+        if ((pMatch->Flags & BAC_ADDR_BIND_REQ) == 0) { /* If bound */
             if (bacnet_address_same(&pMatch->address, src)) {
                 if (device_id) {
                     *device_id = pMatch->device_id;
@@ -500,7 +1016,7 @@ bool address_get_device_id(
                 break;
             }
         }
-        pMatch++;
+        index = pMatch->address_next;
     }
 
     return found;
@@ -511,8 +1027,8 @@ void address_add(
     unsigned max_apdu,
     BACNET_ADDRESS * src)
 {
-    bool found = false; /* return value */
     struct Address_Cache_Entry *pMatch;
+    uint16_t index;
 
     if (Own_Device_ID == device_id) {
         return;
@@ -525,59 +1041,35 @@ void address_add(
        bind request if it exists */
 
     /* existing device or bind request outstanding - update address */
-    pMatch = Address_Cache;
-    while (pMatch <= &Address_Cache[MAX_ADDRESS_CACHE - 1]) {
-        if (((pMatch->Flags & BAC_ADDR_IN_USE) != 0) &&
-            (pMatch->device_id == device_id)) {
-            bacnet_address_copy(&pMatch->address, src);
-            pMatch->max_apdu = max_apdu;
-
-            /* Pick the right time to live */
-
-            if ((pMatch->Flags & BAC_ADDR_BIND_REQ) != 0)       /* Bind requested so long time */
-                pMatch->TimeToLive = BAC_ADDR_LONG_TIME;
-            else if ((pMatch->Flags & BAC_ADDR_STATIC) != 0)    /* Static already so make sure it never expires */
-                pMatch->TimeToLive = BAC_ADDR_FOREVER;
-            else if ((pMatch->Flags & BAC_ADDR_SHORT_TTL) != 0) /* Opportunistic entry so leave on short fuse */
-                pMatch->TimeToLive = BAC_ADDR_SHORT_TIME;
-            else
-                pMatch->TimeToLive = BAC_ADDR_LONG_TIME;        /* Renewing existing entry */
-
-            pMatch->Flags &= ~BAC_ADDR_BIND_REQ;        /* Clear bind request flag just in case */
-            found = true;
-            break;
-        }
-        pMatch++;
-    }
+    index = address_find_device(device_id);
+    if (index != ADDRESS_NONE) {
+        pMatch = &Address_Cache[index];
+        address_entry_set(index, src);
+        pMatch->max_apdu = max_apdu;
 
-    /* new device - add to cache if there is room */
-    if (!found) {
-        pMatch = Address_Cache;
-        while (pMatch <= &Address_Cache[MAX_ADDRESS_CACHE - 1]) {
-            if ((pMatch->Flags & BAC_ADDR_IN_USE) == 0) {
-                pMatch->Flags = BAC_ADDR_IN_USE;
-                pMatch->device_id = device_id;
-                pMatch->max_apdu = max_apdu;
-                bacnet_address_copy(&pMatch->address, src);
-                pMatch->TimeToLive = BAC_ADDR_SHORT_TIME;       /* Opportunistic entry so leave on short fuse */
-                found = true;
-                break;
-            }
-            pMatch++;
-        }
+        /* Pick the right time to live */
+
+        if ((pMatch->Flags & BAC_ADDR_BIND_REQ) != 0)   /* Bind requested so long time */
+            address_ttl_set(index, BAC_ADDR_LONG_TIME);
+        else if ((pMatch->Flags & BAC_ADDR_STATIC) != 0)        /* Static already so make sure it never expires */
+            address_ttl_set(index, BAC_ADDR_FOREVER);
+        else if ((pMatch->Flags & BAC_ADDR_SHORT_TTL) != 0)     /* Opportunistic entry so leave on short fuse */
+            address_ttl_set(index, BAC_ADDR_SHORT_TIME);
+        else
+            address_ttl_set(index, BAC_ADDR_LONG_TIME); /* Renewing existing entry */
+
+        pMatch->Flags &= ~BAC_ADDR_BIND_REQ;    /* Clear bind request flag just in case */
+        return;
     }
 
-    /* See if we can squeeze it in */
-    if (!found) {
-        pMatch = address_remove_oldest();
-        if (pMatch != NULL) {
-            pMatch->Flags = BAC_ADDR_IN_USE;
-            pMatch->device_id = device_id;
-            pMatch->max_apdu = max_apdu;
-            bacnet_address_copy(&pMatch->address, src);
-            pMatch->TimeToLive = BAC_ADDR_SHORT_TIME;   /* Opportunistic entry so leave on short fuse */
-        }
+    /* new device - add to cache if there is room, or squeeze it in */
+    /* Opportunistic entry so leave on short fuse */
+    index = address_entry_alloc(device_id, BAC_ADDR_IN_USE);
+    if (index != ADDRESS_NONE) {
+        address_entry_set(index, src);
+        Address_Cache[index].max_apdu = max_apdu;
     }
+
     return;
 }
 
@@ -591,56 +1083,38 @@ bool address_device_bind_request(
 {
     bool found = false; /* return value */
     struct Address_Cache_Entry *pMatch;
+    uint16_t index;
 
     /* existing device - update address info if currently bound */
-    pMatch = Address_Cache;
-    while (pMatch <= &Address_Cache[MAX_ADDRESS_CACHE - 1]) {
-        if (((pMatch->Flags & BAC_ADDR_IN_USE) != 0) &&
-            (pMatch->device_id == device_id)) {
-            if ((pMatch->Flags & BAC_ADDR_BIND_REQ) == 0) {     /* Already bound */
-                found = true;
-                if (src) {
-                    bacnet_address_copy(src, &pMatch->address);
-                }
-                if (max_apdu) {
-                    *max_apdu = pMatch->max_apdu;
-                }
-                if (device_ttl) {
-                    *device_ttl = pMatch->TimeToLive;
-                }
-                if ((pMatch->Flags & BAC_ADDR_SHORT_TTL) != 0) {        /* Was picked up opportunistacilly */
-                    pMatch->Flags &= ~BAC_ADDR_SHORT_TTL;       /* Convert to normal entry  */
-                    pMatch->TimeToLive = BAC_ADDR_LONG_TIME;    /* And give it a decent time to live */
-                }
+    index = address_find_device(device_id);
+    if (index != ADDRESS_NONE) {
+        pMatch = &Address_Cache[index];
+        if ((pMatch->Flags & BAC_ADDR_BIND_REQ) == 0) { /* Already bound */
+            found = true;
+            if (src) {
+                bacnet_address_copy(src, &pMatch->address);
+            }
+            if (max_apdu) {
+                *max_apdu = pMatch->max_apdu;
+            }
+            if (device_ttl) {
+                *device_ttl = address_ttl_get(pMatch);
+            }
+            if ((pMatch->Flags & BAC_ADDR_SHORT_TTL) != 0) {    /* Was picked up opportunistacilly */
+                pMatch->Flags &= ~BAC_ADDR_SHORT_TTL;   /* Convert to normal entry  */
+                address_ttl_set(index, BAC_ADDR_LONG_TIME);     /* And give it a decent time to live */
             }
-            return (found);     /* True if bound, false if bind request outstanding */
         }
-        pMatch++;
+        return (found); /* True if bound, false if bind request outstanding */
     }
 
-    /* Not there already so look for a free entry to put it in */
-    pMatch = Address_Cache;
-    while (pMatch <= &Address_Cache[MAX_ADDRESS_CACHE - 1]) {
-        if ((pMatch->Flags & (BAC_ADDR_IN_USE | BAC_ADDR_RESERVED)) == 0) {
-            /* In use and awaiting binding */
-            pMatch->Flags = (uint8_t) (BAC_ADDR_IN_USE | BAC_ADDR_BIND_REQ);
-            pMatch->device_id = device_id;
-            /* No point in leaving bind requests in for long haul */
-            pMatch->TimeToLive = BAC_ADDR_SHORT_TIME;
-            /* now would be a good time to do a Who-Is request */
-            return (false);
-        }
-        pMatch++;
-    }
+    /* Not there already so put it in a free entry, or squeeze it in by
+       dropping an existing one. In use and awaiting binding, with no
+       point in leaving bind requests in for long haul */
+    address_entry_alloc(device_id,
+        (uint8_t) (BAC_ADDR_IN_USE | BAC_ADDR_BIND_REQ));
+    /* now would be a good time to do a Who-Is request */
 
-    /* No free entries, See if we can squeeze it in by dropping an existing one */
-    pMatch = address_remove_oldest();
-    if (pMatch != NULL) {
-        pMatch->Flags = (uint8_t) (BAC_ADDR_IN_USE | BAC_ADDR_BIND_REQ);
-        pMatch->device_id = device_id;
-        /* No point in leaving bind requests in for long haul */
-        pMatch->TimeToLive = BAC_ADDR_SHORT_TIME;
-    }
     return (false);
 }
 
@@ -660,24 +1134,21 @@ void address_add_binding(
     BACNET_ADDRESS * src)
 {
     struct Address_Cache_Entry *pMatch;
+    uint16_t index;
 
     /* existing device or bind request - update address */
-    pMatch = Address_Cache;
-    while (pMatch <= &Address_Cache[MAX_ADDRESS_CACHE - 1]) {
-        if (((pMatch->Flags & BAC_ADDR_IN_USE) != 0) &&
-            (pMatch->device_id == device_id)) {
-            bacnet_address_copy(&pMatch->address, src);
-            pMatch->max_apdu = max_apdu;
-            /* Clear bind request flag in case it was set */
-            pMatch->Flags &= ~BAC_ADDR_BIND_REQ;
-            /* Only update TTL if not static */
-            if ((pMatch->Flags & BAC_ADDR_STATIC) == 0) {
-                /* and set it on a long fuse */
-                pMatch->TimeToLive = BAC_ADDR_LONG_TIME;
-            }
-            break;
+    index = address_find_device(device_id);
+    if (index != ADDRESS_NONE) {
+        pMatch = &Address_Cache[index];
+        address_entry_set(index, src);
+        pMatch->max_apdu = max_apdu;
+        /* Clear bind request flag in case it was set */
+        pMatch->Flags &= ~BAC_ADDR_BIND_REQ;
+        /* Only update TTL if not static */
+        if ((pMatch->Flags & BAC_ADDR_STATIC) == 0) {
+            /* and set it on a long fuse */
+            address_ttl_set(index, BAC_ADDR_LONG_TIME);
         }
-        pMatch++;
     }
     return;
 }
@@ -692,7 +1163,7 @@ bool address_device_get_by_index(
     struct Address_Cache_Entry *pMatch;
     bool found = false; /* return value */
 
-    if (index < MAX_ADDRESS_CACHE) {
+    if (index < Address_Cache_Size) {
         pMatch = &Address_Cache[index];
         if ((pMatch->Flags & (BAC_ADDR_IN_USE | BAC_ADDR_BIND_REQ)) ==
             BAC_ADDR_IN_USE) {
@@ -706,7 +1177,7 @@ bool address_device_get_by_index(
                 *max_apdu = pMatch->max_apdu;
             }
             if (device_ttl) {
-                *device_ttl = pMatch->TimeToLive;
+                *device_ttl = address_ttl_get(pMatch);
             }
             found = true;
         }
@@ -724,20 +1195,26 @@ bool address_get_by_index(
     return address_device_get_by_index(index, device_id, NULL, max_apdu, src);
 }
 
+/* number of entries, for walking the cache by index */
+unsigned address_cache_size(
+    void)
+{
+    return Address_Cache_Size;
+}
+
 unsigned address_count(
     void)
 {
     struct Address_Cache_Entry *pMatch;
     unsigned count = 0; /* return value */
+    unsigned i;
 
-    pMatch = Address_Cache;
-    while (pMatch <= &Address_Cache[MAX_ADDRESS_CACHE - 1]) {
+    for (i = 0; i < Address_Cache_Size; i++) {
+        pMatch = &Address_Cache[i];
         /* Only count bound entries */
         if ((pMatch->Flags & (BAC_ADDR_IN_USE | BAC_ADDR_BIND_REQ)) ==
             BAC_ADDR_IN_USE)
             count++;
-
-        pMatch++;
     }
 
     return count;
@@ -755,14 +1232,15 @@ int address_list_encode(
     int iLen = 0;
     struct Address_Cache_Entry *pMatch;
     BACNET_OCTET_STRING MAC_Address;
+    unsigned i;
 
     /* FIXME: I really shouild check the length remaining here but it is
        fairly pointless until we have the true length remaining in
        the packet to work with as at the moment it is just MAX_APDU */
     unused_var(apdu_len);
     /* look for matching address */
-    pMatch = Address_Cache;
-    while (pMatch <= &Address_Cache[MAX_ADDRESS_CACHE - 1]) {
+    for (i = 0; i < Address_Cache_Size; i++) {
+        pMatch = &Address_Cache[i];
         if ((pMatch->Flags & (BAC_ADDR_IN_USE | BAC_ADDR_BIND_REQ)) ==
             BAC_ADDR_IN_USE) {
             iLen +=
@@ -785,7 +1263,6 @@ int address_list_encode(
                     encode_application_octet_string(&apdu[iLen], &MAC_Address);
             }
         }
-        pMatch++;
     }
 
     return (iLen);
@@ -945,7 +1422,10 @@ int rr_address_list_encode(
         pMatch++;
         pRequest->ItemCount++;  /* Chalk up another one for the response count */
 
-        while ((pMatch->Flags & (BAC_ADDR_IN_USE | BAC_ADDR_BIND_REQ)) != BAC_ADDR_IN_USE)      /* Find next bound entry */
+        /* Find next bound entry, if there is one to find */
+        while ((uiIndex <= uiTarget) &&
+            ((pMatch->Flags & (BAC_ADDR_IN_USE | BAC_ADDR_BIND_REQ)) !=
+                BAC_ADDR_IN_USE))
             pMatch++;
     }
 
@@ -961,29 +1441,35 @@ int rr_address_list_encode(
 }
 
 /****************************************************************************
- * Scan the cache and eliminate any expired entries. Should be called       *
- * periodically to ensure the cache is managed correctly. If this function  *
- * is never called at all the whole cache is effectivly rendered static and *
- * entries never expire unless explictely deleted.                          *
+ * Eliminate any expired entries. Should be called periodically to ensure   *
+ * the cache is managed correctly. If this function is never called at all *
+ * the whole cache is effectivly rendered static and entries never expire   *
+ * unless explictely deleted. Only the entries that expire are looked at.   *
  ****************************************************************************/
 
 void address_cache_timer(
     uint16_t uSeconds)
 {       /* Approximate number of seconds since last call to this function */
-    struct Address_Cache_Entry *pMatch;
-
-    pMatch = Address_Cache;
-    while (pMatch <= &Address_Cache[MAX_ADDRESS_CACHE - 1]) {
-        if (((pMatch->Flags & (BAC_ADDR_IN_USE | BAC_ADDR_RESERVED)) != 0)
-            && ((pMatch->Flags & BAC_ADDR_STATIC) == 0)) {      /* Check all entries holding a slot except statics */
-            if (pMatch->TimeToLive >= uSeconds)
-                pMatch->TimeToLive -= uSeconds;
-            else
-                pMatch->Flags = 0;
+    uint16_t index;
+
+    if (!Address_Ready)
+        address_rebuild();
+    Address_Clock += uSeconds;
+    while (Address_TTL_Count > 0) {
+        index = Address_TTL_Heap[0];
+        if (Address_Cache[index].Expires >= Address_Clock)
+            break;
+        address_entry_free(index);
+    }
+#ifdef BACNET_ADDRESS_CACHE_FILE
+    Address_Snapshot_Seconds += uSeconds;
+    if (Address_Snapshot_Seconds >= ADDRESS_SNAPSHOT_INTERVAL) {
+        Address_Snapshot_Seconds = 0;
+        if (Address_Snapshot_Dirty) {
+            address_snapshot_save(Address_Snapshot_Filename);
         }
-
-        pMatch++;
     }
+#endif
 }
 
 
@@ -1010,6 +1496,7 @@ static void set_address(
     }
 }
 
+#ifdef BACNET_ADDRESS_CACHE_FILE
 static void set_file_address(
     const char *pFilename,
     uint32_t device_id,
@@ -1091,6 +1578,7 @@ void testAddressFile(
     ct_test(pTest, bacnet_address_same(&test_address, &src));
 
 }
+#endif
 
 void testAddress(
     Test * pTest)
@@ -1141,6 +1629,87 @@ void testAddress(
     }
 }
 
+void testAddressTimer(
+    Test * pTest)
+{
+    BACNET_ADDRESS src;
+    BACNET_ADDRESS test_address;
+    unsigned test_max_apdu = 0;
+    uint32_t test_device_id = 0;
+    uint32_t test_ttl = 0;
+    unsigned i, count;
+
+    address_init();
+    /* static entries from the file, if any */
+    count = address_count();
+    /* opportunistic entry, short fuse */
+    set_address(1, &src);
+    address_add(1, 480, &src);
+    /* bound on request, long fuse */
+    ct_test(pTest, !address_bind_request(2, &test_max_apdu, &test_address));
+    set_address(2, &src);
+    address_add_binding(2, 480, &src);
+    ct_test(pTest, address_device_bind_request(2, &test_ttl, &test_max_apdu,
+            &test_address));
+    ct_test(pTest, test_ttl == BAC_ADDR_LONG_TIME);
+    /* static entry */
+    set_address(3, &src);
+    address_add(3, 480, &src);
+    address_set_device_TTL(3, 0, true);
+    ct_test(pTest, address_count() == (count + 3));
+
+    address_cache_timer(BAC_ADDR_SHORT_TIME);
+    ct_test(pTest, address_get_by_device(1, &test_max_apdu, &test_address));
+    address_cache_timer(1);
+    ct_test(pTest, !address_get_by_device(1, &test_max_apdu, &test_address));
+    set_address(1, &src);
+    ct_test(pTest, !address_get_device_id(&src, &test_device_id));
+    set_address(2, &src);
+    ct_test(pTest, address_get_device_id(&src, &test_device_id));
+    ct_test(pTest, test_device_id == 2);
+    for (i = 0; i < (BAC_ADDR_LONG_TIME / BAC_ADDR_SHORT_TIME); i++) {
+        address_cache_timer(BAC_ADDR_SHORT_TIME);
+    }
+    ct_test(pTest, !address_get_by_device(2, &test_max_apdu, &test_address));
+    ct_test(pTest, address_get_by_device(3, &test_max_apdu, &test_address));
+    ct_test(pTest, address_count() == (count + 1));
+    address_init();
+}
+
+#ifdef BACNET_ADDRESS_CACHE_FILE
+void testAddressSnapshot(
+    Test * pTest)
+{
+    BACNET_ADDRESS src;
+    BACNET_ADDRESS test_address;
+    unsigned test_max_apdu = 0;
+    uint32_t test_ttl = 0;
+
+    address_init();
+    set_address(11, &src);
+    address_add(11, 480, &src);
+    ct_test(pTest, !address_bind_request(12, &test_max_apdu, &test_address));
+    set_address(12, &src);
+    address_add_binding(12, 1476, &src);
+    ct_test(pTest, !address_bind_request(13, &test_max_apdu, &test_address));
+    ct_test(pTest, address_snapshot_save(Address_Snapshot_Filename));
+    /* a restart finds the bindings, but not the bind request */
+    address_init();
+    ct_test(pTest, address_get_by_device(11, &test_max_apdu, &test_address));
+    ct_test(pTest, test_max_apdu == 480);
+    set_address(11, &src);
+    ct_test(pTest, bacnet_address_same(&test_address, &src));
+    ct_test(pTest, address_device_bind_request(12, &test_ttl, &test_max_apdu,
+            &test_address));
+    ct_test(pTest, test_max_apdu == 1476);
+    ct_test(pTest, (test_ttl > 0) && (test_ttl <= BAC_ADDR_LONG_TIME));
+    ct_test(pTest, !address_get_by_device(13, &test_max_apdu, &test_address));
+    remove(Address_Snapshot_Filename);
+    address_init();
+    ct_test(pTest, !address_get_by_device(11, &test_max_apdu, &test_address));
+}
+#endif
+
 #ifdef TEST_ADDRESS
 int main(
     void)
@@ -1152,8 +1721,14 @@ int main(
     /* individual tests */
     rc = ct_addTestFunction(pTest, testAddress);
     assert(rc);
+    rc = ct_addTestFunction(pTest, testAddressTimer);
+    assert(rc);
+#ifdef BACNET_ADDRESS_CACHE_FILE
     rc = ct_addTestFunction(pTest, testAddressFile);
     assert(rc);
+    rc = ct_addTestFunction(pTest, testAddressSnapshot);
+    assert(rc);
+#endif
 
 
     ct_setStream(pTest, stdout);
@@ -56,6 +56,8 @@ extern int Routed_Device_Service_Approval(
 static uint16_t Timeout_Milliseconds = 3000;
 /* Number of APDU Retries */
 static uint8_t Number_Of_Retries = 3;
+/* APDU Segment Timeout in Milliseconds */
+static uint16_t Segment_Timeout_Milliseconds = 2000;
 
 /* a simple table for crossing the services supported */
 static BACNET_SERVICES_SUPPORTED
@@ -374,6 +376,18 @@ void apdu_retries_set(
     Number_Of_Retries = value;
 }
 
+uint16_t apdu_segment_timeout(
+    void)
+{
+    return Segment_Timeout_Milliseconds;
+}
+
+void apdu_segment_timeout_set(
+    uint16_t milliseconds)
+{
+    Segment_Timeout_Milliseconds = milliseconds;
+}
+
 
 /* When network communications are completely disabled,
    only DeviceCommunicationControl and ReinitializeDevice APDUs
@@ -457,6 +471,10 @@ void apdu_handler(
     uint32_t error_class = 0;
     uint8_t reason = 0;
     bool server = false;
+#if MAX_SEGMENTS_ACCEPTED
+    uint8_t *assembled = NULL;
+    uint16_t assembled_len = 0;
+#endif
 
     if (apdu) {
         /* PDU Type */
@@ -471,6 +489,18 @@ void apdu_handler(
                        shall be processed and no messages shall be initiated. */
                     break;
                 }
+#if MAX_SEGMENTS_ACCEPTED
+                if (service_data.segmented_message) {
+                    /* the service is handled once all segments are here */
+                    assembled =
+                        tsm_segment_received(src, apdu, apdu_len,
+                        &assembled_len);
+                    if (assembled) {
+                        apdu_handler(src, assembled, assembled_len);
+                    }
+                    break;
+                }
+#endif
                 if ((service_choice < MAX_BACNET_CONFIRMED_SERVICE) &&
                     (Confirmed_Function[service_choice]))
                     Confirmed_Function[service_choice] (service_request,
@@ -526,7 +556,7 @@ void apdu_handler(
                                 Confirmed_ACK_Function[service_choice]) (src,
                                 invoke_id);
                         }
-                        tsm_free_invoke_id(invoke_id);
+                        tsm_free_invoke_id_peer(src, invoke_id);
                         break;
                     default:
                         break;
@@ -540,8 +570,19 @@ void apdu_handler(
                 invoke_id = service_ack_data.invoke_id = apdu[1];
                 len = 2;
                 if (service_ack_data.segmented_message) {
+#if MAX_SEGMENTS_ACCEPTED
+                    /* the ack is handled once all segments are here */
+                    assembled =
+                        tsm_segment_received(src, apdu, apdu_len,
+                        &assembled_len);
+                    if (assembled) {
+                        apdu_handler(src, assembled, assembled_len);
+                    }
+                    break;
+#else
                     service_ack_data.sequence_number = apdu[len++];
                     service_ack_data.proposed_window_number = apdu[len++];
+#endif
                 }
                 service_choice = apdu[len++];
                 service_request = &apdu[len];
@@ -570,16 +611,25 @@ void apdu_handler(
                                 (service_request, service_request_len, src,
                                 &service_ack_data);
                         }
-                        tsm_free_invoke_id(invoke_id);
+                        tsm_free_invoke_id_peer(src, invoke_id);
                         break;
                     default:
                         break;
                 }
                 break;
             case PDU_TYPE_SEGMENT_ACK:
+#if MAX_SEGMENTS_ACCEPTED
+                /* the TSM matches src and invoke ID to a transaction */
+                if (apdu_len >= 4) {
+                    tsm_segment_ack_received(src, apdu[1], apdu[2], apdu[3],
+                        (apdu[0] & BIT(1)) ? true : false,
+                        (apdu[0] & BIT(0)) ? true : false);
+                }
+#else
                 /* FIXME: what about a denial of service attack here?
                    we could check src to see if that matched the tsm */
-                tsm_free_invoke_id(invoke_id);
+                tsm_free_invoke_id_peer(src, invoke_id);
+#endif
                 break;
             case PDU_TYPE_ERROR:
                 invoke_id = apdu[1];
@@ -618,14 +668,14 @@ void apdu_handler(
                             (BACNET_ERROR_CLASS) error_class,
                             (BACNET_ERROR_CODE) error_code);
                 }
-                tsm_free_invoke_id(invoke_id);
+                tsm_free_invoke_id_peer(src, invoke_id);
                 break;
             case PDU_TYPE_REJECT:
                 invoke_id = apdu[1];
                 reason = apdu[2];
                 if (Reject_Function)
                     Reject_Function(src, invoke_id, reason);
-                tsm_free_invoke_id(invoke_id);
+                tsm_free_invoke_id_peer(src, invoke_id);
                 break;
             case PDU_TYPE_ABORT:
                 server = apdu[0] & 0x01;
@@ -633,7 +683,11 @@ void apdu_handler(
                 reason = apdu[2];
                 if (Abort_Function)
                     Abort_Function(src, invoke_id, reason, server);
-                tsm_free_invoke_id(invoke_id);
+#if MAX_SEGMENTS_ACCEPTED
+                /* an abort from the server ends our side as the client */
+                tsm_segmented_free(src, invoke_id, !server);
+#endif
+                tsm_free_invoke_id_peer(src, invoke_id);
                 break;
             default:
                 break;
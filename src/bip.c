@@ -32,6 +32,9 @@
  -------------------------------------------
 ####COPYRIGHTEND####*/
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE     /* for recvmmsg */
+#endif
 #include <stdint.h>     /* for standard integer types uint8_t etc. */
 #include <stdbool.h>    /* for the standard bool type. */
 #include "bacdcode.h"
@@ -52,6 +55,20 @@ static uint16_t BIP_Port = 0;   /* this will force initialization in demos */
 static struct in_addr BIP_Address;
 /* Broadcast Address - stored in network byte order */
 static struct in_addr BIP_Broadcast_Address;
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+#define BIP_RECVMMSG 1
+/* datagrams drained from the socket by one recvmmsg, and handed out
+   one at a time by the following calls to bip_receive_mpdu */
+#ifndef BIP_RECEIVE_BATCH
+#define BIP_RECEIVE_BATCH 16
+#endif
+static uint8_t BIP_Rx_Buf[BIP_RECEIVE_BATCH][MAX_MPDU];
+static struct sockaddr_in BIP_Rx_Addr[BIP_RECEIVE_BATCH];
+static struct mmsghdr BIP_Rx_Msg[BIP_RECEIVE_BATCH];
+static struct iovec BIP_Rx_Iov[BIP_RECEIVE_BATCH];
+static unsigned BIP_Rx_Count = 0;
+static unsigned BIP_Rx_Next = 0;
+#endif
 
 /** Setter for the BACnet/IP socket handle.
  *
@@ -61,6 +78,11 @@ void bip_set_socket(
     int sock_fd)
 {
     BIP_Socket = sock_fd;
+#if defined(BIP_RECVMMSG)
+    /* anything still queued came from the previous socket */
+    BIP_Rx_Count = 0;
+    BIP_Rx_Next = 0;
+#endif
 }
 
 /** Getter for the BACnet/IP socket handle.
@@ -205,6 +227,95 @@ int bip_send_pdu(
     return bytes_sent;
 }
 
+/** Receives the next datagram from the BACnet/IP socket, as is.
+ * On Linux, each wakeup drains the socket with a single recvmmsg, and
+ * the datagrams that came with it are returned by the next calls
+ * without waiting, so a burst costs one system call and not one each.
+ *
+ * @param sin [out] Source address of the datagram, in network order.
+ * @param mtu [out] Buffer for the datagram.
+ * @param max_mtu [in] Size of the mtu[] buffer; longer datagrams are
+ *  truncated.
+ * @param timeout [in] The number of milliseconds to wait for a datagram.
+ * @return The number of octets received, zero on timeout,
+ *  or negative on error.
+ */
+int bip_receive_mpdu(
+    struct sockaddr_in *sin,
+    uint8_t * mtu,
+    uint16_t max_mtu,
+    unsigned timeout)
+{
+    fd_set read_fds;
+    int max = 0;
+    struct timeval select_timeout;
+#if defined(BIP_RECVMMSG)
+    unsigned len = 0;
+    unsigned i = 0;
+    int count = 0;
+#else
+    socklen_t sin_len = sizeof(*sin);
+#endif
+
+    if (BIP_Socket < 0) {
+        return -1;
+    }
+#if defined(BIP_RECVMMSG)
+    if (BIP_Rx_Next < BIP_Rx_Count) {
+        i = BIP_Rx_Next++;
+        len = BIP_Rx_Msg[i].msg_len;
+        if (len > max_mtu) {
+            len = max_mtu;
+        }
+        memcpy(mtu, BIP_Rx_Buf[i], len);
+        *sin = BIP_Rx_Addr[i];
+        return (int) len;
+    }
+#endif
+    /* we could just use a non-blocking socket, but that consumes all
+       the CPU time.  We can use a timeout; it is only supported as
+       a select. */
+    if (timeout >= 1000) {
+        select_timeout.tv_sec = timeout / 1000;
+        select_timeout.tv_usec =
+            1000 * (timeout - select_timeout.tv_sec * 1000);
+    } else {
+        select_timeout.tv_sec = 0;
+        select_timeout.tv_usec = 1000 * timeout;
+    }
+    FD_ZERO(&read_fds);
+    FD_SET(BIP_Socket, &read_fds);
+    max = BIP_Socket;
+    /* see if there is a packet for us */
+    if (select(max + 1, &read_fds, NULL, NULL, &select_timeout) <= 0) {
+        return 0;
+    }
+#if defined(BIP_RECVMMSG)
+    for (i = 0; i < BIP_RECEIVE_BATCH; i++) {
+        BIP_Rx_Iov[i].iov_base = BIP_Rx_Buf[i];
+        BIP_Rx_Iov[i].iov_len = sizeof(BIP_Rx_Buf[i]);
+        memset(&BIP_Rx_Msg[i], 0, sizeof(BIP_Rx_Msg[i]));
+        BIP_Rx_Msg[i].msg_hdr.msg_name = &BIP_Rx_Addr[i];
+        BIP_Rx_Msg[i].msg_hdr.msg_namelen = sizeof(BIP_Rx_Addr[i]);
+        BIP_Rx_Msg[i].msg_hdr.msg_iov = &BIP_Rx_Iov[i];
+        BIP_Rx_Msg[i].msg_hdr.msg_iovlen = 1;
+    }
+    count =
+        recvmmsg(BIP_Socket, BIP_Rx_Msg, BIP_RECEIVE_BATCH, MSG_DONTWAIT,
+        NULL);
+    if (count <= 0) {
+        return count;
+    }
+    BIP_Rx_Count = (unsigned) count;
+    BIP_Rx_Next = 0;
+
+    return bip_receive_mpdu(sin, mtu, max_mtu, 0);
+#else
+    return recvfrom(BIP_Socket, (char *) &mtu[0], max_mtu, 0,
+        (struct sockaddr *) sin, &sin_len);
+#endif
+}
+
 /** Implementation of the receive() function for BACnet/IP; receives one
  * packet, verifies its BVLC header, and removes the BVLC header from
  * the PDU data before returning.
@@ -224,11 +335,7 @@ uint16_t bip_receive(
 {
     int received_bytes = 0;
     uint16_t pdu_len = 0;       /* return value */
-    fd_set read_fds;
-    int max = 0;
-    struct timeval select_timeout;
     struct sockaddr_in sin = { 0 };
-    socklen_t sin_len = sizeof(sin);
     uint16_t i = 0;
     int function = 0;
 
@@ -236,27 +343,7 @@ uint16_t bip_receive(
     if (BIP_Socket < 0)
         return 0;
 
-    /* we could just use a non-blocking socket, but that consumes all
-       the CPU time.  We can use a timeout; it is only supported as
-       a select. */
-    if (timeout >= 1000) {
-        select_timeout.tv_sec = timeout / 1000;
-        select_timeout.tv_usec =
-            1000 * (timeout - select_timeout.tv_sec * 1000);
-    } else {
-        select_timeout.tv_sec = 0;
-        select_timeout.tv_usec = 1000 * timeout;
-    }
-    FD_ZERO(&read_fds);
-    FD_SET(BIP_Socket, &read_fds);
-    max = BIP_Socket;
-    /* see if there is a packet for us */
-    if (select(max + 1, &read_fds, NULL, NULL, &select_timeout) > 0)
-        received_bytes =
-            recvfrom(BIP_Socket, (char *) &pdu[0], max_pdu, 0,
-            (struct sockaddr *) &sin, &sin_len);
-    else
-        return 0;
+    received_bytes = bip_receive_mpdu(&sin, &pdu[0], max_pdu, timeout);
 
     /* See if there is a problem */
     if (received_bytes < 0) {
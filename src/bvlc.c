@@ -32,6 +32,9 @@
  -------------------------------------------
 ####COPYRIGHTEND####*/
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE     /* for sendmmsg */
+#endif
 #include <stdint.h>     /* for standard integer types uint8_t etc. */
 #include <stdbool.h>    /* for the standard bool type. */
 #include <time.h>
@@ -89,22 +92,202 @@ entry if no re-registration occurs. This value will be initialized
 to the 2-octet Time-to-Live value supplied at the time of
 registration.*/
 typedef struct {
-    bool valid;
     /* BACnet/IP address */
     struct in_addr dest_address;
     /* BACnet/IP port number - not always 47808=BAC0h */
     uint16_t dest_port;
     /* seconds for valid entry lifetime */
     uint16_t time_to_live;
-    /* our counter */
-    time_t seconds_remaining;   /* includes 30 second grace period */
+    /* FDT clock second when the entry is purged,
+       including the 30 second grace period */
+    uint32_t expire;
+    /* next entry in the same hash bucket */
+    unsigned hash_next;
+    /* neighbors in the same timer wheel slot */
+    unsigned timer_next;
+    unsigned timer_prev;
 } FD_TABLE_ENTRY;
 
+/* The FDT is a dense array that grows as devices register, so the
+   forwarding loop only visits live entries.  Entries are found by
+   B/IP address through a hash table, and purged by a timer wheel of
+   one second slots, so registration, renewal, deletion and the
+   maintenance timer don't depend on the number of foreign devices.
+   A deleted entry is replaced by the last one in the array. */
 #ifndef MAX_FD_ENTRIES
-#define MAX_FD_ENTRIES 128
+#define MAX_FD_ENTRIES 4096
 #endif
-static FD_TABLE_ENTRY FD_Table[MAX_FD_ENTRIES];
+#define FDT_NONE (~0U)
+#define FDT_WHEEL_SIZE 256
+static FD_TABLE_ENTRY *FD_Table = NULL;
+static unsigned FD_Count = 0;
+static unsigned FD_Size = 0;
+/* hash of the B/IP address to the first entry, FD_Size buckets */
+static unsigned *FD_Hash = NULL;
+/* first entry that expires in each slot - slot is expire modulo size */
+static unsigned FD_Wheel[FDT_WHEEL_SIZE];
+static bool FD_Wheel_Initialized = false;
+/* seconds counted by bvlc_maintenance_timer */
+static uint32_t FD_Clock = 0;
+
+static unsigned bvlc_fdt_hash(
+    uint32_t address,
+    uint16_t port)
+{
+    uint32_t hash;
+
+    hash = address ^ ((uint32_t) port << 16) ^ port;
+    hash *= 2654435761UL;
+
+    return (unsigned) (hash >> 8) & (FD_Size - 1);
+}
+
+static unsigned bvlc_fdt_find(
+    uint32_t address,
+    uint16_t port)
+{
+    unsigned i;
+
+    if (!FD_Count) {
+        return FDT_NONE;
+    }
+    i = FD_Hash[bvlc_fdt_hash(address, port)];
+    while (i != FDT_NONE) {
+        if ((FD_Table[i].dest_address.s_addr == address) &&
+            (FD_Table[i].dest_port == port)) {
+            break;
+        }
+        i = FD_Table[i].hash_next;
+    }
+
+    return i;
+}
+
+static void bvlc_fdt_hash_link(
+    unsigned i)
+{
+    unsigned bucket;
+
+    bucket =
+        bvlc_fdt_hash(FD_Table[i].dest_address.s_addr,
+        FD_Table[i].dest_port);
+    FD_Table[i].hash_next = FD_Hash[bucket];
+    FD_Hash[bucket] = i;
+}
+
+/* replaces the reference to entry i in its hash chain with j */
+static void bvlc_fdt_hash_replace(
+    unsigned i,
+    unsigned j)
+{
+    unsigned *link;
+
+    link =
+        &FD_Hash[bvlc_fdt_hash(FD_Table[i].dest_address.s_addr,
+            FD_Table[i].dest_port)];
+    while (*link != i) {
+        link = &FD_Table[*link].hash_next;
+    }
+    *link = j;
+}
+
+static void bvlc_fdt_timer_link(
+    unsigned i)
+{
+    unsigned slot = FD_Table[i].expire % FDT_WHEEL_SIZE;
+
+    FD_Table[i].timer_prev = FDT_NONE;
+    FD_Table[i].timer_next = FD_Wheel[slot];
+    if (FD_Wheel[slot] != FDT_NONE) {
+        FD_Table[FD_Wheel[slot]].timer_prev = i;
+    }
+    FD_Wheel[slot] = i;
+}
+
+/* replaces the reference to entry i in its timer slot with j */
+static void bvlc_fdt_timer_replace(
+    unsigned i,
+    unsigned j)
+{
+    FD_TABLE_ENTRY *entry = &FD_Table[i];
+
+    if (entry->timer_prev != FDT_NONE) {
+        FD_Table[entry->timer_prev].timer_next = j;
+    } else {
+        FD_Wheel[entry->expire % FDT_WHEEL_SIZE] = j;
+    }
+    if (entry->timer_next != FDT_NONE) {
+        FD_Table[entry->timer_next].timer_prev = j;
+    }
+}
 
+static void bvlc_fdt_timer_unlink(
+    unsigned i)
+{
+    FD_TABLE_ENTRY *entry = &FD_Table[i];
+
+    bvlc_fdt_timer_replace(i, entry->timer_next);
+    if (entry->timer_next != FDT_NONE) {
+        FD_Table[entry->timer_next].timer_prev = entry->timer_prev;
+    }
+}
+
+/* removes entry i, and moves the last entry into its place */
+static void bvlc_fdt_remove(
+    unsigned i)
+{
+    unsigned last = FD_Count - 1;
+
+    bvlc_fdt_hash_replace(i, FD_Table[i].hash_next);
+    bvlc_fdt_timer_unlink(i);
+    if (i != last) {
+        bvlc_fdt_hash_replace(last, i);
+        bvlc_fdt_timer_replace(last, i);
+        FD_Table[i] = FD_Table[last];
+    }
+    FD_Count--;
+}
+
+/* doubles the table and the hash, up to MAX_FD_ENTRIES */
+static bool bvlc_fdt_grow(
+    void)
+{
+    FD_TABLE_ENTRY *table;
+    unsigned *hash;
+    unsigned size;
+    unsigned i;
+
+    size = FD_Size ? (FD_Size * 2) : 16;
+    if (size > MAX_FD_ENTRIES) {
+        return false;
+    }
+    table = realloc(FD_Table, size * sizeof(FD_TABLE_ENTRY));
+    if (!table) {
+        return false;
+    }
+    FD_Table = table;
+    hash = realloc(FD_Hash, size * sizeof(unsigned));
+    if (!hash) {
+        return false;
+    }
+    FD_Hash = hash;
+    FD_Size = size;
+    for (i = 0; i < FD_Size; i++) {
+        FD_Hash[i] = FDT_NONE;
+    }
+    for (i = 0; i < FD_Count; i++) {
+        bvlc_fdt_hash_link(i);
+    }
+
+    return true;
+}
+
+/* seconds remaining before the entry is purged */
+static uint32_t bvlc_fdt_seconds_remaining(
+    unsigned i)
+{
+    return FD_Table[i].expire - FD_Clock;
+}
 
 /** A timer function that is called about once a second.
  *
@@ -113,20 +296,33 @@ static FD_TABLE_ENTRY FD_Table[MAX_FD_ENTRIES];
 void bvlc_maintenance_timer(
     time_t seconds)
 {
-    unsigned i = 0;
+    unsigned slot;
+    unsigned i;
+    unsigned next;
 
-    for (i = 0; i < MAX_FD_ENTRIES; i++) {
-        if (FD_Table[i].valid) {
-            if (FD_Table[i].seconds_remaining) {
-                if (FD_Table[i].seconds_remaining < seconds) {
-                    FD_Table[i].seconds_remaining = 0;
-                } else {
-                    FD_Table[i].seconds_remaining -= seconds;
-                }
-                if (FD_Table[i].seconds_remaining == 0) {
-                    FD_Table[i].valid = false;
+    if (!FD_Wheel_Initialized || (seconds <= 0)) {
+        return;
+    }
+    if (seconds > FDT_WHEEL_SIZE) {
+        /* each slot is visited once by the remaining ticks */
+        FD_Clock += (uint32_t) (seconds - FDT_WHEEL_SIZE);
+        seconds = FDT_WHEEL_SIZE;
+    }
+    while (seconds) {
+        FD_Clock++;
+        seconds--;
+        slot = FD_Clock % FDT_WHEEL_SIZE;
+        i = FD_Wheel[slot];
+        while (i != FDT_NONE) {
+            next = FD_Table[i].timer_next;
+            if ((int32_t) (FD_Table[i].expire - FD_Clock) <= 0) {
+                if (next == FD_Count - 1) {
+                    /* the last entry is moved into this place */
+                    next = i;
                 }
+                bvlc_fdt_remove(i);
             }
+            i = next;
         }
     }
 }
@@ -526,32 +722,31 @@ static int bvlc_encode_read_fdt_ack(
     int len = 0;
     unsigned count = 0;
     unsigned i;
-    uint16_t seconds_remaining = 0;
+    uint32_t seconds_remaining = 0;
 
-    for (i = 0; i < MAX_FD_ENTRIES; i++) {
-        if (FD_Table[i].valid) {
-            count++;
-        }
+    /* as many entries as fit - a single Ack can't carry a large FDT */
+    count = FD_Count;
+    if (max_pdu < 4) {
+        return 0;
+    }
+    if (count > (unsigned) ((max_pdu - 4) / 10)) {
+        count = (max_pdu - 4) / 10;
     }
     len = bvlc_encode_read_fdt_ack_init(&pdu[0], count);
     pdu_len += len;
-    for (i = 0; i < MAX_FD_ENTRIES; i++) {
-        if (FD_Table[i].valid) {
-            /* too much to send */
-            if ((pdu_len + 10) > max_pdu) {
-                pdu_len = 0;
-                break;
-            }
-            len =
-                bvlc_encode_bip_address(&pdu[pdu_len],
-                &FD_Table[i].dest_address, FD_Table[i].dest_port);
-            pdu_len += len;
-            len = encode_unsigned16(&pdu[pdu_len], FD_Table[i].time_to_live);
-            pdu_len += len;
-            seconds_remaining = (uint16_t) FD_Table[i].seconds_remaining;
-            len = encode_unsigned16(&pdu[pdu_len], seconds_remaining);
-            pdu_len += len;
+    for (i = 0; i < count; i++) {
+        len =
+            bvlc_encode_bip_address(&pdu[pdu_len],
+            &FD_Table[i].dest_address, FD_Table[i].dest_port);
+        pdu_len += len;
+        len = encode_unsigned16(&pdu[pdu_len], FD_Table[i].time_to_live);
+        pdu_len += len;
+        seconds_remaining = bvlc_fdt_seconds_remaining(i);
+        if (seconds_remaining > 0xFFFF) {
+            seconds_remaining = 0xFFFF;
         }
+        len = encode_unsigned16(&pdu[pdu_len], (uint16_t) seconds_remaining);
+        pdu_len += len;
     }
 
     return pdu_len;
@@ -718,40 +913,36 @@ static bool bvlc_register_foreign_device(
     uint16_t time_to_live)
 {
     unsigned i = 0;
-    bool status = false;
 
-    /* am I here already?  If so, update my time to live... */
-    for (i = 0; i < MAX_FD_ENTRIES; i++) {
-        if (FD_Table[i].valid) {
-            if ((FD_Table[i].dest_address.s_addr == sin->sin_addr.s_addr) &&
-                (FD_Table[i].dest_port == sin->sin_port)) {
-                status = true;
-                FD_Table[i].time_to_live = time_to_live;
-                /*  Upon receipt of a BVLL Register-Foreign-Device message,
-                   a BBMD shall start a timer with a value equal to the
-                   Time-to-Live parameter supplied plus a fixed grace
-                   period of 30 seconds. */
-                FD_Table[i].seconds_remaining = time_to_live + 30;
-                break;
-            }
+    if (!FD_Wheel_Initialized) {
+        for (i = 0; i < FDT_WHEEL_SIZE; i++) {
+            FD_Wheel[i] = FDT_NONE;
         }
+        FD_Wheel_Initialized = true;
     }
-    if (!status) {
-        for (i = 0; i < MAX_FD_ENTRIES; i++) {
-            if (!FD_Table[i].valid) {
-                FD_Table[i].dest_address.s_addr = sin->sin_addr.s_addr;
-                FD_Table[i].dest_port = sin->sin_port;
-                FD_Table[i].time_to_live = time_to_live;
-                FD_Table[i].seconds_remaining = time_to_live + 30;
-                FD_Table[i].valid = true;
-                status = true;
-                break;
-            }
+    /* am I here already?  If so, update my time to live... */
+    i = bvlc_fdt_find(sin->sin_addr.s_addr, sin->sin_port);
+    if (i != FDT_NONE) {
+        bvlc_fdt_timer_unlink(i);
+    } else {
+        if ((FD_Count >= FD_Size) && !bvlc_fdt_grow()) {
+            return false;
         }
+        i = FD_Count;
+        FD_Count++;
+        FD_Table[i].dest_address.s_addr = sin->sin_addr.s_addr;
+        FD_Table[i].dest_port = sin->sin_port;
+        bvlc_fdt_hash_link(i);
     }
+    FD_Table[i].time_to_live = time_to_live;
+    /*  Upon receipt of a BVLL Register-Foreign-Device message,
+       a BBMD shall start a timer with a value equal to the
+       Time-to-Live parameter supplied plus a fixed grace
+       period of 30 seconds. */
+    FD_Table[i].expire = FD_Clock + time_to_live + 30;
+    bvlc_fdt_timer_link(i);
 
-
-    return status;
+    return true;
 }
 
 /** Delete a Foreign Device from the Foreign Device Table
@@ -768,16 +959,10 @@ static bool bvlc_delete_foreign_device(
     unsigned i = 0;
 
     bvlc_decode_bip_address(pdu, &sin.sin_addr, &sin.sin_port);
-    for (i = 0; i < MAX_FD_ENTRIES; i++) {
-        if (FD_Table[i].valid) {
-            if ((FD_Table[i].dest_address.s_addr == sin.sin_addr.s_addr) &&
-                (FD_Table[i].dest_port == sin.sin_port)) {
-                FD_Table[i].valid = false;
-                FD_Table[i].seconds_remaining = 0;
-                status = true;
-                break;
-            }
-        }
+    i = bvlc_fdt_find(sin.sin_addr.s_addr, sin.sin_port);
+    if (i != FDT_NONE) {
+        bvlc_fdt_remove(i);
+        status = true;
     }
     return status;
 }
@@ -816,6 +1001,77 @@ int bvlc_send_mpdu(
         (struct sockaddr *) &bvlc_dest, sizeof(struct sockaddr));
 }
 
+#if defined(BBMD_ENABLED) && BBMD_ENABLED
+/* destinations handed to the kernel by each sendmmsg */
+#ifndef BVLC_SEND_BATCH
+#define BVLC_SEND_BATCH 64
+#endif
+
+/** Sends the same MPDU to a list of destinations.
+ * On Linux they go out with one sendmmsg for each BVLC_SEND_BATCH
+ * destinations, rather than one sendto each.  As with separate
+ * sends, a destination that fails does not stop the others.
+ *
+ * @param dest - the destination addresses, in network byte order
+ * @param count - the number of destinations
+ * @param mtu - the bytes of data to send
+ * @param mtu_len - the number of bytes of data to send
+ * @return the number of destinations the MPDU was sent to
+ */
+static unsigned bvlc_send_mpdu_multiple(
+    struct sockaddr_in *dest,
+    unsigned count,
+    uint8_t * mtu,
+    uint16_t mtu_len)
+{
+    unsigned sent = 0;
+    unsigned i = 0;
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+    struct mmsghdr msg[BVLC_SEND_BATCH];
+    struct iovec iov;
+    unsigned batch = 0;
+    unsigned j = 0;
+    int rv = 0;
+
+    if (bip_socket() < 0) {
+        return 0;
+    }
+    iov.iov_base = mtu;
+    iov.iov_len = mtu_len;
+    while (i < count) {
+        batch = count - i;
+        if (batch > BVLC_SEND_BATCH) {
+            batch = BVLC_SEND_BATCH;
+        }
+        memset(msg, 0, batch * sizeof(msg[0]));
+        for (j = 0; j < batch; j++) {
+            dest[i + j].sin_family = AF_INET;
+            msg[j].msg_hdr.msg_name = &dest[i + j];
+            msg[j].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+            msg[j].msg_hdr.msg_iov = &iov;
+            msg[j].msg_hdr.msg_iovlen = 1;
+        }
+        rv = sendmmsg(bip_socket(), msg, batch, 0);
+        if (rv > 0) {
+            sent += (unsigned) rv;
+            i += (unsigned) rv;
+        } else {
+            /* the first one failed - skip it, and carry on */
+            i++;
+        }
+    }
+#else
+    for (i = 0; i < count; i++) {
+        if (bvlc_send_mpdu(&dest[i], mtu, mtu_len) > 0) {
+            sent++;
+        }
+    }
+#endif
+
+    return sent;
+}
+#endif
+
 #if defined(BBMD_ENABLED) && BBMD_ENABLED
 /** Sends all Broadcast Devices a Forwarded NPDU
  *
@@ -836,6 +1092,8 @@ static void bvlc_bdt_forward_npdu(
     uint16_t mtu_len = 0;
     unsigned i = 0;     /* loop counter */
     struct sockaddr_in bip_dest = { 0 };
+    struct sockaddr_in dest_list[MAX_BBMD_ENTRIES];
+    unsigned count = 0;
 
     /* If we are forwarding an original broadcast message and the NAT
      * handling is enabled, change the source address to NAT routers
@@ -886,11 +1144,13 @@ static void bvlc_bdt_forward_npdu(
                 (bip_dest.sin_port == bip_get_port())) {
                 continue;
             }
-            bvlc_send_mpdu(&bip_dest, mtu, mtu_len);
+            dest_list[count] = bip_dest;
+            count++;
             debug_printf("BVLC: BDT Sent Forwarded-NPDU to %s:%04X\n",
                 inet_ntoa(bip_dest.sin_addr), ntohs(bip_dest.sin_port));
         }
     }
+    bvlc_send_mpdu_multiple(&dest_list[0], count, mtu, mtu_len);
 
     return;
 }
@@ -941,6 +1201,8 @@ static void bvlc_fdt_forward_npdu(
     uint16_t mtu_len = 0;
     unsigned i = 0;     /* loop counter */
     struct sockaddr_in bip_dest = { 0 };
+    struct sockaddr_in dest_list[BVLC_SEND_BATCH];
+    unsigned count = 0;
 
     /* If we are forwarding an original broadcast message and the NAT
      * handling is enabled, change the source address to NAT routers
@@ -961,33 +1223,39 @@ static void bvlc_fdt_forward_npdu(
     }
 
     /* loop through the FDT and send one to each entry */
-    for (i = 0; i < MAX_FD_ENTRIES; i++) {
-        if (FD_Table[i].valid && FD_Table[i].seconds_remaining) {
-            bip_dest.sin_addr.s_addr = FD_Table[i].dest_address.s_addr;
-            bip_dest.sin_port = FD_Table[i].dest_port;
-            /* don't send to my ip address and same port */
-            if ((bip_dest.sin_addr.s_addr == bip_get_addr()) &&
-                (bip_dest.sin_port == bip_get_port())) {
-                continue;
-            }
-            /* don't send to src ip address and same port */
-            if ((bip_dest.sin_addr.s_addr == sin->sin_addr.s_addr) &&
-                (bip_dest.sin_port == sin->sin_port)) {
-                continue;
-            }
-            /* NAT router port forwards BACnet packets from global IP to us.
-             * Packets sent to that global IP by us would end up back, creating
-             * a loop.
-             */
-            if (BVLC_NAT_Handling &&
-                (bip_dest.sin_addr.s_addr == BVLC_Global_Address.s_addr) &&
-                (bip_dest.sin_port == bip_get_port())) {
-                continue;
-            }
-            bvlc_send_mpdu(&bip_dest, mtu, mtu_len);
-            debug_printf("BVLC: FDT Sent Forwarded-NPDU to %s:%04X\n",
-                inet_ntoa(bip_dest.sin_addr), ntohs(bip_dest.sin_port));
+    for (i = 0; i < FD_Count; i++) {
+        bip_dest.sin_addr.s_addr = FD_Table[i].dest_address.s_addr;
+        bip_dest.sin_port = FD_Table[i].dest_port;
+        /* don't send to my ip address and same port */
+        if ((bip_dest.sin_addr.s_addr == bip_get_addr()) &&
+            (bip_dest.sin_port == bip_get_port())) {
+            continue;
+        }
+        /* don't send to src ip address and same port */
+        if ((bip_dest.sin_addr.s_addr == sin->sin_addr.s_addr) &&
+            (bip_dest.sin_port == sin->sin_port)) {
+            continue;
+        }
+        /* NAT router port forwards BACnet packets from global IP to us.
+         * Packets sent to that global IP by us would end up back, creating
+         * a loop.
+         */
+        if (BVLC_NAT_Handling &&
+            (bip_dest.sin_addr.s_addr == BVLC_Global_Address.s_addr) &&
+            (bip_dest.sin_port == bip_get_port())) {
+            continue;
         }
+        dest_list[count] = bip_dest;
+        count++;
+        debug_printf("BVLC: FDT Sent Forwarded-NPDU to %s:%04X\n",
+            inet_ntoa(bip_dest.sin_addr), ntohs(bip_dest.sin_port));
+        if (count == BVLC_SEND_BATCH) {
+            bvlc_send_mpdu_multiple(&dest_list[0], count, mtu, mtu_len);
+            count = 0;
+        }
+    }
+    if (count) {
+        bvlc_send_mpdu_multiple(&dest_list[0], count, mtu, mtu_len);
     }
 
     return;
@@ -1110,13 +1378,9 @@ uint16_t bvlc_receive(
     unsigned timeout)
 {
     uint16_t npdu_len = 0;      /* return value */
-    fd_set read_fds;
-    int max = 0;
-    struct timeval select_timeout;
     struct sockaddr_in sin = { 0 };
     struct sockaddr_in original_sin = { 0 };
     struct sockaddr_in dest = { 0 };
-    socklen_t sin_len = sizeof(sin);
     int received_bytes = 0;
     uint16_t result_code = 0;
     uint16_t i = 0;
@@ -1128,28 +1392,7 @@ uint16_t bvlc_receive(
         return 0;
     }
 
-    /* we could just use a non-blocking socket, but that consumes all
-       the CPU time.  We can use a timeout; it is only supported as
-       a select. */
-    if (timeout >= 1000) {
-        select_timeout.tv_sec = timeout / 1000;
-        select_timeout.tv_usec =
-            1000 * (timeout - select_timeout.tv_sec * 1000);
-    } else {
-        select_timeout.tv_sec = 0;
-        select_timeout.tv_usec = 1000 * timeout;
-    }
-    FD_ZERO(&read_fds);
-    FD_SET(bip_socket(), &read_fds);
-    max = bip_socket();
-    /* see if there is a packet for us */
-    if (select(max + 1, &read_fds, NULL, NULL, &select_timeout) > 0) {
-        received_bytes =
-            recvfrom(bip_socket(), (char *) &npdu[0], max_npdu, 0,
-            (struct sockaddr *) &sin, &sin_len);
-    } else {
-        return 0;
-    }
+    received_bytes = bip_receive_mpdu(&sin, &npdu[0], max_npdu, timeout);
     /* See if there is a problem */
     if (received_bytes < 0) {
         return 0;
@@ -581,6 +581,56 @@ void tsm_free_invoke_id(
     (void) invokeID;
 }
 
+void tsm_free_invoke_id_peer(
+    BACNET_ADDRESS * dest,
+    uint8_t invokeID)
+{
+    (void) dest;
+    (void) invokeID;
+}
+
+#if MAX_SEGMENTS_ACCEPTED
+uint8_t *tsm_segment_received(
+    BACNET_ADDRESS * src,
+    uint8_t * apdu,
+    uint16_t apdu_len,
+    uint16_t * assembled_len)
+{
+    (void) src;
+    (void) apdu;
+    (void) apdu_len;
+    (void) assembled_len;
+
+    return NULL;
+}
+
+void tsm_segment_ack_received(
+    BACNET_ADDRESS * src,
+    uint8_t invokeID,
+    uint8_t sequence_number,
+    uint8_t actual_window_size,
+    bool nak,
+    bool server)
+{
+    (void) src;
+    (void) invokeID;
+    (void) sequence_number;
+    (void) actual_window_size;
+    (void) nak;
+    (void) server;
+}
+
+void tsm_segmented_free(
+    BACNET_ADDRESS * src,
+    uint8_t invokeID,
+    bool server)
+{
+    (void) src;
+    (void) invokeID;
+    (void) server;
+}
+#endif
+
 void iam_handler(
     uint8_t * service_request,
     uint16_t service_len,
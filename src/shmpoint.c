@@ -0,0 +1,423 @@
+/**************************************************************************
+*
+* Copyright (C) 2016 Steve Karg <skarg@users.sourceforge.net>
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*********************************************************************/
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shmpoint.h"
+
+/** @file shmpoint.c  Shared-memory point table */
+
+/* attempts to get a consistent copy while the writer is busy */
+#define SHM_POINT_READ_TRIES 64
+
+static const BACNET_OBJECT_TYPE Shm_Object_Types[SHM_POINT_TABLES] = {
+    OBJECT_ANALOG_INPUT,
+    OBJECT_ANALOG_OUTPUT,
+    OBJECT_ANALOG_VALUE,
+    OBJECT_BINARY_INPUT,
+    OBJECT_BINARY_OUTPUT,
+    OBJECT_BINARY_VALUE,
+    OBJECT_MULTI_STATE_INPUT,
+    OBJECT_MULTI_STATE_OUTPUT,
+    OBJECT_MULTI_STATE_VALUE
+};
+
+static SHM_POINT_HEADER *Shm_Header;
+static size_t Shm_Size;
+/* table generation and point sequences seen by the last poll */
+static uint32_t Shm_Generation[SHM_POINT_TABLES];
+static uint32_t *Shm_Sequence[SHM_POINT_TABLES];
+
+static size_t shm_point_size(
+    void)
+{
+    return sizeof(SHM_POINT_HEADER) +
+        (SHM_POINT_TABLES * SHM_POINT_TABLE_SIZE * sizeof(SHM_POINT));
+}
+
+/* fills in the table descriptors of a new mapping */
+static void shm_point_layout(
+    SHM_POINT_HEADER * header)
+{
+    unsigned i;
+
+    header->version = SHM_POINT_VERSION;
+    header->tables = SHM_POINT_TABLES;
+    header->size = shm_point_size();
+    header->point_size = sizeof(SHM_POINT);
+    for (i = 0; i < SHM_POINT_TABLES; i++) {
+        header->table[i].object_type = Shm_Object_Types[i];
+        header->table[i].count = SHM_POINT_TABLE_SIZE;
+        header->table[i].offset = sizeof(SHM_POINT_HEADER) +
+            (i * SHM_POINT_TABLE_SIZE * sizeof(SHM_POINT));
+        header->table[i].generation = 0;
+    }
+}
+
+/* true if a mapping made by another process has our layout */
+static bool shm_point_layout_valid(
+    SHM_POINT_HEADER * header)
+{
+    unsigned i;
+
+    if ((header->magic != SHM_POINT_MAGIC) ||
+        (header->version != SHM_POINT_VERSION) ||
+        (header->tables != SHM_POINT_TABLES) ||
+        (header->size != shm_point_size()) ||
+        (header->point_size != sizeof(SHM_POINT))) {
+        return false;
+    }
+    for (i = 0; i < SHM_POINT_TABLES; i++) {
+        if ((header->table[i].object_type != Shm_Object_Types[i]) ||
+            (header->table[i].count != SHM_POINT_TABLE_SIZE) ||
+            (header->table[i].offset != sizeof(SHM_POINT_HEADER) +
+                (i * SHM_POINT_TABLE_SIZE * sizeof(SHM_POINT)))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static SHM_POINT_TABLE *shm_point_table(
+    BACNET_OBJECT_TYPE object_type,
+    unsigned *index)
+{
+    unsigned i;
+
+    if (!Shm_Header) {
+        return NULL;
+    }
+    for (i = 0; i < SHM_POINT_TABLES; i++) {
+        if (Shm_Object_Types[i] == object_type) {
+            if (index) {
+                *index = i;
+            }
+            return &Shm_Header->table[i];
+        }
+    }
+
+    return NULL;
+}
+
+static SHM_POINT *shm_point_get(
+    SHM_POINT_TABLE * table,
+    uint32_t slot)
+{
+    return (SHM_POINT *) ((uint8_t *) Shm_Header + table->offset) + slot;
+}
+
+/* finds the slot of an instance by linear probing from its hash,
+   optionally claiming a free slot for it.  Slots are never freed,
+   so a free slot ends the search. */
+static SHM_POINT *shm_point_find(
+    SHM_POINT_TABLE * table,
+    uint32_t object_instance,
+    bool claim)
+{
+    SHM_POINT *point;
+    uint32_t key = object_instance + 1;
+    uint32_t mask = table->count - 1;
+    uint32_t slot, probes;
+
+    if (key == 0) {
+        return NULL;
+    }
+    /* a multiplicative hash spreads a run of instances without collisions */
+    slot = (object_instance * 2654435761UL) & mask;
+    for (probes = 0; probes < table->count; probes++) {
+        point = shm_point_get(table, slot);
+        if (point->key == key) {
+            return point;
+        }
+        if (point->key == 0) {
+            if (!claim) {
+                return NULL;
+            }
+            /* the other side may be claiming the same slot */
+            if (__sync_bool_compare_and_swap(&point->key, 0, key) ||
+                (point->key == key)) {
+                return point;
+            }
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    return NULL;
+}
+
+/* copies a point under its sequence lock, and returns the sequence */
+static bool shm_point_copy(
+    SHM_POINT * point,
+    SHM_POINT_VALUE * value,
+    uint32_t * sequence)
+{
+    unsigned tries;
+    uint32_t begin, end;
+
+    for (tries = 0; tries < SHM_POINT_READ_TRIES; tries++) {
+        begin = point->sequence;
+        if (begin & 1) {
+            /* the writer is in the middle of an update */
+            continue;
+        }
+        __sync_synchronize();
+        value->value = point->value;
+        value->flags = point->flags;
+        value->seconds = point->seconds;
+        value->nanoseconds = point->nanoseconds;
+        __sync_synchronize();
+        end = point->sequence;
+        if (begin == end) {
+            if (sequence) {
+                *sequence = begin;
+            }
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/** Maps the point table, creating it if it does not exist yet.
+ * Either side may create the table; the other side attaches to it
+ * and checks that the layout matches its own.
+ * @param name - shared memory object name, or NULL for SHM_POINT_NAME
+ * @param create - true to create the table if it does not exist
+ * @return true if the table is mapped
+ */
+bool shm_point_open(
+    const char *name,
+    bool create)
+{
+    SHM_POINT_HEADER *header;
+    struct stat st;
+    size_t size = shm_point_size();
+    bool initialize = false;
+    unsigned i;
+    int fd = -1;
+
+    shm_point_close();
+    if (!name) {
+        name = SHM_POINT_NAME;
+    }
+    if (create) {
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0660);
+        if (fd >= 0) {
+            if (ftruncate(fd, size) != 0) {
+                close(fd);
+                shm_unlink(name);
+                return false;
+            }
+            initialize = true;
+        }
+    }
+    if (fd < 0) {
+        fd = shm_open(name, O_RDWR, 0);
+        if (fd < 0) {
+            return false;
+        }
+        if ((fstat(fd, &st) != 0) || ((size_t) st.st_size < size)) {
+            close(fd);
+            return false;
+        }
+    }
+    header =
+        mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED) {
+        return false;
+    }
+    if (initialize) {
+        /* the new object is zero filled: all points unwritten */
+        shm_point_layout(header);
+        __sync_synchronize();
+        header->magic = SHM_POINT_MAGIC;
+    } else if (!shm_point_layout_valid(header)) {
+        munmap(header, size);
+        return false;
+    }
+    Shm_Header = header;
+    Shm_Size = size;
+    for (i = 0; i < SHM_POINT_TABLES; i++) {
+        Shm_Sequence[i] = calloc(SHM_POINT_TABLE_SIZE, sizeof(uint32_t));
+        if (!Shm_Sequence[i]) {
+            shm_point_close();
+            return false;
+        }
+        /* differ from the table, so the first poll reads every point */
+        Shm_Generation[i] = ~header->table[i].generation;
+    }
+
+    return true;
+}
+
+/** Unmaps the point table.  The shared memory object stays,
+ * for the other side and for the next start.
+ */
+void shm_point_close(
+    void)
+{
+    unsigned i;
+
+    if (Shm_Header) {
+        munmap(Shm_Header, Shm_Size);
+        Shm_Header = NULL;
+        Shm_Size = 0;
+    }
+    for (i = 0; i < SHM_POINT_TABLES; i++) {
+        free(Shm_Sequence[i]);
+        Shm_Sequence[i] = NULL;
+    }
+}
+
+/** Publishes a point.  There must be only one writer for each point.
+ * @param object_type - the object type of the point
+ * @param object_instance - the instance
+ * @param value - the present value
+ * @param flags - SHM_POINT_ flags
+ * @return true if the point was written, false if the table of the
+ *  type is full
+ */
+bool shm_point_write(
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance,
+    float value,
+    uint32_t flags)
+{
+    SHM_POINT_TABLE *table;
+    SHM_POINT *point;
+    struct timespec now;
+    uint32_t sequence;
+
+    table = shm_point_table(object_type, NULL);
+    if (!table) {
+        return false;
+    }
+    point = shm_point_find(table, object_instance, true);
+    if (!point) {
+        /* table full */
+        return false;
+    }
+    clock_gettime(CLOCK_REALTIME, &now);
+    sequence = point->sequence;
+    point->sequence = sequence + 1;
+    __sync_synchronize();
+    point->value = value;
+    point->flags = flags | SHM_POINT_VALID;
+    point->seconds = (uint32_t) now.tv_sec;
+    point->nanoseconds = (uint32_t) now.tv_nsec;
+    __sync_synchronize();
+    point->sequence = sequence + 2;
+    /* full barrier, and safe with one writer per point */
+    __sync_fetch_and_add(&table->generation, 1);
+
+    return true;
+}
+
+/** Reads a consistent copy of a point.
+ * @param object_type - the object type of the point
+ * @param object_instance - the instance
+ * @param point - the copy
+ * @return true if the point was written at least once and was copied
+ */
+bool shm_point_read(
+    BACNET_OBJECT_TYPE object_type,
+    uint32_t object_instance,
+    SHM_POINT_VALUE * point)
+{
+    SHM_POINT_TABLE *table;
+    SHM_POINT *shm;
+
+    table = shm_point_table(object_type, NULL);
+    if (!table || !point) {
+        return false;
+    }
+    shm = shm_point_find(table, object_instance, false);
+    if (!shm || !shm_point_copy(shm, point, NULL)) {
+        return false;
+    }
+
+    return (point->flags & SHM_POINT_VALID) ? true : false;
+}
+
+/** Calls back for each point of a type that was written since the
+ * last poll.  Costs a single load when nothing was written.
+ * A point that stays busy during the poll is picked up by the next one.
+ * @param object_type - the object type of the points
+ * @param callback - called with each changed point
+ * @return the number of changed points
+ */
+int shm_point_poll(
+    BACNET_OBJECT_TYPE object_type,
+    shm_point_function callback)
+{
+    SHM_POINT_TABLE *table;
+    SHM_POINT_VALUE value;
+    SHM_POINT *point;
+    uint32_t generation, sequence, i;
+    unsigned index = 0;
+    bool busy = false;
+    int changed = 0;
+
+    table = shm_point_table(object_type, &index);
+    if (!table) {
+        return 0;
+    }
+    generation = table->generation;
+    if (generation == Shm_Generation[index]) {
+        return 0;
+    }
+    __sync_synchronize();
+    for (i = 0; i < table->count; i++) {
+        point = shm_point_get(table, i);
+        if (point->sequence == Shm_Sequence[index][i]) {
+            continue;
+        }
+        if (!shm_point_copy(point, &value, &sequence)) {
+            busy = true;
+            continue;
+        }
+        Shm_Sequence[index][i] = sequence;
+        if (!(value.flags & SHM_POINT_VALID)) {
+            continue;
+        }
+        changed++;
+        if (callback) {
+            /* the key of a written slot no longer changes */
+            callback(object_type, point->key - 1, &value);
+        }
+    }
+    if (!busy) {
+        Shm_Generation[index] = generation;
+    }
+
+    return changed;
+}
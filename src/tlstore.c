@@ -0,0 +1,447 @@
+/**************************************************************************
+*
+* Copyright (C) 2016 Steve Karg <skarg@users.sourceforge.net>
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be included
+* in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*********************************************************************/
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "tlstore.h"
+
+/** @file tlstore.c  Memory-mapped trend log storage */
+
+static uint32_t tl_store_check(
+    TL_STORE_META * meta,
+    uint32_t sequence)
+{
+    uint32_t fields[5];
+    uint8_t *octet = (uint8_t *) & fields[0];
+    uint32_t hash = 2166136261UL;
+    unsigned i;
+
+    fields[0] = sequence;
+    fields[1] = meta->head;
+    fields[2] = meta->count;
+    fields[3] = meta->total;
+    fields[4] = meta->step;
+    for (i = 0; i < sizeof(fields); i++) {
+        hash = (hash ^ octet[i]) * 16777619UL;
+    }
+
+    return hash;
+}
+
+/* the records start on a page of their own */
+static uint32_t tl_store_offset(
+    void)
+{
+    long page = sysconf(_SC_PAGESIZE);
+
+    if (page < (long) sizeof(TL_STORE_HEADER)) {
+        page = 4096;
+    }
+
+    return (uint32_t) page;
+}
+
+static size_t tl_store_size(
+    uint32_t capacity)
+{
+    return tl_store_offset() +
+        (((size_t) capacity + 1) * sizeof(TL_STORE_RECORD));
+}
+
+/* writes the pages of a range of the file mapping to the disk */
+static void tl_store_msync(
+    TL_STORE * store,
+    void *start,
+    size_t length,
+    int flags)
+{
+    size_t offset = (size_t) ((uint8_t *) start - (uint8_t *) store->header);
+    size_t page = tl_store_offset();
+    size_t first = offset - (offset % page);
+
+    msync((uint8_t *) store->header + first, (offset - first) + length,
+        flags);
+}
+
+/* writes the records appended since the last time, and then the
+   metadata, to the disk */
+static void tl_store_sync(
+    TL_STORE * store)
+{
+    uint32_t slots = store->capacity + 1;
+    uint32_t unsynced = store->unsynced;
+    uint32_t first;
+
+    if (unsynced > slots) {
+        unsynced = slots;
+    }
+    if (unsynced) {
+        first = (store->head + slots - unsynced) % slots;
+        if ((first + unsynced) > slots) {
+            /* the range wraps around the end of the ring */
+            tl_store_msync(store, &store->records[0],
+                (first + unsynced - slots) * sizeof(TL_STORE_RECORD),
+                MS_SYNC);
+            unsynced = slots - first;
+        }
+        tl_store_msync(store, &store->records[first],
+            unsynced * sizeof(TL_STORE_RECORD), MS_SYNC);
+    }
+    tl_store_msync(store, store->header, sizeof(TL_STORE_HEADER), MS_SYNC);
+    store->unsynced = 0;
+}
+
+/* writes the inactive metadata slot, making it the current one */
+static void tl_store_commit(
+    TL_STORE * store)
+{
+    uint32_t sequence = store->sequence + 1;
+    TL_STORE_META *meta = &store->header->meta[sequence & 1];
+
+    meta->head = store->head;
+    meta->count = store->count;
+    meta->total = store->total;
+    meta->step = store->step;
+    meta->check = tl_store_check(meta, sequence);
+    __sync_synchronize();
+    meta->sequence = sequence;
+    store->sequence = sequence;
+}
+
+/* loads the newest metadata slot that is intact */
+static void tl_store_load(
+    TL_STORE * store)
+{
+    TL_STORE_META *meta;
+    TL_STORE_META *current = NULL;
+    unsigned i;
+
+    for (i = 0; i < 2; i++) {
+        meta = &store->header->meta[i];
+        if ((meta->check != tl_store_check(meta, meta->sequence)) ||
+            (meta->head > store->capacity) ||
+            (meta->count > store->capacity)) {
+            continue;
+        }
+        if (!current || ((int32_t) (meta->sequence - current->sequence) > 0)) {
+            current = meta;
+        }
+    }
+    if (current) {
+        store->sequence = current->sequence;
+        store->head = current->head;
+        store->count = current->count;
+        store->total = current->total;
+        store->step = current->step;
+    } else {
+        store->sequence = 0;
+        store->head = 0;
+        store->count = 0;
+        store->total = 0;
+        store->step = 0;
+    }
+}
+
+static void tl_store_layout(
+    TL_STORE_HEADER * header,
+    uint32_t capacity)
+{
+    memset(header, 0, sizeof(TL_STORE_HEADER));
+    header->version = TL_STORE_VERSION;
+    header->record_size = sizeof(TL_STORE_RECORD);
+    header->capacity = capacity;
+    header->offset = tl_store_offset();
+}
+
+static bool tl_store_layout_valid(
+    TL_STORE_HEADER * header,
+    uint32_t capacity)
+{
+    return (header->magic == TL_STORE_MAGIC) &&
+        (header->version == TL_STORE_VERSION) &&
+        (header->record_size == sizeof(TL_STORE_RECORD)) &&
+        (header->capacity == capacity) &&
+        (header->offset == tl_store_offset());
+}
+
+/* maps the ring file of a log, or returns NULL */
+static TL_STORE_HEADER *tl_store_map_file(
+    const char *directory,
+    uint32_t instance,
+    size_t size)
+{
+    char path[256];
+    struct stat st;
+    void *map;
+    int fd;
+
+    if (snprintf(path, sizeof(path), "%s/tl_%lu.bin", directory,
+            (unsigned long) instance) >= (int) sizeof(path)) {
+        return NULL;
+    }
+    /* the directory may be on a volatile file system */
+    mkdir(directory, 0755);
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return NULL;
+    }
+    if ((fstat(fd, &st) != 0) ||
+        (((size_t) st.st_size != size) && (ftruncate(fd, size) != 0))) {
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    return (TL_STORE_HEADER *) map;
+}
+
+/** Maps the ring of a trend log, keeping the records that are in its
+ * file from before if the file has the same capacity.
+ * The pages of the ring are only read in as the records are used.
+ * @param store - the store to open
+ * @param directory - where the ring files are kept, or NULL to keep
+ *  the records in memory only
+ * @param instance - the Trend Log instance, which names the file
+ * @param capacity - records in the ring, up to TL_STORE_CAPACITY_MAX
+ * @return true if the ring is mapped, from the file or from memory
+ */
+bool tl_store_open(
+    TL_STORE * store,
+    const char *directory,
+    uint32_t instance,
+    uint32_t capacity)
+{
+    TL_STORE_HEADER *header = NULL;
+    void *map;
+    size_t size;
+
+    memset(store, 0, sizeof(TL_STORE));
+    if (capacity == 0) {
+        capacity = 1;
+    } else if (capacity > TL_STORE_CAPACITY_MAX) {
+        capacity = TL_STORE_CAPACITY_MAX;
+    }
+    size = tl_store_size(capacity);
+    if (directory && directory[0]) {
+        header = tl_store_map_file(directory, instance, size);
+    }
+    if (header) {
+        store->persistent = true;
+    } else {
+        map =
+            mmap(NULL, size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (map == MAP_FAILED) {
+            return false;
+        }
+        header = (TL_STORE_HEADER *) map;
+    }
+    store->header = header;
+    store->records =
+        (TL_STORE_RECORD *) ((uint8_t *) header + tl_store_offset());
+    store->size = size;
+    store->capacity = capacity;
+    if (tl_store_layout_valid(header, capacity)) {
+        tl_store_load(store);
+    } else {
+        /* a new file, or a different capacity: start an empty ring */
+        tl_store_layout(header, capacity);
+        tl_store_commit(store);
+        __sync_synchronize();
+        header->magic = TL_STORE_MAGIC;
+    }
+
+    return true;
+}
+
+/** Unmaps the ring.  The records stay in the file for the next open.
+ * @param store - the store to close
+ */
+void tl_store_close(
+    TL_STORE * store)
+{
+    if (store->header) {
+        if (store->persistent) {
+            msync(store->header, store->size, MS_SYNC);
+        }
+        munmap(store->header, store->size);
+    }
+    memset(store, 0, sizeof(TL_STORE));
+}
+
+/** Adds a record to the ring, dropping the oldest if the ring is full.
+ * @param store - the store
+ * @param record - the record to add
+ * @return true if the record was added
+ */
+bool tl_store_append(
+    TL_STORE * store,
+    const TL_STORE_RECORD * record)
+{
+    if (!store->header) {
+        return false;
+    }
+    if ((store->count > 0) &&
+        (record->timestamp <
+            tl_store_record(store, store->count)->timestamp)) {
+        /* the clock went back */
+        store->step = store->total + 1;
+    }
+    store->records[store->head] = *record;
+    __sync_synchronize();
+    if (store->persistent) {
+        /* start writing the record before the metadata refers to it */
+        tl_store_msync(store, &store->records[store->head],
+            sizeof(TL_STORE_RECORD), MS_ASYNC);
+        store->unsynced++;
+    }
+    store->head++;
+    if (store->head > store->capacity) {
+        store->head = 0;
+    }
+    if (store->count < store->capacity) {
+        store->count++;
+    }
+    store->total++;
+    tl_store_commit(store);
+    if (store->unsynced >= TL_STORE_SYNC_RECORDS) {
+        tl_store_sync(store);
+    }
+
+    return true;
+}
+
+/** Empties the ring.  The count of records ever written is kept.
+ * @param store - the store
+ */
+void tl_store_clear(
+    TL_STORE * store)
+{
+    if (!store->header) {
+        return;
+    }
+    store->count = 0;
+    tl_store_commit(store);
+}
+
+/** Finds a record by its position in the ring.
+ * @param store - the store
+ * @param position - 1 for the oldest record, up to the record count
+ * @return the record, or NULL if there is no such position
+ */
+TL_STORE_RECORD *tl_store_record(
+    TL_STORE * store,
+    uint32_t position)
+{
+    uint32_t slot;
+
+    if (!store->header || (position == 0) || (position > store->count)) {
+        return NULL;
+    }
+    /* the ring has capacity + 1 slots, and the oldest is count back */
+    slot = store->head + (store->capacity + 1) - store->count + position - 1;
+    if (slot > store->capacity) {
+        slot -= store->capacity + 1;
+    }
+
+    return &store->records[slot];
+}
+
+/** Steps to the record after one from tl_store_record, wrapping
+ * around the ring.  The caller keeps count of the records it has seen.
+ * @param store - the store
+ * @param record - a record in the ring
+ * @return the next record
+ */
+TL_STORE_RECORD *tl_store_next(
+    TL_STORE * store,
+    TL_STORE_RECORD * record)
+{
+    record++;
+    if (record > &store->records[store->capacity]) {
+        record = &store->records[0];
+    }
+
+    return record;
+}
+
+/** Tells if the records in the ring are in time order, that is no
+ * record is stamped earlier than the one before it.
+ * @param store - the store
+ * @return true if the records are in time order
+ */
+bool tl_store_ordered(
+    TL_STORE * store)
+{
+    /* the record before the step is at position count - (total - step) */
+    return (store->step == 0) ||
+        ((store->total - store->step) + 1 >= store->count);
+}
+
+/** Finds the first record stamped at or after a time: with a binary
+ * search while the records are in time order, else with a linear scan
+ * from the oldest record.
+ * @param store - the store
+ * @param timestamp - seconds since the epoch
+ * @return the position of the record, or one past the record count
+ *  if all of the records are older
+ */
+uint32_t tl_store_find(
+    TL_STORE * store,
+    uint32_t timestamp)
+{
+    uint32_t low = 1;
+    uint32_t high = store->count + 1;
+    uint32_t middle;
+    TL_STORE_RECORD *record;
+
+    if (!tl_store_ordered(store)) {
+        record = tl_store_record(store, 1);
+        while ((low < high) && (record->timestamp < timestamp)) {
+            record = tl_store_next(store, record);
+            low++;
+        }
+
+        return low;
+    }
+    while (low < high) {
+        middle = low + ((high - low) / 2);
+        if (tl_store_record(store, middle)->timestamp < timestamp) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
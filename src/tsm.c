@@ -35,11 +35,13 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <string.h>
 #include "bits.h"
 #include "apdu.h"
 #include "bacdef.h"
 #include "bacdcode.h"
 #include "bacenum.h"
+#include "abort.h"
 #include "tsm.h"
 #include "config.h"
 #include "datalink.h"
@@ -55,16 +57,98 @@
 /* If we are only a server and only initiate broadcasts, */
 /* then we don't need a TSM layer. */
 
-/* FIXME: not coded for segmentation */
+/* Segmentation: we receive segmented requests and ComplexACKs,
+   and send segmented ComplexACKs.  Our own requests are not segmented. */
+
+#if (MAX_TSM_TRANSACTIONS > 65534)
+#error MAX_TSM_TRANSACTIONS is too large
+#endif
 
 /* declare space for the TSM transactions, and set it up in the init. */
 /* table rules: an Invoke ID = 0 is an unused spot in the table */
 static BACNET_TSM_DATA TSM_List[MAX_TSM_TRANSACTIONS];
+/* the slot + 1 of each invoke ID that is unique among all peers */
+static uint16_t TSM_Index[256];
+/* the number of transactions using each invoke ID of a peer space */
+static uint16_t TSM_Peer_ID_Count[256];
+/* released slots (slot + 1, linked by TimerNext), and the slots */
+/* that were never used, which follow the first TSM_Slots_Used */
+static uint16_t TSM_Free_List;
+static uint16_t TSM_Slots_Used;
+static uint16_t TSM_Active_Count;
+
+/* transactions (slot + 1) of the peer spaces by dest and invoke ID, */
+/* and peers by dest */
+#ifndef TSM_HASH_SIZE
+#define TSM_HASH_SIZE 256
+#endif
+#if (TSM_HASH_SIZE & (TSM_HASH_SIZE - 1))
+#error TSM_HASH_SIZE must be a power of two
+#endif
+static uint16_t TSM_Hash[TSM_HASH_SIZE];
+
+/* A peer with outstanding invoke IDs of its own space,
+   or with a window that is not the default one. */
+#ifndef TSM_MAX_PEERS
+#define TSM_MAX_PEERS MAX_TSM_TRANSACTIONS
+#endif
+struct TSM_Peer {
+    BACNET_ADDRESS address;
+    uint16_t active;
+    /* next (index + 1) in the hash chain or the free list */
+    uint16_t next;
+    /* the maximum of active, 0 for TSM_PEER_WINDOW */
+    uint8_t window;
+    uint8_t next_invoke_id;
+};
+static struct TSM_Peer TSM_Peer_List[TSM_MAX_PEERS];
+static uint16_t TSM_Peer_Hash[TSM_HASH_SIZE];
+static uint16_t TSM_Peer_Free_List;
+static uint16_t TSM_Peers_Used;
 
 /* invoke ID for incrementing between subsequent calls. */
 static uint8_t Current_Invoke_ID = 1;
+/* the last invoke ID of tsm_next_free_invokeID() */
+#if (TSM_PEER_INVOKE_ID_FIRST > 1)
+#define TSM_INVOKE_ID_LAST (TSM_PEER_INVOKE_ID_FIRST - 1)
+#else
+#define TSM_INVOKE_ID_LAST 255
+#endif
 
 static tsm_timeout_function Timeout_Function;
+static tsm_timeout_peer_function Timeout_Peer_Function;
+
+/* Request timers run on a two level timer wheel, so that the timer
+   only visits the transactions that expire.  A tick is
+   TSM_TIMER_TICK_MS, and the wheel spans TSM_WHEEL_SIZE^2 ticks. */
+#ifndef TSM_TIMER_TICK_MS
+#define TSM_TIMER_TICK_MS 32
+#endif
+#define TSM_WHEEL_BITS 6
+#define TSM_WHEEL_SIZE (1 << TSM_WHEEL_BITS)
+#define TSM_WHEEL_MASK (TSM_WHEEL_SIZE - 1)
+#if (65535 / TSM_TIMER_TICK_MS) >= (TSM_WHEEL_SIZE * (TSM_WHEEL_SIZE - 1))
+#error TSM_TIMER_TICK_MS is too small for the longest APDU timeout
+#endif
+/* slot + 1 of the first transaction in each bucket; */
+/* the upper level follows the lower one */
+static uint16_t TSM_Wheel[2 * TSM_WHEEL_SIZE];
+static uint32_t TSM_Ticks;
+static uint16_t TSM_Tick_Remainder;
+static uint16_t TSM_Timers_Running;
+
+#if MAX_SEGMENTS_ACCEPTED
+/* the window size that we propose when sending segments */
+#define TSM_PROPOSED_WINDOW_SIZE 16
+/* segmented ComplexACK header: type, invoke ID, sequence, window, service */
+#define TSM_SEGMENTED_ACK_HEADER 5
+static BACNET_TSM_SEGMENTED_DATA
+    TSM_Segmented_List[MAX_TSM_SEGMENTED_TRANSACTIONS];
+/* a segment, Segment-ACK or Abort on its way out */
+static uint8_t TSM_Segment_Buffer[MAX_PDU];
+static void tsm_segmented_timer(
+    uint16_t milliseconds);
+#endif
 
 void tsm_set_timeout_handler(
     tsm_timeout_function pFunction)
@@ -72,71 +156,302 @@ void tsm_set_timeout_handler(
     Timeout_Function = pFunction;
 }
 
-/* returns MAX_TSM_TRANSACTIONS if not found */
-static uint8_t tsm_find_invokeID_index(
+/** Sets the handler of the requests that failed to confirm and that
+ * use an invoke ID from tsm_next_free_invokeID_peer().  Without it,
+ * the handler of tsm_set_timeout_handler() is called for them too.
+ * @param pFunction [in] The handler, or NULL.
+ */
+void tsm_set_timeout_peer_handler(
+    tsm_timeout_peer_function pFunction)
+{
+    Timeout_Peer_Function = pFunction;
+}
+
+/* hashes the fields that bacnet_address_same() compares */
+static uint32_t tsm_address_hash(
+    BACNET_ADDRESS * dest)
+{
+    uint32_t hash = 2166136261UL;
+    uint8_t i, len;
+
+    hash = (hash ^ (dest->net & 0xFF)) * 16777619UL;
+    hash = (hash ^ (dest->net >> 8)) * 16777619UL;
+    len = dest->len;
+    if (len > MAX_MAC_LEN)
+        len = MAX_MAC_LEN;
+    for (i = 0; i < len; i++) {
+        hash = (hash ^ dest->adr[i]) * 16777619UL;
+    }
+    if (dest->net == 0) {
+        len = dest->mac_len;
+        if (len > MAX_MAC_LEN)
+            len = MAX_MAC_LEN;
+        for (i = 0; i < len; i++) {
+            hash = (hash ^ dest->mac[i]) * 16777619UL;
+        }
+    }
+
+    return hash;
+}
+
+static unsigned tsm_hash_bucket(
+    BACNET_ADDRESS * dest,
     uint8_t invokeID)
 {
-    unsigned i = 0;     /* counter */
-    uint8_t index = MAX_TSM_TRANSACTIONS;       /* return value */
+    return (unsigned) (((tsm_address_hash(dest) ^ invokeID) * 16777619UL) &
+        (TSM_HASH_SIZE - 1));
+}
+
+static void tsm_hash_link(
+    uint16_t index)
+{
+    unsigned bucket =
+        tsm_hash_bucket(&TSM_List[index].dest, TSM_List[index].InvokeID);
+
+    TSM_List[index].HashNext = TSM_Hash[bucket];
+    TSM_List[index].Hashed = true;
+    TSM_Hash[bucket] = index + 1;
+}
 
-    for (i = 0; i < MAX_TSM_TRANSACTIONS; i++) {
-        if (TSM_List[i].InvokeID == invokeID) {
-            index = (uint8_t) i;
+static void tsm_hash_unlink(
+    uint16_t index)
+{
+    unsigned bucket;
+    uint16_t *link;
+
+    if (!TSM_List[index].Hashed) {
+        return;
+    }
+    bucket = tsm_hash_bucket(&TSM_List[index].dest, TSM_List[index].InvokeID);
+    for (link = &TSM_Hash[bucket]; *link; link = &TSM_List[*link - 1].HashNext) {
+        if (*link == (index + 1)) {
+            *link = TSM_List[index].HashNext;
             break;
         }
     }
+    TSM_List[index].HashNext = 0;
+    TSM_List[index].Hashed = false;
+}
+
+/* the transaction with this dest and invoke ID; returns MAX_TSM_TRANSACTIONS
+   if not found */
+static uint16_t tsm_hash_find(
+    BACNET_ADDRESS * dest,
+    uint8_t invokeID)
+{
+    uint16_t slot;
+
+    slot = TSM_Hash[tsm_hash_bucket(dest, invokeID)];
+    while (slot) {
+        if ((TSM_List[slot - 1].InvokeID == invokeID) &&
+            bacnet_address_same(&TSM_List[slot - 1].dest, dest)) {
+            return slot - 1;
+        }
+        slot = TSM_List[slot - 1].HashNext;
+    }
+
+    return MAX_TSM_TRANSACTIONS;
+}
+
+/* finds the transaction of a peer, or else the one with an invoke ID
+   that is unique among all peers, as a reply may come from another
+   address than the one the request was sent to.
+   returns MAX_TSM_TRANSACTIONS if not found */
+static uint16_t tsm_find(
+    BACNET_ADDRESS * dest,
+    uint8_t invokeID)
+{
+    uint16_t index = MAX_TSM_TRANSACTIONS;       /* return value */
+
+    if (invokeID == 0) {
+        return index;
+    }
+    if (dest && TSM_Peer_ID_Count[invokeID]) {
+        index = tsm_hash_find(dest, invokeID);
+    }
+    if ((index == MAX_TSM_TRANSACTIONS) && TSM_Index[invokeID]) {
+        index = TSM_Index[invokeID] - 1;
+    }
 
     return index;
 }
 
-static uint8_t tsm_find_first_free_index(
-    void)
+/* returns the peer index + 1, or 0 if not found and not created */
+static uint16_t tsm_peer_find(
+    BACNET_ADDRESS * dest,
+    bool create)
 {
-    unsigned i = 0;     /* counter */
-    uint8_t index = MAX_TSM_TRANSACTIONS;       /* return value */
+    unsigned bucket = tsm_address_hash(dest) & (TSM_HASH_SIZE - 1);
+    struct TSM_Peer *peer;
+    uint16_t slot;
 
-    for (i = 0; i < MAX_TSM_TRANSACTIONS; i++) {
-        if (TSM_List[i].InvokeID == 0) {
-            index = (uint8_t) i;
-            break;
+    for (slot = TSM_Peer_Hash[bucket]; slot; slot = peer->next) {
+        peer = &TSM_Peer_List[slot - 1];
+        if (bacnet_address_same(&peer->address, dest)) {
+            return slot;
         }
     }
+    if (!create) {
+        return 0;
+    }
+    if (TSM_Peer_Free_List) {
+        slot = TSM_Peer_Free_List;
+        TSM_Peer_Free_List = TSM_Peer_List[slot - 1].next;
+    } else if (TSM_Peers_Used < TSM_MAX_PEERS) {
+        slot = ++TSM_Peers_Used;
+    } else {
+        return 0;
+    }
+    peer = &TSM_Peer_List[slot - 1];
+    bacnet_address_copy(&peer->address, dest);
+    peer->active = 0;
+    peer->window = 0;
+    peer->next_invoke_id = TSM_PEER_INVOKE_ID_FIRST;
+    peer->next = TSM_Peer_Hash[bucket];
+    TSM_Peer_Hash[bucket] = slot;
 
-    return index;
+    return slot;
 }
 
-bool tsm_transaction_available(
-    void)
+/* forgets a peer with no outstanding requests and the default window */
+static void tsm_peer_release(
+    uint16_t slot)
 {
-    bool status = false;        /* return value */
-    unsigned i = 0;     /* counter */
+    struct TSM_Peer *peer = &TSM_Peer_List[slot - 1];
+    unsigned bucket;
+    uint16_t *link;
 
-    for (i = 0; i < MAX_TSM_TRANSACTIONS; i++) {
-        if (TSM_List[i].InvokeID == 0) {
-            /* one is available! */
-            status = true;
+    if (peer->active || peer->window) {
+        return;
+    }
+    bucket = tsm_address_hash(&peer->address) & (TSM_HASH_SIZE - 1);
+    for (link = &TSM_Peer_Hash[bucket]; *link;
+        link = &TSM_Peer_List[*link - 1].next) {
+        if (*link == slot) {
+            *link = peer->next;
             break;
         }
     }
+    peer->next = TSM_Peer_Free_List;
+    TSM_Peer_Free_List = slot;
+}
 
-    return status;
+/* puts a running timer into the bucket of its expiry tick */
+static void tsm_timer_link(
+    uint16_t index)
+{
+    BACNET_TSM_DATA *data = &TSM_List[index];
+    unsigned bucket = 0;
+
+    if ((uint32_t) (data->RequestTimer - TSM_Ticks) < TSM_WHEEL_SIZE) {
+        bucket = data->RequestTimer & TSM_WHEEL_MASK;
+    } else {
+        bucket = TSM_WHEEL_SIZE +
+            ((data->RequestTimer >> TSM_WHEEL_BITS) & TSM_WHEEL_MASK);
+    }
+    data->TimerBucket = (uint8_t) (bucket + 1);
+    data->TimerPrev = 0;
+    data->TimerNext = TSM_Wheel[bucket];
+    if (data->TimerNext) {
+        TSM_List[data->TimerNext - 1].TimerPrev = index + 1;
+    }
+    TSM_Wheel[bucket] = index + 1;
 }
 
-uint8_t tsm_transaction_idle_count(
+static void tsm_timer_unlink(
+    uint16_t index)
+{
+    BACNET_TSM_DATA *data = &TSM_List[index];
+
+    if (data->TimerPrev) {
+        TSM_List[data->TimerPrev - 1].TimerNext = data->TimerNext;
+    } else {
+        TSM_Wheel[data->TimerBucket - 1] = data->TimerNext;
+    }
+    if (data->TimerNext) {
+        TSM_List[data->TimerNext - 1].TimerPrev = data->TimerPrev;
+    }
+    data->TimerBucket = 0;
+    data->TimerNext = 0;
+    data->TimerPrev = 0;
+}
+
+static void tsm_timer_stop(
+    uint16_t index)
+{
+    if (TSM_List[index].TimerBucket) {
+        tsm_timer_unlink(index);
+        TSM_Timers_Running--;
+    }
+}
+
+static void tsm_timer_start(
+    uint16_t index,
+    uint16_t milliseconds)
+{
+    /* rounded down, as the timer may be called once a second */
+    uint32_t ticks = milliseconds / TSM_TIMER_TICK_MS;
+
+    tsm_timer_stop(index);
+    if (ticks == 0) {
+        ticks = 1;
+    }
+    TSM_List[index].RequestTimer = TSM_Ticks + ticks;
+    tsm_timer_link(index);
+    TSM_Timers_Running++;
+}
+
+static uint16_t tsm_slot_alloc(
     void)
 {
-    uint8_t count = 0;  /* return value */
-    unsigned i = 0;     /* counter */
+    uint16_t slot = 0;
 
-    for (i = 0; i < MAX_TSM_TRANSACTIONS; i++) {
-        if ((TSM_List[i].InvokeID == 0) &&
-            (TSM_List[i].state == TSM_STATE_IDLE)) {
-            /* one is available! */
-            count++;
-        }
+    if (TSM_Free_List) {
+        slot = TSM_Free_List;
+        TSM_Free_List = TSM_List[slot - 1].TimerNext;
+        TSM_List[slot - 1].TimerNext = 0;
+    } else if (TSM_Slots_Used < MAX_TSM_TRANSACTIONS) {
+        slot = ++TSM_Slots_Used;
+    }
+    if (slot) {
+        TSM_Active_Count++;
     }
 
-    return count;
+    return slot;
+}
+
+static void tsm_slot_free(
+    uint16_t index)
+{
+    BACNET_TSM_DATA *data = &TSM_List[index];
+
+    tsm_timer_stop(index);
+    tsm_hash_unlink(index);
+    if (data->Peer) {
+        TSM_Peer_ID_Count[data->InvokeID]--;
+        TSM_Peer_List[data->Peer - 1].active--;
+        tsm_peer_release(data->Peer);
+        data->Peer = 0;
+    } else {
+        TSM_Index[data->InvokeID] = 0;
+    }
+    data->state = TSM_STATE_IDLE;
+    data->InvokeID = 0;
+    data->TimerNext = TSM_Free_List;
+    TSM_Free_List = index + 1;
+    TSM_Active_Count--;
+}
+
+bool tsm_transaction_available(
+    void)
+{
+    return (TSM_Active_Count < MAX_TSM_TRANSACTIONS);
+}
+
+uint16_t tsm_transaction_idle_count(
+    void)
+{
+    return (uint16_t) (MAX_TSM_TRANSACTIONS - TSM_Active_Count);
 }
 
 /* sets the invokeID */
@@ -144,7 +459,7 @@ uint8_t tsm_transaction_idle_count(
 void tsm_invokeID_set(
     uint8_t invokeID)
 {
-    if (invokeID == 0) {
+    if ((invokeID == 0) || (invokeID > TSM_INVOKE_ID_LAST)) {
         invokeID = 1;
     }
     Current_Invoke_ID = invokeID;
@@ -156,45 +471,149 @@ void tsm_invokeID_set(
 uint8_t tsm_next_free_invokeID(
     void)
 {
-    uint8_t index = 0;
+    uint16_t slot = 0;
     uint8_t invokeID = 0;
-    bool found = false;
+    unsigned tries = 0;
 
     /* is there even space available? */
-    if (tsm_transaction_available()) {
-        while (!found) {
-            index = tsm_find_invokeID_index(Current_Invoke_ID);
-            if (index == MAX_TSM_TRANSACTIONS) {
-                /* Not found, so this invokeID is not used */
-                found = true;
-                /* set this id into the table */
-                index = tsm_find_first_free_index();
-                if (index != MAX_TSM_TRANSACTIONS) {
-                    TSM_List[index].InvokeID = invokeID = Current_Invoke_ID;
-                    TSM_List[index].state = TSM_STATE_IDLE;
-                    TSM_List[index].RequestTimer = apdu_timeout();
-                    /* update for the next call or check */
-                    Current_Invoke_ID++;
-                    /* skip zero - we treat that internally as invalid or no free */
-                    if (Current_Invoke_ID == 0) {
-                        Current_Invoke_ID = 1;
-                    }
-                }
-            } else {
-                /* found! This invokeID is already used */
-                /* try next one */
-                Current_Invoke_ID++;
-                /* skip zero - we treat that internally as invalid or no free */
-                if (Current_Invoke_ID == 0) {
-                    Current_Invoke_ID = 1;
-                }
-            }
+    if (!tsm_transaction_available()) {
+        return 0;
+    }
+    for (tries = 1; tries <= TSM_INVOKE_ID_LAST; tries++) {
+        /* skip the IDs that a peer space has in use */
+        if (!TSM_Index[Current_Invoke_ID] &&
+            !TSM_Peer_ID_Count[Current_Invoke_ID]) {
+            invokeID = Current_Invoke_ID;
+        }
+        /* update for the next call or check */
+        /* skip zero - we treat that internally as invalid or no free -
+           and the IDs of split peer spaces */
+        if (Current_Invoke_ID >= TSM_INVOKE_ID_LAST) {
+            Current_Invoke_ID = 1;
+        } else {
+            Current_Invoke_ID++;
+        }
+        if (invokeID) {
+            break;
+        }
+    }
+    if (invokeID) {
+        slot = tsm_slot_alloc();
+        TSM_Index[invokeID] = slot;
+        TSM_List[slot - 1].InvokeID = invokeID;
+        TSM_List[slot - 1].state = TSM_STATE_IDLE;
+    }
+
+    return invokeID;
+}
+
+/** Gets the next free invoke ID of a peer, and reserves a spot in
+ * the table.  The ID is unique for the peer only, so that a client
+ * can have more than 255 requests outstanding to many devices.  It is
+ * TSM_PEER_INVOKE_ID_FIRST or more, and never one that
+ * tsm_next_free_invokeID() has in use.
+ * Use the dest with the _peer functions to find the transaction.
+ * @param dest [in] The peer that the request is sent to.
+ * @return The invoke ID, or 0 if the table is full or the peer already
+ *  has as many outstanding requests as its window.
+ */
+uint8_t tsm_next_free_invokeID_peer(
+    BACNET_ADDRESS * dest)
+{
+    struct TSM_Peer *peer;
+    uint16_t peer_slot = 0;
+    uint16_t slot = 0;
+    uint8_t invokeID = 0;
+    uint8_t candidate = 0;
+    unsigned window = TSM_PEER_WINDOW;
+    unsigned tries = 0;
+
+    if (!dest || !tsm_transaction_available()) {
+        return 0;
+    }
+    peer_slot = tsm_peer_find(dest, true);
+    if (!peer_slot) {
+        return 0;
+    }
+    peer = &TSM_Peer_List[peer_slot - 1];
+    if (peer->window) {
+        window = peer->window;
+    }
+    if (peer->active >= window) {
+        return 0;
+    }
+    candidate = peer->next_invoke_id;
+    for (tries = TSM_PEER_INVOKE_ID_FIRST; tries < 256; tries++) {
+        if (candidate < TSM_PEER_INVOKE_ID_FIRST) {
+            candidate = TSM_PEER_INVOKE_ID_FIRST;
         }
+        if (!TSM_Index[candidate] &&
+            (tsm_hash_find(dest, candidate) == MAX_TSM_TRANSACTIONS)) {
+            invokeID = candidate;
+            break;
+        }
+        candidate++;
+    }
+    if (!invokeID) {
+        tsm_peer_release(peer_slot);
+        return 0;
     }
+    peer->next_invoke_id = invokeID + 1;
+    slot = tsm_slot_alloc();
+    TSM_List[slot - 1].InvokeID = invokeID;
+    TSM_List[slot - 1].state = TSM_STATE_IDLE;
+    TSM_List[slot - 1].Peer = peer_slot;
+    bacnet_address_copy(&TSM_List[slot - 1].dest, dest);
+    tsm_hash_link(slot - 1);
+    TSM_Peer_ID_Count[invokeID]++;
+    peer->active++;
 
     return invokeID;
 }
 
+/** Sets the number of outstanding requests to a peer, for the invoke
+ * IDs from tsm_next_free_invokeID_peer().
+ * @param dest [in] The peer.
+ * @param window [in] 1 to 255, or 0 for TSM_PEER_WINDOW.
+ * @return true if set, false if there is no room for another peer.
+ */
+bool tsm_peer_window_set(
+    BACNET_ADDRESS * dest,
+    uint8_t window)
+{
+    uint16_t peer_slot;
+
+    peer_slot = tsm_peer_find(dest, window != 0);
+    if (peer_slot) {
+        TSM_Peer_List[peer_slot - 1].window = window;
+        tsm_peer_release(peer_slot);
+    }
+
+    return (peer_slot || (window == 0));
+}
+
+/** The buffer in which the transaction keeps its PDU for retries.
+ * A request encoded here, NPDU first, is not copied again by
+ * tsm_set_confirmed_unsegmented_transaction().
+ * @param dest [in] The peer, or NULL for an invoke ID that is unique
+ *  among all peers.
+ * @param invokeID [in] A reserved invoke ID.
+ * @return The buffer of MAX_PDU bytes, or NULL if the ID is not in use.
+ */
+uint8_t *tsm_transaction_buffer(
+    BACNET_ADDRESS * dest,
+    uint8_t invokeID)
+{
+    uint16_t index;
+
+    index = tsm_find(dest, invokeID);
+    if (index < MAX_TSM_TRANSACTIONS) {
+        return &TSM_List[index].apdu[0];
+    }
+
+    return NULL;
+}
+
 void tsm_set_confirmed_unsegmented_transaction(
     uint8_t invokeID,
     BACNET_ADDRESS * dest,
@@ -202,30 +621,45 @@ void tsm_set_confirmed_unsegmented_transaction(
     uint8_t * apdu,
     uint16_t apdu_len)
 {
-    uint16_t j = 0;
-    uint8_t index;
+    uint16_t index;
 
     if (invokeID) {
-        index = tsm_find_invokeID_index(invokeID);
+        index = tsm_find(dest, invokeID);
         if (index < MAX_TSM_TRANSACTIONS) {
             /* SendConfirmedUnsegmented */
             TSM_List[index].state = TSM_STATE_AWAIT_CONFIRMATION;
             TSM_List[index].RetryCount = 0;
             /* start the timer */
-            TSM_List[index].RequestTimer = apdu_timeout();
-            /* copy the data */
-            for (j = 0; j < apdu_len; j++) {
-                TSM_List[index].apdu[j] = apdu[j];
+            tsm_timer_start(index, apdu_timeout());
+            /* copy the data, unless it was encoded in place */
+            if (apdu != &TSM_List[index].apdu[0]) {
+                memcpy(&TSM_List[index].apdu[0], apdu, apdu_len);
             }
             TSM_List[index].apdu_len = apdu_len;
             npdu_copy_data(&TSM_List[index].npdu_data, ndpu_data);
-            bacnet_address_copy(&TSM_List[index].dest, dest);
+            if (!TSM_List[index].Peer) {
+                bacnet_address_copy(&TSM_List[index].dest, dest);
+            }
         }
     }
 
     return;
 }
 
+static void tsm_transaction_pdu_copy(
+    uint16_t index,
+    BACNET_NPDU_DATA * ndpu_data,
+    uint8_t * apdu,
+    uint16_t * apdu_len)
+{
+    /* FIXME: we may want to free the transaction so it doesn't timeout */
+    /* retrieve the transaction */
+    /* FIXME: bounds check the pdu_len? */
+    *apdu_len = (uint16_t) TSM_List[index].apdu_len;
+    memcpy(apdu, &TSM_List[index].apdu[0], *apdu_len);
+    npdu_copy_data(ndpu_data, &TSM_List[index].npdu_data);
+}
+
 /* used to retrieve the transaction payload */
 /* if we wanted to find out what we sent (i.e. when we get an ack) */
 bool tsm_get_transaction_pdu(
@@ -235,22 +669,14 @@ bool tsm_get_transaction_pdu(
     uint8_t * apdu,
     uint16_t * apdu_len)
 {
-    uint16_t j = 0;
-    uint8_t index;
+    uint16_t index;
     bool found = false;
 
     if (invokeID) {
-        index = tsm_find_invokeID_index(invokeID);
+        index = tsm_find(NULL, invokeID);
         /* how much checking is needed?  state?  dest match? just invokeID? */
         if (index < MAX_TSM_TRANSACTIONS) {
-            /* FIXME: we may want to free the transaction so it doesn't timeout */
-            /* retrieve the transaction */
-            /* FIXME: bounds check the pdu_len? */
-            *apdu_len = (uint16_t) TSM_List[index].apdu_len;
-            for (j = 0; j < *apdu_len; j++) {
-                apdu[j] = TSM_List[index].apdu[j];
-            }
-            npdu_copy_data(ndpu_data, &TSM_List[index].npdu_data);
+            tsm_transaction_pdu_copy(index, ndpu_data, apdu, apdu_len);
             bacnet_address_copy(dest, &TSM_List[index].dest);
             found = true;
         }
@@ -259,52 +685,142 @@ bool tsm_get_transaction_pdu(
     return found;
 }
 
+/** Retrieves the payload of a transaction, like tsm_get_transaction_pdu(),
+ * for the invoke ID of a peer space too.
+ * @param dest [in] The peer that the request was sent to, or that
+ *  the reply came from.
+ * @param invokeID [in] The invoke ID of the request.
+ * @return true if the transaction is found.
+ */
+bool tsm_get_transaction_pdu_peer(
+    BACNET_ADDRESS * dest,
+    uint8_t invokeID,
+    BACNET_NPDU_DATA * ndpu_data,
+    uint8_t * apdu,
+    uint16_t * apdu_len)
+{
+    uint16_t index;
+
+    index = tsm_find(dest, invokeID);
+    if (index < MAX_TSM_TRANSACTIONS) {
+        tsm_transaction_pdu_copy(index, ndpu_data, apdu, apdu_len);
+        return true;
+    }
+
+    return false;
+}
+
+/* tells the application that a request failed to confirm */
+static void tsm_timeout_notify(
+    uint16_t index)
+{
+    BACNET_TSM_DATA *data = &TSM_List[index];
+
+    if (data->Peer && Timeout_Peer_Function) {
+        Timeout_Peer_Function(&data->dest, data->InvokeID);
+    } else if (Timeout_Function) {
+        Timeout_Function(data->InvokeID);
+    }
+}
+
+/* the request timer of a transaction expired */
+static void tsm_request_timeout(
+    uint16_t index)
+{
+    BACNET_TSM_DATA *data = &TSM_List[index];
+
+    if (data->state != TSM_STATE_AWAIT_CONFIRMATION) {
+        return;
+    }
+    if (data->RetryCount < apdu_retries()) {
+        tsm_timer_start(index, apdu_timeout());
+        data->RetryCount++;
+        datalink_send_pdu(&data->dest, &data->npdu_data, &data->apdu[0],
+            data->apdu_len);
+    } else {
+        /* note: the invoke id has not been cleared yet
+           and this indicates a failed message:
+           IDLE and a valid invoke id */
+        data->state = TSM_STATE_IDLE;
+        tsm_timeout_notify(index);
+    }
+}
+
+/* advances the wheel by one tick and expires the timers of the tick */
+static void tsm_timer_tick(
+    void)
+{
+    unsigned bucket = 0;
+    uint16_t slot = 0;
+
+    TSM_Ticks++;
+    bucket = TSM_Ticks & TSM_WHEEL_MASK;
+    if (bucket == 0) {
+        /* the timers of the next TSM_WHEEL_SIZE ticks move down */
+        bucket = TSM_WHEEL_SIZE +
+            ((TSM_Ticks >> TSM_WHEEL_BITS) & TSM_WHEEL_MASK);
+        while ((slot = TSM_Wheel[bucket]) != 0) {
+            tsm_timer_unlink(slot - 1);
+            tsm_timer_link(slot - 1);
+        }
+        bucket = 0;
+    }
+    /* restarted timers and new ones go to later buckets */
+    while ((slot = TSM_Wheel[bucket]) != 0) {
+        tsm_timer_unlink(slot - 1);
+        TSM_Timers_Running--;
+        tsm_request_timeout(slot - 1);
+    }
+}
+
 /* called once a millisecond or slower */
 void tsm_timer_milliseconds(
     uint16_t milliseconds)
 {
-    unsigned i = 0;     /* counter */
-
-    for (i = 0; i < MAX_TSM_TRANSACTIONS; i++) {
-        if (TSM_List[i].state == TSM_STATE_AWAIT_CONFIRMATION) {
-            if (TSM_List[i].RequestTimer > milliseconds)
-                TSM_List[i].RequestTimer -= milliseconds;
-            else
-                TSM_List[i].RequestTimer = 0;
-            /* AWAIT_CONFIRMATION */
-            if (TSM_List[i].RequestTimer == 0) {
-                if (TSM_List[i].RetryCount < apdu_retries()) {
-                    TSM_List[i].RequestTimer = apdu_timeout();
-                    TSM_List[i].RetryCount++;
-                    datalink_send_pdu(&TSM_List[i].dest,
-                        &TSM_List[i].npdu_data, &TSM_List[i].apdu[0],
-                        TSM_List[i].apdu_len);
-                } else {
-                    /* note: the invoke id has not been cleared yet
-                       and this indicates a failed message:
-                       IDLE and a valid invoke id */
-                    TSM_List[i].state = TSM_STATE_IDLE;
-                    if (TSM_List[i].InvokeID != 0) {
-                        if (Timeout_Function) {
-                            Timeout_Function(TSM_List[i].InvokeID);
-                        }
-                    }
-                }
-            }
+    uint32_t elapsed = (uint32_t) milliseconds + TSM_Tick_Remainder;
+
+    while (elapsed >= TSM_TIMER_TICK_MS) {
+        if (TSM_Timers_Running) {
+            tsm_timer_tick();
+            elapsed -= TSM_TIMER_TICK_MS;
+        } else {
+            /* nothing to expire */
+            TSM_Ticks += elapsed / TSM_TIMER_TICK_MS;
+            elapsed %= TSM_TIMER_TICK_MS;
         }
     }
+    TSM_Tick_Remainder = (uint16_t) elapsed;
+#if MAX_SEGMENTS_ACCEPTED
+    tsm_segmented_timer(milliseconds);
+#endif
 }
 
 /* frees the invokeID and sets its state to IDLE */
 void tsm_free_invoke_id(
     uint8_t invokeID)
 {
-    uint8_t index;
+    uint16_t index;
 
-    index = tsm_find_invokeID_index(invokeID);
+    index = tsm_find(NULL, invokeID);
     if (index < MAX_TSM_TRANSACTIONS) {
-        TSM_List[index].state = TSM_STATE_IDLE;
-        TSM_List[index].InvokeID = 0;
+        tsm_slot_free(index);
+    }
+}
+
+/** Frees the invoke ID of a reply, or of a request to a peer,
+ * and sets its state to IDLE.
+ * @param dest [in] The peer.
+ * @param invokeID [in] The invoke ID, of the peer or of all peers.
+ */
+void tsm_free_invoke_id_peer(
+    BACNET_ADDRESS * dest,
+    uint8_t invokeID)
+{
+    uint16_t index;
+
+    index = tsm_find(dest, invokeID);
+    if (index < MAX_TSM_TRANSACTIONS) {
+        tsm_slot_free(index);
     }
 }
 
@@ -316,15 +832,27 @@ bool tsm_invoke_id_free(
     uint8_t invokeID)
 {
     bool status = true;
-    uint8_t index;
+    uint16_t index;
 
-    index = tsm_find_invokeID_index(invokeID);
+    index = tsm_find(NULL, invokeID);
     if (index < MAX_TSM_TRANSACTIONS)
         status = false;
 
     return status;
 }
 
+/** Check if the invoke ID of a request to a peer has been made free.
+ * @param dest [in] The peer.
+ * @param invokeID [in] The invokeID to be checked.
+ * @return True if it is free (done with), False if still pending in the TSM.
+ */
+bool tsm_invoke_id_free_peer(
+    BACNET_ADDRESS * dest,
+    uint8_t invokeID)
+{
+    return (tsm_find(dest, invokeID) == MAX_TSM_TRANSACTIONS);
+}
+
 /** See if we failed get a confirmation for the message associated
  *  with this invoke ID.
  * @param invokeID [in] The invokeID to be checked, normally of last message sent.
@@ -335,9 +863,9 @@ bool tsm_invoke_id_failed(
     uint8_t invokeID)
 {
     bool status = false;
-    uint8_t index;
+    uint16_t index;
 
-    index = tsm_find_invokeID_index(invokeID);
+    index = tsm_find(NULL, invokeID);
     if (index < MAX_TSM_TRANSACTIONS) {
         /* a valid invoke ID and the state is IDLE is a
            message that failed to confirm */
@@ -348,6 +876,552 @@ bool tsm_invoke_id_failed(
     return status;
 }
 
+/** See if a request to a peer failed to confirm.
+ * @param dest [in] The peer.
+ * @param invokeID [in] The invokeID to be checked.
+ * @return True if already failed, False if done or segmented or still waiting
+ *         for a confirmation.
+ */
+bool tsm_invoke_id_failed_peer(
+    BACNET_ADDRESS * dest,
+    uint8_t invokeID)
+{
+    uint16_t index;
+
+    index = tsm_find(dest, invokeID);
+
+    return ((index < MAX_TSM_TRANSACTIONS) &&
+        (TSM_List[index].state == TSM_STATE_IDLE));
+}
+
+
+#if MAX_SEGMENTS_ACCEPTED
+static BACNET_TSM_SEGMENTED_DATA *tsm_segmented_find(
+    BACNET_ADDRESS * src,
+    uint8_t invokeID,
+    bool server)
+{
+    unsigned i = 0;
+
+    for (i = 0; i < MAX_TSM_SEGMENTED_TRANSACTIONS; i++) {
+        if ((TSM_Segmented_List[i].state != TSM_STATE_IDLE) &&
+            (TSM_Segmented_List[i].InvokeID == invokeID) &&
+            (TSM_Segmented_List[i].server == server) &&
+            bacnet_address_same(&TSM_Segmented_List[i].dest, src)) {
+            return &TSM_Segmented_List[i];
+        }
+    }
+
+    return NULL;
+}
+
+static BACNET_TSM_SEGMENTED_DATA *tsm_segmented_alloc(
+    void)
+{
+    BACNET_TSM_SEGMENTED_DATA *data = NULL;
+    unsigned i = 0;
+
+    for (i = 0; i < MAX_TSM_SEGMENTED_TRANSACTIONS; i++) {
+        if (TSM_Segmented_List[i].state == TSM_STATE_IDLE) {
+            data = &TSM_Segmented_List[i];
+            break;
+        }
+        if (TSM_Segmented_List[i].complete && !data) {
+            /* only kept to repeat its final Segment-ACK */
+            data = &TSM_Segmented_List[i];
+        }
+    }
+    if (data) {
+        data->state = TSM_STATE_IDLE;
+        data->complete = false;
+        data->nak = false;
+        data->SegmentRetryCount = 0;
+        data->apdu_len = 0;
+    }
+
+    return data;
+}
+
+/* the client of a segmented ComplexACK gave up: fail its transaction */
+static void tsm_segmented_confirmation_failed(
+    BACNET_ADDRESS * src,
+    uint8_t invokeID)
+{
+    uint16_t index;
+
+    index = tsm_find(src, invokeID);
+    if (index < MAX_TSM_TRANSACTIONS) {
+        TSM_List[index].state = TSM_STATE_IDLE;
+        tsm_timeout_notify(index);
+    }
+}
+
+static void tsm_segmented_abort(
+    BACNET_TSM_SEGMENTED_DATA * data,
+    BACNET_ADDRESS * dest,
+    uint8_t invokeID,
+    uint8_t abort_reason,
+    bool server)
+{
+    BACNET_NPDU_DATA npdu_data;
+    BACNET_ADDRESS my_address;
+    int len = 0;
+
+    datalink_get_my_address(&my_address);
+    npdu_encode_npdu_data(&npdu_data, false, MESSAGE_PRIORITY_NORMAL);
+    len =
+        npdu_encode_pdu(&TSM_Segment_Buffer[0], dest, &my_address,
+        &npdu_data);
+    len +=
+        abort_encode_apdu(&TSM_Segment_Buffer[len], invokeID, abort_reason,
+        server);
+    datalink_send_pdu(dest, &npdu_data, &TSM_Segment_Buffer[0], len);
+    if (!server) {
+        tsm_segmented_confirmation_failed(dest, invokeID);
+    }
+    if (data) {
+        data->state = TSM_STATE_IDLE;
+    }
+}
+
+static void tsm_segment_ack_send(
+    BACNET_TSM_SEGMENTED_DATA * data,
+    uint8_t sequence_number,
+    bool nak)
+{
+    BACNET_NPDU_DATA npdu_data;
+    BACNET_ADDRESS my_address;
+    int len = 0;
+
+    datalink_get_my_address(&my_address);
+    npdu_encode_npdu_data(&npdu_data, false, MESSAGE_PRIORITY_NORMAL);
+    len =
+        npdu_encode_pdu(&TSM_Segment_Buffer[0], &data->dest, &my_address,
+        &npdu_data);
+    TSM_Segment_Buffer[len] = PDU_TYPE_SEGMENT_ACK;
+    if (nak) {
+        TSM_Segment_Buffer[len] |= BIT(1);
+    }
+    if (data->server) {
+        TSM_Segment_Buffer[len] |= BIT(0);
+    }
+    len++;
+    TSM_Segment_Buffer[len++] = data->InvokeID;
+    TSM_Segment_Buffer[len++] = sequence_number;
+    TSM_Segment_Buffer[len++] = data->ActualWindowSize;
+    datalink_send_pdu(&data->dest, &npdu_data, &TSM_Segment_Buffer[0], len);
+}
+
+static void tsm_segment_send(
+    BACNET_TSM_SEGMENTED_DATA * data,
+    unsigned segment)
+{
+    BACNET_ADDRESS my_address;
+    unsigned offset = segment * data->segment_size;
+    unsigned len = data->segment_size;
+    int pdu_len = 0;
+
+    if ((offset + len) > data->apdu_len) {
+        len = data->apdu_len - offset;
+    }
+    datalink_get_my_address(&my_address);
+    pdu_len =
+        npdu_encode_pdu(&TSM_Segment_Buffer[0], &data->dest, &my_address,
+        &data->npdu_data);
+    TSM_Segment_Buffer[pdu_len] = PDU_TYPE_COMPLEX_ACK | BIT(3);
+    if ((segment + 1) < data->segment_count) {
+        /* more follows */
+        TSM_Segment_Buffer[pdu_len] |= BIT(2);
+    }
+    pdu_len++;
+    TSM_Segment_Buffer[pdu_len++] = data->InvokeID;
+    TSM_Segment_Buffer[pdu_len++] = (uint8_t) segment;
+    TSM_Segment_Buffer[pdu_len++] = TSM_PROPOSED_WINDOW_SIZE;
+    TSM_Segment_Buffer[pdu_len++] = data->service_choice;
+    memcpy(&TSM_Segment_Buffer[pdu_len], &data->apdu[offset], len);
+    pdu_len += len;
+    datalink_send_pdu(&data->dest, &data->npdu_data, &TSM_Segment_Buffer[0],
+        pdu_len);
+}
+
+/* sends the segments of the window and waits for the Segment-ACK */
+static void tsm_segment_window_send(
+    BACNET_TSM_SEGMENTED_DATA * data)
+{
+    unsigned segment = data->window_start;
+
+    data->window_sent = 0;
+    while ((segment < data->segment_count) &&
+        (data->window_sent < data->ActualWindowSize)) {
+        tsm_segment_send(data, segment);
+        data->window_sent++;
+        segment++;
+    }
+    data->SegmentTimer = apdu_segment_timeout();
+}
+
+static void tsm_segmented_timer(
+    uint16_t milliseconds)
+{
+    BACNET_TSM_SEGMENTED_DATA *data;
+    unsigned i = 0;
+
+    for (i = 0; i < MAX_TSM_SEGMENTED_TRANSACTIONS; i++) {
+        data = &TSM_Segmented_List[i];
+        if (data->state == TSM_STATE_IDLE) {
+            continue;
+        }
+        if (data->SegmentTimer > milliseconds) {
+            data->SegmentTimer -= milliseconds;
+            continue;
+        }
+        data->SegmentTimer = 0;
+        if (data->complete) {
+            /* the message was handled */
+            data->state = TSM_STATE_IDLE;
+            data->complete = false;
+        } else if ((data->state == TSM_STATE_SEGMENTED_RESPONSE) &&
+            (data->SegmentRetryCount < apdu_retries())) {
+            /* the window or its Segment-ACK was lost */
+            data->SegmentRetryCount++;
+            data->nak = false;
+            tsm_segment_window_send(data);
+        } else {
+            /* the peer went away */
+            if (data->state == TSM_STATE_SEGMENTED_CONFIRMATION) {
+                tsm_segmented_confirmation_failed(&data->dest,
+                    data->InvokeID);
+            }
+            data->state = TSM_STATE_IDLE;
+        }
+    }
+}
+
+/** Largest ComplexACK, with its unsegmented APDU header,
+ * that can be sent to the requester of a confirmed service.
+ * @param service_data [in] The header of the request.
+ * @return The size in bytes.
+ */
+unsigned tsm_segmented_complex_ack_max(
+    BACNET_CONFIRMED_SERVICE_DATA * service_data)
+{
+    unsigned max_apdu = MAX_APDU;
+    unsigned segments = MAX_SEGMENTS_ACCEPTED;
+    unsigned max_len = 0;
+
+    if ((service_data->max_resp > 0) &&
+        ((unsigned) service_data->max_resp < max_apdu)) {
+        max_apdu = (unsigned) service_data->max_resp;
+    }
+    if (!service_data->segmented_response_accepted) {
+        return max_apdu;
+    }
+    /* zero is unspecified, and more than 64 is unlimited */
+    if ((service_data->max_segs > 0) && (service_data->max_segs <= 64)) {
+        segments = (unsigned) service_data->max_segs;
+    }
+    max_len = (segments * (max_apdu - TSM_SEGMENTED_ACK_HEADER)) + 3;
+    if (max_len > MAX_APDU_SEGMENTED) {
+        max_len = MAX_APDU_SEGMENTED;
+    }
+    if (max_len < max_apdu) {
+        max_len = max_apdu;
+    }
+
+    return max_len;
+}
+
+/** Sends a ComplexACK that is too large for one APDU of the requester
+ * as a segmented message: the first segment alone, then windows of
+ * segments as the requester acknowledges them with Segment-ACKs.
+ * @param dest [in] The requester.
+ * @param npdu_data [in] The NPDU of the reply.
+ * @param service_data [in] The header of the request.
+ * @param apdu [in] The ComplexACK encoded with an unsegmented header.
+ * @param apdu_len [in] Its length.
+ * @param error_code [out] The abort error code when it can't be sent.
+ * @return True if the first segment was sent.
+ */
+bool tsm_segmented_complex_ack_send(
+    BACNET_ADDRESS * dest,
+    BACNET_NPDU_DATA * npdu_data,
+    BACNET_CONFIRMED_SERVICE_DATA * service_data,
+    uint8_t * apdu,
+    unsigned apdu_len,
+    BACNET_ERROR_CODE * error_code)
+{
+    BACNET_TSM_SEGMENTED_DATA *data;
+    unsigned max_apdu = MAX_APDU;
+
+    if (!service_data->segmented_response_accepted) {
+        *error_code = ERROR_CODE_ABORT_SEGMENTATION_NOT_SUPPORTED;
+        return false;
+    }
+    if ((apdu_len < 3) ||
+        (apdu_len > tsm_segmented_complex_ack_max(service_data))) {
+        *error_code = ERROR_CODE_ABORT_BUFFER_OVERFLOW;
+        return false;
+    }
+    /* a repeated request restarts its response */
+    data = tsm_segmented_find(dest, apdu[1], true);
+    if (data) {
+        data->state = TSM_STATE_IDLE;
+    }
+    data = tsm_segmented_alloc();
+    if (!data) {
+        /* busy with other segmented messages */
+        *error_code = ERROR_CODE_ABORT_PREEMPTED_BY_HIGHER_PRIORITY_TASK;
+        return false;
+    }
+    if ((service_data->max_resp > 0) &&
+        ((unsigned) service_data->max_resp < max_apdu)) {
+        max_apdu = (unsigned) service_data->max_resp;
+    }
+    data->state = TSM_STATE_SEGMENTED_RESPONSE;
+    data->server = true;
+    data->InvokeID = apdu[1];
+    data->service_choice = apdu[2];
+    data->apdu_len = apdu_len - 3;
+    memcpy(&data->apdu[0], &apdu[3], data->apdu_len);
+    data->segment_size = max_apdu - TSM_SEGMENTED_ACK_HEADER;
+    data->segment_count =
+        (data->apdu_len + data->segment_size - 1) / data->segment_size;
+    data->window_start = 0;
+    /* the first segment is sent alone */
+    data->ActualWindowSize = 1;
+    bacnet_address_copy(&data->dest, dest);
+    npdu_copy_data(&data->npdu_data, npdu_data);
+    tsm_segment_window_send(data);
+
+    return true;
+}
+
+/** Handles a Segment-ACK for a segmented ComplexACK that we send.
+ * @param src [in] The sender of the Segment-ACK.
+ * @param invokeID [in] The invoke ID of the transaction.
+ * @param sequence_number [in] The last segment received in order.
+ * @param actual_window_size [in] The window size for the next segments.
+ * @param nak [in] True if a segment was received out of order.
+ * @param server [in] True if the Segment-ACK was sent by a server.
+ */
+void tsm_segment_ack_received(
+    BACNET_ADDRESS * src,
+    uint8_t invokeID,
+    uint8_t sequence_number,
+    uint8_t actual_window_size,
+    bool nak,
+    bool server)
+{
+    BACNET_TSM_SEGMENTED_DATA *data;
+    unsigned acked = 0;
+
+    if (server) {
+        /* we don't send segmented requests */
+        return;
+    }
+    data = tsm_segmented_find(src, invokeID, true);
+    if (!data || (data->state != TSM_STATE_SEGMENTED_RESPONSE)) {
+        return;
+    }
+    /* the segments of the window acknowledged by this ACK */
+    acked = (uint8_t) (sequence_number - (uint8_t) (data->window_start - 1));
+    if ((acked > data->window_sent) || ((acked == 0) && !nak)) {
+        /* duplicate or out of the window */
+        return;
+    }
+    if ((acked == 0) && data->nak) {
+        /* another NAK for the window that we already resent */
+        return;
+    }
+    data->nak = nak;
+    data->window_start += acked;
+    if (data->window_start >= data->segment_count) {
+        /* the final Segment-ACK */
+        data->state = TSM_STATE_IDLE;
+        return;
+    }
+    if (actual_window_size == 0) {
+        actual_window_size = 1;
+    } else if (actual_window_size > 127) {
+        actual_window_size = 127;
+    }
+    data->ActualWindowSize = actual_window_size;
+    data->SegmentRetryCount = 0;
+    tsm_segment_window_send(data);
+}
+
+/** Assembles the segments of a confirmed request, or of the ComplexACK
+ * of one of our requests, and acknowledges each window of them.
+ * @param src [in] The sender of the segment.
+ * @param apdu [in] The segment.
+ * @param apdu_len [in] Its length.
+ * @param assembled_len [out] The length of the assembled message.
+ * @return The message with an unsegmented APDU header once the last
+ *  segment is received, or NULL.  It is kept for a while after that,
+ *  to repeat the final Segment-ACK if the sender missed it.
+ */
+uint8_t *tsm_segment_received(
+    BACNET_ADDRESS * src,
+    uint8_t * apdu,
+    uint16_t apdu_len,
+    uint16_t * assembled_len)
+{
+    BACNET_TSM_SEGMENTED_DATA *data;
+    bool request = false;
+    bool more_follows = false;
+    uint8_t invokeID = 0;
+    uint8_t sequence_number = 0;
+    uint8_t window_size = 0;
+    uint8_t ahead = 0;
+    uint16_t index = 0;
+    unsigned len = 0;
+
+    request = ((apdu[0] & 0xF0) == PDU_TYPE_CONFIRMED_SERVICE_REQUEST);
+    more_follows = (apdu[0] & BIT(2)) ? true : false;
+    if (request) {
+        len = 6;
+        invokeID = apdu[2];
+        sequence_number = apdu[3];
+        window_size = apdu[4];
+    } else {
+        len = TSM_SEGMENTED_ACK_HEADER;
+        invokeID = apdu[1];
+        sequence_number = apdu[2];
+        window_size = apdu[3];
+    }
+    if (apdu_len < len) {
+        return NULL;
+    }
+    /* as the receiver of a request we are the server */
+    data = tsm_segmented_find(src, invokeID, request);
+    if (!data) {
+        if (sequence_number != 0) {
+            return NULL;
+        }
+        if (!request) {
+            /* only the ack of a request that we sent */
+            index = tsm_find(src, invokeID);
+            if ((index == MAX_TSM_TRANSACTIONS) ||
+                (TSM_List[index].state != TSM_STATE_AWAIT_CONFIRMATION)) {
+                return NULL;
+            }
+        }
+        data = tsm_segmented_alloc();
+        if (!data) {
+            tsm_segmented_abort(NULL, src, invokeID,
+                ABORT_REASON_PREEMPTED_BY_HIGHER_PRIORITY_TASK, request);
+            return NULL;
+        }
+        data->server = request;
+        data->InvokeID = invokeID;
+        data->service_choice = apdu[len - 1];
+        bacnet_address_copy(&data->dest, src);
+        if (request) {
+            data->state = TSM_STATE_SEGMENTED_REQUEST;
+            /* keep segmented-response-accepted and max segs/APDU */
+            data->apdu[0] = apdu[0] & (uint8_t) ~ (BIT(3) | BIT(2));
+            data->apdu[1] = apdu[1];
+            data->apdu[2] = invokeID;
+            data->apdu[3] = data->service_choice;
+            data->apdu_len = 4;
+        } else {
+            data->state = TSM_STATE_SEGMENTED_CONFIRMATION;
+            data->apdu[0] = PDU_TYPE_COMPLEX_ACK;
+            data->apdu[1] = invokeID;
+            data->apdu[2] = data->service_choice;
+            data->apdu_len = 3;
+            /* the request timer of the transaction stops */
+            TSM_List[index].state = TSM_STATE_SEGMENTED_CONFIRMATION;
+            tsm_timer_stop(index);
+        }
+        if (window_size > TSM_PROPOSED_WINDOW_SIZE) {
+            window_size = TSM_PROPOSED_WINDOW_SIZE;
+        } else if (window_size == 0) {
+            window_size = 1;
+        }
+        data->ActualWindowSize = window_size;
+        data->InitialSequenceNumber = 0;
+        /* the first segment is expected next */
+        data->LastSequenceNumber = 0xFF;
+    }
+    if (data->complete) {
+        /* our final Segment-ACK was lost: repeat it once for each
+           window that the sender repeats, on its final segment */
+        if (!more_follows) {
+            tsm_segment_ack_send(data, data->LastSequenceNumber, false);
+        }
+        return NULL;
+    }
+    /* segments from the one expected next, modulo 256 */
+    ahead =
+        (uint8_t) (sequence_number - (uint8_t) (data->LastSequenceNumber +
+            1));
+    if (ahead >= 128) {
+        /* a duplicate, from a window that the sender repeats because
+           our Segment-ACK was lost: repeat it once, on the segment
+           that it acknowledged, and discard the others */
+        if (sequence_number == data->InitialSequenceNumber) {
+            tsm_segment_ack_send(data, data->LastSequenceNumber, false);
+        }
+        return NULL;
+    }
+    if (ahead > 0) {
+        /* a segment was lost: ask once for the ones after the last,
+           and discard the rest of the window */
+        if (!data->nak) {
+            data->nak = true;
+            data->InitialSequenceNumber = data->LastSequenceNumber;
+            tsm_segment_ack_send(data, data->LastSequenceNumber, true);
+        }
+        return NULL;
+    }
+    data->nak = false;
+    if ((data->apdu_len + (apdu_len - len)) > sizeof(data->apdu)) {
+        tsm_segmented_abort(data, src, invokeID, ABORT_REASON_BUFFER_OVERFLOW,
+            request);
+        return NULL;
+    }
+    memcpy(&data->apdu[data->apdu_len], &apdu[len], apdu_len - len);
+    data->apdu_len += (apdu_len - len);
+    data->LastSequenceNumber = sequence_number;
+    data->SegmentTimer = apdu_segment_timeout() * 4;
+    if (!more_follows) {
+        tsm_segment_ack_send(data, sequence_number, false);
+        data->complete = true;
+        *assembled_len = (uint16_t) data->apdu_len;
+        return &data->apdu[0];
+    }
+    if ((sequence_number == 0) ||
+        (sequence_number ==
+            (uint8_t) (data->InitialSequenceNumber +
+                data->ActualWindowSize))) {
+        /* the window is full */
+        data->InitialSequenceNumber = sequence_number;
+        tsm_segment_ack_send(data, sequence_number, false);
+    }
+
+    return NULL;
+}
+
+/** Ends a segmented message when the peer aborted the transaction.
+ * @param src [in] The peer.
+ * @param invokeID [in] The invoke ID of the transaction.
+ * @param server [in] True if we are the server of the transaction.
+ */
+void tsm_segmented_free(
+    BACNET_ADDRESS * src,
+    uint8_t invokeID,
+    bool server)
+{
+    BACNET_TSM_SEGMENTED_DATA *data;
+
+    data = tsm_segmented_find(src, invokeID, server);
+    if (data) {
+        data->state = TSM_STATE_IDLE;
+        data->complete = false;
+    }
+}
+#endif
 
 #ifdef TEST
 #include <assert.h>
@@ -357,19 +1431,37 @@ bool tsm_invoke_id_failed(
 /* flag to send an I-Am */
 bool I_Am_Request = true;
 
-/* dummy function stubs */
+/* the packets sent by the TSM, delivered by the tests */
+#define TEST_PACKETS 64
+struct test_packet {
+    BACNET_ADDRESS dest;
+    uint8_t pdu[MAX_PDU];
+    unsigned pdu_len;
+};
+static struct test_packet Test_Packets[TEST_PACKETS];
+static unsigned Test_Packet_Head;
+static unsigned Test_Packet_Count;
+
 int datalink_send_pdu(
     BACNET_ADDRESS * dest,
     BACNET_NPDU_DATA * npdu_data,
     uint8_t * pdu,
     unsigned pdu_len)
 {
-    (void) dest;
+    struct test_packet *packet;
+
     (void) npdu_data;
-    (void) pdu;
-    (void) pdu_len;
+    if ((Test_Packet_Count == TEST_PACKETS) || (pdu_len > MAX_PDU)) {
+        return -1;
+    }
+    packet =
+        &Test_Packets[(Test_Packet_Head + Test_Packet_Count) % TEST_PACKETS];
+    bacnet_address_copy(&packet->dest, dest);
+    memcpy(&packet->pdu[0], pdu, pdu_len);
+    packet->pdu_len = pdu_len;
+    Test_Packet_Count++;
 
-    return 0;
+    return (int) pdu_len;
 }
 
 /* dummy function stubs */
@@ -379,13 +1471,561 @@ void datalink_get_broadcast_address(
     (void) dest;
 }
 
+void datalink_get_my_address(
+    BACNET_ADDRESS * my_address)
+{
+    memset(my_address, 0, sizeof(BACNET_ADDRESS));
+}
+
+static uint16_t Test_APDU_Timeout = 3000;
+static uint8_t Test_APDU_Retries = 3;
+
+uint16_t apdu_timeout(
+    void)
+{
+    return Test_APDU_Timeout;
+}
+
+uint8_t apdu_retries(
+    void)
+{
+    return Test_APDU_Retries;
+}
+
+uint16_t apdu_segment_timeout(
+    void)
+{
+    return 2000;
+}
+
+/* the last request timeouts reported by the TSM */
+static unsigned Test_Timeouts;
+static uint8_t Test_Timeout_Invoke_ID;
+static BACNET_ADDRESS Test_Timeout_Peer;
+
+static void testTSMTimeout(
+    uint8_t invokeID)
+{
+    Test_Timeouts++;
+    Test_Timeout_Invoke_ID = invokeID;
+}
+
+static void testTSMTimeoutPeer(
+    BACNET_ADDRESS * dest,
+    uint8_t invokeID)
+{
+    Test_Timeouts++;
+    Test_Timeout_Invoke_ID = invokeID;
+    bacnet_address_copy(&Test_Timeout_Peer, dest);
+}
+
+static void testTSMAddress(
+    BACNET_ADDRESS * address,
+    uint8_t mac)
+{
+    memset(address, 0, sizeof(BACNET_ADDRESS));
+    address->mac_len = 1;
+    address->mac[0] = mac;
+    address->len = 0;
+}
+
+static void testTSMRequest(
+    uint8_t invokeID,
+    BACNET_ADDRESS * dest)
+{
+    BACNET_NPDU_DATA npdu_data;
+    uint8_t apdu[4];
+
+    apdu[0] = PDU_TYPE_CONFIRMED_SERVICE_REQUEST;
+    apdu[1] = 0x05;
+    apdu[2] = invokeID;
+    apdu[3] = SERVICE_CONFIRMED_READ_PROPERTY;
+    npdu_encode_npdu_data(&npdu_data, true, MESSAGE_PRIORITY_NORMAL);
+    tsm_set_confirmed_unsegmented_transaction(invokeID, dest, &npdu_data,
+        &apdu[0], sizeof(apdu));
+}
+
+/* runs the timer in steps, as the main loop would */
+static void testTSMAdvance(
+    unsigned milliseconds)
+{
+    while (milliseconds >= 10) {
+        tsm_timer_milliseconds(10);
+        milliseconds -= 10;
+    }
+    if (milliseconds) {
+        tsm_timer_milliseconds((uint16_t) milliseconds);
+    }
+}
+
+/* 8 peers with full windows, and the invoke IDs of all peers */
+#define TEST_PEERS 8
+#define TEST_GLOBAL_IDS \
+    (MAX_TSM_TRANSACTIONS - (TEST_PEERS * TSM_PEER_WINDOW))
+
 void testTSM(
     Test * pTest)
 {
-    /* FIXME: add some unit testing... */
-    return;
+    uint8_t invoke_ids[TEST_GLOBAL_IDS];
+    uint8_t peer_ids[TEST_PEERS][TSM_PEER_WINDOW];
+    BACNET_ADDRESS peers[TEST_PEERS];
+    bool used[256];
+    uint8_t invokeID = 0;
+    uint8_t wrapped[4];
+    unsigned i, j;
+
+    ct_test(pTest, tsm_transaction_idle_count() == MAX_TSM_TRANSACTIONS);
+    /* the peer spaces don't use up the IDs of all peers */
+    memset(used, 0, sizeof(used));
+    for (i = 0; i < TEST_PEERS; i++) {
+        testTSMAddress(&peers[i], (uint8_t) (10 + i));
+        for (j = 0; j < TSM_PEER_WINDOW; j++) {
+            peer_ids[i][j] = tsm_next_free_invokeID_peer(&peers[i]);
+            ct_test(pTest, peer_ids[i][j] >= TSM_PEER_INVOKE_ID_FIRST);
+            used[peer_ids[i][j]] = true;
+        }
+    }
+    /* and the IDs of all peers skip those the peer spaces use */
+    tsm_invokeID_set(1);
+    for (i = 0; i < TEST_GLOBAL_IDS; i++) {
+        invokeID = tsm_next_free_invokeID();
+        ct_test(pTest, invokeID != 0);
+        ct_test(pTest, invokeID <= TSM_INVOKE_ID_LAST);
+        ct_test(pTest, !used[invokeID]);
+        ct_test(pTest, !tsm_invoke_id_free(invokeID));
+        used[invokeID] = true;
+        invoke_ids[i] = invokeID;
+    }
+    ct_test(pTest, tsm_next_free_invokeID() == 0);
+    /* the table is full */
+    ct_test(pTest, !tsm_transaction_available());
+    ct_test(pTest, tsm_transaction_idle_count() == 0);
+    ct_test(pTest, tsm_next_free_invokeID_peer(&peers[0]) == 0);
+    /* a freed slot is used again, and a freed invoke ID once the
+       others are in use */
+    tsm_free_invoke_id(invoke_ids[10]);
+    ct_test(pTest, tsm_invoke_id_free(invoke_ids[10]));
+    ct_test(pTest, tsm_transaction_idle_count() == 1);
+    invokeID = tsm_next_free_invokeID();
+    ct_test(pTest, invokeID != 0);
+    ct_test(pTest, tsm_transaction_idle_count() == 0);
+#if (TSM_PEER_INVOKE_ID_FIRST > 1)
+    ct_test(pTest, invokeID == invoke_ids[10]);
+#endif
+    invoke_ids[10] = invokeID;
+    for (i = 0; i < TEST_GLOBAL_IDS; i++) {
+        tsm_free_invoke_id(invoke_ids[i]);
+        ct_test(pTest, tsm_invoke_id_free(invoke_ids[i]));
+    }
+    for (i = 0; i < TEST_PEERS; i++) {
+        for (j = 0; j < TSM_PEER_WINDOW; j++) {
+            ct_test(pTest, !tsm_invoke_id_free_peer(&peers[i],
+                    peer_ids[i][j]));
+            tsm_free_invoke_id_peer(&peers[i], peer_ids[i][j]);
+        }
+    }
+    ct_test(pTest, tsm_transaction_idle_count() == MAX_TSM_TRANSACTIONS);
+    /* the invoke IDs wrap around without zero and split peer spaces,
+       and skip those in use */
+    tsm_invokeID_set(TSM_INVOKE_ID_LAST - 1);
+    wrapped[0] = tsm_next_free_invokeID();
+    wrapped[1] = tsm_next_free_invokeID();
+    wrapped[2] = tsm_next_free_invokeID();
+    ct_test(pTest, wrapped[0] == (TSM_INVOKE_ID_LAST - 1));
+    ct_test(pTest, wrapped[1] == TSM_INVOKE_ID_LAST);
+    ct_test(pTest, wrapped[2] == 1);
+    tsm_invokeID_set(TSM_INVOKE_ID_LAST);
+    wrapped[3] = tsm_next_free_invokeID();
+    ct_test(pTest, wrapped[3] == 2);
+    for (i = 0; i < 4; i++) {
+        tsm_free_invoke_id(wrapped[i]);
+    }
+    tsm_invokeID_set(0);
+    invokeID = tsm_next_free_invokeID();
+    ct_test(pTest, invokeID == 1);
+    tsm_free_invoke_id(invokeID);
+#if (TSM_PEER_INVOKE_ID_FIRST > 1)
+    tsm_invokeID_set(TSM_PEER_INVOKE_ID_FIRST);
+    invokeID = tsm_next_free_invokeID();
+    ct_test(pTest, invokeID == 1);
+    tsm_free_invoke_id(invokeID);
+#else
+    /* sharing the IDs, each space skips those the other has in use */
+    tsm_invokeID_set(1);
+    invokeID = tsm_next_free_invokeID();
+    ct_test(pTest, invokeID == 1);
+    peer_ids[0][0] = tsm_next_free_invokeID_peer(&peers[0]);
+    ct_test(pTest, peer_ids[0][0] == 2);
+    wrapped[0] = tsm_next_free_invokeID();
+    ct_test(pTest, wrapped[0] == 3);
+    tsm_free_invoke_id(invokeID);
+    tsm_free_invoke_id(wrapped[0]);
+    tsm_free_invoke_id_peer(&peers[0], peer_ids[0][0]);
+#endif
+    ct_test(pTest, tsm_transaction_idle_count() == MAX_TSM_TRANSACTIONS);
 }
 
+void testTSMTimer(
+    Test * pTest)
+{
+    /* a timer on the lower level of the wheel, and timers that
+       move down from the upper level once, and many times */
+    static const uint16_t timeouts[] = { 100, 3000, 60000 };
+    BACNET_ADDRESS dest;
+    uint8_t invokeID = 0;
+    uint8_t late = 0;
+    unsigned i;
+
+    testTSMAddress(&dest, 3);
+    tsm_set_timeout_handler(testTSMTimeout);
+    Test_APDU_Retries = 1;
+    for (i = 0; i < sizeof(timeouts) / sizeof(timeouts[0]); i++) {
+        Test_APDU_Timeout = timeouts[i];
+        Test_Packet_Count = 0;
+        Test_Timeouts = 0;
+        invokeID = tsm_next_free_invokeID();
+        testTSMRequest(invokeID, &dest);
+        /* the timeout is rounded down to a tick, and the first
+           tick may be partly over */
+        testTSMAdvance(timeouts[i] - (2 * TSM_TIMER_TICK_MS));
+        ct_test(pTest, Test_Packet_Count == 0);
+        testTSMAdvance(2 * TSM_TIMER_TICK_MS);
+        /* the request is sent again, and then fails */
+        ct_test(pTest, Test_Packet_Count == 1);
+        ct_test(pTest, !tsm_invoke_id_failed(invokeID));
+        testTSMAdvance(timeouts[i] - (2 * TSM_TIMER_TICK_MS));
+        ct_test(pTest, Test_Timeouts == 0);
+        testTSMAdvance(2 * TSM_TIMER_TICK_MS);
+        ct_test(pTest, Test_Packet_Count == 1);
+        ct_test(pTest, Test_Timeouts == 1);
+        ct_test(pTest, Test_Timeout_Invoke_ID == invokeID);
+        ct_test(pTest, tsm_invoke_id_failed(invokeID));
+        tsm_free_invoke_id(invokeID);
+    }
+    /* timers on both levels at once, and a stopped one */
+    Test_Packet_Count = 0;
+    Test_Timeouts = 0;
+    Test_APDU_Retries = 0;
+    Test_APDU_Timeout = 3000;
+    late = tsm_next_free_invokeID();
+    testTSMRequest(late, &dest);
+    Test_APDU_Timeout = 100;
+    invokeID = tsm_next_free_invokeID();
+    testTSMRequest(invokeID, &dest);
+    testTSMAdvance(200);
+    ct_test(pTest, Test_Timeouts == 1);
+    ct_test(pTest, Test_Timeout_Invoke_ID == invokeID);
+    ct_test(pTest, !tsm_invoke_id_failed(late));
+    tsm_free_invoke_id(late);
+    testTSMAdvance(3000);
+    ct_test(pTest, Test_Timeouts == 1);
+    tsm_free_invoke_id(invokeID);
+    ct_test(pTest, tsm_transaction_idle_count() == MAX_TSM_TRANSACTIONS);
+    tsm_set_timeout_handler(NULL);
+    Test_APDU_Timeout = 3000;
+    Test_APDU_Retries = 3;
+}
+
+void testTSMPeer(
+    Test * pTest)
+{
+    BACNET_ADDRESS peer_a;
+    BACNET_ADDRESS peer_b;
+    uint8_t invoke_ids[3];
+    uint8_t other = 0;
+
+    testTSMAddress(&peer_a, 4);
+    testTSMAddress(&peer_b, 5);
+    ct_test(pTest, tsm_peer_window_set(&peer_a, 2));
+    invoke_ids[0] = tsm_next_free_invokeID_peer(&peer_a);
+    invoke_ids[1] = tsm_next_free_invokeID_peer(&peer_a);
+    ct_test(pTest, invoke_ids[0] >= TSM_PEER_INVOKE_ID_FIRST);
+    ct_test(pTest, invoke_ids[1] >= TSM_PEER_INVOKE_ID_FIRST);
+    ct_test(pTest, invoke_ids[0] != invoke_ids[1]);
+    /* the window of the peer is full */
+    ct_test(pTest, tsm_next_free_invokeID_peer(&peer_a) == 0);
+    /* another peer has its own window and invoke IDs */
+    other = tsm_next_free_invokeID_peer(&peer_b);
+    ct_test(pTest, other == invoke_ids[0]);
+    ct_test(pTest, !tsm_invoke_id_free_peer(&peer_b, other));
+    tsm_free_invoke_id_peer(&peer_a, invoke_ids[0]);
+    ct_test(pTest, tsm_invoke_id_free_peer(&peer_a, invoke_ids[0]));
+    ct_test(pTest, !tsm_invoke_id_free_peer(&peer_b, other));
+    invoke_ids[2] = tsm_next_free_invokeID_peer(&peer_a);
+    ct_test(pTest, invoke_ids[2] != 0);
+    ct_test(pTest, invoke_ids[2] != invoke_ids[1]);
+    /* the timeout of a request to a peer tells the peer */
+    tsm_set_timeout_peer_handler(testTSMTimeoutPeer);
+    Test_APDU_Retries = 0;
+    Test_Packet_Count = 0;
+    Test_Timeouts = 0;
+    testTSMRequest(other, &peer_b);
+    testTSMAdvance(Test_APDU_Timeout);
+    ct_test(pTest, Test_Timeouts == 1);
+    ct_test(pTest, Test_Timeout_Invoke_ID == other);
+    ct_test(pTest, bacnet_address_same(&Test_Timeout_Peer, &peer_b));
+    ct_test(pTest, tsm_invoke_id_failed_peer(&peer_b, other));
+    ct_test(pTest, !tsm_invoke_id_free_peer(&peer_a, invoke_ids[1]));
+    tsm_set_timeout_peer_handler(NULL);
+    Test_APDU_Retries = 3;
+    tsm_free_invoke_id_peer(&peer_b, other);
+    tsm_free_invoke_id_peer(&peer_a, invoke_ids[1]);
+    tsm_free_invoke_id_peer(&peer_a, invoke_ids[2]);
+    ct_test(pTest, tsm_peer_window_set(&peer_a, 0));
+    ct_test(pTest, tsm_transaction_idle_count() == MAX_TSM_TRANSACTIONS);
+}
+
+#if MAX_SEGMENTS_ACCEPTED
+/* the segment size is 201 octets, so the ACK has 11 segments */
+#define TEST_SEGMENT_MAX_APDU 206
+#define TEST_SEGMENTED_LEN (3 + (10 * 201) + 150)
+
+static BACNET_ADDRESS Test_Client;
+static BACNET_ADDRESS Test_Server;
+
+struct test_link {
+    /* the segments and Segment-ACKs sent */
+    unsigned segments;
+    unsigned acks;
+    /* 1-based number of the segment or ACK that is lost once */
+    unsigned lose_segment;
+    unsigned lose_ack;
+    /* every segment is received twice */
+    bool duplicate;
+    /* the ComplexACK assembled by the client */
+    uint8_t *apdu;
+    uint16_t apdu_len;
+};
+
+/* delivers the packets in the order that they were sent, until
+   the server has sent the whole ComplexACK */
+static void testTSMSegmentedLink(
+    Test * pTest,
+    struct test_link *link,
+    uint8_t invokeID)
+{
+    struct test_packet *packet;
+    BACNET_ADDRESS dest;
+    BACNET_ADDRESS src;
+    BACNET_NPDU_DATA npdu_data;
+    uint8_t *apdu;
+    uint8_t *assembled;
+    uint16_t assembled_len = 0;
+    unsigned apdu_len;
+    unsigned copies;
+    unsigned timeouts = 0;
+    int len;
+
+    for (;;) {
+        if (Test_Packet_Count == 0) {
+            if (!tsm_segmented_find(&Test_Client, invokeID, true) ||
+                (timeouts == apdu_retries())) {
+                break;
+            }
+            /* a window or its Segment-ACK was lost */
+            timeouts++;
+            tsm_timer_milliseconds(apdu_segment_timeout());
+            continue;
+        }
+        packet = &Test_Packets[Test_Packet_Head];
+        Test_Packet_Head = (Test_Packet_Head + 1) % TEST_PACKETS;
+        Test_Packet_Count--;
+        len = npdu_decode(&packet->pdu[0], &dest, &src, &npdu_data);
+        ct_test(pTest, len > 0);
+        apdu = &packet->pdu[len];
+        apdu_len = packet->pdu_len - (unsigned) len;
+        if ((apdu[0] & 0xF0) == PDU_TYPE_COMPLEX_ACK) {
+            ct_test(pTest, bacnet_address_same(&packet->dest, &Test_Client));
+            link->segments++;
+            if (link->segments == link->lose_segment) {
+                continue;
+            }
+            for (copies = link->duplicate ? 2 : 1; copies > 0; copies--) {
+                assembled =
+                    tsm_segment_received(&Test_Server, apdu,
+                    (uint16_t) apdu_len, &assembled_len);
+                if (assembled) {
+                    ct_test(pTest, link->apdu == NULL);
+                    link->apdu = assembled;
+                    link->apdu_len = assembled_len;
+                }
+            }
+        } else if ((apdu[0] & 0xF0) == PDU_TYPE_SEGMENT_ACK) {
+            ct_test(pTest, bacnet_address_same(&packet->dest, &Test_Server));
+            link->acks++;
+            if (link->acks == link->lose_ack) {
+                continue;
+            }
+            tsm_segment_ack_received(&Test_Client, apdu[1], apdu[2],
+                apdu[3], (apdu[0] & BIT(1)) ? true : false,
+                (apdu[0] & BIT(0)) ? true : false);
+        }
+    }
+}
+
+static void testTSMSegmentedCase(
+    Test * pTest,
+    struct test_link *link)
+{
+    BACNET_CONFIRMED_SERVICE_DATA service_data;
+    BACNET_NPDU_DATA npdu_data;
+    BACNET_ERROR_CODE error_code = ERROR_CODE_SUCCESS;
+    static uint8_t apdu[TEST_SEGMENTED_LEN];
+    uint8_t request[4];
+    uint8_t invokeID = 0;
+    unsigned i;
+
+    testTSMAddress(&Test_Client, 1);
+    testTSMAddress(&Test_Server, 2);
+    Test_Packet_Head = 0;
+    Test_Packet_Count = 0;
+    npdu_encode_npdu_data(&npdu_data, true, MESSAGE_PRIORITY_NORMAL);
+    /* the client side */
+    invokeID = tsm_next_free_invokeID();
+    ct_test(pTest, invokeID != 0);
+    request[0] = PDU_TYPE_CONFIRMED_SERVICE_REQUEST;
+    request[1] = 0x05;
+    request[2] = invokeID;
+    request[3] = SERVICE_CONFIRMED_READ_PROPERTY;
+    tsm_set_confirmed_unsegmented_transaction(invokeID, &Test_Server,
+        &npdu_data, &request[0], sizeof(request));
+    /* the server side */
+    apdu[0] = PDU_TYPE_COMPLEX_ACK;
+    apdu[1] = invokeID;
+    apdu[2] = SERVICE_CONFIRMED_READ_PROPERTY;
+    for (i = 3; i < sizeof(apdu); i++) {
+        apdu[i] = (uint8_t) (i * 7);
+    }
+    memset(&service_data, 0, sizeof(service_data));
+    service_data.segmented_response_accepted = true;
+    service_data.max_resp = TEST_SEGMENT_MAX_APDU;
+    service_data.invoke_id = invokeID;
+    npdu_encode_npdu_data(&npdu_data, false, MESSAGE_PRIORITY_NORMAL);
+    ct_test(pTest, tsm_segmented_complex_ack_send(&Test_Client, &npdu_data,
+            &service_data, &apdu[0], sizeof(apdu), &error_code));
+    testTSMSegmentedLink(pTest, link, invokeID);
+    /* the whole ComplexACK was received, and its sender is done */
+    ct_test(pTest, link->apdu != NULL);
+    if (link->apdu) {
+        ct_test(pTest, link->apdu_len == sizeof(apdu));
+        ct_test(pTest, memcmp(link->apdu, &apdu[0], sizeof(apdu)) == 0);
+    }
+    ct_test(pTest, tsm_segmented_find(&Test_Client, invokeID, true) == NULL);
+    ct_test(pTest, Test_Packet_Count == 0);
+    tsm_free_invoke_id(invokeID);
+    /* forget the final Segment-ACK kept for repeats */
+    tsm_timer_milliseconds(apdu_segment_timeout() * 4);
+    ct_test(pTest, tsm_segmented_find(&Test_Server, invokeID,
+            false) == NULL);
+}
+
+void testTSMSegmentation(
+    Test * pTest)
+{
+    struct test_link link;
+
+    /* no loss: the first segment, then one window of 10 */
+    memset(&link, 0, sizeof(link));
+    testTSMSegmentedCase(pTest, &link);
+    ct_test(pTest, link.segments == 11);
+    ct_test(pTest, link.acks == 2);
+    /* segment 3 lost: one Segment-NAK, and the window is resent
+       from there, instead of a NAK for each later segment */
+    memset(&link, 0, sizeof(link));
+    link.lose_segment = 4;
+    testTSMSegmentedCase(pTest, &link);
+    ct_test(pTest, link.segments == (1 + 10 + 8));
+    ct_test(pTest, link.acks == 3);
+    /* each segment received twice: the duplicates are discarded,
+       and the ACK of the first segment and the final one repeated */
+    memset(&link, 0, sizeof(link));
+    link.duplicate = true;
+    testTSMSegmentedCase(pTest, &link);
+    ct_test(pTest, link.segments == 11);
+    ct_test(pTest, link.acks == 4);
+    /* the final Segment-ACK lost: the window is resent once after
+       the segment timeout, and the final ACK repeated once */
+    memset(&link, 0, sizeof(link));
+    link.lose_ack = 2;
+    testTSMSegmentedCase(pTest, &link);
+    ct_test(pTest, link.segments == (11 + 10));
+    ct_test(pTest, link.acks == 3);
+}
+
+/* a confirmed request of 5 segments, sent with a window of 2 */
+#define TEST_REQUEST_SEGMENTS 5
+#define TEST_REQUEST_SEGMENT_LEN 50
+
+void testTSMSegmentedRequest(
+    Test * pTest)
+{
+    uint8_t segment[6 + TEST_REQUEST_SEGMENT_LEN];
+    uint8_t message[4 + (TEST_REQUEST_SEGMENTS * TEST_REQUEST_SEGMENT_LEN)];
+    struct test_packet *packet;
+    BACNET_ADDRESS dest;
+    BACNET_ADDRESS src;
+    BACNET_NPDU_DATA npdu_data;
+    uint8_t *assembled = NULL;
+    uint8_t *apdu;
+    uint16_t assembled_len = 0;
+    uint8_t invokeID = 7;
+    unsigned acks = 0;
+    unsigned i;
+    int len;
+
+    testTSMAddress(&Test_Client, 1);
+    Test_Packet_Head = 0;
+    Test_Packet_Count = 0;
+    /* segmented-response-accepted, with its max segs and max APDU */
+    message[0] = PDU_TYPE_CONFIRMED_SERVICE_REQUEST | BIT(1);
+    message[1] = 0x75;
+    message[2] = invokeID;
+    message[3] = SERVICE_CONFIRMED_WRITE_PROPERTY;
+    for (i = 4; i < sizeof(message); i++) {
+        message[i] = (uint8_t) (i * 3);
+    }
+    for (i = 0; i < TEST_REQUEST_SEGMENTS; i++) {
+        segment[0] = message[0] | BIT(3);
+        if ((i + 1) < TEST_REQUEST_SEGMENTS) {
+            segment[0] |= BIT(2);
+        }
+        segment[1] = message[1];
+        segment[2] = invokeID;
+        segment[3] = (uint8_t) i;
+        segment[4] = 2;
+        segment[5] = message[3];
+        memcpy(&segment[6], &message[4 + (i * TEST_REQUEST_SEGMENT_LEN)],
+            TEST_REQUEST_SEGMENT_LEN);
+        assembled =
+            tsm_segment_received(&Test_Client, &segment[0], sizeof(segment),
+            &assembled_len);
+        ct_test(pTest, (assembled != NULL) ==
+            ((i + 1) == TEST_REQUEST_SEGMENTS));
+    }
+    ct_test(pTest, assembled != NULL);
+    if (assembled) {
+        ct_test(pTest, assembled_len == sizeof(message));
+        ct_test(pTest, memcmp(assembled, &message[0], sizeof(message)) == 0);
+    }
+    /* the server ACKs the first segment and each full window */
+    while (Test_Packet_Count) {
+        packet = &Test_Packets[Test_Packet_Head];
+        Test_Packet_Head = (Test_Packet_Head + 1) % TEST_PACKETS;
+        Test_Packet_Count--;
+        len = npdu_decode(&packet->pdu[0], &dest, &src, &npdu_data);
+        apdu = &packet->pdu[len];
+        ct_test(pTest, bacnet_address_same(&packet->dest, &Test_Client));
+        ct_test(pTest, apdu[0] == (PDU_TYPE_SEGMENT_ACK | BIT(0)));
+        ct_test(pTest, apdu[1] == invokeID);
+        ct_test(pTest, apdu[2] == (uint8_t) (acks * 2));
+        ct_test(pTest, apdu[3] == 2);
+        acks++;
+    }
+    ct_test(pTest, acks == 3);
+    tsm_segmented_free(&Test_Client, invokeID, true);
+}
+#endif
+
 #ifdef TEST_TSM
 int main(
     void)
@@ -397,6 +2037,16 @@ int main(
     /* individual tests */
     rc = ct_addTestFunction(pTest, testTSM);
     assert(rc);
+    rc = ct_addTestFunction(pTest, testTSMTimer);
+    assert(rc);
+    rc = ct_addTestFunction(pTest, testTSMPeer);
+    assert(rc);
+#if MAX_SEGMENTS_ACCEPTED
+    rc = ct_addTestFunction(pTest, testTSMSegmentation);
+    assert(rc);
+    rc = ct_addTestFunction(pTest, testTSMSegmentedRequest);
+    assert(rc);
+#endif
 
     ct_setStream(pTest, stdout);
     ct_run(pTest);
@@ -20,7 +20,11 @@
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/stat.h>
+#include <sys/inotify.h>
 
 #include <uci_config.h>
 #include <uci.h>
@@ -279,7 +283,7 @@ time_t check_uci_update(const char *config, time_t mtime)
 	return f_mtime;
 }
 
-/* Add tuple */
+/* Add tuple, or update the tuple a previous load added for the section */
 void load_value(const char *sec_idx, struct uci_itr_ctx *itr)
 {
 	value_tuple_t *t;
@@ -295,16 +299,453 @@ void load_value(const char *sec_idx, struct uci_itr_ctx *itr)
 		"value_time",0);
 	Out_Of_Service = ucix_get_option_int(itr->ctx, itr->section, sec_idx,
 		"Out_Of_Service",1);
-	if( (t = (value_tuple_t *)malloc(sizeof(value_tuple_t))) != NULL ) {
-		strncpy(t->idx, sec_idx, sizeof(t->idx));
-		if ( value != NULL ) {
-			strncpy(t->value, value, sizeof(t->value));
+	if (value == NULL)
+		value = "";
+	/* the sections mostly come in the order of the last load */
+	t = itr->cursor;
+	if (!t || strcmp(t->idx, sec_idx)) {
+		for (t = itr->list; t; t = t->next) {
+			if (!strcmp(t->idx, sec_idx))
+				break;
+		}
+	}
+	if (!t) {
+		if ((t = (value_tuple_t *)malloc(sizeof(value_tuple_t))) == NULL)
+			return;
+		memset(t, 0, sizeof(value_tuple_t));
+		strncpy(t->idx, sec_idx, sizeof(t->idx) - 1);
+		t->Out_Of_Service = -1;
+		if (itr->prev) {
+			t->next = itr->prev->next;
+			itr->prev->next = t;
+		} else {
+			t->next = itr->list;
+			itr->list = t;
+		}
+	}
+	t->changed = false;
+	if ((t->value_time != value_time) ||
+		(t->Out_Of_Service != Out_Of_Service) ||
+		strncmp(t->value, value, sizeof(t->value) - 1)) {
+		strncpy(t->value, value, sizeof(t->value) - 1);
+		t->value[sizeof(t->value) - 1] = 0;
+		t->value_time = value_time;
+		t->Out_Of_Service = Out_Of_Service;
+		t->changed = true;
+		itr->changed++;
+	}
+	t->generation = itr->generation;
+	itr->count++;
+	itr->prev = t;
+	itr->cursor = t->next;
+}
+
+void load_value_begin(struct uci_itr_ctx *itr)
+{
+	itr->generation++;
+	itr->cursor = itr->list;
+	itr->prev = NULL;
+	itr->changed = 0;
+	itr->count = 0;
+}
+
+/* Drop the tuples of the sections that are gone */
+int load_value_end(struct uci_itr_ctx *itr)
+{
+	value_tuple_t **link = &itr->list;
+	value_tuple_t *t;
+
+	while ((t = *link) != NULL) {
+		if (t->generation != itr->generation) {
+			*link = t->next;
+			free(t);
+		} else {
+			link = &t->next;
+		}
+	}
+	itr->cursor = NULL;
+	itr->prev = NULL;
+	return itr->changed;
+}
+
+void load_value_free(struct uci_itr_ctx *itr)
+{
+	value_tuple_t *t;
+
+	while ((t = itr->list) != NULL) {
+		itr->list = t->next;
+		free(t);
+	}
+	itr->cursor = NULL;
+	itr->prev = NULL;
+}
+
+/* uci packages watched for changes */
+#ifndef UCIX_WATCH_MAX
+#define UCIX_WATCH_MAX 16
+#endif
+struct ucix_watch {
+	char config[32];
+	bool changed;
+	time_t mtime;	/* only used without inotify */
+	bool pending;	/* mtime changed, not yet a second old */
+};
+static struct ucix_watch ucix_watch_list[UCIX_WATCH_MAX];
+static int ucix_watch_count = 0;
+static int ucix_watch_ifd = -1;
+static bool ucix_watch_failed = false;
+/* the directories of the packages, as in check_uci_update() */
+#define UCIX_WATCH_DIRS 2
+static const char *ucix_watch_dir[UCIX_WATCH_DIRS] = {
+	"/etc/config", "/var/state"
+};
+static int ucix_watch_wd[UCIX_WATCH_DIRS] = { -1, -1 };
+static bool ucix_watch_all = false;	/* every directory has a watch */
+static time_t ucix_watch_retry = 0;
+
+/* Add the directory watches that are missing. /var/state is a tmpfs
+   directory that may only be created after we start, so a failed watch
+   is retried, and the packages are polled by file time meanwhile. */
+static bool ucix_watch_dirs_add(void)
+{
+	bool all = true;
+	int i;
+
+	for (i = 0; i < UCIX_WATCH_DIRS; i++) {
+		if (ucix_watch_wd[i] < 0) {
+			ucix_watch_wd[i] = inotify_add_watch(ucix_watch_ifd,
+				ucix_watch_dir[i], IN_CLOSE_WRITE | IN_MOVED_TO);
+			if (ucix_watch_wd[i] < 0)
+				all = false;
+		}
+	}
+	return all;
+}
+
+/* uci rewrites a package by renaming a temporary file over it,
+   so the directories are watched rather than the files */
+static int ucix_watch_init(void)
+{
+	if ((ucix_watch_ifd < 0) && !ucix_watch_failed) {
+		ucix_watch_ifd = inotify_init();
+		if (ucix_watch_ifd < 0) {
+#if PRINT_ENABLED
+			fprintf(stderr, "inotify: %s, polling uci files\n",
+				strerror(errno));
+#endif
+			ucix_watch_failed = true;
+			return -1;
+		}
+		fcntl(ucix_watch_ifd, F_SETFL,
+			fcntl(ucix_watch_ifd, F_GETFL) | O_NONBLOCK);
+		fcntl(ucix_watch_ifd, F_SETFD, FD_CLOEXEC);
+		ucix_watch_all = ucix_watch_dirs_add();
+		ucix_watch_retry = time(NULL);
+	}
+	return ucix_watch_ifd;
+}
+
+/* drain the pending inotify events without blocking */
+static void ucix_watch_read(void)
+{
+	char buf[4096]
+		__attribute__ ((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	ssize_t len;
+	char *p;
+	int i;
+
+	for (;;) {
+		len = read(ucix_watch_ifd, buf, sizeof(buf));
+		if (len <= 0)
+			break;
+		for (p = buf; p < buf + len;
+			p += sizeof(struct inotify_event) + ev->len) {
+			ev = (const struct inotify_event *)p;
+			if (ev->mask & IN_IGNORED) {
+				/* the directory is gone, poll until it is back */
+				for (i = 0; i < UCIX_WATCH_DIRS; i++) {
+					if (ucix_watch_wd[i] == ev->wd)
+						ucix_watch_wd[i] = -1;
+				}
+				ucix_watch_all = false;
+				continue;
+			}
+			for (i = 0; i < ucix_watch_count; i++) {
+				if ((ev->mask & IN_Q_OVERFLOW) ||
+					((ev->len > 0) &&
+					!strcmp(ev->name, ucix_watch_list[i].config)))
+					ucix_watch_list[i].changed = true;
+			}
 		}
-		t->value_time=value_time;
-		t->Out_Of_Service=Out_Of_Service;
-		t->next = itr->list;
-		itr->list = t;
 	}
 }
 
+/* Start watching a uci package for changes */
+int ucix_watch_add(const char *config)
+{
+	struct ucix_watch *w;
+
+	if (ucix_watch_count >= UCIX_WATCH_MAX)
+		return -1;
+	w = &ucix_watch_list[ucix_watch_count++];
+	strncpy(w->config, config, sizeof(w->config) - 1);
+	w->changed = false;
+	w->mtime = check_uci_update(config, 0);
+	w->pending = false;
+	ucix_watch_init();
+	return 0;
+}
 
+/* Collect the changes of the watched packages without blocking.
+   Returns the number of packages changed and not yet checked. */
+int ucix_watch_poll(void)
+{
+	time_t mtime;
+	time_t now;
+	bool polled;
+	int count = 0;
+	int i;
+
+	if (ucix_watch_ifd >= 0) {
+		ucix_watch_read();
+	}
+	now = time(NULL);
+	polled = (ucix_watch_ifd < 0) || !ucix_watch_all;
+	if ((ucix_watch_ifd >= 0) && !ucix_watch_all) {
+		if (now != ucix_watch_retry) {
+			ucix_watch_retry = now;
+			ucix_watch_all = ucix_watch_dirs_add();
+		}
+	}
+	if (polled) {
+		/* no inotify, or not for every directory yet - compare the
+		   file times, which also covers a watch that was just added.
+		   A file time only has seconds, and a package may be written
+		   in place: report it once its time is a second old, so that
+		   the writer is done */
+		for (i = 0; i < ucix_watch_count; i++) {
+			mtime = check_uci_update(ucix_watch_list[i].config,
+				ucix_watch_list[i].mtime);
+			if (mtime) {
+				ucix_watch_list[i].mtime = mtime;
+				ucix_watch_list[i].pending = true;
+			}
+		}
+	}
+	for (i = 0; i < ucix_watch_count; i++) {
+		if (ucix_watch_list[i].pending &&
+			(now > ucix_watch_list[i].mtime)) {
+			ucix_watch_list[i].pending = false;
+			ucix_watch_list[i].changed = true;
+		}
+		if (ucix_watch_list[i].changed)
+			count++;
+	}
+	return count;
+}
+
+/* Check if given uci package changed since the last check */
+bool ucix_watch_changed(const char *config)
+{
+	int i;
+
+	for (i = 0; i < ucix_watch_count; i++) {
+		if (!strcmp(ucix_watch_list[i].config, config)) {
+			if (ucix_watch_list[i].changed) {
+				ucix_watch_list[i].changed = false;
+				return true;
+			}
+			break;
+		}
+	}
+	return false;
+}
+
+/* write-behind journal of options, so that a request handler does not
+   rewrite a package for every option it changes */
+#ifndef UCIX_JOURNAL_MAX
+#define UCIX_JOURNAL_MAX 512
+#endif
+#ifndef UCIX_JOURNAL_THRESHOLD
+#define UCIX_JOURNAL_THRESHOLD 128
+#endif
+#ifndef UCIX_JOURNAL_DELAY_MS
+#define UCIX_JOURNAL_DELAY_MS 250
+#endif
+struct ucix_journal_entry {
+	char package[32];
+	char section[32];
+	char option[32];
+	char *value;
+	int list;	/* items of 64 chars in value, or -1 for an option */
+	bool commit;	/* to /etc/config, else saved to /var/state */
+	bool done;
+};
+static struct ucix_journal_entry ucix_journal[UCIX_JOURNAL_MAX];
+static unsigned ucix_journal_count = 0;
+static unsigned long ucix_journal_oldest = 0;
+static struct ucix_journal_stats ucix_journal_stat;
+
+static unsigned long ucix_journal_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long)ts.tv_sec * 1000UL + ts.tv_nsec / 1000000L;
+}
+
+/* Take value into the journal, replacing a queued value of the option */
+static bool ucix_journal_queue(const char *p, const char *s, const char *o,
+	char *value, int list, bool commit)
+{
+	struct ucix_journal_entry *e = NULL;
+	unsigned i;
+
+	for (i = 0; i < ucix_journal_count; i++) {
+		e = &ucix_journal[i];
+		if ((e->commit == commit) && !strcmp(e->option, o) &&
+			!strcmp(e->section, s) && !strcmp(e->package, p)) {
+			free(e->value);
+			e->value = value;
+			e->list = list;
+			ucix_journal_stat.coalesced++;
+			return true;
+		}
+	}
+	if (ucix_journal_count >= UCIX_JOURNAL_MAX)
+		ucix_journal_flush();
+	if (ucix_journal_count == 0)
+		ucix_journal_oldest = ucix_journal_ms();
+	e = &ucix_journal[ucix_journal_count++];
+	strncpy(e->package, p, sizeof(e->package) - 1);
+	e->package[sizeof(e->package) - 1] = 0;
+	strncpy(e->section, s, sizeof(e->section) - 1);
+	e->section[sizeof(e->section) - 1] = 0;
+	strncpy(e->option, o, sizeof(e->option) - 1);
+	e->option[sizeof(e->option) - 1] = 0;
+	e->value = value;
+	e->list = list;
+	e->commit = commit;
+	e->done = false;
+	ucix_journal_stat.added++;
+	if (ucix_journal_count > ucix_journal_stat.max_depth)
+		ucix_journal_stat.max_depth = ucix_journal_count;
+	return true;
+}
+
+/* Queue an option for the next flush, replacing a queued value of it */
+bool ucix_journal_add(const char *p, const char *s, const char *o,
+	const char *t, bool commit)
+{
+	char *value;
+
+	value = strdup(t);
+	if (!value)
+		return false;
+	return ucix_journal_queue(p, s, o, value, -1, commit);
+}
+
+/* Queue a list, written like ucix_set_list() */
+bool ucix_journal_add_list(const char *p, const char *s, const char *o,
+	char t[254][64], int l, bool commit)
+{
+	char *value;
+
+	value = malloc(l > 0 ? l * 64 : 1);
+	if (!value)
+		return false;
+	if (l > 0)
+		memcpy(value, t, l * 64);
+	return ucix_journal_queue(p, s, o, value, l, commit);
+}
+
+bool ucix_journal_add_int(const char *p, const char *s, const char *o,
+	int t, bool commit)
+{
+	char tmp[64];
+	snprintf(tmp, 64, "%d", t);
+	return ucix_journal_add(p, s, o, tmp, commit);
+}
+
+/* Write the queued options, one load and one save per package */
+void ucix_journal_flush(void)
+{
+	struct uci_context *ctx;
+	struct ucix_journal_entry *e;
+	unsigned long start;
+	unsigned long ms;
+	unsigned i, j;
+
+	if (ucix_journal_count == 0)
+		return;
+	start = ucix_journal_ms();
+	for (i = 0; i < ucix_journal_count; i++) {
+		if (ucix_journal[i].done)
+			continue;
+		e = &ucix_journal[i];
+		ctx = ucix_init(e->package);
+		for (j = i; j < ucix_journal_count; j++) {
+			if (ucix_journal[j].done ||
+				(ucix_journal[j].commit != e->commit) ||
+				strcmp(ucix_journal[j].package, e->package))
+				continue;
+			if (ctx && (ucix_journal[j].list >= 0)) {
+				ucix_set_list(ctx, e->package,
+					ucix_journal[j].section,
+					ucix_journal[j].option,
+					(char (*)[64])ucix_journal[j].value,
+					ucix_journal[j].list);
+				ucix_journal_stat.written++;
+			} else if (ctx) {
+				ucix_add_option(ctx, e->package,
+					ucix_journal[j].section,
+					ucix_journal[j].option,
+					ucix_journal[j].value);
+				ucix_journal_stat.written++;
+			}
+			ucix_journal[j].done = true;
+		}
+		if (ctx) {
+			if (e->commit)
+				ucix_commit(ctx, e->package);
+			else
+				ucix_save_state(ctx, e->package);
+			ucix_cleanup(ctx);
+		}
+	}
+	for (i = 0; i < ucix_journal_count; i++) {
+		free(ucix_journal[i].value);
+		ucix_journal[i].value = NULL;
+	}
+	ucix_journal_count = 0;
+	ucix_journal_stat.flushes++;
+	ms = ucix_journal_ms();
+	ucix_journal_stat.last_latency_ms = ms - ucix_journal_oldest;
+	if (ucix_journal_stat.last_latency_ms > ucix_journal_stat.max_latency_ms)
+		ucix_journal_stat.max_latency_ms =
+			ucix_journal_stat.last_latency_ms;
+	ucix_journal_stat.last_flush_ms = ms - start;
+	if (ucix_journal_stat.last_flush_ms > ucix_journal_stat.max_flush_ms)
+		ucix_journal_stat.max_flush_ms = ucix_journal_stat.last_flush_ms;
+}
+
+/* Flush the journal when its oldest option is due, or when it is full
+   enough.  Called from the main loop, after the requests are answered.
+   Returns true if the journal was flushed. */
+bool ucix_journal_task(void)
+{
+	if (ucix_journal_count == 0)
+		return false;
+	if ((ucix_journal_count < UCIX_JOURNAL_THRESHOLD) &&
+		((ucix_journal_ms() - ucix_journal_oldest) < UCIX_JOURNAL_DELAY_MS))
+		return false;
+	ucix_journal_flush();
+	return true;
+}
+
+void ucix_journal_get_stats(struct ucix_journal_stats *stats)
+{
+	*stats = ucix_journal_stat;
+	stats->depth = ucix_journal_count;
+}
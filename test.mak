@@ -12,7 +12,7 @@ LOGFILE = test.log
 all: abort address arf awf bvlc6 bacapp bacdcode bacerror bacint bacstr \
 	cov crc datetime dcc event filename fifo getevent iam ihave \
 	indtext keylist key memcopy npdu proplist ptransfer \
-	rd reject ringbuf rp rpm sbuf timesync vmac \
+	rd reject ringbuf rp rpm sbuf timesync tsm vmac \
 	whohas whois wp objects lighting
 
 clean: logfile
@@ -196,6 +196,14 @@ timesync: logfile test/timesync.mak
 	( ./test/timesync >> ${LOGFILE} )
 	$(MAKE) -s -C test -f timesync.mak clean
 
+tsm: logfile test/tsm.mak
+	$(MAKE) -s -C test -f tsm.mak clean all
+	( ./test/tsm >> ${LOGFILE} )
+	$(MAKE) -s -C test -f tsm.mak clean all \
+		TSM_DEFINES=-DTSM_PEER_INVOKE_ID_FIRST=128
+	( ./test/tsm >> ${LOGFILE} )
+	$(MAKE) -s -C test -f tsm.mak clean
+
 vmac: logfile test/vmac.mak
 	$(MAKE) -s -C test -f vmac.mak clean all
 	( ./test/vmac >> ${LOGFILE} )
@@ -0,0 +1,39 @@
+#Makefile to build test case
+CC      = gcc
+SRC_DIR = ../src
+INCLUDES = -I../include -I. -I../ports/linux
+DEFINES = -DBIG_ENDIAN=0 -DTEST -DTEST_TSM -DMAX_SEGMENTS_ACCEPTED=16 \
+	$(TSM_DEFINES)
+
+CFLAGS  = -Wall $(INCLUDES) $(DEFINES) -g
+
+SRCS = $(SRC_DIR)/tsm.c \
+	$(SRC_DIR)/abort.c \
+	$(SRC_DIR)/npdu.c \
+	$(SRC_DIR)/bacaddr.c \
+	$(SRC_DIR)/bacdcode.c \
+	$(SRC_DIR)/bacint.c \
+	$(SRC_DIR)/bacstr.c \
+	$(SRC_DIR)/bacreal.c \
+	ctest.c
+
+OBJS = ${SRCS:.c=.o}
+
+TARGET = tsm
+
+all: ${TARGET}
+
+${TARGET}: ${OBJS}
+	${CC} -o $@ ${OBJS}
+
+.c.o:
+	${CC} -c ${CFLAGS} $*.c -o $@
+
+depend:
+	rm -f .depend
+	${CC} -MM ${CFLAGS} *.c >> .depend
+
+clean:
+	rm -rf ${TARGET} $(OBJS)
+
+include: .depend